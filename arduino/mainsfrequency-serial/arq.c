@@ -0,0 +1,320 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include "arq.h"
+#include "crc16.h"
+
+/**
+ * Get channel and sequence number of a packet (including CRC trailer).
+ * Returns false for packets without sequence header.
+ */
+bool arq_packet_id(const uint8_t *pkt, size_t len, uint16_t *channel, uint16_t *seq)
+{
+    pkt_header_t header;
+    pkt_seq_t seqhdr;
+    if (len < sizeof(header) + sizeof(seqhdr) + sizeof(pkt_trailer_t))
+        return false;
+    memcpy(&header, pkt, sizeof(header));
+    if (!(header.type & PKTTYPE_FLAG_SEQ))
+        return false;
+    memcpy(&seqhdr, &pkt[sizeof(header)], sizeof(seqhdr));
+    *seq = seqhdr.seq;
+    *channel = 0;
+    if ((header.type & ~PKTTYPE_FLAG_SEQ) == PKTTYPE_SAMPLES_MC) {
+        pkt_mc_t mc;
+        if (len < sizeof(header) + sizeof(seqhdr) + sizeof(mc) + sizeof(pkt_trailer_t))
+            return false;
+        memcpy(&mc, &pkt[sizeof(header) + sizeof(seqhdr)], sizeof(mc));
+        *channel = mc.channel;
+    }
+    return true;
+}
+
+void arq_sender_init(arq_sender_t *s)
+{
+    for (int i = 0; i < ARQ_SENDER_WINDOW; i++)
+        s->slots[i].len = 0;
+    s->next = 0;
+    s->retransmissions = 0;
+}
+
+/**
+ * Keep a sent packet for retransmission, replacing the oldest packet.
+ */
+void arq_sender_store(arq_sender_t *s, const uint8_t *pkt, size_t len)
+{
+    uint16_t channel, seq;
+    if (len > ARQ_MAX_PKTSIZE || !arq_packet_id(pkt, len, &channel, &seq))
+        return;
+    arq_slot_t *slot = &s->slots[s->next];
+    memcpy(slot->pkt, pkt, len);
+    slot->len = len;
+    slot->channel = channel;
+    slot->seq = seq;
+    s->next = (s->next + 1) % ARQ_SENDER_WINDOW;
+}
+
+static void resend_packet(arq_sender_t *s, uint16_t channel, uint16_t seq, arq_resend_t resend, void *ctx,
+                          size_t *n)
+{
+    for (int i = 0; i < ARQ_SENDER_WINDOW; i++) {
+        const arq_slot_t *slot = &s->slots[i];
+        if (slot->len > 0 && slot->channel == channel && slot->seq == seq) {
+            resend(slot->pkt, slot->len, ctx);
+            s->retransmissions++;
+            (*n)++;
+            return;
+        }
+    }
+    // Packet has already left the window; the receiver will give up on it.
+}
+
+/**
+ * Handle a received NACK packet (including CRC trailer) by passing the
+ * requested packets still in the window to resend.
+ * Returns the number of retransmitted packets.
+ */
+size_t arq_sender_nack(arq_sender_t *s, const uint8_t *nack, size_t len, arq_resend_t resend, void *ctx)
+{
+    pkt_header_t header;
+    pkt_trailer_t trailer;
+    if (len < sizeof(header) + sizeof(trailer))
+        return 0;
+    memcpy(&header, nack, sizeof(header));
+    memcpy(&trailer, &nack[len - sizeof(trailer)], sizeof(trailer));
+    if (header.type != PKTTYPE_NACK ||
+        header.payload_length != len - sizeof(header) - sizeof(trailer) ||
+        crc16_update(0, nack, len - sizeof(trailer)) != trailer.crcsum)
+        return 0;
+    
+    size_t n = 0;
+    for (size_t off = sizeof(header); off + sizeof(arq_nack_t) <= len - sizeof(trailer);
+         off += sizeof(arq_nack_t)) {
+        arq_nack_t entry;
+        memcpy(&entry, &nack[off], sizeof(entry));
+        resend_packet(s, entry.channel, entry.seq, resend, ctx, &n);
+        for (int i = 0; i < 16; i++) {
+            if (entry.mask & (1u << i))
+                resend_packet(s, entry.channel, entry.seq + 1 + i, resend, ctx, &n);
+        }
+    }
+    return n;
+}
+
+void arq_receiver_init(arq_receiver_t *r, uint32_t timeout_ms, uint32_t retry_ms)
+{
+    for (int c = 0; c < ARQ_MAX_CHANNELS; c++) {
+        arq_channel_t *ch = &r->channels[c];
+        ch->initialized = false;
+        ch->n = 0;
+        for (int i = 0; i < ARQ_RECEIVER_WINDOW; i++)
+            ch->slots[i].len = 0;
+    }
+    r->timeout_ms = timeout_ms;
+    r->retry_ms = retry_ms;
+    r->nacks = 0;
+    r->requested = 0;
+    r->recovered = 0;
+    r->given_up = 0;
+}
+
+static bool is_buffered(const arq_channel_t *ch, uint16_t seq)
+{
+    return ch->slots[seq % ARQ_RECEIVER_WINDOW].len > 0;
+}
+
+/**
+ * Pass a received packet (including CRC trailer, CRC checked) to the receiver.
+ * Returns one of the ARQ_* results.
+ */
+int arq_receiver_put(arq_receiver_t *r, const uint8_t *pkt, size_t len, uint32_t now_ms)
+{
+    uint16_t channel, seq;
+    if (len > ARQ_MAX_PKTSIZE || !arq_packet_id(pkt, len, &channel, &seq) || channel >= ARQ_MAX_CHANNELS)
+        return ARQ_PASS;
+    arq_channel_t *ch = &r->channels[channel];
+    if (!ch->initialized) {
+        ch->initialized = true;
+        ch->next = seq;
+        ch->last = seq - 1;
+        ch->limit = seq;
+    }
+
+    int16_t d = (int16_t) (uint16_t) (seq - ch->next);
+    if (d < 0) {
+        // Already released or given up; the caller's loss detection
+        // accounts for it.
+        return ARQ_PASS;
+    }
+    if (d >= ARQ_RECEIVER_WINDOW) {
+        if (ch->n > 0) {
+            // Buffered packets must be released before the window can move.
+            uint16_t limit = seq - ARQ_RECEIVER_WINDOW + 1;
+            if ((int16_t) (uint16_t) (limit - ch->limit) > 0)
+                ch->limit = limit;
+            return ARQ_BLOCKED;
+        }
+        // Nothing buffered, so the window can simply jump ahead.
+        r->given_up += d;
+        ch->next = seq;
+        ch->last = seq - 1;
+    }
+    if (is_buffered(ch, seq))
+        return ARQ_DROP;
+
+    arq_slot_t *slot = &ch->slots[seq % ARQ_RECEIVER_WINDOW];
+    memcpy(slot->pkt, pkt, len);
+    slot->len = len;
+    slot->channel = channel;
+    slot->seq = seq;
+    ch->n++;
+    if ((int16_t) (uint16_t) (seq - ch->last) > 0) {
+        ch->last = seq;
+    } else {
+        // Filled a hole.
+        r->recovered++;
+    }
+    if (seq != ch->next && ch->n == 1) {
+        // First hole since the channel was in order.
+        ch->t_hole = now_ms;
+        ch->nacked = false;
+        ch->nack_end = ch->next;
+    }
+    return ARQ_QUEUED;
+}
+
+/**
+ * Get the next packet to be processed in sequence order. Missing packets are
+ * skipped after the timeout or if the window is full.
+ * Returns the length of the packet, or 0 if no packet can be released yet.
+ * size should be at least ARQ_MAX_PKTSIZE.
+ */
+size_t arq_receiver_get(arq_receiver_t *r, uint8_t *pkt, size_t size, uint32_t now_ms)
+{
+    for (int c = 0; c < ARQ_MAX_CHANNELS; c++) {
+        arq_channel_t *ch = &r->channels[c];
+        if (!ch->initialized)
+            continue;
+        while (1) {
+            arq_slot_t *slot = &ch->slots[ch->next % ARQ_RECEIVER_WINDOW];
+            if (slot->len > 0) {
+                size_t len = (slot->len < size) ? slot->len : size;
+                memcpy(pkt, slot->pkt, len);
+                slot->len = 0;
+                ch->n--;
+                ch->next++;
+                if (ch->n > 0 && !is_buffered(ch, ch->next))
+                    ch->t_hole = now_ms;
+                return len;
+            }
+            bool full = (int16_t) (uint16_t) (ch->limit - ch->next) > 0;
+            bool expired = ch->n > 0 && now_ms - ch->t_hole >= r->timeout_ms;
+            if (!full && !expired)
+                break;
+            if (ch->n == 0) {
+                // Only reached if the window is full: nothing left to release.
+                r->given_up += (uint16_t) (ch->limit - ch->next);
+                ch->next = ch->limit;
+                break;
+            }
+            // Give up on the missing packet.
+            r->given_up++;
+            ch->next++;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Build a NACK packet requesting missing packets, if new holes have been
+ * detected or the retry interval of a pending request has passed.
+ * Returns the size of the packet, or 0 if no NACK is due.
+ */
+size_t arq_receiver_nack(arq_receiver_t *r, uint8_t *pkt, size_t size, uint32_t now_ms)
+{
+    if (size < ARQ_MAX_NACK_PKTSIZE)
+        return 0;
+    
+    size_t nentries = 0;
+    for (int c = 0; c < ARQ_MAX_CHANNELS && nentries < ARQ_MAX_NACK_ENTRIES; c++) {
+        arq_channel_t *ch = &r->channels[c];
+        if (!ch->initialized || ch->n == 0)
+            continue;
+        bool retry = !ch->nacked || now_ms - ch->t_nack >= r->retry_ms;
+        uint16_t s = ch->next;
+        if (!retry && (int16_t) (uint16_t) (ch->nack_end - ch->next) > 0)
+            s = ch->nack_end;
+        // Holes are between next and the last received packet.
+        size_t first = nentries;
+        while ((int16_t) (uint16_t) (ch->last - s) > 0 && nentries < ARQ_MAX_NACK_ENTRIES) {
+            if (is_buffered(ch, s)) {
+                s++;
+                continue;
+            }
+            arq_nack_t entry;
+            entry.channel = c;
+            entry.seq = s;
+            entry.mask = 0;
+            r->requested++;
+            for (int i = 0; i < 16; i++) {
+                uint16_t s2 = s + 1 + i;
+                if ((int16_t) (uint16_t) (ch->last - s2) <= 0)
+                    break;
+                if (!is_buffered(ch, s2)) {
+                    entry.mask |= (1u << i);
+                    r->requested++;
+                }
+            }
+            memcpy(&pkt[sizeof(pkt_header_t) + nentries*sizeof(entry)], &entry, sizeof(entry));
+            nentries++;
+            s += 17;
+        }
+        if ((int16_t) (uint16_t) (s - ch->last) > 0)
+            s = ch->last;
+        ch->nack_end = s;
+        if (retry && nentries > first) {
+            ch->t_nack = now_ms;
+            ch->nacked = true;
+        }
+    }
+    if (nentries == 0)
+        return 0;
+
+    pkt_header_t header;
+    header.type = PKTTYPE_NACK;
+    header.payload_length = nentries*sizeof(arq_nack_t);
+    memcpy(pkt, &header, sizeof(header));
+    size_t len = sizeof(header) + header.payload_length;
+    pkt_trailer_t trailer;
+    trailer.crcsum = crc16_update(0, pkt, len);
+    memcpy(&pkt[len], &trailer, sizeof(trailer));
+    r->nacks++;
+    
+    return len + sizeof(trailer);
+}
@@ -0,0 +1,175 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ARQ_H
+#define ARQ_H
+
+/**
+ * Selective retransmission (ARQ) of packets with sequence headers.
+ *
+ * The sender (firmware) keeps a window of recently sent packets. The receiver
+ * (host) buffers packets arriving after a hole in the sequence numbers of a
+ * channel, requests the missing packets with NACK packets sent back over the
+ * serial link, and releases the packets in sequence order. If a missing packet
+ * does not arrive within a timeout, the receiver gives up and releases the
+ * following packets, so the hole is reported as lost waves as without ARQ.
+ *
+ * Packets are identified by their channel (0 for samples and 1-pps packets,
+ * the channel of the multi-channel header otherwise) and sequence number.
+ * Packets without sequence header are not retransmitted.
+ *
+ * This module is plain C without dependencies, so it is shared by the firmware
+ * and the Linux tools (pkt-to-tlv-stream, firmware emulator).
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "packetizer.h"
+
+// Packet type of NACK packets (host to firmware): packet header, a list of
+// arq_nack_t entries, CRC trailer.
+#define PKTTYPE_NACK 16
+
+// Packets kept by the sender for retransmission.
+#ifndef ARQ_SENDER_WINDOW
+#define ARQ_SENDER_WINDOW 32
+#endif
+
+// Larger packets are neither kept by the sender nor buffered by the receiver.
+#ifndef ARQ_MAX_PKTSIZE
+#define ARQ_MAX_PKTSIZE 128
+#endif
+
+// Packets buffered per channel by the receiver while waiting for a missing packet.
+#ifndef ARQ_RECEIVER_WINDOW
+#define ARQ_RECEIVER_WINDOW 32
+#endif
+
+#ifndef ARQ_MAX_CHANNELS
+#define ARQ_MAX_CHANNELS 16
+#endif
+
+// Maximum number of entries of a NACK packet.
+#define ARQ_MAX_NACK_ENTRIES 8
+
+// Upper bound of the size of a NACK packet.
+#define ARQ_MAX_NACK_PKTSIZE (sizeof(pkt_header_t) + ARQ_MAX_NACK_ENTRIES*sizeof(arq_nack_t) + \
+                              sizeof(pkt_trailer_t))
+
+// Results of arq_receiver_put().
+#define ARQ_QUEUED 0  /* packet is buffered; fetch released packets with arq_receiver_get() */
+#define ARQ_PASS 1    /* packet is not subject to ARQ (no sequence header, too large, or
+                         older than the window); process it right away */
+#define ARQ_DROP 2    /* duplicate of a buffered packet */
+#define ARQ_BLOCKED 3 /* window is full; fetch packets with arq_receiver_get() and retry */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Request of sequence number seq and, for each bit i set in mask,
+ * of sequence number seq+1+i.
+ */
+typedef struct __attribute__((__packed__)) {
+    uint16_t channel;
+    uint16_t seq;
+    uint16_t mask;
+} arq_nack_t;
+
+typedef struct {
+    uint16_t len; // 0 if empty
+    uint16_t channel;
+    uint16_t seq;
+    uint8_t pkt[ARQ_MAX_PKTSIZE];
+} arq_slot_t;
+
+typedef struct {
+    arq_slot_t slots[ARQ_SENDER_WINDOW];
+    // Slot to be overwritten next.
+    uint16_t next;
+    uint32_t retransmissions;
+} arq_sender_t;
+
+typedef struct {
+    bool initialized;
+    // Next sequence number to be released.
+    uint16_t next;
+    // Highest sequence number received so far.
+    uint16_t last;
+    // Number of buffered packets.
+    uint16_t n;
+    // Sequence numbers before limit are skipped even if missing (window full).
+    uint16_t limit;
+    // Time when the hole at next has been detected, and of the last NACK for it.
+    uint32_t t_hole;
+    uint32_t t_nack;
+    bool nacked;
+    // Sequence numbers before nack_end have been requested by the last NACK.
+    uint16_t nack_end;
+    // Slot seq % ARQ_RECEIVER_WINDOW holds the packet with sequence number seq.
+    arq_slot_t slots[ARQ_RECEIVER_WINDOW];
+} arq_channel_t;
+
+typedef struct {
+    arq_channel_t channels[ARQ_MAX_CHANNELS];
+    // Give up on a missing packet after this time.
+    uint32_t timeout_ms;
+    // Repeat NACKs for missing packets after this time.
+    uint32_t retry_ms;
+
+    uint64_t nacks;     // NACK packets sent
+    uint64_t requested; // sequence numbers requested (including repeated requests)
+    uint64_t recovered; // missing packets received later
+    uint64_t given_up;  // missing packets skipped after the timeout
+} arq_receiver_t;
+
+typedef void (*arq_resend_t)(const uint8_t *pkt, size_t len, void *ctx);
+
+bool arq_packet_id(const uint8_t *pkt, size_t len, uint16_t *channel, uint16_t *seq);
+
+void arq_sender_init(arq_sender_t *s);
+
+void arq_sender_store(arq_sender_t *s, const uint8_t *pkt, size_t len);
+
+size_t arq_sender_nack(arq_sender_t *s, const uint8_t *nack, size_t len, arq_resend_t resend, void *ctx);
+
+void arq_receiver_init(arq_receiver_t *r, uint32_t timeout_ms, uint32_t retry_ms);
+
+int arq_receiver_put(arq_receiver_t *r, const uint8_t *pkt, size_t len, uint32_t now_ms);
+
+size_t arq_receiver_get(arq_receiver_t *r, uint8_t *pkt, size_t size, uint32_t now_ms);
+
+size_t arq_receiver_nack(arq_receiver_t *r, uint8_t *pkt, size_t size, uint32_t now_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,118 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deltacodec.h"
+
+static size_t put_varint(uint64_t v, uint8_t *buffer, size_t pos, size_t buffersize)
+{
+    do {
+        if (pos == buffersize)
+            return 0;
+        uint8_t b = v & 0x7f;
+        v >>= 7;
+        if (v != 0)
+            b |= 0x80;
+        buffer[pos++] = b;
+    } while (v != 0);
+
+    return pos;
+}
+
+static size_t get_varint(const uint8_t *buffer, size_t pos, size_t len, uint64_t *v)
+{
+    unsigned int shift = 0;
+
+    *v = 0;
+    while (pos < len && shift < 64) {
+        uint8_t b = buffer[pos++];
+        *v |= ((uint64_t) (b & 0x7f)) << shift;
+        if ((b & 0x80) == 0)
+            return pos;
+        shift += 7;
+    }
+
+    // Truncated or overlong varint.
+    return 0;
+}
+
+/**
+ * Encode n intervals into the given buffer.
+ * Returns the number of bytes written, or 0 if the buffer is too small.
+ */
+size_t deltacodec_encode(const uint32_t *samples, size_t n, uint8_t *buffer, size_t buffersize)
+{
+    size_t pos = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t v;
+        if (i == 0) {
+            v = samples[0];
+        } else {
+            int64_t delta = (int64_t) samples[i] - (int64_t) samples[i-1];
+            // Zig-zag encoding maps small negative and positive values to small unsigned values.
+            v = (delta >= 0) ? ((uint64_t) delta << 1) : ((((uint64_t) -delta) << 1) - 1);
+        }
+        pos = put_varint(v, buffer, pos, buffersize);
+        if (pos == 0)
+            return 0;
+    }
+
+    return pos;
+}
+
+/**
+ * Decode intervals from a buffer of len bytes.
+ * Returns the number of decoded intervals, or -1 if the encoding is invalid
+ * or more than maxsamples intervals are encoded.
+ */
+int deltacodec_decode(const uint8_t *buffer, size_t len, uint32_t *samples, size_t maxsamples)
+{
+    size_t pos = 0;
+    size_t n = 0;
+    int64_t prev = 0;
+
+    while (pos < len) {
+        uint64_t v;
+        pos = get_varint(buffer, pos, len, &v);
+        if (pos == 0 || n == maxsamples)
+            return -1;
+
+        int64_t sample;
+        if (n == 0)
+            sample = v;
+        else
+            sample = prev + ((v & 1) ? -((int64_t) ((v+1) >> 1)) : (int64_t) (v >> 1));
+        if (sample < 0 || sample > UINT32_MAX)
+            return -1;
+
+        samples[n++] = (uint32_t) sample;
+        prev = sample;
+    }
+
+    return (int) n;
+}
@@ -0,0 +1,63 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DELTACODEC_H
+#define DELTACODEC_H
+
+/**
+ * Compact encoding of batches of sample intervals (tick counts).
+ *
+ * The first interval is encoded as unsigned varint (LEB128, 7 bits per byte,
+ * most significant bit set if more bytes follow). Each following interval is
+ * encoded as zig-zag varint of its difference to the previous interval.
+ * Since consecutive waves have almost the same period, most differences fit
+ * into one or two bytes instead of four.
+ *
+ * This module is plain C without dependencies, so it is shared by the firmware
+ * and the Linux tools.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Upper bound of the encoded size of n intervals in bytes.
+#define DELTACODEC_MAX_ENCODED_SIZE(n) (5*(n))
+
+size_t deltacodec_encode(const uint32_t *samples, size_t n, uint8_t *buffer, size_t buffersize);
+
+int deltacodec_decode(const uint8_t *buffer, size_t len, uint32_t *samples, size_t maxsamples);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
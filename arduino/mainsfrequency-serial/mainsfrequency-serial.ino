@@ -26,48 +26,53 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
  
-#include <CRC16.h>
+// Atomic sections of the ring buffer consumer (see ringbuffer.h).
+#define RINGBUFFER_ATOMIC_BEGIN() noInterrupts()
+#define RINGBUFFER_ATOMIC_END() interrupts()
+
+#include "ringbuffer.h"
+#include "packetizer.h"
+#include "slipenc.h"
+#include "slipdec.h"
+#include "arq.h"
+
+// Send sample packets with these many samples (at most PACKETIZER_MAX_BATCHSIZE).
+// Larger batches reduce the per-packet overhead (header, CRC, SLIP framing),
+// but increase the latency.
+// Use firmware-sim (see linux/src) to check that a batch size is sustainable
+// at the chosen baud rate before flashing.
+#define BATCHSIZE 10
 
-// Ringbuffer with 128 entries.
-// Consumes less than 1 KB RAM and can buffer samples at about 50 Hz for more than 2 seconds. 
-#define RINGBUFFERSIZE 128  /* must be a power of two for fast modulo */
-#define RINGBUFFERMOD 0x7f  /* fast modulo RINGBUFFERSIZE through binary & */
+// If set to 1, sample packets are delta-encoded, which typically needs 
+// 1-2 bytes per sample instead of 4 bytes.
+#define USE_DELTA_ENCODING 1
 
-// Different packet types to transport different data.
-#define PKTTYPE_SAMPLES 0 /* samples packet */
-#define PKTTYPE_ONEPPS 1  /* 1-pps calibration packet */
+// If set to 1, packets carry a sequence header, so the receiver can detect
+// lost packets and the number of lost waves.
+#define USE_SEQUENCE_NUMBERS 1
 
-// Send sample packets with these many samples.
-#define BATCHSIZE 10
+// If set to 1, recently sent packets are kept and retransmitted on NACKs
+// from the host (pkt-to-tlv-stream -a). Requires sequence numbers.
+#define USE_ARQ 1
 
 // Maximum packet size
 #define MAX_PKTSIZE 1500
 
-// SLIP special character codes.
-#define SLIP_END             0300    /* indicates end of packet */
-#define SLIP_ESC             0333    /* indicates byte stuffing */
-#define SLIP_ESC_END         0334    /* ESC ESC_END means END data byte */
-#define SLIP_ESC_ESC         0335    /* ESC ESC_ESC means ESC data byte */
+// (sizeof cannot be evaluated by the preprocessor.)
+static_assert(PACKETIZER_MAX_PKTSIZE(BATCHSIZE) <= MAX_PKTSIZE, "BATCHSIZE too large for MAX_PKTSIZE");
 
-typedef struct {
-    uint32_t data[RINGBUFFERSIZE];
-    uint8_t head;
-    uint8_t tail;
-    uint8_t n;
-} ringbuffer_t;
+#if BATCHSIZE > PACKETIZER_MAX_BATCHSIZE
+#error "BATCHSIZE too large for PACKETIZER_MAX_BATCHSIZE"
+#endif
 
-typedef struct __attribute__((__packed__)) {
-    uint16_t type;
-    uint16_t payload_length;
-} pkt_header_t;
+#if USE_ARQ && !USE_SEQUENCE_NUMBERS
+#error "USE_ARQ requires USE_SEQUENCE_NUMBERS"
+#endif
 
-typedef struct __attribute__((__packed__)) {
-    uint16_t crcsum;
-} pkt_trailer_t;
-
-typedef struct {
-    unsigned char buffer[MAX_PKTSIZE]; // header, payload, trailer
-} pkt_t;
+#if USE_ARQ
+// Larger packets would not be kept for retransmission.
+static_assert(PACKETIZER_MAX_PKTSIZE(BATCHSIZE) <= ARQ_MAX_PKTSIZE, "BATCHSIZE too large for ARQ_MAX_PKTSIZE");
+#endif
 
 volatile ringbuffer_t rb_samples;
 volatile ringbuffer_t rb_onepps;
@@ -75,32 +80,33 @@ volatile ringbuffer_t rb_onepps;
 volatile boolean ledstate;
 volatile short wavecnt;
 
-// 16 bit CRC-CCITT: polynomial 0x1021 with start value 0x0000.
-CRC16 crc;
-
-inline pkt_header_t *get_pkt_header(pkt_t *pkt)
-{
-    return ((pkt_header_t *) pkt);
-}
-
-inline unsigned char *get_pkt_payload(pkt_t *pkt) 
-{
-    return (&pkt->buffer[sizeof(pkt_header_t)]);  
-}
+packetizer_t packetizer;
 
-inline pkt_trailer_t *get_pkt_trailer(pkt_t *pkt)
-{
-    pkt_header_t *pkt_header = get_pkt_header(pkt);
-    size_t traileroffset = sizeof(pkt_header_t) + pkt_header->payload_length;
-    return ((pkt_trailer_t *) &pkt->buffer[traileroffset]);
-}
+#if USE_ARQ
+arq_sender_t arq;
+uint8_t nackbuf[ARQ_MAX_NACK_PKTSIZE];
+slipdec_t nackdec;
+#endif
 
 void setup() 
 {
     Serial.begin(115200);
 
-    rb_samples.head = rb_samples.tail = rb_samples.n = 0;
-    rb_onepps.head = rb_onepps.tail = rb_onepps.n = 0;
+    ringbuffer_init(&rb_samples);
+    ringbuffer_init(&rb_onepps);
+
+    uint8_t options = 0;
+#if USE_DELTA_ENCODING
+    options |= PACKETIZER_DELTA;
+#endif
+#if USE_SEQUENCE_NUMBERS
+    options |= PACKETIZER_SEQ;
+#endif
+    packetizer_init(&packetizer, BATCHSIZE, options);
+#if USE_ARQ
+    arq_sender_init(&arq);
+    slipdec_init(&nackdec, nackbuf, sizeof(nackbuf));
+#endif
      
     // We use the LED to signal a fatal error (constantly on) 
     // and to blink once per second after capturing 50 waves during normal operation.
@@ -251,15 +257,12 @@ void TC0_Handler()
         // Copy timestamp value to ring buffer.
         // The interrupt routine has exclusive access to the ring buffer structure,
         // and the following code block is effectively atomic. 
-        if (rb_samples.n == RINGBUFFERSIZE) {
+        if (!ringbuffer_push(&rb_samples, ra)) {
             // Consumer is too slow to process data produced here.
             // This must never happen since it results in wrong interval measurements.
             // Let it crash, reset, and get back into a safe state.
             die();
         }
-        rb_samples.data[rb_samples.head] = ra;
-        rb_samples.head = ((rb_samples.head+1) & RINGBUFFERMOD);
-        rb_samples.n++;
 
         // Blink LED once per second.
         wavecnt++;
@@ -301,15 +304,12 @@ void TC6_Handler()
         // Copy timestamp value to ring buffer.
         // The interrupt routine has exclusive access to the ring buffer structure,
         // and the following code block is effectively atomic. 
-        if (rb_onepps.n == RINGBUFFERSIZE) {
+        if (!ringbuffer_push(&rb_onepps, ra)) {
             // Consumer is too slow to process data produced here.
             // This must never happen since it results in wrong interval measurements.
             // Let it crash, reset, and get back into a safe state.
             die();
         }
-        rb_onepps.data[rb_onepps.head] = ra;
-        rb_onepps.head = ((rb_onepps.head+1) & RINGBUFFERMOD);
-        rb_onepps.n++;
     }
     
     if (stat & TC_SR_LDRBS) {
@@ -318,54 +318,50 @@ void TC6_Handler()
 }
 
 /**
- * Send a packet of serial using SLIP protocol.
- * The following code is adapted from RFC 1055.
+ * Output function of the SLIP encoder.
  */
-void send_packet_slip(const void *data, size_t len)
+void serial_put(uint8_t b, void *ctx)
 {
-    const unsigned char *d = (unsigned char *) data;
-    
-    // Send an initial END character to flush out any data that may
-    // have accumulated in the receiver due to line noise.
-    // This might result in zero length packets on receiver side,
-    // which the receiver should drop.
-    Serial.write(SLIP_END);
-
-    // For each byte in the packet, send the appropriate character
-    // sequence.
-    while (len--) {
-        switch (*d) {
-            // If it's the same code as an END character, we send a
-            // special two character code so as not to make the
-            // receiver think we sent an END.
-            case SLIP_END:
-                Serial.write(SLIP_ESC);
-                Serial.write(SLIP_ESC_END);
-                break;
-            // If it's the same code as an ESC character,
-            // we send a special two character code so as not
-            // to make the receiver think we sent an ESC.
-            case SLIP_ESC:
-                Serial.write(SLIP_ESC);
-                Serial.write(SLIP_ESC_ESC);
-                break;
-            default:
-                Serial.write(*d);
-        }
-        d++;
-    }
+    Serial.write(b);
+}
 
-    // Tell the receiver that we're done sending the packet.
-    Serial.write(SLIP_END);
+/**
+ * Send a packet and keep it for retransmission.
+ */
+void send_packet(const uint8_t *pkt, size_t len)
+{
+    slipenc_send(pkt, len, serial_put, NULL);
+#if USE_ARQ
+    arq_sender_store(&arq, pkt, len);
+#endif
+}
+
+#if USE_ARQ
+/**
+ * Retransmit a packet requested by the host.
+ */
+void resend_packet(const uint8_t *pkt, size_t len, void *ctx)
+{
+    slipenc_send(pkt, len, serial_put, NULL);
 }
 
+/**
+ * Handle NACKs received from the host.
+ */
+void receive_nacks()
+{
+    while (Serial.available() > 0) {
+        size_t len = slipdec_put(&nackdec, Serial.read());
+        if (len > 0)
+            arq_sender_nack(&arq, nackbuf, len, resend_packet, NULL);
+    }
+}
+#endif
+
 void loop() 
 {
-    pkt_t pkt_samples; // a packet with samples
-    pkt_t pkt_onepps; // a packet with 1-pps calibration values
-    // Directly write samples into packet.
-    uint32_t *batch = (uint32_t *) get_pkt_payload(&pkt_samples);
-    size_t nbatch = 0;
+    uint8_t pkt[MAX_PKTSIZE]; // header, payload, trailer
+    size_t pkt_len;
 
     boolean first_sample = true;
     boolean first_onepps = true;
@@ -374,19 +370,15 @@ void loop()
     
     while (true) {
         // Busy waiting for data to be produced.
-        // Safe since reading a single byte is atomic. 
-        while (rb_samples.n == 0 && rb_onepps.n == 0);
+        while (ringbuffer_count(&rb_samples) == 0 && ringbuffer_count(&rb_onepps) == 0) {
+#if USE_ARQ
+            receive_nacks();
+#endif
+        }
 
-        // Since n is a single byte, reading it is safe (atomic).
-        if (rb_samples.n > 0) { 
+        if (ringbuffer_count(&rb_samples) > 0) { 
             // There is at least one sample in the ringbuffer.
-            uint32_t ts = rb_samples.data[rb_samples.tail];
-            rb_samples.tail = ((rb_samples.tail+1) & RINGBUFFERMOD);
-            // Get exclusive access to n, without concurrent access by interrupt routine
-            // (perform atomic read-modify-write on n).
-            noInterrupts();
-            rb_samples.n--;
-            interrupts();
+            uint32_t ts = ringbuffer_pop(&rb_samples);
 
             if (first_sample) {
                 // First value -> cannot calculate interval
@@ -403,41 +395,16 @@ void loop()
                 }
                 ts_samples_old = ts;
 
-                batch[nbatch++] = interval;
-                if (nbatch == BATCHSIZE) {
-                    // Batch is complete -> send packet
-                       
-                    // Fill in packet header.
-                    pkt_header_t *pkt_header = get_pkt_header(&pkt_samples);
-                    pkt_header->type = PKTTYPE_SAMPLES;
-                    pkt_header->payload_length = BATCHSIZE*sizeof(uint32_t);
-
-                    // Packet payload is already filled in (zero-copy; batch points to packet payload).
-                    
-                    // Fill in packet trailer.
-                    pkt_trailer_t *pkt_trailer = get_pkt_trailer(&pkt_samples);
-                    crc.add(pkt_samples.buffer, sizeof(pkt_header_t)+pkt_header->payload_length);
-                    pkt_trailer->crcsum = crc.getCRC();
-
-                    size_t pkt_len = sizeof(pkt_header_t) + sizeof(pkt_trailer_t) + pkt_header->payload_length;
-                    send_packet_slip(pkt_samples.buffer, pkt_len);
-            
-                    crc.reset();
-                    nbatch = 0;
-                }
+                // Send packet if the batch is complete.
+                pkt_len = packetizer_add_sample(&packetizer, interval, pkt, sizeof(pkt));
+                if (pkt_len > 0)
+                    send_packet(pkt, pkt_len);
             }
         }
 
-        // Since n is a single byte, reading it is safe (atomic).
-        if (rb_onepps.n > 0) { 
+        if (ringbuffer_count(&rb_onepps) > 0) { 
             // There is at least one 1-pps measurement in the ringbuffer.
-            uint32_t ts = rb_onepps.data[rb_onepps.tail];
-            rb_onepps.tail = ((rb_onepps.tail+1) & RINGBUFFERMOD);
-            // Get exclusive access to n, without concurrent access by interrupt routine
-            // (perform atomic read-modify-write on n).
-            noInterrupts();
-            rb_onepps.n--;
-            interrupts();
+            uint32_t ts = ringbuffer_pop(&rb_onepps);
 
             if (first_onepps) {
                 // First value -> cannot calculate interval
@@ -454,24 +421,8 @@ void loop()
                 }
                 ts_onepps_old = ts;
 
-                // Fill in packet header.
-                pkt_header_t *pkt_header = get_pkt_header(&pkt_onepps);
-                pkt_header->type = PKTTYPE_ONEPPS;
-                pkt_header->payload_length = sizeof(interval);
-
-                // Copy payload into packet.
-                uint32_t *payload = (uint32_t *) get_pkt_payload(&pkt_onepps);
-                *payload = interval;
-                
-                // Fill in packet trailer.
-                pkt_trailer_t *pkt_trailer = get_pkt_trailer(&pkt_onepps);
-                crc.add(pkt_onepps.buffer, sizeof(pkt_header_t)+pkt_header->payload_length);
-                pkt_trailer->crcsum = crc.getCRC();
-
-                size_t pkt_len = sizeof(pkt_header_t) + sizeof(pkt_trailer_t) + pkt_header->payload_length;
-                send_packet_slip(pkt_onepps.buffer, pkt_len);
-            
-                crc.reset();
+                pkt_len = packetizer_onepps(&packetizer, interval, pkt, sizeof(pkt));
+                send_packet(pkt, pkt_len);
             }
         }
     }
@@ -0,0 +1,152 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include "packetizer.h"
+#include "crc16.h"
+
+bool packetizer_init(packetizer_t *p, uint16_t batchsize, uint8_t options)
+{
+    if (batchsize == 0 || batchsize > PACKETIZER_MAX_BATCHSIZE)
+        return false;
+    p->batchsize = batchsize;
+    p->options = options;
+    for (int c = 0; c < PACKETIZER_MAX_CHANNELS; c++) {
+        p->channels[c].n = 0;
+        p->channels[c].seq = 0;
+        p->channels[c].wave = 0;
+    }
+    return true;
+}
+
+static size_t data_offset(const packetizer_t *p)
+{
+    return sizeof(pkt_header_t) + ((p->options & PACKETIZER_SEQ) ? sizeof(pkt_seq_t) : 0);
+}
+
+/**
+ * Fill in header, sequence header (if enabled), and trailer of a packet
+ * whose data has already been written after the headers.
+ * Returns the size of the packet.
+ */
+static size_t finish_packet(packetizer_t *p, packetizer_channel_t *ch, uint16_t type, size_t datalen, uint8_t *pkt)
+{
+    pkt_header_t header;
+    size_t seqlen = 0;
+    if (p->options & PACKETIZER_SEQ) {
+        pkt_seq_t seq;
+        seq.seq = ch->seq++;
+        seq.wave = ch->wave;
+        memcpy(&pkt[sizeof(pkt_header_t)], &seq, sizeof(seq));
+        seqlen = sizeof(seq);
+        type |= PKTTYPE_FLAG_SEQ;
+    }
+    header.type = type;
+    header.payload_length = seqlen + datalen;
+    memcpy(pkt, &header, sizeof(header));
+
+    size_t len = sizeof(pkt_header_t) + header.payload_length;
+    pkt_trailer_t trailer;
+    trailer.crcsum = crc16_update(0, pkt, len);
+    memcpy(&pkt[len], &trailer, sizeof(trailer));
+
+    return len + sizeof(trailer);
+}
+
+/**
+ * Encode the batch of a channel into a packet. Returns the size of the packet.
+ */
+static size_t batch_packet(packetizer_t *p, uint16_t channel, uint8_t *pkt, size_t pktsize)
+{
+    packetizer_channel_t *ch = &p->channels[channel];
+    size_t offset = data_offset(p);
+    size_t datalen = 0;
+    uint16_t type;
+    if (channel > 0) {
+        pkt_mc_t mc;
+        mc.channel = channel;
+        mc.flags = (p->options & PACKETIZER_DELTA) ? PKT_MC_DELTA : 0;
+        memcpy(&pkt[offset], &mc, sizeof(mc));
+        offset += sizeof(mc);
+        datalen = sizeof(mc);
+        type = PKTTYPE_SAMPLES_MC;
+    } else {
+        type = (p->options & PACKETIZER_DELTA) ? PKTTYPE_SAMPLES_DELTA : PKTTYPE_SAMPLES;
+    }
+    
+    if (p->options & PACKETIZER_DELTA) {
+        datalen += deltacodec_encode(ch->batch, ch->n, &pkt[offset],
+            pktsize - offset - sizeof(pkt_trailer_t));
+    } else {
+        memcpy(&pkt[offset], ch->batch, ch->n*sizeof(uint32_t));
+        datalen += ch->n*sizeof(uint32_t);
+    }
+    size_t len = finish_packet(p, ch, type, datalen, pkt);
+    
+    ch->wave += ch->n;
+    ch->n = 0;
+
+    return len;
+}
+
+/**
+ * Add the interval of a wave of a channel to its batch. If the batch is
+ * complete, the packet is written to pkt and its size is returned;
+ * otherwise 0. pkt must hold at least PACKETIZER_MAX_PKTSIZE(batchsize) bytes.
+ */
+size_t packetizer_add_sample_mc(packetizer_t *p, uint16_t channel, uint32_t interval, uint8_t *pkt, size_t pktsize)
+{
+    if (channel >= PACKETIZER_MAX_CHANNELS)
+        return 0;
+    packetizer_channel_t *ch = &p->channels[channel];
+    ch->batch[ch->n++] = interval;
+    if (ch->n < p->batchsize)
+        return 0;
+
+    // Batch is complete -> build packet.
+    return batch_packet(p, channel, pkt, pktsize);
+}
+
+/**
+ * Add the interval of a wave of channel 0 (single-channel firmware).
+ */
+size_t packetizer_add_sample(packetizer_t *p, uint32_t interval, uint8_t *pkt, size_t pktsize)
+{
+    return packetizer_add_sample_mc(p, 0, interval, pkt, pktsize);
+}
+
+/**
+ * Build a 1-pps calibration packet. Returns the size of the packet.
+ */
+size_t packetizer_onepps(packetizer_t *p, uint32_t interval, uint8_t *pkt, size_t pktsize)
+{
+    if (pktsize < data_offset(p) + sizeof(interval) + sizeof(pkt_trailer_t))
+        return 0;
+    memcpy(&pkt[data_offset(p)], &interval, sizeof(interval));
+    return finish_packet(p, &p->channels[0], PKTTYPE_ONEPPS, sizeof(interval), pkt);
+}
@@ -0,0 +1,129 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PACKETIZER_H
+#define PACKETIZER_H
+
+/**
+ * Batching of sample intervals into packets (header, optional sequence
+ * header, payload, CRC trailer) as sent by the firmware.
+ *
+ * This module is plain C without dependencies, so it is shared by the firmware
+ * and the Linux tools (firmware simulator).
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "deltacodec.h"
+
+// Different packet types to transport different data.
+#define PKTTYPE_SAMPLES 0 /* samples packet */
+#define PKTTYPE_ONEPPS 1  /* 1-pps calibration packet */
+#define PKTTYPE_SAMPLES_DELTA 4 /* samples packet, delta-encoded (see deltacodec.h) */
+#define PKTTYPE_SAMPLES_MC 8 /* samples packet of channel > 0 (payload starts with pkt_mc_t) */
+#define PKTTYPE_FLAG_SEQ 0x8000 /* flag: payload starts with sequence header (pkt_seq_t) */
+
+// Options of the packetizer.
+#define PACKETIZER_DELTA 0x01 /* delta-encode sample packets */
+#define PACKETIZER_SEQ 0x02   /* add sequence headers */
+
+// Flags of multi-channel samples packets.
+#define PKT_MC_DELTA 0x0001 /* samples are delta-encoded */
+
+#ifndef PACKETIZER_MAX_BATCHSIZE
+#define PACKETIZER_MAX_BATCHSIZE 256
+#endif
+
+// Number of input channels (e.g., three phases). Channel 0 is sent as
+// ordinary samples packets, the other channels as multi-channel samples packets.
+// Each channel needs a batch buffer of PACKETIZER_MAX_BATCHSIZE samples.
+#ifndef PACKETIZER_MAX_CHANNELS
+#define PACKETIZER_MAX_CHANNELS 1
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct __attribute__((__packed__)) {
+    uint16_t type;
+    uint16_t payload_length;
+} pkt_header_t;
+
+typedef struct __attribute__((__packed__)) {
+    uint16_t seq;  // packet counter
+    uint16_t wave; // index of first wave in this (sample packets) or the next sample packet (other packets)
+} pkt_seq_t;
+
+typedef struct __attribute__((__packed__)) {
+    uint16_t channel;
+    uint16_t flags;
+} pkt_mc_t;
+
+typedef struct __attribute__((__packed__)) {
+    uint16_t crcsum;
+} pkt_trailer_t;
+
+// Upper bound of the size of a sample packet with n samples.
+#define PACKETIZER_MAX_PKTSIZE(n) (sizeof(pkt_header_t) + sizeof(pkt_seq_t) + sizeof(pkt_mc_t) + \
+                                   DELTACODEC_MAX_ENCODED_SIZE(n) + sizeof(pkt_trailer_t))
+
+/**
+ * Each channel is a separate stream with its own sequence numbers and wave
+ * indices, so the receiver detects lost waves per channel. 1-pps packets
+ * belong to the stream of channel 0.
+ */
+typedef struct {
+    uint32_t batch[PACKETIZER_MAX_BATCHSIZE];
+    uint16_t n;
+    // Next sequence number.
+    uint16_t seq;
+    // Index of the first wave of the current batch (modulo 2^16) for detecting lost waves at the receiver.
+    uint16_t wave;
+} packetizer_channel_t;
+
+typedef struct {
+    uint16_t batchsize;
+    uint8_t options;
+    packetizer_channel_t channels[PACKETIZER_MAX_CHANNELS];
+} packetizer_t;
+
+bool packetizer_init(packetizer_t *p, uint16_t batchsize, uint8_t options);
+
+size_t packetizer_add_sample(packetizer_t *p, uint32_t interval, uint8_t *pkt, size_t pktsize);
+
+size_t packetizer_add_sample_mc(packetizer_t *p, uint16_t channel, uint32_t interval, uint8_t *pkt, size_t pktsize);
+
+size_t packetizer_onepps(packetizer_t *p, uint32_t interval, uint8_t *pkt, size_t pktsize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,115 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+/**
+ * Ring buffer passing timestamps from the interrupt handlers (producer)
+ * to the main loop (consumer).
+ *
+ * The producer only writes head and the consumer only writes tail. Both
+ * modify the counter n, so the consumer must decrement it atomically;
+ * define RINGBUFFER_ATOMIC_BEGIN() and RINGBUFFER_ATOMIC_END() (e.g., as
+ * noInterrupts() and interrupts()) before including this header.
+ *
+ * This module is plain C without dependencies, so it is shared by the firmware
+ * and the Linux tools (firmware simulator).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Ringbuffer with 128 entries.
+// Consumes less than 1 KB RAM and can buffer samples at about 50 Hz for more than 2 seconds. 
+#define RINGBUFFERSIZE 128  /* must be a power of two for fast modulo */
+#define RINGBUFFERMOD 0x7f  /* fast modulo RINGBUFFERSIZE through binary & */
+
+#ifndef RINGBUFFER_ATOMIC_BEGIN
+#define RINGBUFFER_ATOMIC_BEGIN()
+#define RINGBUFFER_ATOMIC_END()
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t data[RINGBUFFERSIZE];
+    uint8_t head;
+    uint8_t tail;
+    uint8_t n;
+} ringbuffer_t;
+
+static inline void ringbuffer_init(volatile ringbuffer_t *rb)
+{
+    rb->head = rb->tail = rb->n = 0;
+}
+
+/**
+ * Add a value (producer). Returns false if the ring buffer is full.
+ */
+static inline bool ringbuffer_push(volatile ringbuffer_t *rb, uint32_t value)
+{
+    if (rb->n == RINGBUFFERSIZE)
+        return false;
+    rb->data[rb->head] = value;
+    rb->head = ((rb->head+1) & RINGBUFFERMOD);
+    rb->n++;
+    return true;
+}
+
+/**
+ * Remove the oldest value (consumer). The ring buffer must not be empty.
+ */
+static inline uint32_t ringbuffer_pop(volatile ringbuffer_t *rb)
+{
+    uint32_t value = rb->data[rb->tail];
+    rb->tail = ((rb->tail+1) & RINGBUFFERMOD);
+    // Get exclusive access to n, without concurrent access by the producer
+    // (perform atomic read-modify-write on n).
+    RINGBUFFER_ATOMIC_BEGIN();
+    rb->n--;
+    RINGBUFFER_ATOMIC_END();
+    return value;
+}
+
+/**
+ * Number of values in the ring buffer. Since n is a single byte, reading it
+ * is safe (atomic).
+ */
+static inline uint8_t ringbuffer_count(volatile ringbuffer_t *rb)
+{
+    return rb->n;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,75 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "slipdec.h"
+
+void slipdec_init(slipdec_t *d, uint8_t *buffer, size_t size)
+{
+    d->buffer = buffer;
+    d->size = size;
+    d->len = 0;
+    d->esc = false;
+    d->overflow = false;
+}
+
+/**
+ * Feed the next received byte into the decoder. Returns the length of the
+ * packet in the buffer if b completes a packet; otherwise 0.
+ * The packet stays valid until the next call.
+ */
+size_t slipdec_put(slipdec_t *d, uint8_t b)
+{
+    if (b == SLIP_END) {
+        // Empty packets (e.g., the initial END of a packet) are ignored,
+        // as are packets exceeding the buffer.
+        size_t len = d->overflow ? 0 : d->len;
+        d->len = 0;
+        d->esc = false;
+        d->overflow = false;
+        return len;
+    }
+
+    if (d->esc) {
+        // If b is neither ESC_END nor ESC_ESC, this is a protocol violation,
+        // and the byte is stored as it is (like the receiver in RFC 1055).
+        if (b == SLIP_ESC_END)
+            b = SLIP_END;
+        else if (b == SLIP_ESC_ESC)
+            b = SLIP_ESC;
+        d->esc = false;
+    } else if (b == SLIP_ESC) {
+        d->esc = true;
+        return 0;
+    }
+
+    if (d->len < d->size)
+        d->buffer[d->len++] = b;
+    else
+        d->overflow = true;
+    return 0;
+}
@@ -0,0 +1,79 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "slipenc.h"
+
+/**
+ * Send a packet using SLIP protocol. Returns the number of bytes passed to put.
+ * The following code is adapted from RFC 1055.
+ */
+size_t slipenc_send(const void *data, size_t len, slipenc_put_t put, void *ctx)
+{
+    const unsigned char *d = (const unsigned char *) data;
+    size_t n = 0;
+    
+    // Send an initial END character to flush out any data that may
+    // have accumulated in the receiver due to line noise.
+    // This might result in zero length packets on receiver side,
+    // which the receiver should drop.
+    put(SLIP_END, ctx);
+    n++;
+
+    // For each byte in the packet, send the appropriate character
+    // sequence.
+    while (len--) {
+        switch (*d) {
+            // If it's the same code as an END character, we send a
+            // special two character code so as not to make the
+            // receiver think we sent an END.
+            case SLIP_END:
+                put(SLIP_ESC, ctx);
+                put(SLIP_ESC_END, ctx);
+                n += 2;
+                break;
+            // If it's the same code as an ESC character,
+            // we send a special two character code so as not
+            // to make the receiver think we sent an ESC.
+            case SLIP_ESC:
+                put(SLIP_ESC, ctx);
+                put(SLIP_ESC_ESC, ctx);
+                n += 2;
+                break;
+            default:
+                put(*d, ctx);
+                n++;
+        }
+        d++;
+    }
+
+    // Tell the receiver that we're done sending the packet.
+    put(SLIP_END, ctx);
+    n++;
+
+    return n;
+}
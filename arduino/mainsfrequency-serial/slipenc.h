@@ -0,0 +1,63 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SLIPENC_H
+#define SLIPENC_H
+
+/**
+ * SLIP framing of packets (RFC 1055).
+ *
+ * The encoder passes the framed bytes to a callback, which writes them to
+ * the serial port in the firmware.
+ *
+ * This module is plain C without dependencies, so it is shared by the firmware
+ * and the Linux tools (firmware simulator).
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+// SLIP special character codes.
+#define SLIP_END             0300    /* indicates end of packet */
+#define SLIP_ESC             0333    /* indicates byte stuffing */
+#define SLIP_ESC_END         0334    /* ESC ESC_END means END data byte */
+#define SLIP_ESC_ESC         0335    /* ESC ESC_ESC means ESC data byte */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*slipenc_put_t)(uint8_t b, void *ctx);
+
+size_t slipenc_send(const void *data, size_t len, slipenc_put_t put, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,119 @@
+"""
+Thin ctypes wrapper of libmainsfreq for loading TLV recordings directly
+into NumPy arrays or a pandas DataFrame (no CSV conversion required).
+
+Example:
+    import mainsfreq
+    df = mainsfreq.load_dataframe('recording.tlv',
+                                  start='2022-09-19 00:00:00', end='2022-09-25 23:59:59')
+
+The library is searched in the directory given by the environment variable
+MAINSFREQ_LIB_DIR, the build directory of the Linux tools, and the default
+library path.
+"""
+
+import ctypes
+import ctypes.util
+import os
+
+import numpy as np
+
+ABI_VERSION = 1
+
+_lib = None
+
+
+def _load_library():
+    global _lib
+    if _lib is not None:
+        return _lib
+
+    candidates = []
+    libdir = os.environ.get('MAINSFREQ_LIB_DIR')
+    if libdir:
+        candidates.append(os.path.join(libdir, 'libmainsfreq.so'))
+    here = os.path.dirname(os.path.abspath(__file__))
+    candidates.append(os.path.join(here, '..', 'linux', 'src', 'build', 'libmainsfreq.so'))
+    found = ctypes.util.find_library('mainsfreq')
+    if found:
+        candidates.append(found)
+
+    for path in candidates:
+        try:
+            lib = ctypes.CDLL(path)
+            break
+        except OSError:
+            continue
+    else:
+        raise OSError('libmainsfreq.so not found (set MAINSFREQ_LIB_DIR)')
+
+    lib.mf_abi_version.restype = ctypes.c_int
+    lib.mf_abi_version.argtypes = []
+    if lib.mf_abi_version() != ABI_VERSION:
+        raise OSError('Incompatible version of libmainsfreq.so')
+
+    lib.mf_open.restype = ctypes.c_void_p
+    lib.mf_open.argtypes = [ctypes.c_char_p]
+    lib.mf_close.restype = None
+    lib.mf_close.argtypes = [ctypes.c_void_p]
+    lib.mf_select.restype = ctypes.c_int
+    lib.mf_select.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.c_uint64]
+    lib.mf_select_channel.restype = ctypes.c_int
+    lib.mf_select_channel.argtypes = [ctypes.c_void_p, ctypes.c_uint16]
+    lib.mf_count.restype = ctypes.c_int64
+    lib.mf_count.argtypes = [ctypes.c_void_p]
+    lib.mf_read.restype = ctypes.c_int64
+    lib.mf_read.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p,
+                            ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t]
+    _lib = lib
+    return lib
+
+
+def _to_ns(t):
+    """Convert None, a number (ns since epoch), or a time string (UTC) to ns since epoch."""
+    if t is None or isinstance(t, (int, np.integer)):
+        return t
+    return int(np.datetime64(t, 'ns').astype(np.int64))
+
+
+def load(path, start=None, end=None, channel=0):
+    """
+    Load all samples of a recording with wallclock timestamps within [start, end]
+    into a dict of NumPy arrays: ticks, f_mains_syncd, f_clk_syncd, t_wallclock.
+    For multi-channel recordings, channel selects the channel.
+    """
+    lib = _load_library()
+    reader = lib.mf_open(os.fsencode(path))
+    if not reader:
+        raise OSError('Could not open ' + str(path))
+    try:
+        tstart = _to_ns(start)
+        tend = _to_ns(end)
+        if lib.mf_select(reader, tstart or 0, tend if tend is not None else 2**64-1) < 0:
+            raise ValueError('Invalid time range')
+        if lib.mf_select_channel(reader, channel) < 0:
+            raise ValueError('Invalid channel')
+        n = lib.mf_count(reader)
+        columns = {
+            'ticks': np.empty(n, dtype=np.uint32),
+            'f_mains_syncd': np.empty(n, dtype=np.float64),
+            'f_clk_syncd': np.empty(n, dtype=np.uint32),
+            't_wallclock': np.empty(n, dtype=np.uint64),
+        }
+        nread = lib.mf_read(reader,
+                            columns['ticks'].ctypes.data,
+                            columns['f_mains_syncd'].ctypes.data,
+                            columns['f_clk_syncd'].ctypes.data,
+                            columns['t_wallclock'].ctypes.data,
+                            n)
+        if nread != n:
+            raise OSError('Recording changed while reading')
+        return columns
+    finally:
+        lib.mf_close(reader)
+
+
+def load_dataframe(path, start=None, end=None, channel=0):
+    """Like load(), but returns a pandas DataFrame."""
+    import pandas as pd
+    return pd.DataFrame(load(path, start, end, channel))
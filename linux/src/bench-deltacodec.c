@@ -0,0 +1,121 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Benchmark of the delta codec: encoding and decoding throughput and
+ * compression ratio for batches of realistic sample intervals.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "deltacodec.h"
+#include "tlv.h"
+
+#define DEFAULT_ITERATIONS 100000
+
+static double now(void)
+{
+     struct timespec ts;
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+     return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static void usage(const char *prog)
+{
+     fprintf(stderr, "USAGE: %s [-n ITERATIONS] [-b BATCHSIZE]\n", prog);
+     fprintf(stderr, "Measures encoding and decoding throughput of the delta codec.\n");
+     fprintf(stderr, "-n ITERATIONS : number of batches to encode and decode (default: %d)\n",
+	     DEFAULT_ITERATIONS);
+     fprintf(stderr, "-b BATCHSIZE : samples per batch (default: %d)\n", MAX_SAMPLE_COUNT);
+}
+
+int main(int argc, char *argv[])
+{
+     long iterations = DEFAULT_ITERATIONS;
+     long batchsize = MAX_SAMPLE_COUNT;
+     int c;
+
+     while ( (c = getopt(argc, argv, "n:b:")) != -1 ) {
+	  switch(c) {
+	  case 'n':
+	       iterations = atol(optarg);
+	       break;
+	  case 'b':
+	       batchsize = atol(optarg);
+	       break;
+	  default:
+	       usage(argv[0]);
+	       exit(1);
+	  }
+     }
+     if (iterations <= 0 || batchsize <= 0 || batchsize > MAX_SAMPLE_COUNT) {
+	  usage(argv[0]);
+	  exit(1);
+     }
+
+     // Periods of a 50 Hz wave at 42 MHz with some jitter.
+     uint32_t samples[MAX_SAMPLE_COUNT];
+     srand(1);
+     for (long i = 0; i < batchsize; i++)
+	  samples[i] = 840000 + (rand() % 2001) - 1000;
+
+     uint8_t encoded[DELTACODEC_MAX_ENCODED_SIZE(MAX_SAMPLE_COUNT)];
+     uint32_t decoded[MAX_SAMPLE_COUNT];
+     size_t len = 0;
+     uint64_t checksum = 0;
+
+     double t0 = now();
+     for (long i = 0; i < iterations; i++) {
+	  // Vary the input a little, so the loop cannot be optimized away.
+	  samples[0] = 840000 + (i & 0xff);
+	  len = deltacodec_encode(samples, batchsize, encoded, sizeof(encoded));
+	  checksum += len;
+     }
+     double t1 = now();
+     for (long i = 0; i < iterations; i++) {
+	  int n = deltacodec_decode(encoded, len, decoded, MAX_SAMPLE_COUNT);
+	  if (n != batchsize) {
+	       fprintf(stderr, "Error: decoding failed\n");
+	       exit(1);
+	  }
+	  checksum += decoded[i % batchsize];
+     }
+     double t2 = now();
+
+     double nsamples = (double) iterations*batchsize;
+     printf("batch size: %ld samples, %zu bytes encoded (%.2f bytes/sample)\n",
+	    batchsize, len, (double) len/batchsize);
+     printf("encode: %.1f Msamples/s\n", nsamples/(t1-t0)/1e6);
+     printf("decode: %.1f Msamples/s\n", nsamples/(t2-t1)/1e6);
+     printf("checksum: %llu\n", (unsigned long long) checksum);
+
+     return 0;
+}
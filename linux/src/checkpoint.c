@@ -0,0 +1,228 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include "checkpoint.h"
+#include "stats.h"
+#include "errandwarn.h"
+
+#define MAX_PATH_SIZE 1000
+
+#define CHECKPOINT_MAGIC "TLVCKPT"
+#define CHECKPOINT_VERSION 1
+
+// Size of the input regions before the offset covered by fingerprints.
+#define FINGERPRINT_SIZE 4096
+
+typedef struct __attribute__((__packed__)) {
+     char magic[8];
+     uint32_t version;
+     char stage[64];
+     // Offset of the first record not processed yet.
+     uint64_t offset;
+     // Set if the input was a regular file (offset and fingerprints are valid).
+     uint8_t seekable;
+     // FNV-1a hashes of the first and the last bytes before offset.
+     uint64_t fp_head;
+     uint64_t fp_tail;
+     uint32_t state_size;
+} checkpoint_header_t;
+
+static bool enabled = false;
+static char path[MAX_PATH_SIZE];
+static char stage[64];
+
+// Input offset the current run started at.
+static uint64_t start_offset = 0;
+
+/**
+ * Enable checkpoints if requested. Removes --checkpoint=FILE from the
+ * command line, so it must be called before parsing the other arguments.
+ */
+void checkpoint_init(int *argc, char *argv[])
+{
+     int j = 1;
+     for (int i = 1; i < *argc; i++) {
+	  if (strncmp(argv[i], "--checkpoint=", 13) == 0) {
+	       enabled = true;
+	       memset(path, 0, MAX_PATH_SIZE);
+	       strncpy(path, &argv[i][13], MAX_PATH_SIZE-1);
+	  } else {
+	       argv[j++] = argv[i];
+	  }
+     }
+     *argc = j;
+     argv[j] = NULL;
+
+     char name[MAX_PATH_SIZE];
+     strncpy(name, argv[0], MAX_PATH_SIZE-1);
+     name[MAX_PATH_SIZE-1] = '\0';
+     memset(stage, 0, sizeof(stage));
+     strncpy(stage, basename(name), sizeof(stage)-1);
+}
+
+/**
+ * FNV-1a hash of len bytes of the input at the given offset.
+ */
+static int fingerprint(int fd, uint64_t offset, size_t len, uint64_t *hash)
+{
+     unsigned char buffer[FINGERPRINT_SIZE];
+     if (pread(fd, buffer, len, offset) != (ssize_t) len)
+	  return -1;
+
+     uint64_t h = 14695981039346656037ull;
+     for (size_t i = 0; i < len; i++) {
+	  h ^= buffer[i];
+	  h *= 1099511628211ull;
+     }
+     *hash = h;
+
+     return 0;
+}
+
+static int fingerprints(int fd, uint64_t offset, uint64_t *head, uint64_t *tail)
+{
+     size_t len = (offset < FINGERPRINT_SIZE) ? offset : FINGERPRINT_SIZE;
+     if (fingerprint(fd, 0, len, head) < 0)
+	  return -1;
+     return fingerprint(fd, offset-len, len, tail);
+}
+
+static bool input_seekable()
+{
+     struct stat st;
+     return (fstat(fileno(stdin), &st) == 0 && S_ISREG(st.st_mode));
+}
+
+/**
+ * Restore the state saved by the last run and continue reading stdin
+ * after the saved offset. Must be called before reading from stdin.
+ * Returns false if there is no checkpoint (first run).
+ */
+bool checkpoint_resume(void *state, size_t size)
+{
+     if (!enabled)
+	  return false;
+
+     FILE *f = fopen(path, "r");
+     if (f == NULL)
+	  return false;
+
+     checkpoint_header_t hdr;
+     if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	 memcmp(hdr.magic, CHECKPOINT_MAGIC, sizeof(hdr.magic)) != 0 ||
+	 hdr.version != CHECKPOINT_VERSION) {
+	  ERROR("Invalid checkpoint file");
+	  exit(-1);
+     }
+     if (strncmp(hdr.stage, stage, sizeof(stage)) != 0 || hdr.state_size != size) {
+	  ERROR("Checkpoint file was written by another filter");
+	  exit(-1);
+     }
+     if (size > 0 && fread(state, size, 1, f) != 1) {
+	  ERROR("Invalid checkpoint file");
+	  exit(-1);
+     }
+     fclose(f);
+
+     if (hdr.seekable && input_seekable()) {
+	  int fd = fileno(stdin);
+	  struct stat st;
+	  uint64_t head, tail;
+	  if (fstat(fd, &st) < 0 || (uint64_t) st.st_size < hdr.offset) {
+	       ERROR("Input is shorter than at the checkpoint (truncated or replaced file?)");
+	       exit(-1);
+	  }
+	  if (fingerprints(fd, hdr.offset, &head, &tail) < 0 ||
+	      head != hdr.fp_head || tail != hdr.fp_tail) {
+	       ERROR("Input differs from the input at the checkpoint (replaced file?)");
+	       exit(-1);
+	  }
+	  if (fseeko(stdin, hdr.offset, SEEK_SET) < 0) {
+	       ERROR("Could not seek to checkpoint offset");
+	       exit(-1);
+	  }
+	  start_offset = hdr.offset;
+     }
+     // Otherwise, the input is a stream continuing after the checkpoint
+     // (e.g., the output of a resumed upstream filter).
+     
+     return true;
+}
+
+/**
+ * Save the state after all input has been processed. Output written to
+ * stdout is flushed first.
+ */
+void checkpoint_save(const void *state, size_t size)
+{
+     if (!enabled)
+	  return;
+
+     if (fflush(stdout) != 0) {
+	  ERROR("Could not write to stdout");
+	  exit(-1);
+     }
+     
+     checkpoint_header_t hdr;
+     memset(&hdr, 0, sizeof(hdr));
+     memcpy(hdr.magic, CHECKPOINT_MAGIC, sizeof(hdr.magic));
+     hdr.version = CHECKPOINT_VERSION;
+     memcpy(hdr.stage, stage, sizeof(hdr.stage));
+     hdr.offset = start_offset + stats_input_offset();
+     hdr.seekable = input_seekable();
+     if (hdr.seekable) {
+	  uint64_t head, tail;
+	  if (fingerprints(fileno(stdin), hdr.offset, &head, &tail) < 0) {
+	       ERROR("Could not read input for checkpoint fingerprint");
+	       exit(-1);
+	  }
+	  hdr.fp_head = head;
+	  hdr.fp_tail = tail;
+     }
+     hdr.state_size = size;
+
+     // Replace the checkpoint atomically.
+     char tmppath[MAX_PATH_SIZE+8];
+     snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+     FILE *f = fopen(tmppath, "w");
+     if (f == NULL ||
+	 fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	 (size > 0 && fwrite(state, size, 1, f) != 1) ||
+	 fclose(f) != 0 ||
+	 rename(tmppath, path) < 0) {
+	  ERROR("Could not write checkpoint file");
+	  exit(-1);
+     }
+}
@@ -0,0 +1,339 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "expr.h"
+
+enum op {
+     OP_CONST, OP_FIELD,
+     OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_NEG,
+     OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE,
+     OP_AND, OP_OR, OP_NOT, OP_ABS
+};
+
+static const char *field_names[EXPR_NFIELDS] = {
+     "f_mains", "f_mains_syncd", "f_clk_syncd", "ppm", "t_wallclock", "hour", "rocof", "channel"
+};
+
+// Recursive descent parser emitting bytecode directly.
+typedef struct {
+     const char *p;
+     expr_t *e;
+     int depth;
+     char *err;
+     size_t errsize;
+     bool failed;
+} parser_t;
+
+static void fail(parser_t *ps, const char *msg)
+{
+     if (!ps->failed)
+	  snprintf(ps->err, ps->errsize, "%s at '%.20s'", msg, ps->p);
+     ps->failed = true;
+}
+
+static void emit(parser_t *ps, enum op op, int arg, int stack_change)
+{
+     if (ps->e->ncode == EXPR_MAX_CODE) {
+	  fail(ps, "Expression too long");
+	  return;
+     }
+     ps->e->code[ps->e->ncode].op = op;
+     ps->e->code[ps->e->ncode].arg = arg;
+     ps->e->ncode++;
+     
+     ps->depth += stack_change;
+     if (ps->depth > EXPR_MAX_STACK)
+	  fail(ps, "Expression too deeply nested");
+     if (ps->depth > ps->e->max_depth)
+	  ps->e->max_depth = ps->depth;
+}
+
+static void skip_space(parser_t *ps)
+{
+     while (isspace((unsigned char) *ps->p))
+	  ps->p++;
+}
+
+static bool accept(parser_t *ps, const char *tok)
+{
+     skip_space(ps);
+     size_t len = strlen(tok);
+     if (strncmp(ps->p, tok, len) != 0)
+	  return false;
+     ps->p += len;
+     return true;
+}
+
+static void parse_or(parser_t *ps);
+
+static void parse_primary(parser_t *ps)
+{
+     skip_space(ps);
+     if (accept(ps, "(")) {
+	  parse_or(ps);
+	  if (!accept(ps, ")"))
+	       fail(ps, "Expected ')'");
+	  return;
+     }
+
+     if (isdigit((unsigned char) *ps->p) || *ps->p == '.') {
+	  char *end;
+	  double v = strtod(ps->p, &end);
+	  ps->p = end;
+	  if (ps->e->nconsts == EXPR_MAX_CONSTS) {
+	       fail(ps, "Too many constants");
+	       return;
+	  }
+	  ps->e->consts[ps->e->nconsts] = v;
+	  emit(ps, OP_CONST, ps->e->nconsts++, 1);
+	  return;
+     }
+
+     if (isalpha((unsigned char) *ps->p) || *ps->p == '_') {
+	  const char *start = ps->p;
+	  while (isalnum((unsigned char) *ps->p) || *ps->p == '_')
+	       ps->p++;
+	  size_t len = ps->p - start;
+	  
+	  if (len == 3 && strncmp(start, "abs", 3) == 0) {
+	       if (!accept(ps, "(")) {
+		    fail(ps, "Expected '('");
+		    return;
+	       }
+	       parse_or(ps);
+	       if (!accept(ps, ")"))
+		    fail(ps, "Expected ')'");
+	       emit(ps, OP_ABS, 0, 0);
+	       return;
+	  }
+	  for (int i = 0; i < EXPR_NFIELDS; i++) {
+	       if (strlen(field_names[i]) == len && strncmp(start, field_names[i], len) == 0) {
+		    ps->e->fields |= (1u << i);
+		    emit(ps, OP_FIELD, i, 1);
+		    return;
+	       }
+	  }
+	  ps->p = start;
+	  fail(ps, "Unknown field");
+	  return;
+     }
+
+     fail(ps, "Syntax error");
+}
+
+static void parse_unary(parser_t *ps)
+{
+     if (accept(ps, "-")) {
+	  parse_unary(ps);
+	  emit(ps, OP_NEG, 0, 0);
+     } else if (accept(ps, "!")) {
+	  // Not to be confused with "!=", which cannot start an operand.
+	  parse_unary(ps);
+	  emit(ps, OP_NOT, 0, 0);
+     } else {
+	  parse_primary(ps);
+     }
+}
+
+static void parse_mul(parser_t *ps)
+{
+     parse_unary(ps);
+     while (!ps->failed) {
+	  if (accept(ps, "*")) {
+	       parse_unary(ps);
+	       emit(ps, OP_MUL, 0, -1);
+	  } else if (accept(ps, "/")) {
+	       parse_unary(ps);
+	       emit(ps, OP_DIV, 0, -1);
+	  } else {
+	       break;
+	  }
+     }
+}
+
+static void parse_add(parser_t *ps)
+{
+     parse_mul(ps);
+     while (!ps->failed) {
+	  if (accept(ps, "+")) {
+	       parse_mul(ps);
+	       emit(ps, OP_ADD, 0, -1);
+	  } else if (accept(ps, "-")) {
+	       parse_mul(ps);
+	       emit(ps, OP_SUB, 0, -1);
+	  } else {
+	       break;
+	  }
+     }
+}
+
+static void parse_cmp(parser_t *ps)
+{
+     parse_add(ps);
+     // Longer operators first.
+     static const struct { const char *tok; enum op op; } ops[] = {
+	  {"<=", OP_LE}, {">=", OP_GE}, {"==", OP_EQ}, {"!=", OP_NE}, {"<", OP_LT}, {">", OP_GT}
+     };
+     for (size_t i = 0; i < sizeof(ops)/sizeof(ops[0]); i++) {
+	  if (accept(ps, ops[i].tok)) {
+	       parse_add(ps);
+	       emit(ps, ops[i].op, 0, -1);
+	       return;
+	  }
+     }
+}
+
+static void parse_and(parser_t *ps)
+{
+     parse_cmp(ps);
+     while (!ps->failed && accept(ps, "&&")) {
+	  parse_cmp(ps);
+	  emit(ps, OP_AND, 0, -1);
+     }
+}
+
+static void parse_or(parser_t *ps)
+{
+     parse_and(ps);
+     while (!ps->failed && accept(ps, "||")) {
+	  parse_and(ps);
+	  emit(ps, OP_OR, 0, -1);
+     }
+}
+
+/**
+ * Compile an expression. Returns -1 and a message in err on syntax errors.
+ */
+int expr_compile(expr_t *e, const char *src, char *err, size_t errsize)
+{
+     memset(e, 0, sizeof(*e));
+     parser_t ps = {.p = src, .e = e, .depth = 0, .err = err, .errsize = errsize, .failed = false};
+     
+     parse_or(&ps);
+     skip_space(&ps);
+     if (!ps.failed && *ps.p != '\0')
+	  fail(&ps, "Unexpected input");
+     if (ps.failed)
+	  return -1;
+
+     e->stack = malloc(e->max_depth*EXPR_BATCH*sizeof(double));
+     if (e->stack == NULL) {
+	  snprintf(err, errsize, "Out of memory");
+	  return -1;
+     }
+     
+     return 0;
+}
+
+void expr_free(expr_t *e)
+{
+     free(e->stack);
+     e->stack = NULL;
+}
+
+// Each instruction is a simple loop over the batch, which the compiler vectorizes.
+#define BINARY(expr)				\
+     for (size_t i = 0; i < n; i++) {		\
+	  double a = s[-2][i];			\
+	  double b = s[-1][i];			\
+	  s[-2][i] = (expr);			\
+     }						\
+     s--;
+
+#define UNARY(expr)				\
+     for (size_t i = 0; i < n; i++) {		\
+	  double a = s[-1][i];			\
+	  s[-1][i] = (expr);			\
+     }
+
+static void eval_batch(const expr_t *e, const double *const fields[EXPR_NFIELDS], size_t n, uint8_t *result)
+{
+     double *stack[EXPR_MAX_STACK];
+     for (int k = 0; k < e->max_depth; k++)
+	  stack[k] = &e->stack[k*EXPR_BATCH];
+     // Points behind the top of the stack.
+     double **s = stack;
+     
+     for (int pc = 0; pc < e->ncode; pc++) {
+	  const expr_insn_t *insn = &e->code[pc];
+	  switch (insn->op) {
+	  case OP_CONST : {
+	       double c = e->consts[insn->arg];
+	       for (size_t i = 0; i < n; i++)
+		    (*s)[i] = c;
+	       s++;
+	       break;
+	  }
+	  case OP_FIELD :
+	       memcpy(*s, fields[insn->arg], n*sizeof(double));
+	       s++;
+	       break;
+	  case OP_ADD : BINARY(a + b); break;
+	  case OP_SUB : BINARY(a - b); break;
+	  case OP_MUL : BINARY(a * b); break;
+	  case OP_DIV : BINARY(a / b); break;
+	  case OP_LT : BINARY(a < b); break;
+	  case OP_LE : BINARY(a <= b); break;
+	  case OP_GT : BINARY(a > b); break;
+	  case OP_GE : BINARY(a >= b); break;
+	  case OP_EQ : BINARY(a == b); break;
+	  case OP_NE : BINARY(a != b); break;
+	  case OP_AND : BINARY(a != 0.0 && b != 0.0); break;
+	  case OP_OR : BINARY(a != 0.0 || b != 0.0); break;
+	  case OP_NEG : UNARY(-a); break;
+	  case OP_NOT : UNARY(a == 0.0); break;
+	  case OP_ABS : UNARY(fabs(a)); break;
+	  }
+     }
+
+     // NaN (e.g., 0/0) is false.
+     for (size_t i = 0; i < n; i++)
+	  result[i] = (stack[0][i] != 0.0 && !isnan(stack[0][i]));
+}
+
+/**
+ * Evaluate the expression for n samples. fields[i] must point to n values
+ * of field i if the field is used by the expression. result[j] is set to 1
+ * if the expression is true for sample j and 0 otherwise.
+ */
+void expr_eval(const expr_t *e, const double *const fields[EXPR_NFIELDS], size_t n, uint8_t *result)
+{
+     const double *f[EXPR_NFIELDS];
+     for (size_t start = 0; start < n; start += EXPR_BATCH) {
+	  size_t len = (n-start < EXPR_BATCH) ? n-start : EXPR_BATCH;
+	  for (int k = 0; k < EXPR_NFIELDS; k++)
+	       f[k] = (e->fields & (1u << k)) ? &fields[k][start] : NULL;
+	  eval_batch(e, f, len, &result[start]);
+     }
+}
@@ -0,0 +1,92 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Small expression language for predicates over per-sample fields, e.g.
+ *
+ *   f_mains_syncd > 49.9 && f_mains_syncd < 50.1 && abs(ppm) < 50
+ *
+ * Expressions are compiled once into stack bytecode, which is evaluated
+ * for a whole batch of samples per instruction, so the interpretation
+ * overhead is shared by all samples of a batch.
+ *
+ * Operators (by increasing precedence): ||, &&, comparisons
+ * (< <= > >= == !=), + -, * /, unary - and !. Functions: abs(x).
+ * Comparisons and logical operators evaluate to 1 or 0.
+ */
+
+// Fields provided by the caller for each sample.
+enum expr_field {
+     EXPR_F_MAINS,       // mains frequency (nominal clock) in Hz
+     EXPR_F_MAINS_SYNCD, // mains frequency (calibrated clock) in Hz
+     EXPR_F_CLK_SYNCD,   // calibrated clock frequency in Hz
+     EXPR_PPM,           // deviation of the calibrated from the nominal clock frequency in ppm (signed)
+     EXPR_T_WALLCLOCK,   // last wallclock timestamp in seconds since Unix epoch
+     EXPR_HOUR,          // hour of day of the wallclock timestamp (0-23)
+     EXPR_ROCOF,         // rate of change of frequency in Hz/s
+     EXPR_CHANNEL,       // channel of multi-channel recordings (0 for single-channel recordings)
+     EXPR_NFIELDS
+};
+
+#define EXPR_MAX_CODE 256
+#define EXPR_MAX_CONSTS 64
+#define EXPR_MAX_STACK 32
+
+// Number of samples evaluated per instruction.
+#define EXPR_BATCH 1024
+
+typedef struct {
+     uint8_t op;
+     uint8_t arg; // constant or field index
+} expr_insn_t;
+
+typedef struct {
+     expr_insn_t code[EXPR_MAX_CODE];
+     int ncode;
+     double consts[EXPR_MAX_CONSTS];
+     int nconsts;
+     int max_depth;
+     // Bit i is set if field i is used by the expression.
+     uint32_t fields;
+     // Evaluation stack (max_depth batches).
+     double *stack;
+} expr_t;
+
+int expr_compile(expr_t *e, const char *src, char *err, size_t errsize);
+
+void expr_free(expr_t *e);
+
+void expr_eval(const expr_t *e, const double *const fields[EXPR_NFIELDS], size_t n, uint8_t *result);
+
+#endif
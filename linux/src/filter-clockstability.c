@@ -0,0 +1,319 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include "tlv.h"
+#include "stats.h"
+#include "errandwarn.h"
+#include "nominal.h"
+
+// Taus are 1, 2, 4, ... seconds up to this many octaves.
+#define MAX_OCTAVES 24
+
+// Consecutive ONEPPS records further apart in wallclock time are not
+// considered consecutive seconds (missing 1-pps pulses).
+#define MAX_ONEPPS_DISTANCE_NS 2500000000ull
+
+/**
+ * Monotonic deque of phase indices for the sliding window maximum
+ * or minimum (ring buffer, capacity is a power of two).
+ */
+typedef struct {
+     int64_t *idx;
+     size_t mask;
+     size_t head;
+     size_t tail; // one behind the last element
+} deque_t;
+
+typedef struct {
+     // Tau in seconds (= number of 1-pps intervals).
+     int64_t m;
+     
+     // Overlapping Allan variance: sum of squared second differences
+     // of the phase in ticks^2 and number of terms.
+     double sum;
+     uint64_t n;
+
+     // MTIE: sliding window maximum and minimum of the phase over m+1
+     // phase values, and the largest difference seen in ticks.
+     deque_t max;
+     deque_t min;
+     int64_t mtie;
+     bool have_mtie;
+} tau_t;
+
+tau_t taus[MAX_OCTAVES];
+int ntaus = 0;
+
+// Phase (time error) in ticks of the reference clock, relative to the start
+// of the current segment of consecutive 1-pps intervals (ring buffer).
+int64_t *phase;
+size_t phase_mask;
+// Number of phase values of the current segment.
+int64_t nphase = 0;
+
+// Reference frequency (ticks per second) from the command line (0: nominal
+// clock frequency of the HEADER record).
+int64_t f_ref_arg = 0;
+int64_t f_ref = F_CLK_NOMINAL;
+
+unsigned int max_deviation_ppm = 1000;
+
+uint64_t t_wallclock = 0;
+uint64_t t_wallclock_onepps = 0;
+
+uint64_t segments = 0;
+
+void usage(const char *app)
+{
+     fprintf(stderr, "USAGE: %s \n"
+	     "Calculates overlapping Allan deviation and MTIE of the clock from ONEPPS records and prints them as CSV.\n"
+	     "-T MAX_TAU_SECONDS : largest tau (default: 86400; taus are 1, 2, 4, ... seconds)\n"
+	     "-f F_REF : reference clock frequency in Hz for the phase (default: from HEADER record, or %d)\n"
+	     "-d MAX_DEVIATION_PPM : start a new segment at 1-pps intervals deviating more than this (default: %u)\n",
+	     app, F_CLK_NOMINAL, max_deviation_ppm);
+}
+
+size_t pow2_above(size_t n)
+{
+     size_t c = 1;
+     while (c < n)
+	  c *= 2;
+     return c;
+}
+
+void *alloc_or_die(size_t size)
+{
+     void *p = malloc(size);
+     if (p == NULL) {
+	  ERROR("Out of memory");
+	  exit(-1);
+     }
+     return p;
+}
+
+void deque_init(deque_t *d, size_t capacity)
+{
+     size_t c = pow2_above(capacity);
+     d->idx = alloc_or_die(c*sizeof(int64_t));
+     d->mask = c-1;
+     d->head = d->tail = 0;
+}
+
+static inline int64_t x(int64_t i)
+{
+     return phase[i & phase_mask];
+}
+
+/**
+ * Append phase value i, keeping the deque sorted (largest first if max is set),
+ * and drop indices falling out of the window [i-m, i].
+ */
+static inline void deque_push(deque_t *d, int64_t i, int64_t m, bool max)
+{
+     int64_t xi = x(i);
+     while (d->tail != d->head) {
+	  int64_t xb = x(d->idx[(d->tail-1) & d->mask]);
+	  if ((max && xb > xi) || (!max && xb < xi))
+	       break;
+	  d->tail--;
+     }
+     d->idx[d->tail++ & d->mask] = i;
+     while (d->idx[d->head & d->mask] < i-m)
+	  d->head++;
+}
+
+static inline int64_t deque_front(const deque_t *d)
+{
+     return x(d->idx[d->head & d->mask]);
+}
+
+void start_segment()
+{
+     nphase = 0;
+     for (int k = 0; k < ntaus; k++)
+	  taus[k].max.head = taus[k].max.tail = taus[k].min.head = taus[k].min.tail = 0;
+     segments++;
+}
+
+void add_phase(int64_t xn)
+{
+     int64_t n = nphase++;
+     phase[n & phase_mask] = xn;
+     
+     for (int k = 0; k < ntaus; k++) {
+	  tau_t *tau = &taus[k];
+	  int64_t m = tau->m;
+
+	  // Terms of the overlapping Allan variance for all phase triples
+	  // x[n-2m], x[n-m], x[n] (O(1) per tau with the phase ring buffer).
+	  if (n >= 2*m) {
+	       double d = (double) (xn - 2*x(n-m) + x(n-2*m));
+	       tau->sum += d*d;
+	       tau->n++;
+	  }
+
+	  deque_push(&tau->max, n, m, true);
+	  deque_push(&tau->min, n, m, false);
+	  if (n >= m) {
+	       int64_t tie = deque_front(&tau->max) - deque_front(&tau->min);
+	       if (!tau->have_mtie || tie > tau->mtie) {
+		    tau->mtie = tie;
+		    tau->have_mtie = true;
+	       }
+	  }
+     }
+}
+
+void process_onepps(uint32_t fclock)
+{
+     int64_t dev = (int64_t) fclock - f_ref;
+     bool consecutive = (t_wallclock == 0 || t_wallclock_onepps == 0 ||
+			 t_wallclock - t_wallclock_onepps <= MAX_ONEPPS_DISTANCE_NS);
+     t_wallclock_onepps = t_wallclock;
+     
+     if ((uint64_t) llabs(dev)*1000000 > (uint64_t) max_deviation_ppm*f_ref) {
+	  // Missing or spurious 1-pps pulse: phase continuity is lost.
+	  stats_drop(1);
+	  if (nphase > 0)
+	       start_segment();
+	  return;
+     }
+     if (!consecutive && nphase > 0)
+	  start_segment();
+
+     // The phase is the cumulative sum of the clock deviation; the interval
+     // belongs between the previous and the new phase value.
+     if (nphase == 0)
+	  add_phase(0);
+     add_phase(x(nphase-1) + dev);
+}
+
+void process_header(const tlv_t *tlv)
+{
+     tlv_header_t header;
+     if (f_ref_arg != 0 || tlv_get_header(tlv, &header) < 0 || header.f_clk == f_ref)
+	  return;
+
+     // The phase is relative to the reference clock.
+     f_ref = header.f_clk;
+     if (nphase > 0)
+	  start_segment();
+}
+
+int main(int argc, char *argv[])
+{
+     stats_init(&argc, argv);
+
+     long max_tau = 86400;
+     
+     int c;
+     while ((c = getopt (argc, argv, "T:f:d:")) != -1) {
+	  switch (c) {
+	  case 'T' :
+	       max_tau = atol(optarg);
+	       break;
+	  case 'f' :
+	       f_ref_arg = atol(optarg);
+	       break;
+	  case 'd' :
+	       max_deviation_ppm = atoi(optarg);
+	       break;
+	  case '?':
+	  default :
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     if (max_tau < 1 || f_ref_arg < 0) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+     if (f_ref_arg != 0)
+	  f_ref = f_ref_arg;
+
+     for (int64_t m = 1; m <= max_tau && ntaus < MAX_OCTAVES; m *= 2) {
+	  tau_t *tau = &taus[ntaus++];
+	  tau->m = m;
+	  tau->sum = 0.0;
+	  tau->n = 0;
+	  tau->mtie = 0;
+	  tau->have_mtie = false;
+	  deque_init(&tau->max, m+2);
+	  deque_init(&tau->min, m+2);
+     }
+     
+     // Phase values needed for the largest tau: x[n-2m] ... x[n].
+     size_t capacity = pow2_above(2*taus[ntaus-1].m+1);
+     phase = alloc_or_die(capacity*sizeof(int64_t));
+     phase_mask = capacity-1;
+     
+     tlv_t tlv;
+     while (1) {
+	  if (stats_read_tlv(&tlv, stdin) < 0) {
+	       if (feof(stdin)) {
+		    break;
+	       } else {
+		    ERROR("Could not read TLV element from stdin");
+		    exit(-1);
+	       }
+	  }
+
+	  switch (tlv.type) {
+	  case TLV_TYPE_ONEPPS :
+	       process_onepps(tlv.value.fclock);
+	       break;
+	  case TLV_TYPE_WALLCLOCKTIME :
+	       t_wallclock = tlv.value.wallclocktime;
+	       break;
+	  case TLV_TYPE_HEADER :
+	       process_header(&tlv);
+	       break;
+	  }
+     }
+
+     printf("tau_s,adev,adev_terms,mtie_s\n");
+     for (int k = 0; k < ntaus; k++) {
+	  tau_t *tau = &taus[k];
+	  if (tau->n == 0 && !tau->have_mtie)
+	       break;
+	  // AVAR(tau) = sum (x[i+2m] - 2x[i+m] + x[i])^2 / (2 tau^2 (N-2m)),
+	  // phase converted from ticks to seconds with f_ref.
+	  double adev = (tau->n > 0) ?
+	       sqrt(tau->sum/(2.0*tau->m*tau->m*tau->n))/f_ref : NAN;
+	  stats_printf("%lld,%.6e,%llu,%.6e\n", (long long) tau->m, adev,
+		       (unsigned long long) tau->n, (double) tau->mtie/f_ref);
+     }
+     
+     return 0;
+}
@@ -33,23 +33,70 @@
 #include <stdlib.h>
 #include <time.h>
 #include "tlv.h"
+#include "stats.h"
+#include "checkpoint.h"
+#include "samplekernels.h"
 #include "errandwarn.h"
-
-// Samples are taken at a nominal frequency of MCLK/2 = 42 MHz.
-// (MCLK = master clock frequency of Arduino Due = 84 MHz)
-#define F_CLK_NOMINAL (84000000/2)
+#include "nominal.h"
 
 #define MAX_TIMESTR_LEN 1000
 
 // Clock frequency synchronized to 1-pps signal.
 uint32_t f_clk_syncd = F_CLK_NOMINAL;
 
+// Nominal values from the HEADER record of the stream.
+tlv_header_t header;
+
+// Deviation of the synchronized clock from the nominal clock in ppm,
+// precomputed when either changes.
+unsigned int deviation_ppm = 0;
+
 // Last wallclock timestamp (Unix epoch) seen in the stream.
 uint64_t t_wallclock = 0;
 
+// If set, add the end time of each wave from TIMESTAMPS records.
+bool wavetimes = false;
+
+// Channel to convert (-1: all channels, with column channel).
+int selected_channel = 0;
+
+// End times of the waves of the next SAMPLES record (from a TIMESTAMPS record).
+uint64_t t_wave[MAX_SAMPLE_COUNT];
+int nwavetimes = 0;
+
+// State saved in checkpoints.
+typedef struct {
+     uint32_t f_clk_syncd;
+     uint64_t t_wallclock;
+     int nwavetimes;
+     uint64_t t_wave[MAX_SAMPLE_COUNT];
+     tlv_header_t header;
+} state_t;
+
+void usage(const char *app)
+{
+     fprintf(stderr, "USAGE: %s \n"
+	     "-n : add column t_wave with the end time of each wave in ns since Unix epoch (requires filter-timestamp; 0 if unknown)\n"
+	     "-c CHANNEL : convert samples of this channel of a multi-channel recording (default: 0), or \"all\" to convert all\n"
+	     "             channels and add column channel\n",
+	     app);
+}
+
 void process_tlv_samples(const tlv_t *tlv)
 {
-     size_t nsamples = tlv->length/sizeof(uint32_t);
+     int channel = tlv_channel(tlv);
+     if (selected_channel >= 0 && channel != selected_channel) {
+	  // Timestamps belong to the record directly following them.
+	  nwavetimes = 0;
+	  return;
+     }
+     
+     uint32_t ticks[MAX_SAMPLE_COUNT];
+     int nsamples = tlv_get_samples(tlv, ticks, MAX_SAMPLE_COUNT);
+     if (nsamples < 0) {
+	  ERROR("Invalid samples record");
+	  exit(-1);
+     }
 
      struct tm *tmtime;
      char timestr[MAX_TIMESTR_LEN];
@@ -60,24 +107,50 @@ void process_tlv_samples(const tlv_t *tlv)
      }
      memset(timestr, 0, MAX_TIMESTR_LEN);
      strftime(timestr, MAX_TIMESTR_LEN, "%Y-%m-%d %H:%M:%S", tmtime);
+
+     double freq[MAX_SAMPLE_COUNT];
+     double freq_syncd[MAX_SAMPLE_COUNT];
+     kernel_frequencies(ticks, nsamples, header.f_clk, freq);
+     kernel_frequencies(ticks, nsamples, f_clk_syncd, freq_syncd);
      
-     for (unsigned int i = 0; i < nsamples; i++) {
-	  double freq = (double) F_CLK_NOMINAL / tlv->value.samples[i];
-	  double freq_syncd = (double) f_clk_syncd / tlv->value.samples[i];
-	  double deviation = (double) (f_clk_syncd) / F_CLK_NOMINAL;
-	  if (deviation > 1.0) {
-	       deviation -= 1.0;
-	  } else {
-	       deviation = 1.0 - deviation;
-	  }
-	  unsigned int deviation_ppm = (unsigned int) (1.0e6*deviation + 0.5);
-	  printf("%.4f,%.4f,%d,%d,%llu,%s\n", freq, freq_syncd, f_clk_syncd, deviation_ppm, t_wallclock, timestr);  
+     for (int i = 0; i < nsamples; i++) {
+	  // Optional columns.
+	  char wavecol[32] = "";
+	  char channelcol[16] = "";
+	  if (wavetimes)
+	       snprintf(wavecol, sizeof(wavecol), ",%llu", (nwavetimes == nsamples) ? (unsigned long long) t_wave[i] : 0ull);
+	  if (selected_channel < 0)
+	       snprintf(channelcol, sizeof(channelcol), ",%d", channel);
+	  stats_printf("%.4f,%.4f,%d,%d,%llu,%s%s%s\n", freq[i], freq_syncd[i], f_clk_syncd, deviation_ppm, t_wallclock, timestr,
+		       wavecol, channelcol);
      }
+     nwavetimes = 0;
+}
+
+void update_deviation()
+{
+     double deviation = (double) (f_clk_syncd) / header.f_clk;
+     if (deviation > 1.0) {
+	  deviation -= 1.0;
+     } else {
+	  deviation = 1.0 - deviation;
+     }
+     deviation_ppm = (unsigned int) (1.0e6*deviation + 0.5);
 }
 
 void process_tlv_onepps(const tlv_t *tlv)
 {
      f_clk_syncd = tlv->value.fclock;
+     update_deviation();
+}
+
+void process_tlv_header(const tlv_t *tlv)
+{
+     // Samples before the first 1-pps record are converted with the nominal clock.
+     if (tlv_get_header(tlv, &header) == 0) {
+	  f_clk_syncd = header.f_clk;
+	  update_deviation();
+     }
 }
 
 void process_tlv_wallclocktime(const tlv_t *tlv)
@@ -89,24 +162,72 @@ void process_tlv(const tlv_t *tlv)
 {
      switch (tlv->type) {
      case TLV_TYPE_SAMPLES :
+     case TLV_TYPE_SAMPLES_MC :
 	  process_tlv_samples(tlv);
 	  break;
      case TLV_TYPE_ONEPPS :
 	  process_tlv_onepps(tlv);
 	  break;
+     case TLV_TYPE_HEADER :
+	  process_tlv_header(tlv);
+	  break;
      case TLV_TYPE_WALLCLOCKTIME :
 	  process_tlv_wallclocktime(tlv);
 	  break;
+     case TLV_TYPE_TIMESTAMPS :
+	  if ( (nwavetimes = decode_timestamps(tlv, t_wave, MAX_SAMPLE_COUNT)) < 0)
+	       nwavetimes = 0;
+	  break;
      }
 }
 
 int main(int argc, char *argv[])
 {
-     printf("f_mains,f_mains_syncd,f_clk_syncd,clk_accuracy_ppm,t_wallclock,t_wallclock_str\n");
+     stats_init(&argc, argv);
+     checkpoint_init(&argc, argv);
+
+     int c;
+     while ((c = getopt (argc, argv, "nc:")) != -1) {
+	  switch (c) {
+	  case 'n' :
+	       wavetimes = true;
+	       break;
+	  case 'c' :
+	       if (strcmp(optarg, "all") == 0) {
+		    selected_channel = -1;
+	       } else {
+		    selected_channel = atoi(optarg);
+		    if (selected_channel < 0 || selected_channel >= TLV_MAX_CHANNELS) {
+			 usage(argv[0]);
+			 exit(-1);
+		    }
+	       }
+	       break;
+	  case '?':
+	  default :
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     
+     state_t state;
+     tlv_header_init(&header);
+     if (checkpoint_resume(&state, sizeof(state))) {
+	  // Output is appended to the output of the last run (no header).
+	  f_clk_syncd = state.f_clk_syncd;
+	  t_wallclock = state.t_wallclock;
+	  nwavetimes = state.nwavetimes;
+	  memcpy(t_wave, state.t_wave, sizeof(t_wave));
+	  header = state.header;
+     } else {
+	  printf("f_mains,f_mains_syncd,f_clk_syncd,clk_accuracy_ppm,t_wallclock,t_wallclock_str%s%s\n",
+		 wavetimes ? ",t_wave" : "", (selected_channel < 0) ? ",channel" : "");
+     }
+     update_deviation();
      
      tlv_t tlv;
      while (1) {
-	  if (read_tlv(&tlv, stdin) < 0) {
+	  if (stats_read_tlv(&tlv, stdin) < 0) {
 	       if (feof(stdin)) {
 		    break;
 	       } else if (ferror(stdin)) {
@@ -117,6 +238,13 @@ int main(int argc, char *argv[])
 
 	  process_tlv(&tlv);
      }
+
+     state.f_clk_syncd = f_clk_syncd;
+     state.t_wallclock = t_wallclock;
+     state.nwavetimes = nwavetimes;
+     memcpy(state.t_wave, t_wave, sizeof(t_wave));
+     state.header = header;
+     checkpoint_save(&state, sizeof(state));
      
      return 0;
 }
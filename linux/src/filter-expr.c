@@ -0,0 +1,311 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "tlv.h"
+#include "stats.h"
+#include "expr.h"
+#include "samplekernels.h"
+#include "errandwarn.h"
+#include "nominal.h"
+
+#define MAX_PATH_SIZE 1000
+
+#define MAX_ERRSTR_LEN 200
+
+expr_t expr;
+
+// Apply the expression to ONEPPS records instead of samples.
+bool onepps_mode = false;
+
+bool uselocaltime = false;
+
+// Stream of rejected samples or records (option -r), if any.
+FILE *frejected = NULL;
+
+// Nominal values from the HEADER record of the stream.
+tlv_header_t header;
+
+// Clock frequency synchronized to 1-pps signal.
+uint32_t f_clk_syncd = F_CLK_NOMINAL;
+
+// Last wallclock timestamp (Unix epoch) seen in the stream.
+uint64_t t_wallclock = 0;
+double hour = 0.0;
+
+// Previous wave of each channel for the rate of change of frequency
+// (ticks_prev = 0 if there is none).
+double f_prev[TLV_MAX_CHANNELS];
+double ticks_prev[TLV_MAX_CHANNELS];
+
+// Field values of the current batch.
+double fields[EXPR_NFIELDS][MAX_SAMPLE_COUNT];
+
+void usage(const char *app)
+{
+     fprintf(stderr, "USAGE: %s -e EXPRESSION [-r REJECTFILE] [-P] [-l]\n"
+	     "Passes only samples for which EXPRESSION is true.\n"
+	     "-e EXPRESSION : predicate over the fields f_mains, f_mains_syncd, f_clk_syncd, ppm, t_wallclock, hour, rocof, channel\n"
+	     "                (e.g., \"f_mains_syncd > 49.9 && f_mains_syncd < 50.1 && abs(ppm) < 50\")\n"
+	     "-r REJECTFILE : write rejected samples to REJECTFILE instead of dropping them (split stream)\n"
+	     "-P : apply the expression to ONEPPS records instead of samples\n"
+	     "-l : hour of day in local time (default: UTC)\n",
+	     app);
+}
+
+void write_tlv_or_die(const tlv_t *tlv, FILE *f)
+{
+     if (stats_write_tlv(tlv, f) < 0) {
+	  ERROR("Could not write TLV element");
+	  exit(-1);
+     }
+}
+
+/**
+ * Fill the fields used by the expression that are the same for all
+ * samples of a record.
+ */
+void fill_constant_fields(size_t n, int channel)
+{
+     double values[EXPR_NFIELDS];
+     values[EXPR_CHANNEL] = channel;
+     values[EXPR_F_CLK_SYNCD] = f_clk_syncd;
+     values[EXPR_PPM] = 1.0e6*((double) f_clk_syncd - header.f_clk)/header.f_clk;
+     values[EXPR_T_WALLCLOCK] = t_wallclock/1.0e9;
+     values[EXPR_HOUR] = hour;
+
+     int constant[] = {EXPR_F_CLK_SYNCD, EXPR_PPM, EXPR_T_WALLCLOCK, EXPR_HOUR, EXPR_CHANNEL};
+     for (size_t k = 0; k < sizeof(constant)/sizeof(constant[0]); k++) {
+	  int field = constant[k];
+	  if (expr.fields & (1u << field)) {
+	       for (size_t i = 0; i < n; i++)
+		    fields[field][i] = values[field];
+	  }
+     }
+}
+
+void process_tlv_samples(const tlv_t *tlv)
+{
+     const double fclk = f_clk_syncd;
+     uint32_t ticks[MAX_SAMPLE_COUNT];
+     uint8_t pass[MAX_SAMPLE_COUNT];
+
+     int channel = tlv_channel(tlv);
+     int nsamples = tlv_get_samples(tlv, ticks, MAX_SAMPLE_COUNT);
+     if (nsamples < 0 || channel >= TLV_MAX_CHANNELS) {
+	  ERROR("Invalid samples record");
+	  exit(-1);
+     }
+     if (nsamples == 0)
+	  return;
+     
+     if (expr.fields & (1u << EXPR_F_MAINS))
+	  kernel_frequencies(ticks, nsamples, header.f_clk, fields[EXPR_F_MAINS]);
+     if (expr.fields & ((1u << EXPR_F_MAINS_SYNCD) | (1u << EXPR_ROCOF)))
+	  kernel_frequencies(ticks, nsamples, fclk, fields[EXPR_F_MAINS_SYNCD]);
+     if (expr.fields & (1u << EXPR_ROCOF))
+	  kernel_rocof(fields[EXPR_F_MAINS_SYNCD], ticks, nsamples, fclk,
+		       f_prev[channel], ticks_prev[channel], fields[EXPR_ROCOF]);
+     f_prev[channel] = fclk/ticks[nsamples-1];
+     ticks_prev[channel] = ticks[nsamples-1];
+     fill_constant_fields(nsamples, channel);
+
+     const double *f[EXPR_NFIELDS];
+     for (int k = 0; k < EXPR_NFIELDS; k++)
+	  f[k] = fields[k];
+     expr_eval(&expr, f, nsamples, pass);
+
+     uint32_t selected[MAX_SAMPLE_COUNT];
+     tlv_t out;
+     size_t npassed = kernel_compact(ticks, pass, nsamples, 1, selected);
+     size_t nrejected = nsamples - npassed;
+     if (npassed > 0) {
+	  tlv_set_samples(&out, channel, selected, npassed);
+	  write_tlv_or_die(&out, stdout);
+     }
+     if (nrejected > 0) {
+	  if (frejected != NULL) {
+	       kernel_compact(ticks, pass, nsamples, 0, selected);
+	       tlv_set_samples(&out, channel, selected, nrejected);
+	       write_tlv_or_die(&out, frejected);
+	  } else {
+	       stats_drop(nrejected);
+	  }
+     }
+}
+
+void process_tlv_onepps(const tlv_t *tlv)
+{
+     f_clk_syncd = tlv->value.fclock;
+     if (!onepps_mode) {
+	  write_tlv_or_die(tlv, stdout);
+	  if (frejected != NULL)
+	       write_tlv_or_die(tlv, frejected);
+	  return;
+     }
+
+     // Only the constant fields are defined for ONEPPS records.
+     fill_constant_fields(1, 0);
+     const double *f[EXPR_NFIELDS];
+     for (int k = 0; k < EXPR_NFIELDS; k++)
+	  f[k] = fields[k];
+     uint8_t pass;
+     expr_eval(&expr, f, 1, &pass);
+
+     if (pass)
+	  write_tlv_or_die(tlv, stdout);
+     else if (frejected != NULL)
+	  write_tlv_or_die(tlv, frejected);
+     else
+	  stats_drop(1);
+}
+
+void process_tlv_wallclocktime(const tlv_t *tlv)
+{
+     t_wallclock = tlv->value.wallclocktime;
+     
+     time_t tsec = t_wallclock/1000000000;
+     struct tm tm;
+     if ((uselocaltime ? localtime_r(&tsec, &tm) : gmtime_r(&tsec, &tm)) != NULL)
+	  hour = tm.tm_hour;
+}
+
+void process_tlv_header(const tlv_t *tlv)
+{
+     // Samples before the first 1-pps record are calibrated with the nominal clock.
+     if (tlv_get_header(tlv, &header) == 0)
+	  f_clk_syncd = header.f_clk;
+}
+
+int main(int argc, char *argv[])
+{
+     stats_init(&argc, argv);
+
+     char *src = NULL;
+     char rejectfile[MAX_PATH_SIZE];
+     memset(rejectfile, 0, MAX_PATH_SIZE);
+     
+     int c;
+     while ((c = getopt (argc, argv, "e:r:Pl")) != -1) {
+	  switch (c) {
+	  case 'e' :
+	       src = optarg;
+	       break;
+	  case 'r' :
+	       strncpy(rejectfile, optarg, MAX_PATH_SIZE-1);
+	       break;
+	  case 'P' :
+	       onepps_mode = true;
+	       break;
+	  case 'l' :
+	       uselocaltime = true;
+	       break;
+	  case '?':
+	  default :
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     if (src == NULL) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+
+     char err[MAX_ERRSTR_LEN];
+     if (expr_compile(&expr, src, err, sizeof(err)) < 0) {
+	  fprintf(stderr, "Error: Invalid expression: %s\n", err);
+	  exit(-1);
+     }
+     if (onepps_mode && (expr.fields & ((1u << EXPR_F_MAINS) | (1u << EXPR_F_MAINS_SYNCD) | (1u << EXPR_ROCOF)))) {
+	  ERROR("Only f_clk_syncd, ppm, t_wallclock, hour, and channel (0) are defined for ONEPPS records");
+	  exit(-1);
+     }
+     
+     if (strlen(rejectfile) > 0) {
+	  if ( (frejected = fopen(rejectfile, "w")) == NULL) {
+	       ERROR("Could not open reject file");
+	       exit(-1);
+	  }
+     }
+     
+     tlv_header_init(&header);
+     
+     tlv_t tlv;
+     while (1) {
+	  if (stats_read_tlv(&tlv, stdin) < 0) {
+	       if (feof(stdin)) {
+		    break;
+	       } else {
+		    ERROR("Could not read TLV element from stdin");
+		    exit(-1);
+	       }
+	  }
+
+	  switch (tlv.type) {
+	  case TLV_TYPE_SAMPLES :
+	  case TLV_TYPE_SAMPLES_MC :
+	       if (onepps_mode) {
+		    write_tlv_or_die(&tlv, stdout);
+		    if (frejected != NULL)
+			 write_tlv_or_die(&tlv, frejected);
+	       } else {
+		    process_tlv_samples(&tlv);
+	       }
+	       continue;
+	  case TLV_TYPE_ONEPPS :
+	       process_tlv_onepps(&tlv);
+	       continue;
+	  case TLV_TYPE_WALLCLOCKTIME :
+	       process_tlv_wallclocktime(&tlv);
+	       break;
+	  case TLV_TYPE_HEADER :
+	       process_tlv_header(&tlv);
+	       break;
+	  case TLV_TYPE_GAP :
+	       if (tlv_gap_channel(&tlv) < TLV_MAX_CHANNELS)
+		    ticks_prev[tlv_gap_channel(&tlv)] = 0.0;
+	       break;
+	  }
+
+	  // Pass through any other element (to both streams).
+	  write_tlv_or_die(&tlv, stdout);
+	  if (frejected != NULL)
+	       write_tlv_or_die(&tlv, frejected);
+     }
+
+     if (frejected != NULL)
+	  fclose(frejected);
+     expr_free(&expr);
+     
+     return 0;
+}
@@ -0,0 +1,268 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "tlv.h"
+#include "stats.h"
+#include "checkpoint.h"
+#include "wavetime.h"
+#include "samplekernels.h"
+#include "errandwarn.h"
+#include "nominal.h"
+
+// Do not interpolate between waves further apart than this (gaps in the recording).
+#define MAX_GAP_NS 1000000000ull
+
+// Record of the binary output format (fixed stride of 16 bytes).
+typedef struct __attribute__((__packed__)) {
+     uint64_t t; // nanoseconds since Unix epoch
+     double f_mains_syncd;
+} gridpoint_t;
+
+// Clock frequency synchronized to 1-pps signal.
+uint32_t f_clk_syncd = F_CLK_NOMINAL;
+
+wavetime_t wt;
+
+// Distance of grid points in nanoseconds.
+uint64_t t_step;
+
+// Next grid point to be calculated.
+uint64_t t_grid;
+
+// Previous wave (center of wave and frequency), if any.
+bool have_prev = false;
+uint64_t t_prev;
+double f_prev;
+
+bool binary = false;
+
+// Channel of multi-channel recordings to resample.
+int selected_channel = 0;
+
+// Length of the last wave, used to estimate the duration of lost waves.
+uint32_t ticks_prev = F_CLK_NOMINAL/F_MAINS_NOMINAL;
+
+// State saved in checkpoints.
+typedef struct {
+     uint32_t f_clk_syncd;
+     wavetime_t wt;
+     uint64_t t_grid;
+     bool have_prev;
+     uint64_t t_prev;
+     double f_prev;
+     uint32_t ticks_prev;
+} state_t;
+
+void usage(const char *app)
+{
+     fprintf(stderr, "USAGE: %s \n"
+	     "-r RATE : rate of the output grid in Hz (e.g., 10 or 1)\n"
+	     "-b : binary output (uint64 t_wallclock, double f_mains_syncd) instead of CSV\n"
+	     "-c CHANNEL : resample this channel of a multi-channel recording (default: 0)\n",
+	     app);
+}
+
+void write_gridpoint(uint64_t t, double f)
+{
+     if (binary) {
+	  gridpoint_t p = {.t = t, .f_mains_syncd = f};
+	  if (stats_fwrite(&p, sizeof(p), 1, stdout) != 1) {
+	       ERROR("Could not write to stdout");
+	       exit(-1);
+	  }
+     } else {
+	  stats_printf("%llu,%.4f\n", (unsigned long long) t, f);
+     }
+}
+
+void process_tlv_samples(const tlv_t *tlv)
+{
+     uint32_t ticks[MAX_SAMPLE_COUNT];
+     double freq[MAX_SAMPLE_COUNT];
+     uint64_t tcenter[MAX_SAMPLE_COUNT];
+
+     if (tlv_channel(tlv) != selected_channel)
+	  return;
+     int nsamples = tlv_get_samples(tlv, ticks, MAX_SAMPLE_COUNT);
+     if (nsamples < 0) {
+	  ERROR("Invalid samples record");
+	  exit(-1);
+     }
+
+     if (!wt.anchored) {
+	  // No wallclock reference yet.
+	  return;
+     }
+     if (wt.discontinuity) {
+	  have_prev = false;
+	  wt.discontinuity = false;
+     }
+
+     // Frequencies of the batch (vectorizable).
+     kernel_frequencies(ticks, nsamples, f_clk_syncd, freq);
+
+     // Points in time of the wave centers.
+     for (int i = 0; i < nsamples; i++) {
+	  uint64_t tstart = wt.t;
+	  uint64_t tend = wavetime_advance(&wt, ticks[i]);
+	  tcenter[i] = tstart + (tend-tstart)/2;
+     }
+     if (nsamples > 0)
+	  ticks_prev = ticks[nsamples-1];
+
+     // Linear interpolation onto the grid.
+     for (int i = 0; i < nsamples; i++) {
+	  if (!have_prev || tcenter[i] - t_prev > MAX_GAP_NS) {
+	       // (Re-)start the grid at the first grid point after this wave.
+	       t_grid = (tcenter[i] + t_step - 1) / t_step * t_step;
+	  } else {
+	       double slope = (freq[i] - f_prev) / (tcenter[i] - t_prev);
+	       for (; t_grid <= tcenter[i]; t_grid += t_step)
+		    write_gridpoint(t_grid, f_prev + slope*(t_grid - t_prev));
+	  }
+	  have_prev = true;
+	  t_prev = tcenter[i];
+	  f_prev = freq[i];
+     }
+}
+
+void process_tlv(const tlv_t *tlv)
+{
+     switch (tlv->type) {
+     case TLV_TYPE_SAMPLES :
+     case TLV_TYPE_SAMPLES_MC :
+	  process_tlv_samples(tlv);
+	  break;
+     case TLV_TYPE_ONEPPS :
+	  f_clk_syncd = tlv->value.fclock;
+	  wavetime_set_clock(&wt, f_clk_syncd);
+	  break;
+     case TLV_TYPE_WALLCLOCKTIME :
+	  wavetime_wallclock(&wt, tlv->value.wallclocktime);
+	  break;
+     case TLV_TYPE_HEADER : {
+	  // Samples before the first 1-pps record are calibrated with the
+	  // nominal clock; lost waves have the nominal length until the next
+	  // samples.
+	  tlv_header_t header;
+	  if (tlv_get_header(tlv, &header) == 0) {
+	       f_clk_syncd = header.f_clk;
+	       wavetime_set_clock(&wt, f_clk_syncd);
+	       ticks_prev = (uint64_t) header.f_clk*1000/header.f_mains_mhz;
+	  }
+	  break;
+     }
+     case TLV_TYPE_GAP :
+	  // Do not interpolate across waves lost on the serial link.
+	  if (tlv_gap_channel(tlv) == selected_channel)
+	       wavetime_gap(&wt, (uint64_t) tlv->value.gap_mc.waves*ticks_prev);
+	  break;
+     }
+}
+
+int main(int argc, char *argv[])
+{
+     stats_init(&argc, argv);
+     checkpoint_init(&argc, argv);
+
+     double rate = -1.0;
+     
+     int c;
+     while ((c = getopt (argc, argv, "r:bc:")) != -1) {
+	  switch (c) {
+	  case 'r' :
+	       rate = strtod(optarg, NULL);
+	       break;
+	  case 'b' :
+	       binary = true;
+	       break;
+	  case 'c' :
+	       selected_channel = atoi(optarg);
+	       break;
+	  case '?':
+	  default :
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     if (rate <= 0.0 || selected_channel < 0 || selected_channel >= TLV_MAX_CHANNELS) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+     t_step = (uint64_t) (1.0e9/rate + 0.5);
+     if (t_step == 0) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+
+     wavetime_init(&wt, f_clk_syncd);
+
+     state_t state;
+     if (checkpoint_resume(&state, sizeof(state))) {
+	  // Output is appended to the output of the last run (no header).
+	  f_clk_syncd = state.f_clk_syncd;
+	  wt = state.wt;
+	  t_grid = state.t_grid;
+	  have_prev = state.have_prev;
+	  t_prev = state.t_prev;
+	  f_prev = state.f_prev;
+	  ticks_prev = state.ticks_prev;
+     } else if (!binary) {
+	  printf("t_wallclock,f_mains_syncd\n");
+     }
+     
+     tlv_t tlv;
+     while (1) {
+	  if (stats_read_tlv(&tlv, stdin) < 0) {
+	       if (feof(stdin)) {
+		    break;
+	       } else {
+		    ERROR("Could not read TLV element from stdin");
+		    exit(-1);
+	       }
+	  }
+
+	  process_tlv(&tlv);
+     }
+
+     state.f_clk_syncd = f_clk_syncd;
+     state.wt = wt;
+     state.t_grid = t_grid;
+     state.have_prev = have_prev;
+     state.t_prev = t_prev;
+     state.f_prev = f_prev;
+     state.ticks_prev = ticks_prev;
+     checkpoint_save(&state, sizeof(state));
+     
+     return 0;
+}
@@ -33,15 +33,24 @@
 #include <stdlib.h>
 #include <time.h>
 #include "tlv.h"
+#include "stats.h"
+#include "checkpoint.h"
+#include "tlvpass.h"
+#include "nominal.h"
+#include "samplekernels.h"
 
 #define WARNING(m) (fprintf(stderr, "Warning: " m "\n"))
 #define ERROR(m) (fprintf(stderr, "Error: " m "\n"))
 
-// Samples are taken at a nominal frequency of MCLK/2 = 42 MHz.
-// (MCLK = master clock frequency of Arduino Due = 84 MHz)
-#define F_CLK_NOMINAL (84000000/2)
-
-uint32_t f_clk_corrected = F_CLK_NOMINAL;
+// Check of 1-pps measurements specialized for the nominal clock frequency
+// of the stream: range of valid measurements.
+typedef struct {
+     unsigned int max_deviation_ppm;
+     // Nominal values from the HEADER record of the stream (saved in checkpoints).
+     tlv_header_t header;
+     uint32_t fclock_min;
+     uint32_t fclock_max;
+} check_t;
 
 void usage(const char *app)
 {
@@ -50,33 +59,53 @@ void usage(const char *app)
 	     "\n", app);
 }
 
-void sanity_check_onepps(tlv_t *tlv, unsigned int max_deviation_ppm)
+/**
+ * Precompute the range of valid 1-pps measurements for the nominal clock
+ * frequency of the stream.
+ */
+void setup_check(check_t *check)
+{
+     kernel_onepps_bounds(check->header.f_clk, check->max_deviation_ppm,
+			  &check->fclock_min, &check->fclock_max);
+}
+
+/**
+ * Records are forwarded unchanged except for 1-pps measurements failing
+ * the sanity check, which are dropped.
+ */
+int sanity_check(uint16_t type, uint16_t length, const uint8_t *value, void *ctx)
 {
-     double deviation = (double) (tlv->value.fclock) / F_CLK_NOMINAL;
-     if (deviation > 1.0) {
-	  deviation -= 1.0;
-     } else {
-	  deviation = 1.0 - deviation;
+     check_t *check = (check_t *) ctx;
+     if (type == TLV_TYPE_HEADER) {
+	  tlv_t tlv;
+	  tlv.type = type;
+	  tlv.length = (length < sizeof(tlv.value)) ? length : sizeof(tlv.value);
+	  memcpy(&tlv.value, value, tlv.length);
+	  if (tlv_get_header(&tlv, &check->header) == 0)
+	       setup_check(check);
+	  return TLVPASS_FORWARD;
      }
-     unsigned int deviation_ppm = (unsigned int) (1.0e6*deviation + 0.5);
+     if (type != TLV_TYPE_ONEPPS)
+	  return TLVPASS_FORWARD;
 
-     if (deviation_ppm > max_deviation_ppm) {
+     uint32_t fclock = 0;
+     memcpy(&fclock, value, (length < sizeof(fclock)) ? length : sizeof(fclock));
+     if (fclock < check->fclock_min || fclock > check->fclock_max) {
 	  // Drop this 1-pps measurement.
 	  WARNING("1-pps measurement exceeds maximum deviation from nominal frequency (dropped 1-pps measurement)");
-	  return;
+	  stats_drop(1);
+	  return TLVPASS_DROP;
      }
 
      // 1-pps measurement passed sanity check. Pass it through.
-
-     if (write_tlv(tlv, stdout) < 0) {
-	  ERROR("Error while writing to stdout");
-	  exit(-1);
-     }	                
+     return TLVPASS_FORWARD;
 }
 
 int main(int argc, char *argv[])
 {
-     double fnominal = -1.0; // nominal frequency
+     stats_init(&argc, argv);
+     checkpoint_init(&argc, argv);
+
      int max_deviation_ppm = -1; // maximum allowed relative deviation in ppm  
      
      int c;
@@ -96,29 +125,18 @@ int main(int argc, char *argv[])
 	  exit(-1);
      }
      
-     tlv_t tlv;
-     while (1) {
-	  if (read_tlv(&tlv, stdin) < 0) {
-	       if (feof(stdin)) {
-		    break;
-	       } else if (ferror(stdin)) {
-		    ERROR("Could not read TLV element from stdin");
-		    exit(-1);
-	       }
-	  }
-
-	  switch (tlv.type) {
-	  case TLV_TYPE_ONEPPS :
-	       sanity_check_onepps(&tlv, max_deviation_ppm);
-	       break;
-	  default :
-	       // Pass-through any other element.
-	       if (write_tlv(&tlv, stdout) < 0) {
-		    ERROR("Error while writing to stdout");
-		    exit(-1);
-	       }
-	  }
+     check_t check;
+     check.max_deviation_ppm = max_deviation_ppm;
+     if (!checkpoint_resume(&check.header, sizeof(check.header)))
+	  tlv_header_init(&check.header);
+     setup_check(&check);
+     
+     if (tlvpass_run(sanity_check, &check) < 0) {
+	  ERROR("Could not pass TLV elements from stdin to stdout");
+	  exit(-1);
      }
+
+     checkpoint_save(&check.header, sizeof(check.header));
      
      return 0;
 }
@@ -33,45 +33,82 @@
 #include <stdlib.h>
 #include <time.h>
 #include "tlv.h"
+#include "stats.h"
+#include "checkpoint.h"
+#include "samplekernels.h"
+#include "nominal.h"
 
 #define WARNING(m) (fprintf(stderr, "Warning: " m "\n"))
 #define ERROR(m) (fprintf(stderr, "Error: " m "\n"))
 
-// Samples are taken at a nominal frequency of MCLK/2 = 42 MHz.
-// (MCLK = master clock frequency of Arduino Due = 84 MHz)
-#define F_CLK (84000000/2)
+// State saved in checkpoints.
+typedef struct {
+     // Clock frequency synchronized to 1-pps signal.
+     uint32_t fclk;
+     // Nominal values from the HEADER record of the stream.
+     tlv_header_t header;
+} state_t;
 
-uint32_t fclk = F_CLK;
+state_t state;
+
+// Nominal mains frequency from the command line (< 0: from the HEADER record).
+double fnominal_arg = -1.0;
+// Maximum allowed deviation from nominal mains frequency in Hertz.
+double maxdev = -1.0;
+
+// Kernel specialized for the current clock frequency: valid wave lengths in ticks.
+uint32_t tmin;
+uint32_t tmax;
 
 void usage(const char *app)
 {
      fprintf(stderr, "USAGE: %s "
-	     "-f NOMINAL_FREQUENCY "
+	     "[-f NOMINAL_FREQUENCY] "
 	     "-d MAX_DEVIATION "
-	     "\n", app);
+	     "\n"
+	     "-f : nominal mains frequency in Hz (default: from HEADER record, or %d)\n", app, F_MAINS_NOMINAL);
 }
 
-void sanity_check(tlv_t *tlv, double fnominal, double maxdev, uint32_t fclk)
+/**
+ * Precompute the tick bounds after the clock frequency or the nominal
+ * mains frequency changed.
+ */
+void setup_kernel()
 {
-     size_t nsamples = tlv->length/sizeof(uint32_t);
-     size_t ncorrect = 0;
+     double fnominal = (fnominal_arg >= 0.0) ? fnominal_arg : state.header.f_mains_mhz/1000.0;
+     kernel_tick_bounds(state.fclk, fnominal-maxdev, fnominal+maxdev, &tmin, &tmax);
+}
+
+void sanity_check(tlv_t *tlv, uint32_t fclk)
+{
+     int channel = tlv_channel(tlv);
+     uint32_t ticks[MAX_SAMPLE_COUNT];
+     uint8_t ok[MAX_SAMPLE_COUNT];
+     uint32_t checked[MAX_SAMPLE_COUNT];
      tlv_t tlv_checked;
 
-     tlv_checked.type = TLV_TYPE_SAMPLES;
-     
-     for (int i = 0; i < nsamples; i++) {
-	  double f = (double) fclk / tlv->value.samples[i];
-	  if (f > fnominal+maxdev || f < fnominal-maxdev) {
-	       fprintf(stderr, "Dropped sample exceeding maximum deviation with f_mains = %f Hz (f_clock = %u)\n", f, fclk);
-	  } else {
-	       // Copy correct sample.
-	       tlv_checked.value.samples[ncorrect++] = tlv->value.samples[i];
+     int nsamples = tlv_get_samples(tlv, ticks, MAX_SAMPLE_COUNT);
+     if (nsamples < 0) {
+	  ERROR("Invalid samples record");
+	  exit(-1);
+     }
+
+     // Check the whole batch at once (vectorizable), then report the
+     // (rare) dropped samples.
+     kernel_ticks_inrange(ticks, nsamples, tmin, tmax, ok);
+     size_t ncorrect = kernel_compact(ticks, ok, nsamples, 1, checked);
+     if (ncorrect < (size_t) nsamples) {
+	  for (int i = 0; i < nsamples; i++) {
+	       if (!ok[i])
+		    fprintf(stderr, "Dropped sample exceeding maximum deviation with f_mains = %f Hz (f_clock = %u, channel %d)\n",
+			    (double) fclk/ticks[i], fclk, channel);
 	  }
+	  stats_drop(nsamples-ncorrect);
      }
 
-     tlv_checked.length = ncorrect*sizeof(uint32_t);
+     tlv_set_samples(&tlv_checked, channel, checked, ncorrect);
      
-     if (write_tlv(&tlv_checked, stdout) < 0) {
+     if (stats_write_tlv(&tlv_checked, stdout) < 0) {
 	  ERROR("Error while writing to stdout");
 	  exit(-1);
      }	            
@@ -79,14 +116,14 @@ void sanity_check(tlv_t *tlv, double fnominal, double maxdev, uint32_t fclk)
 
 int main(int argc, char *argv[])
 {
-     double fnominal = -1.0; // nominal mains frequency
-     double maxdev = -1.0; // maximum allowed deviation from nominal mains frequency in Hertz
-     
+     stats_init(&argc, argv);
+     checkpoint_init(&argc, argv);
+
      int c;
      while ((c = getopt (argc, argv, "f:d:")) != -1) {
 	  switch (c) {
 	  case 'f' :
-	       fnominal = strtod(optarg, NULL);
+	       fnominal_arg = strtod(optarg, NULL);
 	       break;
 	  case 'd' :
 	       maxdev = strtod(optarg, NULL);
@@ -97,14 +134,20 @@ int main(int argc, char *argv[])
 	       exit(-1);
 	  }
      }
-     if (fnominal < 0.0 || maxdev <= 0) {
+     if (maxdev <= 0) {
 	  usage(argv[0]);
 	  exit(-1);
      }
 
+     if (!checkpoint_resume(&state, sizeof(state))) {
+	  state.fclk = F_CLK_NOMINAL;
+	  tlv_header_init(&state.header);
+     }
+     setup_kernel();
+     
      tlv_t tlv;
      while (1) {
-	  if (read_tlv(&tlv, stdin) < 0) {
+	  if (stats_read_tlv(&tlv, stdin) < 0) {
 	       if (feof(stdin)) {
 		    break;
 	       } else if (ferror(stdin)) {
@@ -115,23 +158,38 @@ int main(int argc, char *argv[])
 
 	  switch (tlv.type) {
 	  case TLV_TYPE_SAMPLES :
-	       sanity_check(&tlv, fnominal, maxdev, fclk);
+	  case TLV_TYPE_SAMPLES_MC :
+	       sanity_check(&tlv, state.fclk);
+	       break;
+	  case TLV_TYPE_HEADER :
+	       // Samples before the first 1-pps record are checked with the nominal clock.
+	       if (tlv_get_header(&tlv, &state.header) == 0) {
+		    state.fclk = state.header.f_clk;
+		    setup_kernel();
+	       }
+	       if (stats_write_tlv(&tlv, stdout) < 0) {
+		    ERROR("Error while writing to stdout");
+		    exit(-1);
+	       }
 	       break;
 	  case TLV_TYPE_ONEPPS :
-	       fclk = tlv.value.fclock;
-	       if (write_tlv(&tlv, stdout) < 0) {
+	       state.fclk = tlv.value.fclock;
+	       setup_kernel();
+	       if (stats_write_tlv(&tlv, stdout) < 0) {
 		    ERROR("Error while writing to stdout");
 		    exit(-1);
 	       }
 	       break;
 	  default :
 	       // Pass-through any other element.
-	       if (write_tlv(&tlv, stdout) < 0) {
+	       if (stats_write_tlv(&tlv, stdout) < 0) {
 		    ERROR("Error while writing to stdout");
 		    exit(-1);
 	       }
 	  }
      }
+
+     checkpoint_save(&state, sizeof(state));
      
      return 0;
 }
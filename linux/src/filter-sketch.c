@@ -0,0 +1,215 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "tlv.h"
+#include "stats.h"
+#include "checkpoint.h"
+#include "sketch.h"
+#include "samplekernels.h"
+#include "errandwarn.h"
+#include "nominal.h"
+
+// Clock frequency synchronized to 1-pps signal.
+uint32_t f_clk_syncd = F_CLK_NOMINAL;
+
+// Last wallclock timestamp (Unix epoch) seen in the stream.
+uint64_t t_wallclock = 0;
+
+// Channel of multi-channel recordings to sketch.
+int selected_channel = 0;
+
+uint64_t bucket_length;
+bool have_bucket = false;
+sketch_bucket_t bucket;
+
+// State saved in checkpoints. The current bucket is written at the end of
+// each run; sketch-query merges it with the rest of the bucket written
+// by the next run.
+typedef struct {
+     uint32_t f_clk_syncd;
+     uint64_t t_wallclock;
+} state_t;
+
+void usage(const char *app)
+{
+     fprintf(stderr, "USAGE: %s [-b BUCKET_SECONDS] [-c CHANNEL]\n"
+	     "Writes a sketch file with t-digests of f_mains_syncd and f_clk_syncd per time bucket\n"
+	     "(default: 3600 seconds; 0 for a single bucket) to stdout.\n"
+	     "-c CHANNEL : sketch this channel of a multi-channel recording (default: 0)\n",
+	     app);
+}
+
+void flush_bucket()
+{
+     if (!have_bucket)
+	  return;
+     if (sketch_write_bucket(stdout, &bucket) < 0) {
+	  ERROR("Could not write to stdout");
+	  exit(-1);
+     }
+     have_bucket = false;
+}
+
+/**
+ * Make the bucket of the current wallclock time the current bucket.
+ * Returns false if there is no wallclock time yet.
+ */
+bool select_bucket()
+{
+     if (t_wallclock == 0)
+	  return false;
+     
+     uint64_t tstart = (bucket_length > 0) ? t_wallclock/bucket_length*bucket_length : 0;
+     if (have_bucket && bucket.tstart == tstart)
+	  return true;
+
+     flush_bucket();
+     bucket.tstart = tstart;
+     tdigest_init(&bucket.f_mains_syncd);
+     tdigest_init(&bucket.f_clk_syncd);
+     have_bucket = true;
+
+     return true;
+}
+
+void process_tlv_samples(const tlv_t *tlv)
+{
+     uint32_t ticks[MAX_SAMPLE_COUNT];
+     double f[MAX_SAMPLE_COUNT];
+
+     if (tlv_channel(tlv) != selected_channel)
+	  return;
+     int nsamples = tlv_get_samples(tlv, ticks, MAX_SAMPLE_COUNT);
+     if (nsamples < 0) {
+	  ERROR("Invalid samples record");
+	  exit(-1);
+     }
+
+     if (!select_bucket()) {
+	  stats_drop(nsamples);
+	  return;
+     }
+
+     kernel_frequencies(ticks, nsamples, f_clk_syncd, f);
+     for (int i = 0; i < nsamples; i++)
+	  tdigest_add(&bucket.f_mains_syncd, f[i], 1.0);
+}
+
+void process_tlv_onepps(const tlv_t *tlv)
+{
+     f_clk_syncd = tlv->value.fclock;
+     if (select_bucket())
+	  tdigest_add(&bucket.f_clk_syncd, f_clk_syncd, 1.0);
+}
+
+void process_tlv_header(const tlv_t *tlv)
+{
+     // Samples before the first 1-pps record are calibrated with the nominal clock.
+     tlv_header_t header;
+     if (tlv_get_header(tlv, &header) == 0)
+	  f_clk_syncd = header.f_clk;
+}
+
+int main(int argc, char *argv[])
+{
+     stats_init(&argc, argv);
+     checkpoint_init(&argc, argv);
+
+     long bucket_seconds = 3600;
+     
+     int c;
+     while ((c = getopt (argc, argv, "b:c:")) != -1) {
+	  switch (c) {
+	  case 'b' :
+	       bucket_seconds = atol(optarg);
+	       break;
+	  case 'c' :
+	       selected_channel = atoi(optarg);
+	       break;
+	  case '?':
+	  default :
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     if (bucket_seconds < 0 || selected_channel < 0 || selected_channel >= TLV_MAX_CHANNELS) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+     bucket_length = 1000000000ull*bucket_seconds;
+
+     state_t state;
+     if (checkpoint_resume(&state, sizeof(state))) {
+	  // Output is appended to the sketch file of the last run (no header).
+	  f_clk_syncd = state.f_clk_syncd;
+	  t_wallclock = state.t_wallclock;
+     } else if (sketch_write_header(stdout, bucket_length) < 0) {
+	  ERROR("Could not write to stdout");
+	  exit(-1);
+     }
+     
+     tlv_t tlv;
+     while (1) {
+	  if (stats_read_tlv(&tlv, stdin) < 0) {
+	       if (feof(stdin)) {
+		    break;
+	       } else {
+		    ERROR("Could not read TLV element from stdin");
+		    exit(-1);
+	       }
+	  }
+
+	  switch (tlv.type) {
+	  case TLV_TYPE_SAMPLES :
+	  case TLV_TYPE_SAMPLES_MC :
+	       process_tlv_samples(&tlv);
+	       break;
+	  case TLV_TYPE_ONEPPS :
+	       process_tlv_onepps(&tlv);
+	       break;
+	  case TLV_TYPE_WALLCLOCKTIME :
+	       t_wallclock = tlv.value.wallclocktime;
+	       break;
+	  case TLV_TYPE_HEADER :
+	       process_tlv_header(&tlv);
+	       break;
+	  }
+     }
+     flush_bucket();
+
+     state.f_clk_syncd = f_clk_syncd;
+     state.t_wallclock = t_wallclock;
+     checkpoint_save(&state, sizeof(state));
+     
+     return 0;
+}
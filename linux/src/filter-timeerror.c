@@ -0,0 +1,318 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include "tlv.h"
+#include "stats.h"
+#include "checkpoint.h"
+#include "errandwarn.h"
+#include "nominal.h"
+
+// A segment ends if there is no valid 1-pps pulse for this many seconds
+// of waves (in units of 1/10 s).
+#define MAX_ONEPPS_DISTANCE_DECISECONDS 25
+
+/**
+ * The time error of a segment is the nominal duration of its waves
+ * (waves/f_nominal) minus their actual duration (ticks/f_clk_syncd).
+ * Both are kept as exact integers in ns plus a remainder; ticks are
+ * converted to ns only when the clock frequency changes or a value is
+ * written, so no rounding error accumulates over long segments.
+ */
+typedef struct {
+     bool active;
+     uint64_t segment;
+     // Calibrated clock frequency (ticks per second) of the following waves.
+     uint32_t fclk;
+     // Waves of the segment.
+     uint64_t waves;
+     // Duration of the waves of the segment: elapsed_ns + rem/fclk ns
+     // plus the ticks not converted yet.
+     uint64_t elapsed_ns;
+     uint64_t rem;
+     uint64_t ticks;
+     // Ticks since the last valid 1-pps pulse.
+     uint64_t ticks_onepps;
+     // Wallclock time of the start of the segment (ns since Unix epoch).
+     uint64_t t_anchor;
+     // Next output (ns since Unix epoch) and the number of ticks to reach it.
+     uint64_t t_next;
+     uint64_t ticks_next;
+     // Last wallclock timestamp seen in the stream.
+     uint64_t t_wallclock;
+     // Nominal values from the HEADER record of the stream.
+     tlv_header_t header;
+} state_t;
+
+state_t st;
+
+// Nominal grid frequency from the command line in mHz (0: from the HEADER record).
+uint64_t f_nominal_arg_mhz = 0;
+
+// Nominal grid frequency in mHz.
+uint64_t f_nominal_mhz;
+
+// Output interval in ns.
+uint64_t interval_ns = 1000000000ull;
+
+unsigned int max_deviation_ppm = 1000;
+
+// Channel of multi-channel recordings to integrate.
+int selected_channel = 0;
+
+void usage(const char *app)
+{
+     fprintf(stderr, "USAGE: %s [OPTIONS]\n"
+	     "Integrates the grid time error (nominal minus actual duration of the waves, calibrated by ONEPPS records)\n"
+	     "and prints it in ms at regular intervals as CSV. The integration restarts (new segment) after missing\n"
+	     "1-pps pulses or lost waves.\n"
+	     "-f NOMINAL_FREQUENCY : nominal grid frequency in Hz (default: from HEADER record, or %d)\n"
+	     "-i INTERVAL_SECONDS : output interval (default: 1)\n"
+	     "-d MAX_DEVIATION_PPM : ignore ONEPPS records deviating more from the nominal clock frequency (default: %u)\n"
+	     "-c CHANNEL : channel of a multi-channel recording (default: 0)\n",
+	     app, F_MAINS_NOMINAL, max_deviation_ppm);
+}
+
+/**
+ * Convert the pending ticks into ns (exact, with remainder).
+ */
+static void flush_ticks()
+{
+     // ticks < 2^64/10^9 since the segment ends without 1-pps pulses for some seconds.
+     uint64_t num = st.ticks*1000000000ull + st.rem;
+     st.elapsed_ns += num / st.fclk;
+     st.rem = num % st.fclk;
+     st.ticks = 0;
+}
+
+/**
+ * Nominal duration of the waves of the segment in ns (integer part and fraction).
+ */
+static uint64_t nominal_ns(double *frac)
+{
+     uint64_t q = st.waves / f_nominal_mhz;
+     uint64_t r = st.waves % f_nominal_mhz;
+     uint64_t num = r*1000000000000ull;
+     *frac = (double) (num % f_nominal_mhz) / f_nominal_mhz;
+     return q*1000000000000ull + num/f_nominal_mhz;
+}
+
+/**
+ * Number of ticks (after the converted ones) until the next output is due.
+ */
+static void schedule_next()
+{
+     double dt_ns = (double) (st.t_next - st.t_anchor) - (double) st.elapsed_ns - (double) st.rem/st.fclk;
+     st.ticks_next = (dt_ns > 0.0) ? (uint64_t) ceil(dt_ns*1.0e-9*st.fclk) : 0;
+}
+
+static void write_time_error()
+{
+     flush_ticks();
+     double frac;
+     uint64_t nominal = nominal_ns(&frac);
+     double te_ns = ((double) ((int64_t) (nominal - st.elapsed_ns))) + frac - (double) st.rem/st.fclk;
+     stats_printf("%llu,%.6f,%llu\n", (unsigned long long) (st.t_anchor + st.elapsed_ns),
+		  te_ns/1.0e6, (unsigned long long) st.segment);
+
+     // Next multiple of the interval.
+     uint64_t t = st.t_anchor + st.elapsed_ns;
+     st.t_next = (t/interval_ns + 1)*interval_ns;
+     schedule_next();
+}
+
+static void start_segment(uint32_t fclk)
+{
+     st.active = true;
+     st.segment++;
+     st.fclk = fclk;
+     st.waves = 0;
+     st.elapsed_ns = 0;
+     st.rem = 0;
+     st.ticks = 0;
+     st.ticks_onepps = 0;
+     st.t_anchor = st.t_wallclock;
+     write_time_error();
+}
+
+static void end_segment()
+{
+     st.active = false;
+}
+
+void process_onepps(uint32_t fclock)
+{
+     int64_t dev = (int64_t) fclock - st.header.f_clk;
+     if ((uint64_t) llabs(dev)*1000000 > (uint64_t) max_deviation_ppm*st.header.f_clk) {
+	  // Spurious 1-pps pulse; keep the last calibration.
+	  stats_drop(1);
+	  return;
+     }
+
+     if (!st.active) {
+	  if (st.t_wallclock != 0)
+	       start_segment(fclock);
+	  return;
+     }
+
+     // The following waves are calibrated with the new frequency.
+     flush_ticks();
+     st.rem = (st.rem*fclock + st.fclk/2) / st.fclk;
+     if (st.rem >= fclock)
+	  st.rem = fclock-1;
+     st.fclk = fclock;
+     st.ticks_onepps = 0;
+     schedule_next();
+}
+
+void process_header(const tlv_t *tlv)
+{
+     if (tlv_get_header(tlv, &st.header) < 0 || f_nominal_arg_mhz != 0)
+	  return;
+
+     if (st.header.f_mains_mhz != f_nominal_mhz) {
+	  // The nominal duration of the waves so far is not known anymore.
+	  end_segment();
+	  f_nominal_mhz = st.header.f_mains_mhz;
+     }
+}
+
+void process_samples(const tlv_t *tlv)
+{
+     uint32_t ticks[MAX_SAMPLE_COUNT];
+     
+     if (!st.active || tlv_channel(tlv) != selected_channel)
+	  return;
+     int n = tlv_get_samples(tlv, ticks, MAX_SAMPLE_COUNT);
+     if (n < 0) {
+	  ERROR("Invalid samples record");
+	  exit(-1);
+     }
+
+     const uint64_t max_ticks_onepps = (uint64_t) st.fclk*MAX_ONEPPS_DISTANCE_DECISECONDS/10;
+     for (int i = 0; i < n; i++) {
+	  st.ticks += ticks[i];
+	  st.ticks_onepps += ticks[i];
+	  st.waves++;
+	  if (st.ticks_onepps > max_ticks_onepps) {
+	       // 1-pps pulses are missing; the clock is not calibrated anymore.
+	       end_segment();
+	       stats_drop(n-i);
+	       return;
+	  }
+	  if (st.ticks >= st.ticks_next)
+	       write_time_error();
+     }
+}
+
+int main(int argc, char *argv[])
+{
+     stats_init(&argc, argv);
+     checkpoint_init(&argc, argv);
+
+     double f_nominal = -1.0;
+     double interval = 1.0;
+     
+     int c;
+     while ((c = getopt (argc, argv, "f:i:d:c:")) != -1) {
+	  switch (c) {
+	  case 'f' :
+	       f_nominal = strtod(optarg, NULL);
+	       break;
+	  case 'i' :
+	       interval = strtod(optarg, NULL);
+	       break;
+	  case 'd' :
+	       max_deviation_ppm = atoi(optarg);
+	       break;
+	  case 'c' :
+	       selected_channel = atoi(optarg);
+	       break;
+	  case '?':
+	  default :
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     if (f_nominal >= 0.0)
+	  f_nominal_arg_mhz = (uint64_t) (f_nominal*1000.0 + 0.5);
+     interval_ns = (uint64_t) (interval*1.0e9 + 0.5);
+     if ((f_nominal >= 0.0 && f_nominal_arg_mhz == 0) || interval_ns == 0 || selected_channel < 0 || selected_channel >= TLV_MAX_CHANNELS) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+
+     memset(&st, 0, sizeof(st));
+     if (!checkpoint_resume(&st, sizeof(st))) {
+	  tlv_header_init(&st.header);
+	  printf("t_wallclock,time_error_ms,segment\n");
+     }
+     f_nominal_mhz = (f_nominal_arg_mhz != 0) ? f_nominal_arg_mhz : st.header.f_mains_mhz;
+     
+     tlv_t tlv;
+     while (1) {
+	  if (stats_read_tlv(&tlv, stdin) < 0) {
+	       if (feof(stdin)) {
+		    break;
+	       } else {
+		    ERROR("Could not read TLV element from stdin");
+		    exit(-1);
+	       }
+	  }
+
+	  switch (tlv.type) {
+	  case TLV_TYPE_SAMPLES :
+	  case TLV_TYPE_SAMPLES_MC :
+	       process_samples(&tlv);
+	       break;
+	  case TLV_TYPE_ONEPPS :
+	       process_onepps(tlv.value.fclock);
+	       break;
+	  case TLV_TYPE_WALLCLOCKTIME :
+	       st.t_wallclock = tlv.value.wallclocktime;
+	       break;
+	  case TLV_TYPE_HEADER :
+	       process_header(&tlv);
+	       break;
+	  case TLV_TYPE_GAP :
+	       // The duration of lost waves is unknown.
+	       if (tlv_gap_channel(&tlv) == selected_channel)
+		    end_segment();
+	       break;
+	  }
+     }
+
+     checkpoint_save(&st, sizeof(st));
+     
+     return 0;
+}
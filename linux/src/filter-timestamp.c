@@ -0,0 +1,202 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "tlv.h"
+#include "stats.h"
+#include "checkpoint.h"
+#include "wavetime.h"
+#include "errandwarn.h"
+#include "nominal.h"
+
+// Time of the waves of each channel.
+wavetime_t wt[TLV_MAX_CHANNELS];
+
+// If set, re-anchor at wallclock timestamps deviating too much, but do not slew.
+bool noslew = false;
+
+// Length of the last wave of each channel, used to estimate the duration of lost waves.
+uint32_t ticks_prev[TLV_MAX_CHANNELS];
+
+// State saved in checkpoints.
+typedef struct {
+     wavetime_t wt[TLV_MAX_CHANNELS];
+     uint32_t ticks_prev[TLV_MAX_CHANNELS];
+} state_t;
+
+void usage(const char *app)
+{
+     fprintf(stderr, "USAGE: %s \n"
+	     "Inserts a TIMESTAMPS record with the end times of all waves (ns since Unix epoch) before each SAMPLES record\n"
+	     "(and each SAMPLES_MC record; channels are timed independently).\n"
+	     "-n : do not slew towards wallclock timestamps (only re-anchor at offsets > 1 s)\n",
+	     app);
+}
+
+void write_tlv_stdout(const tlv_t *tlv)
+{
+     if (stats_write_tlv(tlv, stdout) < 0) {
+	  ERROR("Could not write to stdout");
+	  exit(-1);
+     }
+}
+
+void process_tlv_samples(const tlv_t *tlv)
+{
+     uint32_t ticks[MAX_SAMPLE_COUNT];
+     uint32_t periods[MAX_SAMPLE_COUNT];
+
+     int channel = tlv_channel(tlv);
+     int nsamples = tlv_get_samples(tlv, ticks, MAX_SAMPLE_COUNT);
+     if (nsamples < 0 || channel >= TLV_MAX_CHANNELS) {
+	  ERROR("Invalid samples record");
+	  exit(-1);
+     }
+     
+     wavetime_t *w = &wt[channel];
+     if (!w->anchored || nsamples == 0) {
+	  // No wallclock reference yet.
+	  return;
+     }
+     
+     uint64_t tstart = w->t;
+     uint64_t t = tstart;
+     for (int i = 0; i < nsamples; i++) {
+	  uint64_t tend = wavetime_advance(w, ticks[i]);
+	  periods[i] = tend - t;
+	  t = tend;
+     }
+     ticks_prev[channel] = ticks[nsamples-1];
+     
+     tlv_t ts;
+     if (encode_timestamps(&ts, tstart, periods, nsamples) < 0) {
+	  ERROR("Could not encode timestamps");
+	  exit(-1);
+     }
+     write_tlv_stdout(&ts);
+}
+
+void process_tlv(const tlv_t *tlv)
+{
+     switch (tlv->type) {
+     case TLV_TYPE_SAMPLES :
+     case TLV_TYPE_SAMPLES_MC :
+	  process_tlv_samples(tlv);
+	  break;
+     case TLV_TYPE_ONEPPS :
+	  for (int c = 0; c < TLV_MAX_CHANNELS; c++)
+	       wavetime_set_clock(&wt[c], tlv->value.fclock);
+	  break;
+     case TLV_TYPE_WALLCLOCKTIME :
+	  for (int c = 0; c < TLV_MAX_CHANNELS; c++) {
+	       if (noslew)
+		    wavetime_wallclock(&wt[c], tlv->value.wallclocktime);
+	       else
+		    wavetime_slew(&wt[c], tlv->value.wallclocktime);
+	  }
+	  break;
+     case TLV_TYPE_HEADER : {
+	  // Waves before the first 1-pps record are timed with the nominal
+	  // clock; lost waves have the nominal length until the next samples.
+	  tlv_header_t header;
+	  if (tlv_get_header(tlv, &header) == 0) {
+	       for (int c = 0; c < TLV_MAX_CHANNELS; c++) {
+		    wavetime_set_clock(&wt[c], header.f_clk);
+		    ticks_prev[c] = (uint64_t) header.f_clk*1000/header.f_mains_mhz;
+	       }
+	  }
+	  break;
+     }
+     case TLV_TYPE_GAP : {
+	  uint16_t channel = tlv_gap_channel(tlv);
+	  if (channel < TLV_MAX_CHANNELS)
+	       wavetime_gap(&wt[channel], (uint64_t) tlv->value.gap_mc.waves*ticks_prev[channel]);
+	  break;
+     }
+     case TLV_TYPE_TIMESTAMPS :
+	  // Replaced by the new timestamps.
+	  stats_drop(1);
+	  return;
+     }
+
+     write_tlv_stdout(tlv);
+}
+
+int main(int argc, char *argv[])
+{
+     stats_init(&argc, argv);
+     checkpoint_init(&argc, argv);
+
+     int c;
+     while ((c = getopt (argc, argv, "n")) != -1) {
+	  switch (c) {
+	  case 'n' :
+	       noslew = true;
+	       break;
+	  case '?':
+	  default :
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+
+     for (int c = 0; c < TLV_MAX_CHANNELS; c++) {
+	  wavetime_init(&wt[c], F_CLK_NOMINAL);
+	  ticks_prev[c] = F_CLK_NOMINAL/F_MAINS_NOMINAL;
+     }
+
+     state_t state;
+     if (checkpoint_resume(&state, sizeof(state))) {
+	  memcpy(wt, state.wt, sizeof(wt));
+	  memcpy(ticks_prev, state.ticks_prev, sizeof(ticks_prev));
+     }
+     
+     tlv_t tlv;
+     while (1) {
+	  if (stats_read_tlv(&tlv, stdin) < 0) {
+	       if (feof(stdin)) {
+		    break;
+	       } else {
+		    ERROR("Could not read TLV element from stdin");
+		    exit(-1);
+	       }
+	  }
+
+	  process_tlv(&tlv);
+     }
+
+     memcpy(state.wt, wt, sizeof(wt));
+     memcpy(state.ticks_prev, ticks_prev, sizeof(ticks_prev));
+     checkpoint_save(&state, sizeof(state));
+     
+     return 0;
+}
@@ -5,9 +5,19 @@
 #include <stdlib.h>
 #include <time.h>
 #include "tlv.h"
+#include "stats.h"
+#include "checkpoint.h"
+#include "tlvpass.h"
 
 #define MAX_TIMESTR_LEN 1000
 
+#define MAX_PATH_SIZE 1000
+
+#define MAX_LINE_LEN 1000
+
+// Maximum number of simultaneously open (overlapping) windows in multi-window mode.
+#define MAX_ACTIVE_WINDOWS 256
+
 #define WARNING(m) (fprintf(stderr, "Warning: " m "\n"))
 #define ERROR(m) (fprintf(stderr, "Error: " m "\n"))
 
@@ -16,6 +26,31 @@ enum State {
      within,
      after};
 
+// A time window of multi-window mode.
+typedef struct {
+     uint16_t id;    // line of the window in the window file (counting windows from 0)
+     uint64_t tstart; // nanoseconds since Unix epoch
+     uint64_t tend;
+     FILE *f;       // output file of the window (option -o)
+} window_t;
+
+// Windows sorted by start time.
+window_t *windows = NULL;
+size_t nwindows = 0;
+
+// Indices of currently open windows (overlapping windows are open at the same time).
+size_t active[MAX_ACTIVE_WINDOWS];
+size_t nactive = 0;
+
+// Output prefix for per-window files; if empty, write a tagged stream to stdout.
+char outprefix[MAX_PATH_SIZE];
+
+// Last HEADER and ONEPPS records, written at the start of each window.
+tlv_t header;
+bool have_header = false;
+tlv_t onepps;
+bool have_onepps = false;
+
 void usage(const char *app)
 {
      fprintf(stderr, "USAGE: %s \n"
@@ -23,25 +58,378 @@ void usage(const char *app)
 	     "-u : time specified as UTC\n"
 	     "-s STARTTIME : include everything after and including this time (format see below)\n"
 	     "-e ENDTIME : include everything before and including this time (format see below)\n"
+	     "-w WINDOWFILE : extract all windows listed in WINDOWFILE in one pass (one window per line: STARTTIME,ENDTIME)\n"
+	     "-o PREFIX : with -w, write window i to file PREFIXi.tlv (default: tagged stream to stdout)\n"
 	     "\n"
 	     "Time format (quoted string): year-month-day hour:minute:second\n"
 	     "year: yyyy \t month: 1-12 \t day: 1-31 \t hour: 0-23 \t minute: 0-59 \t second: 0-59 \n",
 	     app);
 }
 
+int parse_time(const char *str, bool uselocaltime, uint64_t *tns)
+{
+     struct tm t;
+     memset(&t, 0, sizeof(t));
+     const char *end = strptime(str, "%Y-%m-%d %H:%M:%S", &t);
+     if (end == NULL)
+	  return -1;
+     while (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n')
+	  end++;
+     if (*end != '\0')
+	  return -1;
+     
+     // The result of both, mktime() and timegm(), is time since epoch in UTC.
+     time_t tsec = uselocaltime ? mktime(&t) : timegm(&t);
+     *tns = 1000000000ull*tsec;
+
+     return 0;
+}
+
+int compare_windows(const void *a, const void *b)
+{
+     const window_t *w1 = (const window_t *) a;
+     const window_t *w2 = (const window_t *) b;
+     if (w1->tstart != w2->tstart)
+	  return (w1->tstart < w2->tstart) ? -1 : 1;
+     return (w1->id < w2->id) ? -1 : (w1->id > w2->id);
+}
+
+void read_windows(const char *path, bool uselocaltime)
+{
+     FILE *f = fopen(path, "r");
+     if (f == NULL) {
+	  ERROR("Could not open window file");
+	  exit(-1);
+     }
+     
+     size_t capacity = 0;
+     char line[MAX_LINE_LEN];
+     int lineno = 0;
+     while (fgets(line, MAX_LINE_LEN, f) != NULL) {
+	  lineno++;
+	  if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line))
+	       continue;
+	  
+	  char *sep = strchr(line, ',');
+	  if (sep == NULL) {
+	       fprintf(stderr, "Error: Invalid window in line %d\n", lineno);
+	       exit(-1);
+	  }
+	  *sep = '\0';
+	  
+	  if (nwindows == capacity) {
+	       capacity = (capacity == 0) ? 64 : 2*capacity;
+	       windows = realloc(windows, capacity*sizeof(window_t));
+	       if (windows == NULL) {
+		    ERROR("Out of memory");
+		    exit(-1);
+	       }
+	  }
+	  window_t *w = &windows[nwindows];
+	  if (parse_time(line, uselocaltime, &w->tstart) < 0 ||
+	      parse_time(sep+1, uselocaltime, &w->tend) < 0 || w->tend < w->tstart) {
+	       fprintf(stderr, "Error: Invalid window in line %d\n", lineno);
+	       exit(-1);
+	  }
+	  if (nwindows > UINT16_MAX) {
+	       ERROR("Too many windows");
+	       exit(-1);
+	  }
+	  w->id = nwindows;
+	  w->f = NULL;
+	  nwindows++;
+     }
+     fclose(f);
+
+     qsort(windows, nwindows, sizeof(window_t), compare_windows);
+}
+
+/**
+ * State of single-window mode.
+ */
+typedef struct {
+     enum State state;
+     uint64_t tstartns;
+     uint64_t tendns;
+} window_state_t;
+
+/**
+ * Single-window mode: records between the first wallclock timestamp >= the
+ * start time and the first wallclock timestamp > the end time are
+ * forwarded unchanged; reading stops after the window.
+ */
+int select_window(uint16_t type, uint16_t length, const uint8_t *value, void *ctx)
+{
+     window_state_t *ws = (window_state_t *) ctx;
+     uint64_t t = 0;
+     if (type == TLV_TYPE_WALLCLOCKTIME)
+	  memcpy(&t, value, (length < sizeof(t)) ? length : sizeof(t));
+     
+     // The header describes all following records, so it is always forwarded.
+     if (type == TLV_TYPE_HEADER && ws->state != after)
+	  return TLVPASS_FORWARD;
+
+     switch (ws->state) {
+     case before :
+	  if (type == TLV_TYPE_WALLCLOCKTIME) {
+	       if (t >= ws->tstartns) {
+		    // Entered time window.
+		    ws->state = within;
+	       }
+	       if (t > ws->tendns) {
+		    // ... and left time window.
+		    ws->state = after;
+	       }
+	       if (ws->state == within)
+		    return TLVPASS_FORWARD;
+	  }
+	  // Ignore all packets before start time.
+	  stats_drop(1);
+	  return TLVPASS_DROP;
+     case within :
+	  if (type == TLV_TYPE_WALLCLOCKTIME && t > ws->tendns) {
+	       // Left time window.
+	       ws->state = after;
+	       return TLVPASS_DROP;
+	  }
+	  // Pass-through packet within time window.
+	  return TLVPASS_FORWARD;
+     case after :
+     default :
+	  return TLVPASS_STOP;
+     }
+}
+
+/**
+ * Write a record to all open windows. In a tagged stream, records of
+ * overlapping windows are written only once.
+ */
+void write_windows(const tlv_t *tlv)
+{
+     if (strlen(outprefix) == 0) {
+	  if (stats_write_tlv(tlv, stdout) < 0) {
+	       ERROR("Could not write packet to stdout");
+	       exit(-1);
+	  }
+	  return;
+     }
+
+     for (size_t i = 0; i < nactive; i++) {
+	  if (stats_write_tlv(tlv, windows[active[i]].f) < 0) {
+	       ERROR("Could not write packet to window file");
+	       exit(-1);
+	  }
+     }
+}
+
+void write_windows_tag()
+{
+     tlv_t tag;
+     tag.type = TLV_TYPE_WINDOWS;
+     tag.length = nactive*sizeof(uint16_t);
+     for (size_t i = 0; i < nactive; i++)
+	  tag.value.windows[i] = windows[active[i]].id;
+     if (stats_write_tlv(&tag, stdout) < 0) {
+	  ERROR("Could not write packet to stdout");
+	  exit(-1);
+     }
+}
+
+/**
+ * State of multi-window mode saved in checkpoints. Window files of open
+ * windows are continued by the next run.
+ */
+typedef struct {
+     uint64_t nwindows;
+     uint64_t next;
+     uint64_t nactive;
+     uint64_t active[MAX_ACTIVE_WINDOWS];
+     bool have_header;
+     tlv_t header;
+     bool have_onepps;
+     tlv_t onepps;
+} windows_state_t;
+
+void open_window_file(size_t i, const char *mode)
+{
+     char path[MAX_PATH_SIZE+16];
+     snprintf(path, sizeof(path), "%s%u.tlv", outprefix, (unsigned int) windows[i].id);
+     windows[i].f = fopen(path, mode);
+     if (windows[i].f == NULL) {
+	  ERROR("Could not open window file");
+	  exit(-1);
+     }
+}
+
+void open_window(size_t i)
+{
+     if (nactive == MAX_ACTIVE_WINDOWS) {
+	  ERROR("Too many overlapping windows");
+	  exit(-1);
+     }
+     active[nactive++] = i;
+     
+     if (strlen(outprefix) > 0) {
+	  open_window_file(i, "w");
+	  // Make the window file self-contained.
+	  if (have_header && stats_write_tlv(&header, windows[i].f) < 0) {
+	       ERROR("Could not write packet to window file");
+	       exit(-1);
+	  }
+	  if (have_onepps && stats_write_tlv(&onepps, windows[i].f) < 0) {
+	       ERROR("Could not write packet to window file");
+	       exit(-1);
+	  }
+     }
+}
+
+void close_window(size_t j)
+{
+     size_t i = active[j];
+     if (windows[i].f != NULL) {
+	  fclose(windows[i].f);
+	  windows[i].f = NULL;
+     }
+     active[j] = active[--nactive];
+}
+
+/**
+ * Extract all windows in a single pass over the input.
+ * Like in single-window mode, a window is entered at the first wallclock
+ * timestamp >= its start time and left at the first wallclock timestamp
+ * > its end time.
+ */
+void extract_windows()
+{
+     // Next window to be opened (windows are sorted by start time).
+     size_t next = 0;
+
+     windows_state_t *state = calloc(1, sizeof(windows_state_t));
+     if (state == NULL) {
+	  ERROR("Out of memory");
+	  exit(-1);
+     }
+     if (checkpoint_resume(state, sizeof(*state))) {
+	  if (state->nwindows != nwindows || state->next > nwindows ||
+	      state->nactive > MAX_ACTIVE_WINDOWS) {
+	       ERROR("Checkpoint file does not match window file");
+	       exit(-1);
+	  }
+	  next = state->next;
+	  nactive = state->nactive;
+	  for (size_t j = 0; j < nactive; j++) {
+	       if (state->active[j] >= next) {
+		    ERROR("Checkpoint file does not match window file");
+		    exit(-1);
+	       }
+	       active[j] = state->active[j];
+	       // Continue the window files of the last run.
+	       if (strlen(outprefix) > 0)
+		    open_window_file(active[j], "a");
+	  }
+	  have_header = state->have_header;
+	  header = state->header;
+	  have_onepps = state->have_onepps;
+	  onepps = state->onepps;
+     }
+     
+     tlv_t tlv;
+     while (next < nwindows || nactive > 0) {
+	  if (stats_read_tlv(&tlv, stdin) < 0) {
+	       if (feof(stdin)) {
+		    break;
+	       } else if (ferror(stdin)) {
+		    ERROR("Could not read TLV element from stdin");
+		    exit(-1);
+	       } else {
+		    ERROR("Could not read TLV element from stdin (corrupt file)");
+		    exit(-1);
+	       }
+	  }
+
+	  if (tlv.type == TLV_TYPE_WALLCLOCKTIME) {
+	       uint64_t t = tlv.value.wallclocktime;
+	       bool changed = false;
+	       
+	       // Leave windows ending before t.
+	       for (size_t j = 0; j < nactive; ) {
+		    if (t > windows[active[j]].tend) {
+			 close_window(j);
+			 changed = true;
+		    } else {
+			 j++;
+		    }
+	       }
+	       
+	       // Enter windows starting before t (windows ending before t are empty).
+	       for (; next < nwindows && windows[next].tstart <= t; next++) {
+		    if (t <= windows[next].tend) {
+			 open_window(next);
+			 changed = true;
+		    }
+	       }
+
+	       if (changed && strlen(outprefix) == 0) {
+		    write_windows_tag();
+		    if (nactive > 0 && have_onepps)
+			 write_windows(&onepps);
+	       }
+	  } else if (tlv.type == TLV_TYPE_ONEPPS) {
+	       onepps = tlv;
+	       have_onepps = true;
+	  } else if (tlv.type == TLV_TYPE_HEADER) {
+	       header = tlv;
+	       have_header = true;
+	       // The header describes all following records of the tagged stream.
+	       if (nactive == 0 && strlen(outprefix) == 0) {
+		    write_windows(&tlv);
+		    continue;
+	       }
+	  }
+
+	  if (nactive > 0)
+	       write_windows(&tlv);
+	  else
+	       stats_drop(1);
+     }
+
+     for (size_t i = 0; i < nwindows; i++) {
+	  if (windows[i].f != NULL)
+	       fclose(windows[i].f);
+     }
+
+     state->nwindows = nwindows;
+     state->next = next;
+     state->nactive = nactive;
+     for (size_t j = 0; j < nactive; j++)
+	  state->active[j] = active[j];
+     state->have_header = have_header;
+     state->header = header;
+     state->have_onepps = have_onepps;
+     state->onepps = onepps;
+     checkpoint_save(state, sizeof(*state));
+     free(state);
+}
+
 int main(int argc, char *argv[])
 {
+     stats_init(&argc, argv);
+     checkpoint_init(&argc, argv);
+
      // If set to false, use UTC (default). 
      bool uselocaltime = false;
      char starttime_arg[MAX_TIMESTR_LEN];
      char endtime_arg[MAX_TIMESTR_LEN];
+     char windowfile[MAX_PATH_SIZE];
      time_t starttime; // in seconds since Unix epoch (UTC)
      time_t endtime;   // in seconds since Unix epoch (UTC)
      
      memset(starttime_arg, 0, MAX_TIMESTR_LEN);
      memset(endtime_arg, 0, MAX_TIMESTR_LEN);	       
+     memset(windowfile, 0, MAX_PATH_SIZE);
+     memset(outprefix, 0, MAX_PATH_SIZE);
      int c;
-     while ((c = getopt (argc, argv, "lus:e:")) != -1) {
+     while ((c = getopt (argc, argv, "lus:e:w:o:")) != -1) {
 	  switch (c) {
 	  case 'l' :
 	       uselocaltime = true;
@@ -55,6 +443,12 @@ int main(int argc, char *argv[])
 	  case 'e' :
 	       strncpy(endtime_arg, optarg, MAX_TIMESTR_LEN-1);
 	       break;
+	  case 'w' :
+	       strncpy(windowfile, optarg, MAX_PATH_SIZE-1);
+	       break;
+	  case 'o' :
+	       strncpy(outprefix, optarg, MAX_PATH_SIZE-1);
+	       break;
 	  case '?':
 	  default :
 	       usage(argv[0]);
@@ -62,7 +456,12 @@ int main(int argc, char *argv[])
 	  }
      }
 
-
+     if (strlen(windowfile) > 0) {
+	  read_windows(windowfile, uselocaltime);
+	  extract_windows();
+	  return 0;
+     }
+     
      if (strlen(starttime_arg) == 0) {
 	  usage(argv[0]);
 	  exit(-1);
@@ -97,73 +496,18 @@ int main(int argc, char *argv[])
 
      // The POSIX standard defines that time_t (starttime, endtime) is time in
      // seconds since the Unix epoch. Therefore, we convert it to time in
-     // nano-seconds since Unix expoch as follows.
-     uint64_t tstartns = 1000000000ull*starttime;
-     uint64_t tendns = 1000000000ull*endtime;
-		    
-     tlv_t tlv;
-     enum State state = before;
-     while (state != after) {
-	  if (read_tlv(&tlv, stdin) < 0) {
-	       if (feof(stdin)) {
-		    break;
-	       } else if (ferror(stdin)) {
-		    ERROR("Could not read TLV element from stdin");
-		    exit(-1);
-	       } else {
-		    ERROR("Could not read TLV element from stdin (corrupt file)");
-		    exit(-1);
-	       }
-	  }
-
-	  switch (state) {
-	  case before :
-	       if (tlv.type == TLV_TYPE_WALLCLOCKTIME) {
-		    if (tlv.value.wallclocktime >= tstartns) {
-			 // Entered time window.
-			 state = within;
-		    }
-		    if (tlv.value.wallclocktime > tendns) {
-			 // ... and left time window.
-			 state = after;
-		    }
-		    if (state == within) {
-			 // Pass through packet within time window.
-			 if (write_tlv(&tlv, stdout) < 0) {
-			      ERROR("Could not write packet to stdout");
-			      exit(-1);
-			 }
-		    }
-	       } else {
-		    // Ignore all packets before start time.
-	       }
-	       break;
-	  case within :
-	       if (tlv.type == TLV_TYPE_WALLCLOCKTIME) {
-		    if (tlv.value.wallclocktime > tendns) {
-			 // Left time window.
-			 state = after;
-		    } else {
-			 // Still within time window.
-			 if (write_tlv(&tlv, stdout) < 0) {
-			      ERROR("Could not write packet to stdout");
-			      exit(-1);
-			 }
-		    }
-	       } else {
-		    // Pass-through packet within time window.
-		    if (write_tlv(&tlv, stdout) < 0) {
-			 ERROR("Could not write packet to stdout");
-			 exit(-1);
-		    }	    
-	       }
-	       break;
-	  case after :
-	       // Should have left while loop already.
-	       ERROR("Invalid state\n");
-	       exit(-1);
-	  }
+     // nano-seconds since Unix expoch (see below).
+     window_state_t ws;
+     ws.state = before;
+     ws.tstartns = 1000000000ull*starttime;
+     ws.tendns = 1000000000ull*endtime;
+     checkpoint_resume(&ws.state, sizeof(ws.state));
+     if (ws.state != after && tlvpass_run(select_window, &ws) < 0) {
+	  ERROR("Could not pass TLV elements from stdin to stdout");
+	  exit(-1);
      }
 
+     checkpoint_save(&ws.state, sizeof(ws.state));
+     
      return 0;
 }
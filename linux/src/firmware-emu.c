@@ -0,0 +1,400 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include "tty.h"
+#include "packetizer.h"
+#include "slipenc.h"
+#include "slipdec.h"
+#include "arq.h"
+#include "errandwarn.h"
+#include "nominal.h"
+
+#define MAX_OUTBUF_SIZE (2*PACKETIZER_MAX_PKTSIZE(PACKETIZER_MAX_BATCHSIZE))
+
+/**
+ * Emulated input channel: a sine wave of the grid frequency with a fixed
+ * phase offset (e.g., one of three phases).
+ */
+typedef struct {
+     double t_next;    // next rising edge (emulated time in s)
+     uint32_t ts_prev; // timer counter value at the previous edge
+     bool first;
+} channel_t;
+
+channel_t channels[PACKETIZER_MAX_CHANNELS];
+int nchannels = 3;
+
+// Grid frequency (random walk around the nominal frequency).
+double f_nominal = F_MAINS_NOMINAL;
+double f_grid;
+
+// Frequency of the emulated Arduino clock (nominal frequency with a deviation in ppm).
+double f_clk;
+
+uint64_t rng_state = 1;
+
+packetizer_t packetizer;
+
+int fdout;
+uint8_t outbuf[MAX_OUTBUF_SIZE];
+size_t outlen = 0;
+
+// Probability that a packet is corrupted on the link.
+double error_rate = 0.0;
+
+bool use_arq = false;
+arq_sender_t arq;
+slipdec_t nackdec;
+uint8_t nackbuf[ARQ_MAX_NACK_PKTSIZE];
+
+// Link statistics (reported at exit).
+uint64_t bytes_sent = 0;
+uint64_t bytes_retransmitted = 0;
+uint64_t packets_sent = 0;
+uint64_t packets_retransmitted = 0;
+uint64_t packets_corrupted = 0;
+uint64_t nacks_received = 0;
+
+void usage(const char *app)
+{
+     fprintf(stderr, "USAGE: %s [OPTIONS]\n"
+	     "Emulates the firmware with several input channels on a pseudo terminal (printed to stdout),\n"
+	     "which can be read by pkt-to-tlv-stream instead of the serial device of an Arduino.\n"
+	     "-c CHANNELS : number of input channels (default: 3; at most %d)\n"
+	     "-b BATCHSIZE : samples per packet (default: 10)\n"
+	     "-f NOMINAL_FREQUENCY : nominal grid frequency in Hz (default: 50)\n"
+	     "-p CLOCK_PPM : deviation of the emulated clock from its nominal frequency in ppm (default: 20)\n"
+	     "-x SPEEDUP : emulated seconds per real second (default: 1; 0: as fast as possible)\n"
+	     "-d DURATION_S : stop after this many emulated seconds (default: 0 = never)\n"
+	     "-o FILE : write the packet stream to FILE (- for stdout) instead of a pseudo terminal\n"
+	     "-e ERROR_RATE : probability that a packet is corrupted (one byte flipped; default: 0)\n"
+	     "-a : retransmit packets on NACKs from pkt-to-tlv-stream -a (ARQ; not with -o)\n"
+	     "-D : no delta encoding\n"
+	     "-Q : no sequence numbers\n"
+	     "-S SEED : seed of the random number generator (default: 1)\n",
+	     app, PACKETIZER_MAX_CHANNELS);
+}
+
+/**
+ * xorshift64* pseudo random number generator.
+ */
+double rng_uniform()
+{
+     rng_state ^= rng_state >> 12;
+     rng_state ^= rng_state << 25;
+     rng_state ^= rng_state >> 27;
+     uint64_t r = rng_state * 0x2545F4914F6CDD1Dull;
+     // (0,1]
+     return ((r >> 11) + 1) * (1.0/9007199254740992.0);
+}
+
+double rng_gauss()
+{
+     return sqrt(-2.0*log(rng_uniform()))*cos(2.0*M_PI*rng_uniform());
+}
+
+/**
+ * Timer counter value at emulated time t (wraps around like the hardware counter).
+ */
+uint32_t ticks(double t)
+{
+     return (uint32_t) (uint64_t) (t*f_clk);
+}
+
+void put_byte(uint8_t b, void *ctx)
+{
+     (void) ctx;
+     outbuf[outlen++] = b;
+}
+
+void flush_output()
+{
+     size_t off = 0;
+     while (off < outlen) {
+	  ssize_t n = write(fdout, &outbuf[off], outlen-off);
+	  if (n < 0) {
+	       if (errno == EINTR)
+		    continue;
+	       ERROR("Could not write packet");
+	       exit(-1);
+	  }
+	  off += n;
+     }
+     outlen = 0;
+}
+
+/**
+ * SLIP-encode and write a packet, corrupting it with the configured error rate.
+ */
+void transmit_packet(const uint8_t *pkt, size_t len)
+{
+     slipenc_send(pkt, len, put_byte, NULL);
+     if (error_rate > 0.0 && rng_uniform() <= error_rate) {
+	  // Flip bits of one byte between the END characters (which might
+	  // also break the framing, as on a real link).
+	  size_t i = 1 + (size_t) (rng_uniform()*(outlen-2)) % (outlen-2);
+	  outbuf[i] ^= 1 + (uint8_t) (rng_uniform()*255.0);
+	  packets_corrupted++;
+     }
+     bytes_sent += outlen;
+     packets_sent++;
+     flush_output();
+}
+
+void send_packet(const uint8_t *pkt, size_t len)
+{
+     if (len == 0)
+	  return;
+     transmit_packet(pkt, len);
+     if (use_arq)
+	  arq_sender_store(&arq, pkt, len);
+}
+
+void resend_packet(const uint8_t *pkt, size_t len, void *ctx)
+{
+     (void) ctx;
+     uint64_t before = bytes_sent;
+     transmit_packet(pkt, len);
+     bytes_retransmitted += bytes_sent - before;
+     packets_retransmitted++;
+}
+
+/**
+ * Handle NACKs written by the reader to the pseudo terminal (without blocking).
+ */
+void receive_nacks()
+{
+     struct pollfd pfd = { .fd = fdout, .events = POLLIN };
+     while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+	  uint8_t buf[256];
+	  ssize_t n = read(fdout, buf, sizeof(buf));
+	  if (n <= 0)
+	       return;
+	  for (ssize_t i = 0; i < n; i++) {
+	       size_t len = slipdec_put(&nackdec, buf[i]);
+	       if (len > 0) {
+		    nacks_received++;
+		    arq_sender_nack(&arq, nackbuf, len, resend_packet, NULL);
+	       }
+	  }
+     }
+}
+
+/**
+ * Sleep until the real time corresponding to emulated time t.
+ */
+void pace(const struct timespec *tstart, double speedup, double t)
+{
+     if (speedup <= 0.0)
+	  return;
+     double treal = t/speedup;
+     struct timespec deadline = *tstart;
+     deadline.tv_sec += (time_t) treal;
+     deadline.tv_nsec += (long) ((treal - (time_t) treal)*1e9);
+     if (deadline.tv_nsec >= 1000000000l) {
+	  deadline.tv_sec++;
+	  deadline.tv_nsec -= 1000000000l;
+     }
+     while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+}
+
+int main(int argc, char *argv[])
+{
+     int batchsize = BATCH_SIZE_NOMINAL;
+     uint8_t options = PACKETIZER_DELTA | PACKETIZER_SEQ;
+     double ppm = 20.0;
+     double speedup = 1.0;
+     double duration = 0.0;
+     const char *outfile = NULL;
+     
+     int c;
+     while ((c = getopt (argc, argv, "c:b:f:p:x:d:o:e:aDQS:")) != -1) {
+	  switch (c) {
+	  case 'c' :
+	       nchannels = atoi(optarg);
+	       break;
+	  case 'b' :
+	       batchsize = atoi(optarg);
+	       break;
+	  case 'f' :
+	       f_nominal = atof(optarg);
+	       break;
+	  case 'p' :
+	       ppm = atof(optarg);
+	       break;
+	  case 'x' :
+	       speedup = atof(optarg);
+	       break;
+	  case 'd' :
+	       duration = atof(optarg);
+	       break;
+	  case 'o' :
+	       outfile = optarg;
+	       break;
+	  case 'e' :
+	       error_rate = atof(optarg);
+	       break;
+	  case 'a' :
+	       use_arq = true;
+	       break;
+	  case 'D' :
+	       options &= ~PACKETIZER_DELTA;
+	       break;
+	  case 'Q' :
+	       options &= ~PACKETIZER_SEQ;
+	       break;
+	  case 'S' :
+	       rng_state = strtoull(optarg, NULL, 10)*0x9E3779B97F4A7C15ull + 1;
+	       break;
+	  case '?':
+	  default :
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     if (nchannels <= 0 || nchannels > PACKETIZER_MAX_CHANNELS || f_nominal <= 0.0 || duration < 0.0 ||
+	 error_rate < 0.0 || error_rate > 1.0 ||
+	 (use_arq && (outfile != NULL || !(options & PACKETIZER_SEQ))) ||
+	 !packetizer_init(&packetizer, batchsize, options)) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+     
+     // The slave side of the pseudo terminal is kept open, so the emulator
+     // can write before a reader opens it.
+     int fdslave = -1;
+     if (outfile == NULL) {
+	  if ( (fdout = posix_openpt(O_RDWR | O_NOCTTY)) < 0 ||
+	       grantpt(fdout) < 0 || unlockpt(fdout) < 0) {
+	       ERROR("Could not create pseudo terminal");
+	       exit(-1);
+	  }
+	  const char *slave = ptsname(fdout);
+	  if (slave == NULL || (fdslave = tty_init_raw(slave, B115200)) < 0) {
+	       ERROR("Could not open pseudo terminal");
+	       exit(-1);
+	  }
+	  printf("%s\n", slave);
+	  fflush(stdout);
+     } else if (strcmp(outfile, "-") == 0) {
+	  fdout = STDOUT_FILENO;
+     } else if ( (fdout = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+	  ERROR("Could not open output file");
+	  exit(-1);
+     }
+
+     arq_sender_init(&arq);
+     slipdec_init(&nackdec, nackbuf, sizeof(nackbuf));
+
+     f_clk = F_CLK_NOMINAL*(1.0 + ppm*1.0e-6);
+     f_grid = f_nominal;
+     for (int i = 0; i < nchannels; i++) {
+	  // Phases are shifted by 1/nchannels of a wave.
+	  channels[i].t_next = (1.0 + (double) i/nchannels)/f_nominal;
+	  channels[i].first = true;
+     }
+     double t_onepps = 1.0;
+     uint32_t ts_onepps_prev = 0;
+     bool first_onepps = true;
+     
+     struct timespec tstart;
+     clock_gettime(CLOCK_MONOTONIC, &tstart);
+     uint8_t pkt[PACKETIZER_MAX_PKTSIZE(PACKETIZER_MAX_BATCHSIZE)];
+     
+     while (1) {
+	  // Next interrupt.
+	  int next = 0;
+	  for (int i = 1; i < nchannels; i++) {
+	       if (channels[i].t_next < channels[next].t_next)
+		    next = i;
+	  }
+	  double t = (t_onepps < channels[next].t_next) ? t_onepps : channels[next].t_next;
+	  if (duration > 0.0 && t > duration)
+	       break;
+	  pace(&tstart, speedup, t);
+	  if (use_arq)
+	       receive_nacks();
+	  
+	  if (t == t_onepps) {
+	       uint32_t ts = ticks(t);
+	       if (!first_onepps)
+		    send_packet(pkt, packetizer_onepps(&packetizer, ts-ts_onepps_prev, pkt, sizeof(pkt)));
+	       first_onepps = false;
+	       ts_onepps_prev = ts;
+	       t_onepps += 1.0;
+	       continue;
+	  }
+
+	  channel_t *ch = &channels[next];
+	  uint32_t ts = ticks(t);
+	  if (!ch->first)
+	       send_packet(pkt, packetizer_add_sample_mc(&packetizer, next, ts-ch->ts_prev, pkt, sizeof(pkt)));
+	  ch->first = false;
+	  ch->ts_prev = ts;
+
+	  if (next == 0) {
+	       // Grid frequency: random walk pulled back to the nominal frequency
+	       // (about 20 mHz standard deviation).
+	       f_grid += -0.01*(f_grid - f_nominal) + 0.003*rng_gauss();
+	  }
+	  // All channels see the same grid frequency with a little measurement noise.
+	  ch->t_next = t + (1.0 + 1.0e-5*rng_gauss())/f_grid;
+     }
+
+     if (fdslave >= 0) {
+	  // Give the reader the chance to read the rest of the stream.
+	  tcdrain(fdout);
+	  close(fdslave);
+     }
+     close(fdout);
+
+     fprintf(stderr, "packets sent: %llu (%llu bytes)\n",
+	     (unsigned long long) packets_sent, (unsigned long long) bytes_sent);
+     fprintf(stderr, "packets corrupted: %llu\n", (unsigned long long) packets_corrupted);
+     if (use_arq) {
+	  fprintf(stderr, "NACKs received: %llu\n", (unsigned long long) nacks_received);
+	  fprintf(stderr, "packets retransmitted: %llu (%llu bytes)\n",
+		  (unsigned long long) packets_retransmitted, (unsigned long long) bytes_retransmitted);
+	  uint64_t bytes_original = bytes_sent - bytes_retransmitted;
+	  fprintf(stderr, "retransmission overhead: %.2f %%\n",
+		  bytes_original > 0 ? 100.0*bytes_retransmitted/bytes_original : 0.0);
+     }
+     
+     return 0;
+}
@@ -0,0 +1,504 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "ringbuffer.h"
+#include "packetizer.h"
+#include "slipenc.h"
+#include "errandwarn.h"
+#include "nominal.h"
+
+// Upper bound for the search of the maximum sustainable wave rate.
+#define MAX_WAVE_RATE 1000000.0
+
+/**
+ * Parameters of the simulated firmware and link.
+ */
+typedef struct {
+     double wave_rate;        // waves per second
+     double wave_jitter;      // standard deviation of wave periods (relative)
+     unsigned int batchsize;
+     uint8_t options;         // packetizer options
+     double baud;
+     size_t txbuffer;         // serial transmit buffer in bytes
+     double stall_interval;   // mean time between USB stalls in s (0: no stalls)
+     double stall_duration;   // mean duration of USB stalls in s
+     double cpu_sample;       // main loop time per sample or 1-pps value in s
+     double cpu_pktbyte;      // packetizer time (encoding, CRC) per packet byte in s
+     double cpu_write;        // SLIP encoder and Serial.write() time per byte in s
+     double cpu_isr;          // interrupt handler time in s
+     double duration;         // simulated time per run in s
+} simconfig_t;
+
+/**
+ * Outcome of one run.
+ */
+typedef struct {
+     bool overflow;
+     double t_overflow;
+     unsigned int max_samples;  // largest occupancy of the samples ring buffer
+     unsigned int max_onepps;   // largest occupancy of the 1-pps ring buffer
+     uint64_t waves;
+     uint64_t wire_bytes;
+     double t_end;
+} simresult_t;
+
+/**
+ * State of one run. The main loop of the firmware is simulated
+ * sequentially; interrupts that fired up to its current time t
+ * are delivered into the ring buffers before each step.
+ */
+typedef struct {
+     const simconfig_t *cfg;
+     uint64_t rng;
+     double t;
+     double next_wave;
+     double next_onepps;
+     volatile ringbuffer_t rb_samples;
+     volatile ringbuffer_t rb_onepps;
+     packetizer_t packetizer;
+     // Serial transmit buffer: number of bytes and time when the
+     // first byte has left the wire.
+     size_t tx_level;
+     double tx_next_done;
+     // Current or next USB stall.
+     double stall_start;
+     double stall_end;
+     simresult_t result;
+} sim_t;
+
+void usage(const char *app)
+{
+     fprintf(stderr, "USAGE: %s [OPTIONS]\n"
+	     "Simulates the firmware (ring buffers, batching, SLIP framing, serial link) and reports ring buffer occupancy,\n"
+	     "overflow probability, and the maximum sustainable wave rate.\n"
+	     "-r WAVE_RATE : waves per second (default: 50)\n"
+	     "-j JITTER : relative standard deviation of wave periods (default: 0.001)\n"
+	     "-b BATCHSIZE : samples per packet (default: 10; at most %d)\n"
+	     "-s BAUD : serial baud rate (default: 115200)\n"
+	     "-t TXBUFFER : serial transmit buffer in bytes (default: 128)\n"
+	     "-u STALL_INTERVAL_S : mean time between USB stalls (default: 60; 0 disables stalls)\n"
+	     "-l STALL_MS : mean duration of USB stalls (default: 20)\n"
+	     "-c CPU_US_PER_SAMPLE : main loop time per sample (default: 1)\n"
+	     "-p CPU_US_PER_PKTBYTE : encoding and CRC time per packet byte (default: 1)\n"
+	     "-w CPU_US_PER_WRITE : SLIP and Serial.write() time per byte (default: 0.5)\n"
+	     "-i CPU_US_PER_ISR : interrupt handler time (default: 0.5)\n"
+	     "-d DURATION_S : simulated time per run (default: 60)\n"
+	     "-n RUNS : Monte Carlo runs (default: 20)\n"
+	     "-P MAX_OVERFLOW_PROBABILITY : largest overflow probability considered sustainable (default: 0)\n"
+	     "-D : no delta encoding\n"
+	     "-Q : no sequence numbers\n"
+	     "-S SEED : seed of the random number generator (default: 1)\n",
+	     app, PACKETIZER_MAX_BATCHSIZE);
+}
+
+/**
+ * xorshift64* pseudo random number generator.
+ */
+static inline double rng_uniform(uint64_t *s)
+{
+     *s ^= *s >> 12;
+     *s ^= *s << 25;
+     *s ^= *s >> 27;
+     uint64_t r = *s * 0x2545F4914F6CDD1Dull;
+     // (0,1]
+     return ((r >> 11) + 1) * (1.0/9007199254740992.0);
+}
+
+static double rng_exp(uint64_t *s, double mean)
+{
+     return -mean*log(rng_uniform(s));
+}
+
+static double rng_gauss(uint64_t *s)
+{
+     double u1 = rng_uniform(s);
+     double u2 = rng_uniform(s);
+     return sqrt(-2.0*log(u1))*cos(2.0*M_PI*u2);
+}
+
+static double next_wave_period(sim_t *sim)
+{
+     double period = (1.0 + sim->cfg->wave_jitter*rng_gauss(&sim->rng))/sim->cfg->wave_rate;
+     return (period > 0.0) ? period : 0.0;
+}
+
+/**
+ * Timestamp of the timer counter at time t.
+ */
+static uint32_t ticks(double t)
+{
+     return (uint32_t) (uint64_t) (t*F_CLK_NOMINAL);
+}
+
+/**
+ * Deliver interrupts up to time t into the ring buffers.
+ * Returns the number of interrupts.
+ */
+static unsigned int deliver_interrupts(sim_t *sim, double t)
+{
+     unsigned int n = 0;
+     while (!sim->result.overflow) {
+	  if (sim->next_wave <= t && sim->next_wave <= sim->next_onepps) {
+	       if (!ringbuffer_push(&sim->rb_samples, ticks(sim->next_wave))) {
+		    sim->result.overflow = true;
+		    sim->result.t_overflow = sim->next_wave;
+		    break;
+	       }
+	       if (ringbuffer_count(&sim->rb_samples) > sim->result.max_samples)
+		    sim->result.max_samples = ringbuffer_count(&sim->rb_samples);
+	       sim->result.waves++;
+	       sim->next_wave += next_wave_period(sim);
+	  } else if (sim->next_onepps <= t) {
+	       if (!ringbuffer_push(&sim->rb_onepps, ticks(sim->next_onepps))) {
+		    sim->result.overflow = true;
+		    sim->result.t_overflow = sim->next_onepps;
+		    break;
+	       }
+	       if (ringbuffer_count(&sim->rb_onepps) > sim->result.max_onepps)
+		    sim->result.max_onepps = ringbuffer_count(&sim->rb_onepps);
+	       sim->next_onepps += 1.0;
+	  } else {
+	       break;
+	  }
+	  n++;
+     }
+     return n;
+}
+
+/**
+ * Advance the main loop to time t. Interrupts firing meanwhile
+ * delay the main loop further.
+ */
+static void advance_to(sim_t *sim, double t)
+{
+     if (t > sim->t)
+	  sim->t = t;
+     unsigned int n;
+     while ( (n = deliver_interrupts(sim, sim->t)) > 0)
+	  sim->t += n*sim->cfg->cpu_isr;
+}
+
+/**
+ * Time when a byte whose transmission may start at time s has left
+ * the wire. No bytes are transferred during USB stalls.
+ */
+static double byte_done(sim_t *sim, double s)
+{
+     const simconfig_t *cfg = sim->cfg;
+     if (cfg->stall_interval > 0.0) {
+	  while (sim->stall_end <= s) {
+	       sim->stall_start = sim->stall_end + rng_exp(&sim->rng, cfg->stall_interval);
+	       sim->stall_end = sim->stall_start + rng_exp(&sim->rng, cfg->stall_duration);
+	  }
+	  if (s >= sim->stall_start)
+	       s = sim->stall_end;
+     }
+     return s + 10.0/cfg->baud;
+}
+
+/**
+ * Remove bytes from the transmit buffer that have left the wire up to time t.
+ */
+static void tx_drain(sim_t *sim, double t)
+{
+     while (sim->tx_level > 0 && sim->tx_next_done <= t) {
+	  sim->tx_level--;
+	  if (sim->tx_level > 0)
+	       sim->tx_next_done = byte_done(sim, sim->tx_next_done);
+     }
+}
+
+/**
+ * Output function of the SLIP encoder: Serial.write() blocks while the
+ * transmit buffer is full.
+ */
+static void serial_put(uint8_t b, void *ctx)
+{
+     sim_t *sim = (sim_t *) ctx;
+     (void) b;
+     
+     tx_drain(sim, sim->t);
+     while (sim->tx_level == sim->cfg->txbuffer && !sim->result.overflow) {
+	  advance_to(sim, sim->tx_next_done);
+	  tx_drain(sim, sim->t);
+     }
+     if (sim->result.overflow)
+	  return;
+     if (sim->tx_level == 0)
+	  sim->tx_next_done = byte_done(sim, sim->t);
+     sim->tx_level++;
+     sim->result.wire_bytes++;
+     advance_to(sim, sim->t + sim->cfg->cpu_write);
+}
+
+static void send_packet(sim_t *sim, const uint8_t *pkt, size_t len)
+{
+     advance_to(sim, sim->t + len*sim->cfg->cpu_pktbyte);
+     slipenc_send(pkt, len, serial_put, sim);
+}
+
+/**
+ * Simulate one run of the firmware main loop (see loop() in mainsfrequency-serial.ino).
+ */
+void simulate(const simconfig_t *cfg, uint64_t seed, simresult_t *result)
+{
+     // Packetizer and ring buffers are too large for the stack.
+     static sim_t sim;
+     uint8_t pkt[PACKETIZER_MAX_PKTSIZE(PACKETIZER_MAX_BATCHSIZE)];
+     
+     memset(&sim, 0, sizeof(sim));
+     sim.cfg = cfg;
+     sim.rng = seed*0x9E3779B97F4A7C15ull + 1;
+     ringbuffer_init(&sim.rb_samples);
+     ringbuffer_init(&sim.rb_onepps);
+     packetizer_init(&sim.packetizer, cfg->batchsize, cfg->options);
+     // Random phase of waves and 1-pps pulses.
+     sim.next_wave = rng_uniform(&sim.rng)/cfg->wave_rate;
+     sim.next_onepps = rng_uniform(&sim.rng);
+     sim.stall_start = sim.stall_end = 0.0;
+     
+     bool first_sample = true;
+     bool first_onepps = true;
+     uint32_t ts_samples_old = 0;
+     uint32_t ts_onepps_old = 0;
+     
+     while (!sim.result.overflow && sim.t < cfg->duration) {
+	  if (ringbuffer_count(&sim.rb_samples) == 0 && ringbuffer_count(&sim.rb_onepps) == 0) {
+	       // Busy waiting for the next interrupt.
+	       advance_to(&sim, (sim.next_wave < sim.next_onepps) ? sim.next_wave : sim.next_onepps);
+	       continue;
+	  }
+
+	  if (ringbuffer_count(&sim.rb_samples) > 0) {
+	       uint32_t ts = ringbuffer_pop(&sim.rb_samples);
+	       advance_to(&sim, sim.t + cfg->cpu_sample);
+	       if (first_sample) {
+		    first_sample = false;
+	       } else {
+		    size_t len = packetizer_add_sample(&sim.packetizer, ts-ts_samples_old, pkt, sizeof(pkt));
+		    if (len > 0)
+			 send_packet(&sim, pkt, len);
+	       }
+	       ts_samples_old = ts;
+	  }
+	  
+	  if (!sim.result.overflow && ringbuffer_count(&sim.rb_onepps) > 0) {
+	       uint32_t ts = ringbuffer_pop(&sim.rb_onepps);
+	       advance_to(&sim, sim.t + cfg->cpu_sample);
+	       if (first_onepps) {
+		    first_onepps = false;
+	       } else {
+		    size_t len = packetizer_onepps(&sim.packetizer, ts-ts_onepps_old, pkt, sizeof(pkt));
+		    send_packet(&sim, pkt, len);
+	       }
+	       ts_onepps_old = ts;
+	  }
+     }
+
+     sim.result.t_end = sim.t;
+     *result = sim.result;
+}
+
+/**
+ * Monte Carlo runs with seeds seed, seed+1, ...
+ * Returns the number of runs with ring buffer overflows.
+ */
+unsigned int simulate_runs(const simconfig_t *cfg, unsigned int runs, uint64_t seed,
+			   simresult_t *worst, double *mean_max_samples, double *bytes_per_wave)
+{
+     unsigned int overflows = 0;
+     uint64_t sum_max_samples = 0;
+     uint64_t waves = 0;
+     uint64_t wire_bytes = 0;
+     
+     memset(worst, 0, sizeof(*worst));
+     for (unsigned int i = 0; i < runs; i++) {
+	  simresult_t r;
+	  simulate(cfg, seed+i, &r);
+	  if (r.overflow)
+	       overflows++;
+	  if (r.max_samples > worst->max_samples)
+	       worst->max_samples = r.max_samples;
+	  if (r.max_onepps > worst->max_onepps)
+	       worst->max_onepps = r.max_onepps;
+	  sum_max_samples += r.max_samples;
+	  waves += r.waves;
+	  wire_bytes += r.wire_bytes;
+     }
+     *mean_max_samples = (double) sum_max_samples/runs;
+     *bytes_per_wave = (waves > 0) ? (double) wire_bytes/waves : 0.0;
+     
+     return overflows;
+}
+
+bool sustainable(const simconfig_t *cfg, unsigned int runs, uint64_t seed, double max_probability)
+{
+     simresult_t worst;
+     double mean_max_samples, bytes_per_wave;
+     unsigned int overflows = simulate_runs(cfg, runs, seed, &worst, &mean_max_samples, &bytes_per_wave);
+     return ((double) overflows/runs <= max_probability);
+}
+
+int main(int argc, char *argv[])
+{
+     simconfig_t cfg = {
+	  .wave_rate = F_MAINS_NOMINAL,
+	  .wave_jitter = 0.001,
+	  .batchsize = BATCH_SIZE_NOMINAL,
+	  .options = PACKETIZER_DELTA | PACKETIZER_SEQ,
+	  .baud = 115200.0,
+	  .txbuffer = 128,
+	  .stall_interval = 60.0,
+	  .stall_duration = 0.020,
+	  .cpu_sample = 1e-6,
+	  .cpu_pktbyte = 1e-6,
+	  .cpu_write = 0.5e-6,
+	  .cpu_isr = 0.5e-6,
+	  .duration = 60.0
+     };
+     unsigned int runs = 20;
+     double max_probability = 0.0;
+     uint64_t seed = 1;
+     
+     int c;
+     while ((c = getopt (argc, argv, "r:j:b:s:t:u:l:c:p:w:i:d:n:P:DQS:")) != -1) {
+	  switch (c) {
+	  case 'r' :
+	       cfg.wave_rate = atof(optarg);
+	       break;
+	  case 'j' :
+	       cfg.wave_jitter = atof(optarg);
+	       break;
+	  case 'b' :
+	       cfg.batchsize = atoi(optarg);
+	       break;
+	  case 's' :
+	       cfg.baud = atof(optarg);
+	       break;
+	  case 't' :
+	       cfg.txbuffer = atoi(optarg);
+	       break;
+	  case 'u' :
+	       cfg.stall_interval = atof(optarg);
+	       break;
+	  case 'l' :
+	       cfg.stall_duration = atof(optarg)/1000.0;
+	       break;
+	  case 'c' :
+	       cfg.cpu_sample = atof(optarg)/1e6;
+	       break;
+	  case 'p' :
+	       cfg.cpu_pktbyte = atof(optarg)/1e6;
+	       break;
+	  case 'w' :
+	       cfg.cpu_write = atof(optarg)/1e6;
+	       break;
+	  case 'i' :
+	       cfg.cpu_isr = atof(optarg)/1e6;
+	       break;
+	  case 'd' :
+	       cfg.duration = atof(optarg);
+	       break;
+	  case 'n' :
+	       runs = atoi(optarg);
+	       break;
+	  case 'P' :
+	       max_probability = atof(optarg);
+	       break;
+	  case 'D' :
+	       cfg.options &= ~PACKETIZER_DELTA;
+	       break;
+	  case 'Q' :
+	       cfg.options &= ~PACKETIZER_SEQ;
+	       break;
+	  case 'S' :
+	       seed = strtoull(optarg, NULL, 10);
+	       break;
+	  case '?':
+	  default :
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     if (cfg.wave_rate <= 0.0 || cfg.batchsize == 0 || cfg.batchsize > PACKETIZER_MAX_BATCHSIZE ||
+	 cfg.baud <= 0.0 || cfg.txbuffer == 0 || cfg.stall_interval < 0.0 || cfg.stall_duration < 0.0 ||
+	 cfg.duration <= 0.0 || runs == 0) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+
+     simresult_t worst;
+     double mean_max_samples, bytes_per_wave;
+     unsigned int overflows = simulate_runs(&cfg, runs, seed, &worst, &mean_max_samples, &bytes_per_wave);
+
+     printf("wave_rate_hz: %.3f\n", cfg.wave_rate);
+     printf("batchsize: %u\n", cfg.batchsize);
+     printf("baud: %.0f\n", cfg.baud);
+     printf("runs: %u x %.0f s\n", runs, cfg.duration);
+     printf("wire_bytes_per_wave: %.3f\n", bytes_per_wave);
+     printf("link_utilization: %.4f\n", bytes_per_wave*cfg.wave_rate*10.0/cfg.baud);
+     printf("max_ring_occupancy_samples: %u/%d (mean of per-run maxima: %.1f)\n",
+	    worst.max_samples, RINGBUFFERSIZE, mean_max_samples);
+     printf("max_ring_occupancy_onepps: %u/%d\n", worst.max_onepps, RINGBUFFERSIZE);
+     printf("overflow_probability: %.4f (%u/%u runs)\n", (double) overflows/runs, overflows, runs);
+
+     // Search for the maximum sustainable wave rate: double the rate until it
+     // is not sustainable anymore, then bisect. All rates use the same seeds,
+     // so runs with more waves see the same stalls.
+     double lo = 0.0;
+     double hi = cfg.wave_rate;
+     simconfig_t search = cfg;
+     while (hi < MAX_WAVE_RATE) {
+	  search.wave_rate = hi;
+	  if (!sustainable(&search, runs, seed, max_probability))
+	       break;
+	  lo = hi;
+	  hi *= 2.0;
+     }
+     if (hi >= MAX_WAVE_RATE) {
+	  printf("max_sustainable_wave_rate_hz: >%.0f\n", lo);
+	  return 0;
+     }
+     while (hi-lo > 0.005*hi) {
+	  search.wave_rate = (lo+hi)/2.0;
+	  if (sustainable(&search, runs, seed, max_probability))
+	       lo = search.wave_rate;
+	  else
+	       hi = search.wave_rate;
+     }
+     printf("max_sustainable_wave_rate_hz: %.1f\n", lo);
+     
+     return 0;
+}
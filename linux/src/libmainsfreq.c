@@ -0,0 +1,401 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mainsfreq.h"
+#include "tlv.h"
+#include "zonemap.h"
+#include "deltacodec.h"
+#include "nominal.h"
+
+// Only functions of mainsfreq.h are exported by the shared library.
+#define MF_API __attribute__((visibility("default")))
+
+#define MAX_PATH_SIZE 1000
+
+#define TLV_HEADER_SIZE (2*sizeof(uint16_t))
+
+struct cursor {
+     // Block to be read and state of reading it.
+     size_t block;
+     bool in_block;
+     uint64_t offset;
+     uint64_t block_end;
+     // State of the stream.
+     uint32_t f_clk_syncd;
+     uint64_t t_wallclock;
+     // Samples of the current record not yet returned.
+     uint32_t samples[MAX_SAMPLE_COUNT];
+     size_t nsamples;
+     size_t pos;
+};
+
+struct mf_reader {
+     // Recording mapped into memory.
+     const uint8_t *data;
+     size_t size;
+     // Blocks of the zone map, or a single block covering the whole file.
+     bool has_zonemap;
+     zonemap_entry_t *blocks;
+     size_t nblocks;
+     // Selected time range and channel.
+     uint64_t tstart;
+     uint64_t tend;
+     uint16_t channel;
+     struct cursor cursor;
+};
+
+static int load_zonemap(mf_reader_t *r, const char *path)
+{
+     char zmpath[MAX_PATH_SIZE];
+     zonemap_path(path, zmpath, MAX_PATH_SIZE);
+     FILE *f = fopen(zmpath, "r");
+     if (f == NULL)
+	  return -1;
+     
+     zonemap_header_t header;
+     if (zonemap_read_header(f, &header) < 0) {
+	  fclose(f);
+	  return -1;
+     }
+
+     size_t capacity = 0;
+     zonemap_entry_t e;
+     while (zonemap_read_entry(f, &e) == 0) {
+	  if (e.offset + e.length > r->size) {
+	       // Zone map does not match the recording.
+	       fclose(f);
+	       return -1;
+	  }
+	  if (r->nblocks == capacity) {
+	       capacity = (capacity == 0) ? 1024 : 2*capacity;
+	       zonemap_entry_t *blocks = realloc(r->blocks, capacity*sizeof(zonemap_entry_t));
+	       if (blocks == NULL) {
+		    fclose(f);
+		    return -1;
+	       }
+	       r->blocks = blocks;
+	  }
+	  r->blocks[r->nblocks++] = e;
+     }
+     fclose(f);
+
+     // The recording might have grown since the zone map was created.
+     uint64_t end = (r->nblocks > 0) ? r->blocks[r->nblocks-1].offset + r->blocks[r->nblocks-1].length : 0;
+     if (end != r->size)
+	  return -1;
+     
+     r->has_zonemap = true;
+     return 0;
+}
+
+MF_API int mf_abi_version(void)
+{
+     return MF_ABI_VERSION;
+}
+
+/**
+ * Open a recording. Returns NULL on error.
+ */
+MF_API mf_reader_t *mf_open(const char *path)
+{
+     mf_reader_t *r = calloc(1, sizeof(mf_reader_t));
+     if (r == NULL)
+	  return NULL;
+
+     int fd = open(path, O_RDONLY);
+     if (fd < 0) {
+	  free(r);
+	  return NULL;
+     }
+     struct stat st;
+     if (fstat(fd, &st) < 0) {
+	  close(fd);
+	  free(r);
+	  return NULL;
+     }
+     r->size = st.st_size;
+     if (r->size > 0) {
+	  void *data = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	  if (data == MAP_FAILED) {
+	       close(fd);
+	       free(r);
+	       return NULL;
+	  }
+	  madvise(data, r->size, MADV_SEQUENTIAL);
+	  r->data = data;
+     }
+     close(fd);
+
+     if (load_zonemap(r, path) < 0) {
+	  // Fall back to a single block covering the whole file.
+	  free(r->blocks);
+	  r->blocks = malloc(sizeof(zonemap_entry_t));
+	  if (r->blocks == NULL) {
+	       mf_close(r);
+	       return NULL;
+	  }
+	  zonemap_entry_init(&r->blocks[0], 0, 0, 0, NULL);
+	  r->blocks[0].length = r->size;
+	  r->nblocks = 1;
+	  r->has_zonemap = false;
+     }
+
+     mf_select(r, 0, UINT64_MAX);
+     
+     return r;
+}
+
+MF_API void mf_close(mf_reader_t *r)
+{
+     if (r == NULL)
+	  return;
+     if (r->data != NULL)
+	  munmap((void *) r->data, r->size);
+     free(r->blocks);
+     free(r);
+}
+
+/**
+ * Select samples with wallclock timestamps within [tstart, tend] (nanoseconds
+ * since Unix epoch) and rewind to the first of them.
+ */
+MF_API int mf_select(mf_reader_t *r, uint64_t tstart, uint64_t tend)
+{
+     if (tstart > tend)
+	  return -1;
+     
+     r->tstart = tstart;
+     r->tend = tend;
+     r->cursor.block = 0;
+     r->cursor.in_block = false;
+     r->cursor.nsamples = 0;
+     r->cursor.pos = 0;
+     r->cursor.f_clk_syncd = F_CLK_NOMINAL;
+     r->cursor.t_wallclock = 0;
+
+     return 0;
+}
+
+/**
+ * Select the channel of multi-channel recordings (default: 0) and rewind to
+ * the first selected sample.
+ */
+MF_API int mf_select_channel(mf_reader_t *r, uint16_t channel)
+{
+     if (channel >= TLV_MAX_CHANNELS)
+	  return -1;
+
+     r->channel = channel;
+     return mf_select(r, r->tstart, r->tend);
+}
+
+static bool next_block(const mf_reader_t *r, struct cursor *c)
+{
+     for (; c->block < r->nblocks; c->block++) {
+	  const zonemap_entry_t *e = &r->blocks[c->block];
+	  if (!r->has_zonemap || zonemap_may_contain_time(e, r->tstart, r->tend)) {
+	       c->offset = e->offset;
+	       c->block_end = e->offset + e->length;
+	       if (r->has_zonemap) {
+		    // Restore the state of the stream at the start of the block.
+		    c->f_clk_syncd = F_CLK_NOMINAL;
+		    if (e->fclk_in != 0)
+			 c->f_clk_syncd = e->fclk_in;
+		    else if (e->header_in.version != 0)
+			 c->f_clk_syncd = e->header_in.f_clk;
+		    c->t_wallclock = e->t_wallclock_in;
+	       }
+	       c->in_block = true;
+	       return true;
+	  }
+     }
+     
+     return false;
+}
+
+/**
+ * Count the samples of a delta-encoded record without decoding it
+ * (every varint ends with a byte with cleared most significant bit).
+ */
+static size_t count_delta_samples(const uint8_t *p, size_t len)
+{
+     size_t n = 0;
+     for (size_t i = 0; i < len; i++)
+	  n += ((p[i] & 0x80) == 0);
+     return n;
+}
+
+/**
+ * Return up to capacity samples starting at the cursor. Column pointers may be NULL.
+ * If count_only is set, samples are only counted.
+ */
+static int64_t scan(const mf_reader_t *r, struct cursor *c,
+		    uint32_t *ticks, double *f_mains_syncd, uint32_t *f_clk_syncd, uint64_t *t_wallclock,
+		    size_t capacity, bool count_only)
+{
+     size_t n = 0;
+     
+     while (n < capacity) {
+	  if (c->pos < c->nsamples) {
+	       size_t k = c->nsamples - c->pos;
+	       if (k > capacity - n)
+		    k = capacity - n;
+	       if (!count_only) {
+		    const uint32_t *s = &c->samples[c->pos];
+		    const double fclk = c->f_clk_syncd;
+		    // Simple loops over contiguous arrays, which the compiler vectorizes.
+		    if (ticks != NULL)
+			 memcpy(&ticks[n], s, k*sizeof(uint32_t));
+		    if (f_mains_syncd != NULL) {
+			 for (size_t i = 0; i < k; i++)
+			      f_mains_syncd[n+i] = fclk / s[i];
+		    }
+		    if (f_clk_syncd != NULL) {
+			 for (size_t i = 0; i < k; i++)
+			      f_clk_syncd[n+i] = c->f_clk_syncd;
+		    }
+		    if (t_wallclock != NULL) {
+			 for (size_t i = 0; i < k; i++)
+			      t_wallclock[n+i] = c->t_wallclock;
+		    }
+	       }
+	       n += k;
+	       c->pos += k;
+	       continue;
+	  }
+
+	  if (!c->in_block && !next_block(r, c))
+	       break;
+	  if (c->offset + TLV_HEADER_SIZE > c->block_end) {
+	       c->in_block = false;
+	       c->block++;
+	       continue;
+	  }
+
+	  uint16_t type;
+	  uint16_t length;
+	  memcpy(&type, &r->data[c->offset], sizeof(type));
+	  memcpy(&length, &r->data[c->offset + sizeof(type)], sizeof(length));
+	  if (c->offset + TLV_HEADER_SIZE + length > r->size) {
+	       // Truncated record at the end of a growing recording.
+	       c->in_block = false;
+	       c->block = r->nblocks;
+	       break;
+	  }
+	  const uint8_t *value = &r->data[c->offset + TLV_HEADER_SIZE];
+	  c->offset += TLV_HEADER_SIZE + length;
+
+	  bool selected = (c->t_wallclock >= r->tstart && c->t_wallclock <= r->tend);
+	  switch (type) {
+	  case TLV_TYPE_ONEPPS :
+	       if (length >= sizeof(uint32_t))
+		    memcpy(&c->f_clk_syncd, value, sizeof(uint32_t));
+	       break;
+	  case TLV_TYPE_WALLCLOCKTIME :
+	       if (length >= sizeof(uint64_t))
+		    memcpy(&c->t_wallclock, value, sizeof(uint64_t));
+	       break;
+	  case TLV_TYPE_HEADER : {
+	       // Samples before the next ONEPPS record use the nominal clock.
+	       tlv_t tlv;
+	       tlv_header_t header;
+	       tlv.type = type;
+	       tlv.length = (length < sizeof(tlv_header_t)) ? length : sizeof(tlv_header_t);
+	       memcpy(&tlv.value.header, value, tlv.length);
+	       if (tlv_get_header(&tlv, &header) == 0)
+		    c->f_clk_syncd = header.f_clk;
+	       break;
+	  }
+	  case TLV_TYPE_SAMPLES :
+	       if (!selected || r->channel != 0 || length > sizeof(c->samples))
+		    break;
+	       c->nsamples = length/sizeof(uint32_t);
+	       c->pos = 0;
+	       if (!count_only)
+		    memcpy(c->samples, value, c->nsamples*sizeof(uint32_t));
+	       break;
+	  case TLV_TYPE_SAMPLES_DELTA :
+	       if (!selected || r->channel != 0)
+		    break;
+	       if (count_only) {
+		    c->nsamples = count_delta_samples(value, length);
+	       } else {
+		    int nsamples = deltacodec_decode(value, length, c->samples, MAX_SAMPLE_COUNT);
+		    c->nsamples = (nsamples > 0) ? nsamples : 0;
+	       }
+	       c->pos = 0;
+	       break;
+	  case TLV_TYPE_SAMPLES_MC : {
+	       if (!selected || length < TLV_SAMPLES_MC_HEADER_SIZE)
+		    break;
+	       uint16_t channel;
+	       memcpy(&channel, value, sizeof(channel));
+	       tlv_t tlv;
+	       if (channel != r->channel || length > sizeof(tlv.value))
+		    break;
+	       tlv.type = type;
+	       tlv.length = length;
+	       memcpy(&tlv.value, value, length);
+	       if (decode_tlv(&tlv) < 0)
+		    break;
+	       int nsamples = tlv_get_samples(&tlv, c->samples, MAX_SAMPLE_COUNT);
+	       c->nsamples = (nsamples > 0) ? nsamples : 0;
+	       c->pos = 0;
+	       break;
+	  }
+	  }
+     }
+
+     return n;
+}
+
+/**
+ * Number of selected samples not read yet.
+ */
+MF_API int64_t mf_count(mf_reader_t *r)
+{
+     struct cursor c = r->cursor;
+     return scan(r, &c, NULL, NULL, NULL, NULL, SIZE_MAX, true);
+}
+
+/**
+ * Read up to capacity samples into the given arrays (each may be NULL).
+ * Returns the number of samples read (0 if all selected samples have been read).
+ */
+MF_API int64_t mf_read(mf_reader_t *r, uint32_t *ticks, double *f_mains_syncd, uint32_t *f_clk_syncd, uint64_t *t_wallclock, size_t capacity)
+{
+     return scan(r, &r->cursor, ticks, f_mains_syncd, f_clk_syncd, t_wallclock, capacity, false);
+}
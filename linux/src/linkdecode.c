@@ -0,0 +1,432 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include "linkdecode.h"
+#include "crc.h"
+#include "stats.h"
+#include "errandwarn.h"
+
+void linkdecode_init(linkdecode_t *d)
+{
+     for (int c = 0; c < TLV_MAX_CHANNELS; c++)
+	  linkseq_init(&d->ls[c]);
+     linkseq_init(&d->total);
+     d->crc_errors = 0;
+     d->short_packets = 0;
+     d->tlast = 0;
+     d->tpending = 0;
+     tlv_header_init(&d->header);
+}
+
+void linkdecode_register_stats(linkdecode_t *d)
+{
+     stats_register_counter("packets", &d->total.packets);
+     stats_register_counter("crc_errors", &d->crc_errors);
+     stats_register_counter("short_packets", &d->short_packets);
+     stats_register_counter("lost_packets", &d->total.lost_packets);
+     stats_register_counter("waves", &d->total.waves);
+     stats_register_counter("lost_waves", &d->total.lost_waves);
+     stats_register_counter("duplicates", &d->total.duplicates);
+     stats_register_counter("late", &d->total.late);
+     stats_register_counter("resyncs", &d->total.resyncs);
+}
+
+static unsigned char *add_or_die(recbatch_t *b, uint16_t type, size_t length)
+{
+     unsigned char *value = recbatch_add(b, type, length);
+     if (value == NULL) {
+	  ERROR("Out of memory");
+	  exit(-1);
+     }
+     return value;
+}
+
+/**
+ * Handle an option of the HEADER record (LINKDECODE_HEADER_OPTIONS).
+ * Returns 1 if the option has been handled, 0 if it is not a header option,
+ * or -1 if the argument is invalid.
+ */
+int linkdecode_header_option(linkdecode_t *d, int c, const char *arg)
+{
+     double value = atof(arg);
+     switch (c) {
+     case 'F' :
+	  if (value <= 0.0)
+	       return -1;
+	  d->header.f_mains_mhz = (uint32_t) (1000.0*value + 0.5);
+	  return 1;
+     case 'C' :
+	  if (value < 1.0 || value > UINT32_MAX)
+	       return -1;
+	  d->header.f_clk = (uint32_t) value;
+	  return 1;
+     case 'b' :
+	  if (value < 1.0 || value > MAX_SAMPLE_COUNT)
+	       return -1;
+	  d->header.batch_size = (uint16_t) value;
+	  return 1;
+     case 'i' :
+	  d->header.appliance_id = (uint32_t) strtoul(arg, NULL, 0);
+	  return 1;
+     }
+     return 0;
+}
+
+/**
+ * Append the HEADER record describing the stream.
+ */
+void linkdecode_write_header(linkdecode_t *d, recbatch_t *b)
+{
+     unsigned char *value = add_or_die(b, TLV_TYPE_HEADER, sizeof(d->header));
+     memcpy(value, &d->header, sizeof(d->header));
+}
+
+/**
+ * Number of waves in a (possibly delta-encoded) sample packet.
+ */
+static uint16_t count_waves(uint16_t type, uint16_t length, const unsigned char *value)
+{
+     const uint8_t *data = value;
+     uint16_t len = length;
+     bool delta = (type == TLV_TYPE_SAMPLES_DELTA);
+     if (type == TLV_TYPE_SAMPLES_MC) {
+	  uint16_t flags;
+	  memcpy(&flags, &value[sizeof(uint16_t)], sizeof(flags));
+	  data = &value[TLV_SAMPLES_MC_HEADER_SIZE];
+	  len -= TLV_SAMPLES_MC_HEADER_SIZE;
+	  delta = (flags & TLV_SAMPLES_MC_DELTA);
+     }
+     
+     if (!delta)
+	  return len/sizeof(uint32_t);
+
+     // Each varint ends with a byte with the most significant bit cleared.
+     uint16_t n = 0;
+     for (uint16_t i = 0; i < len; i++) {
+	  if ((data[i] & 0x80) == 0)
+	       n++;
+     }
+     return n;
+}
+
+/**
+ * Sum up the counters of all channels (each channel is a separate stream
+ * with its own sequence numbers).
+ */
+static void sum_linkseq(linkseq_t *total, const linkseq_t *ls, int n)
+{
+     linkseq_init(total);
+     for (int c = 0; c < n; c++) {
+	  total->packets += ls[c].packets;
+	  total->waves += ls[c].waves;
+	  total->lost_packets += ls[c].lost_packets;
+	  total->lost_waves += ls[c].lost_waves;
+	  total->duplicates += ls[c].duplicates;
+	  total->late += ls[c].late;
+	  total->resyncs += ls[c].resyncs;
+     }
+}
+
+/**
+ * Check size and CRC sum of a received packet.
+ */
+int linkdecode_check(const unsigned char *pkt, size_t pktsize)
+{
+     // Expecting at least packet header (2*uint16_t) + CRC checksum (uint16_t).
+     if (pktsize < 3*sizeof(uint16_t))
+	  return LINKDECODE_SHORT;
+
+     uint16_t crcsum;
+     memcpy(&crcsum, &pkt[pktsize-sizeof(uint16_t)], sizeof(crcsum));
+     if (crc_check_crc16ccitt((uint8_t *) pkt, pktsize-sizeof(uint16_t), crcsum) < 0)
+	  return LINKDECODE_CRC_ERROR;
+
+     return LINKDECODE_OK;
+}
+
+/**
+ * Decode delta-encoded samples of the record of packet p into buffer as
+ * TLV_TYPE_SAMPLES or plain TLV_TYPE_SAMPLES_MC record, like decode_tlv()
+ * but without the limit of MAX_SAMPLE_COUNT samples.
+ */
+static int decode_samples(linkdecode_packet_t *p, unsigned char *buffer)
+{
+     uint16_t type, length;
+     memcpy(&type, p->record, sizeof(type));
+     memcpy(&length, &p->record[sizeof(type)], sizeof(length));
+     const unsigned char *value = &p->record[RECBATCH_HEADER_SIZE];
+
+     // Bytes of the value preceding the samples.
+     size_t offset;
+     uint16_t flags = 0;
+     if (type == TLV_TYPE_SAMPLES_DELTA) {
+	  offset = 0;
+     } else if (type == TLV_TYPE_SAMPLES_MC && length >= TLV_SAMPLES_MC_HEADER_SIZE) {
+	  memcpy(&flags, &value[sizeof(uint16_t)], sizeof(flags));
+	  if (!(flags & TLV_SAMPLES_MC_DELTA))
+	       return 0;
+	  offset = TLV_SAMPLES_MC_HEADER_SIZE;
+     } else {
+	  return 0;
+     }
+
+     uint32_t *samples = (uint32_t *) &buffer[RECBATCH_HEADER_SIZE + offset];
+     int nsamples = deltacodec_decode(&value[offset], length-offset, samples,
+				      (UINT16_MAX-offset)/sizeof(uint32_t));
+     if (nsamples < 0)
+	  return -1;
+
+     if (type == TLV_TYPE_SAMPLES_DELTA) {
+	  type = TLV_TYPE_SAMPLES;
+     } else {
+	  // Channel followed by the flags without the delta flag.
+	  memcpy(&buffer[RECBATCH_HEADER_SIZE], value, sizeof(uint16_t));
+	  flags &= ~TLV_SAMPLES_MC_DELTA;
+	  memcpy(&buffer[RECBATCH_HEADER_SIZE + sizeof(uint16_t)], &flags, sizeof(flags));
+     }
+     length = offset + nsamples*sizeof(uint32_t);
+     memcpy(buffer, &type, sizeof(type));
+     memcpy(&buffer[sizeof(type)], &length, sizeof(length));
+     p->record = buffer;
+     return 0;
+}
+
+/**
+ * Append a record to batch b. Sample records with more than MAX_SAMPLE_COUNT
+ * samples (possible on the serial link, but not readable by read_tlv()) are
+ * split into records of at most MAX_SAMPLE_COUNT samples, which are stored
+ * uncompressed.
+ */
+static void add_record(recbatch_t *b, const unsigned char *record)
+{
+     uint16_t type, length;
+     memcpy(&type, record, sizeof(type));
+     memcpy(&length, &record[sizeof(type)], sizeof(length));
+     const unsigned char *value = &record[RECBATCH_HEADER_SIZE];
+
+     uint16_t nwaves = 0;
+     if (type == TLV_TYPE_SAMPLES || type == TLV_TYPE_SAMPLES_DELTA ||
+	 (type == TLV_TYPE_SAMPLES_MC && length >= TLV_SAMPLES_MC_HEADER_SIZE))
+	  nwaves = count_waves(type, length, value);
+     if (nwaves <= MAX_SAMPLE_COUNT) {
+	  if (recbatch_add_record(b, record) < 0) {
+	       ERROR("Out of memory");
+	       exit(-1);
+	  }
+	  return;
+     }
+
+     // Bytes of the value preceding the samples.
+     size_t offset = 0;
+     uint16_t channel = 0;
+     bool delta = (type == TLV_TYPE_SAMPLES_DELTA);
+     if (type == TLV_TYPE_SAMPLES_MC) {
+	  uint16_t flags;
+	  memcpy(&channel, value, sizeof(channel));
+	  memcpy(&flags, &value[sizeof(uint16_t)], sizeof(flags));
+	  offset = TLV_SAMPLES_MC_HEADER_SIZE;
+	  delta = (flags & TLV_SAMPLES_MC_DELTA);
+     }
+
+     uint32_t samples[UINT16_MAX/sizeof(uint32_t)];
+     int nsamples;
+     if (delta) {
+	  nsamples = deltacodec_decode(&value[offset], length-offset, samples,
+				       UINT16_MAX/sizeof(uint32_t));
+	  if (nsamples < 0) {
+	       WARNING("Invalid compressed samples (ignoring packet)");
+	       return;
+	  }
+     } else {
+	  nsamples = (length-offset)/sizeof(uint32_t);
+	  memcpy(samples, &value[offset], nsamples*sizeof(uint32_t));
+     }
+     for (int i = 0; i < nsamples; i += MAX_SAMPLE_COUNT) {
+	  size_t n = (nsamples-i < MAX_SAMPLE_COUNT) ? nsamples-i : MAX_SAMPLE_COUNT;
+	  tlv_t tlv;
+	  tlv_set_samples(&tlv, channel, &samples[i], n);
+	  if (recbatch_add_tlv(b, &tlv) < 0) {
+	       ERROR("Out of memory");
+	       exit(-1);
+	  }
+     }
+}
+
+/**
+ * Turn a packet (CRC checked) into a tlv element: strip the sequence header
+ * in place, and decode delta-encoded samples into buffer (at least
+ * LINKDECODE_MAX_RECORD_SIZE bytes, aligned like malloc()) unless
+ * keep_compressed is set. p->record points to the resulting tlv element.
+ */
+void linkdecode_prepare(unsigned char *pkt, size_t pktsize, bool keep_compressed, unsigned char *buffer, linkdecode_packet_t *p)
+{
+     // A tlv element is basically a packet stripped off the trailing CRC sum.
+     // Besides the CRC sum, packets and tlv elements have the same structure (type, length, value).
+     uint16_t type, length;
+     memcpy(&type, pkt, sizeof(type));
+     memcpy(&length, &pkt[sizeof(type)], sizeof(length));
+     unsigned char *value = &pkt[RECBATCH_HEADER_SIZE];
+     p->record = pkt;
+     p->seq = false;
+     p->channel = 0;
+     p->nwaves = 0;
+     p->invalid_compressed = false;
+     if (length > pktsize-3*sizeof(uint16_t)) {
+	  p->status = LINKDECODE_INVALID_LENGTH;
+	  return;
+     }
+
+     if (type & LINKSEQ_FLAG) {
+	  // Strip the sequence header, so the packet becomes an ordinary tlv element.
+	  if (length < sizeof(linkseq_header_t)) {
+	       p->status = LINKDECODE_SHORT_SEQ;
+	       return;
+	  }
+	  p->seq = true;
+	  memcpy(&p->hdr, value, sizeof(p->hdr));
+	  type &= ~LINKSEQ_FLAG;
+	  length -= sizeof(p->hdr);
+	  memmove(value, &value[sizeof(p->hdr)], length);
+	  memcpy(pkt, &type, sizeof(type));
+	  memcpy(&pkt[sizeof(type)], &length, sizeof(length));
+
+	  if (type == TLV_TYPE_SAMPLES_MC) {
+	       uint16_t channel = TLV_MAX_CHANNELS;
+	       if (length >= TLV_SAMPLES_MC_HEADER_SIZE)
+		    memcpy(&channel, value, sizeof(channel));
+	       if (channel >= TLV_MAX_CHANNELS) {
+		    p->status = LINKDECODE_INVALID_CHANNEL;
+		    return;
+	       }
+	       p->channel = channel;
+	  }
+	  if (type == TLV_TYPE_SAMPLES || type == TLV_TYPE_SAMPLES_DELTA ||
+	      type == TLV_TYPE_SAMPLES_MC)
+	       p->nwaves = count_waves(type, length, value);
+     }
+
+     if (!keep_compressed && decode_samples(p, buffer) < 0)
+	  p->invalid_compressed = true;
+     p->status = LINKDECODE_OK;
+}
+
+/**
+ * Account for a checked and prepared packet, and append it as tlv element to
+ * batch b, preceded by a GAP element if packets are missing. Packets must be
+ * passed in the order they have been received.
+ */
+void linkdecode_emit(linkdecode_t *d, const linkdecode_packet_t *p, recbatch_t *b)
+{
+     switch (p->status) {
+     case LINKDECODE_SHORT :
+     case LINKDECODE_SHORT_SEQ :
+	  WARNING("Short packet (ignoring packet)");
+	  d->short_packets++;
+	  return;
+     case LINKDECODE_CRC_ERROR :
+	  WARNING("CRC checksum error (ignoring packet)");
+	  d->crc_errors++;
+	  return;
+     case LINKDECODE_INVALID_LENGTH :
+	  WARNING("Invalid packet length (ignoring packet)");
+	  d->short_packets++;
+	  return;
+     case LINKDECODE_INVALID_CHANNEL :
+	  WARNING("Invalid channel (ignoring packet)");
+	  d->short_packets++;
+	  return;
+     }
+
+     if (p->seq) {
+	  // Packets are received at most a second after the last read time
+	  // (see linkdecode_read_time()), accurate enough to count wraps
+	  // of the wave index (2^16 waves).
+	  uint64_t wave_ns = (d->header.f_mains_mhz > 0) ? 1000000000000ull/d->header.f_mains_mhz : 0;
+	  uint32_t missing;
+	  int result = linkseq_check(&d->ls[p->channel], &p->hdr, p->nwaves, d->tlast, wave_ns, &missing);
+	  sum_linkseq(&d->total, d->ls, TLV_MAX_CHANNELS);
+	  switch (result) {
+	  case LINKSEQ_DUPLICATE :
+	       WARNING("Duplicate packet (ignoring packet)");
+	       return;
+	  case LINKSEQ_LATE :
+	       WARNING("Late packet (ignoring packet)");
+	       return;
+	  case LINKSEQ_RESYNC :
+	       WARNING("Sequence numbers restarted (resynchronizing)");
+	       /* fallthrough */
+	  case LINKSEQ_GAP :
+	       if (missing > 0) {
+		    // Tell downstream filters how many waves are missing here.
+		    tlv_t gap;
+		    tlv_set_gap(&gap, p->channel, missing);
+		    if (recbatch_add_tlv(b, &gap) < 0) {
+			 ERROR("Out of memory");
+			 exit(-1);
+		    }
+	       }
+	       break;
+	  }
+     }
+
+     if (p->invalid_compressed) {
+	  WARNING("Invalid compressed samples (ignoring packet)");
+	  return;
+     }
+     add_record(b, p->record);
+}
+
+/**
+ * Wall-clock time t (ns since Unix epoch) at which bytes have been read from
+ * the serial device. About once per second, the time is remembered to be
+ * written after the next valid packet (see linkdecode_timestamp()).
+ * Returns true if the time has been remembered.
+ */
+bool linkdecode_read_time(linkdecode_t *d, uint64_t t)
+{
+     if (t - d->tlast < 1000000000ull)
+	  return false;
+     d->tlast = t;
+     d->tpending = t;
+     return true;
+}
+
+/**
+ * Append the remembered wall-clock timestamp, if any, after a valid packet
+ * (CRC checked) to roughly reference samples to wall-clock time.
+ */
+void linkdecode_timestamp(linkdecode_t *d, recbatch_t *b)
+{
+     if (d->tpending == 0)
+	  return;
+     unsigned char *value = add_or_die(b, TLV_TYPE_WALLCLOCKTIME, sizeof(uint64_t));
+     memcpy(value, &d->tpending, sizeof(uint64_t));
+     d->tpending = 0;
+}
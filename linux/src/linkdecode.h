@@ -0,0 +1,122 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LINKDECODE_H
+#define LINKDECODE_H
+
+/**
+ * Conversion of packets received on the serial link (SLIP decoded) into tlv
+ * elements, shared by pkt-to-tlv-stream (live) and tlv-rawdecode (offline
+ * decoding of raw captures), so both produce identical output.
+ *
+ * Packets are processed in two stages: linkdecode_check() and
+ * linkdecode_prepare() only look at the packet itself, so they can run in
+ * parallel for many packets; linkdecode_emit() checks sequence numbers and
+ * appends the tlv elements to a record batch (see recbatch.h), so it must be
+ * called in packet order. The caller writes the batch, e.g., after all
+ * packets of a read from the serial device.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "tlv.h"
+#include "linkseq.h"
+#include "recbatch.h"
+
+// Options of the HEADER record (see linkdecode_header_option()).
+#define LINKDECODE_HEADER_OPTIONS "F:C:b:i:"
+#define LINKDECODE_HEADER_USAGE \
+     "-F NOMINAL_FREQUENCY : nominal mains frequency in Hz written to the HEADER record (default: 50)\n" \
+     "-C CLOCK_FREQUENCY : nominal clock frequency in Hz written to the HEADER record (default: 42000000)\n" \
+     "-b BATCHSIZE : samples per packet written to the HEADER record (default: 10)\n" \
+     "-i APPLIANCE_ID : id of the measurement appliance written to the HEADER record (default: 0)\n"
+
+// Maximum size of a SLIP decoded packet (longer packets are truncated):
+// the largest tlv element followed by the CRC sum.
+#define LINKDECODE_MAX_PKT_SIZE (RECBATCH_MAX_RECORD_SIZE + sizeof(uint16_t))
+
+// Size of the buffer for records with decoded samples (see linkdecode_prepare()).
+#define LINKDECODE_MAX_RECORD_SIZE RECBATCH_MAX_RECORD_SIZE
+
+// Results of linkdecode_check() and linkdecode_prepare().
+#define LINKDECODE_OK 0
+#define LINKDECODE_SHORT 1           /* shorter than header and CRC sum */
+#define LINKDECODE_CRC_ERROR 2
+#define LINKDECODE_INVALID_LENGTH 3  /* length field exceeds the packet */
+#define LINKDECODE_SHORT_SEQ 4       /* too short for the sequence header */
+#define LINKDECODE_INVALID_CHANNEL 5
+
+typedef struct {
+     int status;
+     // Packet carried a sequence header.
+     bool seq;
+     linkseq_header_t hdr;
+     uint16_t channel;
+     uint16_t nwaves;
+     // Decoding the samples failed; the packet is dropped after the sequence check.
+     bool invalid_compressed;
+     // Tlv element (type, length, value) in the packet buffer, or in the
+     // record buffer if samples have been decoded.
+     unsigned char *record;
+} linkdecode_packet_t;
+
+typedef struct {
+     linkseq_t ls[TLV_MAX_CHANNELS];
+     // Sum of the counters of all channels.
+     linkseq_t total;
+     uint64_t crc_errors;
+     uint64_t short_packets;
+     // Time in ns since Unix epoch of the last wall-clock timestamp, and of the
+     // timestamp to be written after the next valid packet (0 if none).
+     uint64_t tlast;
+     uint64_t tpending;
+     // Written at the start of the stream (nominal values by default).
+     tlv_header_t header;
+} linkdecode_t;
+
+void linkdecode_init(linkdecode_t *d);
+
+void linkdecode_register_stats(linkdecode_t *d);
+
+int linkdecode_header_option(linkdecode_t *d, int c, const char *arg);
+
+void linkdecode_write_header(linkdecode_t *d, recbatch_t *b);
+
+int linkdecode_check(const unsigned char *pkt, size_t pktsize);
+
+void linkdecode_prepare(unsigned char *pkt, size_t pktsize, bool keep_compressed, unsigned char *buffer, linkdecode_packet_t *p);
+
+void linkdecode_emit(linkdecode_t *d, const linkdecode_packet_t *p, recbatch_t *b);
+
+bool linkdecode_read_time(linkdecode_t *d, uint64_t t);
+
+void linkdecode_timestamp(linkdecode_t *d, recbatch_t *b);
+
+#endif
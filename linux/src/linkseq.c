@@ -0,0 +1,145 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "linkseq.h"
+
+void linkseq_init(linkseq_t *ls)
+{
+     ls->initialized = false;
+     ls->next_seq = 0;
+     ls->next_wave = 0;
+     ls->received = 0;
+     ls->tlast = 0;
+     ls->packets = 0;
+     ls->waves = 0;
+     ls->lost_packets = 0;
+     ls->lost_waves = 0;
+     ls->duplicates = 0;
+     ls->late = 0;
+     ls->resyncs = 0;
+}
+
+/**
+ * Number of waves lost between the last packet in sequence and a packet
+ * with nwaves waves received at time t, estimated from the receive times
+ * (-1 if unknown).
+ */
+static int64_t waves_elapsed(const linkseq_t *ls, uint16_t nwaves, uint64_t t, uint64_t wave_ns)
+{
+     if (ls->tlast == 0 || t <= ls->tlast || wave_ns == 0)
+	  return -1;
+     int64_t n = (int64_t) ((t - ls->tlast)/wave_ns) - nwaves;
+     return (n > 0) ? n : 0;
+}
+
+static void start(linkseq_t *ls, const linkseq_header_t *hdr, uint16_t nwaves, uint64_t t)
+{
+     ls->next_seq = hdr->seq+1;
+     ls->next_wave = hdr->wave+nwaves;
+     ls->received = 1;
+     ls->tlast = t;
+     ls->packets++;
+     ls->waves += nwaves;
+}
+
+/**
+ * Check the sequence header of a received packet carrying nwaves samples
+ * (0 for packets other than sample packets), received at time t in ns (0
+ * if unknown). wave_ns is the nominal length of a wave in ns.
+ *
+ * Returns LINKSEQ_GAP and the number of waves lost before this packet
+ * in missing_waves if packets are missing. Duplicate and late packets
+ * should be dropped, since their waves have been accounted for already.
+ * Since wave indices wrap around after 2^16 waves, the receive times are
+ * used to detect longer outages.
+ *
+ * If the sequence number jumps back further than LINKSEQ_WINDOW (the sender
+ * restarted), the check starts over with this packet and returns
+ * LINKSEQ_RESYNC, with the waves lost according to the receive times in
+ * missing_waves.
+ */
+int linkseq_check(linkseq_t *ls, const linkseq_header_t *hdr, uint16_t nwaves, uint64_t t, uint64_t wave_ns,
+		  uint32_t *missing_waves)
+{
+     *missing_waves = 0;
+     
+     if (!ls->initialized) {
+	  ls->initialized = true;
+	  start(ls, hdr, nwaves, t);
+	  return LINKSEQ_OK;
+     }
+
+     // Distance to the expected sequence number (modulo 2^16).
+     int16_t d = (int16_t) (uint16_t) (hdr->seq - ls->next_seq);
+     if (d < 0) {
+	  // Sequence number from the past.
+	  int age = -d-1;
+	  if (age >= LINKSEQ_WINDOW) {
+	       // Too old to be reordered: the sender restarted its counters.
+	       int64_t elapsed = waves_elapsed(ls, nwaves, t, wave_ns);
+	       if (elapsed > 0) {
+		    *missing_waves = (elapsed > UINT32_MAX) ? UINT32_MAX : elapsed;
+		    ls->lost_waves += *missing_waves;
+	       }
+	       ls->resyncs++;
+	       start(ls, hdr, nwaves, t);
+	       return LINKSEQ_RESYNC;
+	  }
+	  if (ls->received & (1ull << age)) {
+	       ls->duplicates++;
+	       return LINKSEQ_DUPLICATE;
+	  }
+	  ls->received |= (1ull << age);
+	  ls->late++;
+	  return LINKSEQ_LATE;
+     }
+
+     int ret = LINKSEQ_OK;
+     if (d > 0) {
+	  ls->lost_packets += d;
+	  uint64_t missing = (uint16_t) (hdr->wave - ls->next_wave);
+	  // Add the wraps of the wave index the receive times account for.
+	  int64_t elapsed = waves_elapsed(ls, nwaves, t, wave_ns);
+	  if (elapsed > (int64_t) missing)
+	       missing += ((elapsed - missing + 0x8000) >> 16) << 16;
+	  *missing_waves = (missing > UINT32_MAX) ? UINT32_MAX : missing;
+	  ls->lost_waves += *missing_waves;
+	  ret = LINKSEQ_GAP;
+     }
+
+     // Shift the window by the number of sequence numbers passed.
+     unsigned int shift = (unsigned int) d + 1;
+     ls->received = (shift < LINKSEQ_WINDOW) ? (ls->received << shift) | 1 : 1;
+     ls->next_seq = hdr->seq+1;
+     ls->next_wave = hdr->wave+nwaves;
+     ls->tlast = t;
+     ls->packets++;
+     ls->waves += nwaves;
+     
+     return ret;
+}
@@ -0,0 +1,85 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LINKSEQ_H
+#define LINKSEQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Flag in the packet type of packets carrying a sequence header.
+// The sequence header precedes the payload of the packet.
+#define LINKSEQ_FLAG 0x8000
+
+// Number of recent sequence numbers remembered to detect duplicates.
+#define LINKSEQ_WINDOW 64
+
+typedef struct __attribute__((__packed__)) {
+     // Packet counter (incremented for every packet sent).
+     uint16_t seq;
+     // Index of the first wave in a sample packet, or of the first wave
+     // of the next sample packet for other packets (modulo 2^16).
+     uint16_t wave;
+} linkseq_header_t;
+
+// Results of linkseq_check().
+#define LINKSEQ_OK 0        /* expected packet */
+#define LINKSEQ_GAP 1       /* packets have been lost before this packet */
+#define LINKSEQ_DUPLICATE 2 /* packet has been received before */
+#define LINKSEQ_LATE 3      /* packet arrived after later packets (reordered) */
+#define LINKSEQ_RESYNC 4    /* sequence numbers jumped back beyond the window (sender restarted) */
+
+/**
+ * Detection of lost, duplicated, and reordered packets on the serial link,
+ * with loss counters.
+ */
+typedef struct {
+     bool initialized;
+     // Next expected sequence number and wave index.
+     uint16_t next_seq;
+     uint16_t next_wave;
+     // Bit i is set if sequence number next_seq-1-i has been received.
+     uint64_t received;
+     // Receive time in ns of the last packet in sequence (0 if unknown).
+     uint64_t tlast;
+     
+     uint64_t packets;
+     uint64_t waves;
+     uint64_t lost_packets;
+     uint64_t lost_waves;
+     uint64_t duplicates;
+     uint64_t late;
+     uint64_t resyncs;
+} linkseq_t;
+
+void linkseq_init(linkseq_t *ls);
+
+int linkseq_check(linkseq_t *ls, const linkseq_header_t *hdr, uint16_t nwaves, uint64_t t, uint64_t wave_ns,
+		  uint32_t *missing_waves);
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MAINSFREQ_H
+#define MAINSFREQ_H
+
+/**
+ * C interface of libmainsfreq, a library for reading TLV recordings directly
+ * into column arrays (e.g., from Python via ctypes).
+ *
+ * Usage:
+ *   mf_reader_t *r = mf_open("recording.tlv");
+ *   mf_select(r, tstart, tend);       // optional; default: everything
+ *   mf_select_channel(r, channel);    // optional; default: channel 0
+ *   int64_t n = mf_count(r);
+ *   ... allocate arrays of n elements ...
+ *   mf_read(r, ticks, f_mains_syncd, f_clk_syncd, t_wallclock, n);
+ *   mf_close(r);
+ *
+ * The values are calculated like by filter-convert_to_csv. If a zone map
+ * (see tlv-index) exists for the recording, blocks outside of the selected
+ * time range are skipped.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Incremented on incompatible changes of the interface.
+#define MF_ABI_VERSION 1
+
+typedef struct mf_reader mf_reader_t;
+
+int mf_abi_version(void);
+
+mf_reader_t *mf_open(const char *path);
+
+void mf_close(mf_reader_t *r);
+
+int mf_select(mf_reader_t *r, uint64_t tstart, uint64_t tend);
+
+int mf_select_channel(mf_reader_t *r, uint16_t channel);
+
+int64_t mf_count(mf_reader_t *r);
+
+int64_t mf_read(mf_reader_t *r, uint32_t *ticks, double *f_mains_syncd, uint32_t *f_clk_syncd, uint64_t *t_wallclock, size_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
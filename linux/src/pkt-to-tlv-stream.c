@@ -26,40 +26,286 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
 #include "tty.h"
 #include "slip.h"
-#include "crc.h"
 #include "tlv.h"
+#include "linkdecode.h"
+#include "recbatch.h"
+#include "rtcapture.h"
+#include "stats.h"
+#include "slipenc.h"
+#include "arq.h"
 
 #define MAX_PATH_SIZE 1000
 
-#define MAX_PKT_SIZE 9000
-
 #define WARNING(m) (fprintf(stderr, "Warning: " m "\n"))
 #define ERROR(m) (fprintf(stderr, "Error: " m "\n"))
 
+// ARQ: give up on a missing packet after this time, and repeat NACKs after this time.
+#define ARQ_TIMEOUT_MS 1000
+#define ARQ_RETRY_MS 200
+
+// Raw capture: size of reads from the serial device, and default length of segment files.
+#define RAW_BUFFER_SIZE 65536
+#define RAW_SEGMENT_SECONDS 3600
+
+linkdecode_t decoder;
+rtcapture_t rt;
+bool keep_compressed = false;
+
+// Records of the packets of the current read from the serial device, and
+// buffer for records with decoded samples.
+recbatch_t batch;
+unsigned char *record_buffer;
+
+typedef struct {
+     uint8_t *data;
+     size_t len;
+} buffer_t;
+
 void usage(const char *app)
 {
      fprintf(stderr, "USAGE: %s "
 	     "-d DEVICE "
 	     "-s BAUDRATE "
-	     "\n", app);
+	     "[-z] "
+	     "[-a] "
+	     "[-r PREFIX [-R SECONDS]] "
+	     "[-F NOMINAL_FREQUENCY] [-C CLOCK_FREQUENCY] [-b BATCHSIZE] [-i APPLIANCE_ID] "
+	     "[-P POLICY:PRIORITY] [-A CPUS] [-M] [-V VMIN] [-T VTIME] [-L] "
+	     "[--stats[=FILE]] "
+	     "\n"
+	     "-z : write delta-encoded sample packets as compressed TLV records (default: decode)\n"
+	     "-a : request retransmissions of lost packets from the firmware (ARQ; requires sequence numbers)\n"
+	     "-r : capture the raw byte stream to segment files PREFIX-NNNNNN.raw with wall-clock timestamps in PREFIX-NNNNNN.ts instead of decoding it (see tlv-rawdecode)\n"
+	     "-R : start a new segment file after SECONDS (default: %d)\n"
+	     LINKDECODE_HEADER_USAGE
+	     RTCAPTURE_USAGE
+	     "--stats : report link statistics (packets, CRC errors, lost packets and waves) and wake-up latencies of the reader on SIGUSR1 and at exit\n", app, RAW_SEGMENT_SECONDS);
+}
+
+/**
+ * Write the records of the batch to stdout.
+ */
+void flush_batch()
+{
+     if (recbatch_write(&batch, stdout) != 0 || fflush(stdout) != 0) {
+	  ERROR("Error while writing tlv to stdout");
+	  exit(-1);
+     }
+     recbatch_clear(&batch);
+}
+
+/**
+ * Check the sequence header of a received packet (CRC checked) and add it
+ * as tlv element to the batch, preceded by a GAP element if packets are missing.
+ */
+void process_packet(unsigned char *pkt, size_t pktsize)
+{
+     linkdecode_packet_t p;
+     linkdecode_prepare(pkt, pktsize, keep_compressed, record_buffer, &p);
+     linkdecode_emit(&decoder, &p, &batch);
+}
+
+uint64_t now_ns()
+{
+     struct timespec tspec;
+     clock_gettime(CLOCK_REALTIME, &tspec);
+     // Time in nano-seconds since Unix epoch.
+     return 1000000000ull*tspec.tv_sec + tspec.tv_nsec;
+}
+
+/**
+ * Timestamp the bytes read from the serial device, so a wall-clock timestamp
+ * is written after the next valid packet about once per second.
+ */
+void read_hook(const unsigned char *data, size_t len, void *ctx)
+{
+     (void) data;
+     (void) len;
+     linkdecode_read_time((linkdecode_t *) ctx, now_ns());
+}
+
+/**
+ * Before waiting for input from the serial device (measuring the wake-up
+ * latency), write the records of the packets of the last read at once.
+ */
+int wait_hook(int fd, void *ctx)
+{
+     flush_batch();
+     return rtcapture_wait((rtcapture_t *) ctx, fd);
+}
+
+uint32_t now_ms()
+{
+     struct timespec tspec;
+     clock_gettime(CLOCK_MONOTONIC, &tspec);
+     return (uint32_t) (1000ull*tspec.tv_sec + tspec.tv_nsec/1000000);
+}
+
+/**
+ * Process all packets the ARQ receiver can release in sequence order.
+ */
+void process_released(arq_receiver_t *arq, uint32_t now)
+{
+     static unsigned char pkt[LINKDECODE_MAX_PKT_SIZE];
+     size_t pktsize;
+     while ((pktsize = arq_receiver_get(arq, pkt, sizeof(pkt), now)) > 0)
+	  process_packet(pkt, pktsize);
+}
+
+/**
+ * Output function of the SLIP encoder for NACKs.
+ */
+void put_byte(uint8_t b, void *ctx)
+{
+     buffer_t *buf = (buffer_t *) ctx;
+     buf->data[buf->len++] = b;
+}
+
+/**
+ * Send a NACK packet to the firmware if packets are missing.
+ */
+void send_nack(int fd, arq_receiver_t *arq, uint32_t now)
+{
+     uint8_t nack[ARQ_MAX_NACK_PKTSIZE];
+     size_t len = arq_receiver_nack(arq, nack, sizeof(nack), now);
+     if (len == 0)
+	  return;
+     
+     // SLIP encoding at most doubles the size (plus two END characters).
+     uint8_t data[2*ARQ_MAX_NACK_PKTSIZE+2];
+     buffer_t buf = { data, 0 };
+     slipenc_send(nack, len, put_byte, &buf);
+     size_t off = 0;
+     while (off < buf.len) {
+	  ssize_t n = write(fd, &buf.data[off], buf.len-off);
+	  if (n < 0) {
+	       if (errno == EINTR)
+		    continue;
+	       ERROR("Could not send NACK");
+	       exit(-1);
+	  }
+	  off += n;
+     }
+}
+
+/**
+ * Open the next unused segment files PREFIX-NNNNNN.raw and PREFIX-NNNNNN.ts.
+ */
+void open_segment(const char *prefix, unsigned int *segment, int *fdraw, FILE **fts)
+{
+     char path[MAX_PATH_SIZE+16];
+     while (1) {
+	  snprintf(path, sizeof(path), "%s-%06u.raw", prefix, *segment);
+	  *fdraw = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	  if (*fdraw >= 0)
+	       break;
+	  if (errno != EEXIST) {
+	       ERROR("Could not create raw capture file");
+	       exit(-1);
+	  }
+	  // Do not overwrite segments of earlier captures.
+	  (*segment)++;
+     }
+     snprintf(path, sizeof(path), "%s-%06u.ts", prefix, *segment);
+     if ( (*fts = fopen(path, "w")) == NULL) {
+	  ERROR("Could not create timestamp file");
+	  exit(-1);
+     }
+     (*segment)++;
+}
+
+/**
+ * Write the raw byte stream from the serial device to segment files without
+ * decoding it. Each line of the timestamp file of a segment holds the offset
+ * of a read in the segment and the wall-clock time of the read in ns, about
+ * once per second (the reads after which pkt-to-tlv-stream would write a
+ * wall-clock timestamp), so tlv-rawdecode reproduces the live output.
+ */
+void capture_raw(int fd, const char *prefix, unsigned int segment_seconds)
+{
+     static uint64_t bytes = 0;
+     static uint64_t segments = 0;
+     stats_register_counter("bytes", &bytes);
+     stats_register_counter("segments", &segments);
+
+     static unsigned char buffer[RAW_BUFFER_SIZE];
+     unsigned int segment = 0;
+     int fdraw = -1;
+     FILE *fts = NULL;
+     uint64_t offset = 0;
+     uint64_t tsegment = 0;
+     while (1) {
+	  if (rtcapture_wait(&rt, fd) < 0) {
+	       ERROR("Could not wait for serial device");
+	       exit(-1);
+	  }
+	  ssize_t n = read(fd, buffer, sizeof(buffer));
+	  if (n < 0 && errno == EINTR)
+	       continue;
+	  if (n <= 0) {
+	       ERROR("Could not read from serial device");
+	       exit(-1);
+	  }
+	  uint64_t t = now_ns();
+
+	  if (fdraw < 0 || t - tsegment >= segment_seconds*1000000000ull) {
+	       if (fdraw >= 0) {
+		    close(fdraw);
+		    fclose(fts);
+	       }
+	       open_segment(prefix, &segment, &fdraw, &fts);
+	       segments++;
+	       offset = 0;
+	       tsegment = t;
+	  }
+
+	  if (linkdecode_read_time(&decoder, t)) {
+	       fprintf(fts, "%" PRIu64 " %" PRIu64 "\n", offset, t);
+	       fflush(fts);
+	  }
+	  for (ssize_t off = 0; off < n; ) {
+	       ssize_t m = write(fdraw, &buffer[off], n-off);
+	       if (m < 0) {
+		    if (errno == EINTR)
+			 continue;
+		    ERROR("Could not write raw capture file");
+		    exit(-1);
+	       }
+	       off += m;
+	  }
+	  offset += n;
+	  bytes += n;
+     }
 }
 
 int main(int argc, char *argv[])
 {
+     stats_init(&argc, argv);
+     
      char ttydev[MAX_PATH_SIZE];
      speed_t ttyspeed;
+     bool use_arq = false;
+     char rawprefix[MAX_PATH_SIZE];
+     int segment_seconds = RAW_SEGMENT_SECONDS;
      
      int c;
      int intarg;
      memset(ttydev, 0, MAX_PATH_SIZE);
-     while ((c = getopt (argc, argv, "d:s:")) != -1) {
+     memset(rawprefix, 0, MAX_PATH_SIZE);
+     linkdecode_init(&decoder);
+     rtcapture_init(&rt);
+     while ((c = getopt (argc, argv, "d:s:zar:R:" LINKDECODE_HEADER_OPTIONS RTCAPTURE_OPTIONS)) != -1) {
 	  switch (c) {
 	  case 'd' :
 	       strncpy(ttydev, optarg, MAX_PATH_SIZE-1);
@@ -92,13 +338,46 @@ int main(int argc, char *argv[])
 		    ttyspeed = B0;
 	       }
 	       break;
+	  case 'z' :
+	       keep_compressed = true;
+	       break;
+	  case 'a' :
+	       use_arq = true;
+	       break;
+	  case 'r' :
+	       strncpy(rawprefix, optarg, MAX_PATH_SIZE-1);
+	       break;
+	  case 'R' :
+	       segment_seconds = atoi(optarg);
+	       break;
+	  case 'F' :
+	  case 'C' :
+	  case 'b' :
+	  case 'i' :
+	       if (linkdecode_header_option(&decoder, c, optarg) < 0) {
+		    usage(argv[0]);
+		    exit(-1);
+	       }
+	       break;
+	  case 'P' :
+	  case 'A' :
+	  case 'M' :
+	  case 'V' :
+	  case 'T' :
+	  case 'L' :
+	       if (rtcapture_option(&rt, c, optarg) < 0) {
+		    usage(argv[0]);
+		    exit(-1);
+	       }
+	       break;
 	  case '?':
 	  default :
 	       usage(argv[0]);
 	       exit(-1);
 	  }
      }
-     if (strlen(ttydev) == 0 || ttyspeed == B0) {
+     if (strlen(ttydev) == 0 || ttyspeed == B0 || segment_seconds <= 0 ||
+	 (strlen(rawprefix) > 0 && use_arq)) {
 	  usage(argv[0]);
 	  exit(-1);
      }
@@ -108,55 +387,77 @@ int main(int argc, char *argv[])
 	  ERROR("Could not init serial device");
 	  exit(-1);
      }
+     if (rtcapture_apply(&rt, fdserial) < 0)
+	  exit(-1);
+     rtcapture_register_stats(&rt);
+
+     if (strlen(rawprefix) > 0) {
+	  capture_raw(fdserial, rawprefix, segment_seconds);
+	  return 0;
+     }
+     linkdecode_register_stats(&decoder);
+     recbatch_init(&batch);
+     if ( (record_buffer = malloc(LINKDECODE_MAX_RECORD_SIZE)) == NULL) {
+	  ERROR("Out of memory");
+	  exit(-1);
+     }
+     linkdecode_write_header(&decoder, &batch);
+     flush_batch();
 
-     unsigned char pkt[MAX_PKT_SIZE];
-     // Time since Unix epoch when last wall-clock timestamp was sent.
-     uint64_t tlast = 0; 
+     // Static because of its size (buffered packets of all channels).
+     static arq_receiver_t arq;
+     arq_receiver_init(&arq, ARQ_TIMEOUT_MS, ARQ_RETRY_MS);
+     if (use_arq) {
+	  stats_register_counter("nacks", &arq.nacks);
+	  stats_register_counter("requested", &arq.requested);
+	  stats_register_counter("recovered", &arq.recovered);
+	  stats_register_counter("given_up", &arq.given_up);
+     }
+     
+     slip_set_read_hook(read_hook, &decoder);
+     slip_set_wait_hook(wait_hook, &rt);
+     // Large enough for a packet with the largest tlv element.
+     static unsigned char pkt[LINKDECODE_MAX_PKT_SIZE];
      while (1) {
-	  ssize_t pktsize = slip_recvpkt(fdserial, pkt, MAX_PKT_SIZE);
+	  ssize_t pktsize = slip_recvpkt(fdserial, pkt, LINKDECODE_MAX_PKT_SIZE);
 	  if (pktsize < 0) {
+	       if (use_arq) {
+		    // Do not keep packets waiting for missing packets, which
+		    // will not arrive anymore.
+		    process_released(&arq, now_ms() + ARQ_TIMEOUT_MS);
+	       }
+	       flush_batch();
 	       ERROR("Could not receive packet");
 	       exit(-1);
-	  } else if (pktsize < 3*sizeof(uint16_t)) {
-	       // Expecting at least packet header (2*uint16_t) + CRC checksum (uint16_t).
-	       WARNING("Short packet (ignoring packet)");
-	       continue;
 	  }
-	  
-	  // Received a packet with at least header and CRC sum.
-	  uint16_t *crcsum = (uint16_t *) &pkt[pktsize-sizeof(uint16_t)];
-	  if (crc_check_crc16ccitt(pkt, pktsize-sizeof(uint16_t), *crcsum) < 0) {
-	       WARNING("CRC checksum error (ignoring packet)");
+
+	  int status = linkdecode_check(pkt, pktsize);
+	  if (status != LINKDECODE_OK) {
+	       linkdecode_packet_t p = { .status = status };
+	       linkdecode_emit(&decoder, &p, &batch);
 	       continue;
 	  }
 
-	  // A tlv element is basically a packet stripped off the trailing CRC sum.
-	  // Besides the CRC sum, packets and tlv elements have the same structure (type, length, value).
-	  // Therfore, we can simply overlay a tlv structure over the packet. 
-	  tlv_t *tlv = (tlv_t *) pkt;
-	  if (write_tlv(tlv, stdout) != 0) {
-	       ERROR("Error while writing tlv to stdout");
-	       exit(-1);
-	  }
-	  fflush(stdout);
-	       
-	  // Each second write a wall-clock timestamp to roughly reference samples to wall-clock time.     
-	  struct timespec tspec;
-	  clock_gettime(CLOCK_REALTIME, &tspec);
-	  // Time in nano-seconds since Unix epoch.
-	  uint64_t tnow = 1000000000ull*tspec.tv_sec + tspec.tv_nsec;
-	  if (tnow - tlast >= 1000000000ull) {
-	       tlv_t tlv;
-	       tlv.type = TLV_TYPE_WALLCLOCKTIME;
-	       tlv.length = sizeof(uint64_t);
-	       tlv.value.wallclocktime = tnow;
-	       if (write_tlv(&tlv, stdout) != 0) {
-		    ERROR("Could not send wallclock timestamp");
-		    exit(-1);
-	       }
-	       fflush(stdout);
-	       tlast = tnow;
+	  // Received a packet with at least header and valid CRC sum.
+	  if (!use_arq) {
+	       process_packet(pkt, pktsize);
+	  } else {
+	       // Packets are processed in sequence order after missing packets have
+	       // been retransmitted or given up. Since receiving blocks, timeouts
+	       // are checked whenever a packet arrives.
+	       uint32_t now = now_ms();
+	       int result;
+	       while ( (result = arq_receiver_put(&arq, pkt, pktsize, now)) == ARQ_BLOCKED)
+		    process_released(&arq, now);
+	       if (result == ARQ_PASS)
+		    process_packet(pkt, pktsize);
+	       process_released(&arq, now);
+	       send_nack(fdserial, &arq, now);
 	  }
+
+	  // Each second write a wall-clock timestamp (taken when the packet was
+	  // read) to roughly reference samples to wall-clock time.
+	  linkdecode_timestamp(&decoder, &batch);
      }
      
      return 0;
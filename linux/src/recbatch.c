@@ -0,0 +1,137 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "recbatch.h"
+#include "stats.h"
+
+// Initial size of the arena.
+#define RECBATCH_INITIAL_SIZE (64*1024)
+
+void recbatch_init(recbatch_t *b)
+{
+     b->data = NULL;
+     b->len = 0;
+     b->size = 0;
+     b->count = 0;
+}
+
+void recbatch_free(recbatch_t *b)
+{
+     free(b->data);
+     recbatch_init(b);
+}
+
+/**
+ * Remove all records, keeping the arena for the next batch.
+ */
+void recbatch_clear(recbatch_t *b)
+{
+     b->len = 0;
+     b->count = 0;
+}
+
+static int reserve(recbatch_t *b, size_t size)
+{
+     if (b->len + size <= b->size)
+	  return 0;
+     size_t newsize = (b->size == 0) ? RECBATCH_INITIAL_SIZE : 2*b->size;
+     while (newsize < b->len + size)
+	  newsize *= 2;
+     unsigned char *data = realloc(b->data, newsize);
+     if (data == NULL)
+	  return -1;
+     b->data = data;
+     b->size = newsize;
+     return 0;
+}
+
+/**
+ * Append a record with a value of length bytes. Returns a pointer to the
+ * (uninitialized) value, which stays valid until the next record is added,
+ * or NULL if the value is too long or memory is exhausted.
+ */
+unsigned char *recbatch_add(recbatch_t *b, uint16_t type, size_t length)
+{
+     if (length > UINT16_MAX || reserve(b, RECBATCH_HEADER_SIZE + length) < 0)
+	  return NULL;
+     uint16_t len = (uint16_t) length;
+     unsigned char *p = &b->data[b->len];
+     memcpy(p, &type, sizeof(type));
+     memcpy(p+sizeof(type), &len, sizeof(len));
+     b->len += RECBATCH_HEADER_SIZE + length;
+     b->count++;
+     return p+RECBATCH_HEADER_SIZE;
+}
+
+/**
+ * Append a copy of a complete record (type, length, value).
+ */
+int recbatch_add_record(recbatch_t *b, const unsigned char *record)
+{
+     uint16_t type, length;
+     memcpy(&type, record, sizeof(type));
+     memcpy(&length, record+sizeof(type), sizeof(length));
+     unsigned char *value = recbatch_add(b, type, length);
+     if (value == NULL)
+	  return -1;
+     memcpy(value, record+RECBATCH_HEADER_SIZE, length);
+     return 0;
+}
+
+int recbatch_add_tlv(recbatch_t *b, const tlv_t *tlv)
+{
+     return recbatch_add_record(b, (const unsigned char *) tlv);
+}
+
+/**
+ * Iterate over the records of a batch, starting with *pos = 0. Returns
+ * false after the last record.
+ */
+bool recbatch_next(const recbatch_t *b, size_t *pos, uint16_t *type, uint16_t *length, const unsigned char **value)
+{
+     if (*pos + RECBATCH_HEADER_SIZE > b->len)
+	  return false;
+     const unsigned char *p = &b->data[*pos];
+     memcpy(type, p, sizeof(*type));
+     memcpy(length, p+sizeof(*type), sizeof(*length));
+     *value = p+RECBATCH_HEADER_SIZE;
+     *pos += RECBATCH_HEADER_SIZE + *length;
+     return true;
+}
+
+/**
+ * Write all records of the batch with a single call.
+ */
+int recbatch_write(const recbatch_t *b, FILE *f)
+{
+     if (b->len == 0)
+	  return 0;
+     return stats_write_records(b->data, b->len, b->count, f);
+}
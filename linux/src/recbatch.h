@@ -0,0 +1,79 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RECBATCH_H
+#define RECBATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "tlv.h"
+
+/**
+ * Batches of tlv records stored back to back in a reusable arena in the
+ * format of tlv streams (uint16_t type, uint16_t length, value), so a
+ * whole batch is written with a single call, and records only take
+ * the space of their value. Unlike tlv_t, a record is only limited by its
+ * 16 bit length field (e.g., 16383 samples instead of MAX_SAMPLE_COUNT).
+ *
+ * Values are stored unaligned; use memcpy() to access them. The arena
+ * grows as needed and is kept when the batch is cleared.
+ */
+
+#define RECBATCH_HEADER_SIZE (2*sizeof(uint16_t))
+
+// Size of the largest record (header and value).
+#define RECBATCH_MAX_RECORD_SIZE (RECBATCH_HEADER_SIZE + UINT16_MAX)
+
+typedef struct {
+     unsigned char *data;
+     // Bytes used and allocated.
+     size_t len;
+     size_t size;
+     // Number of records.
+     size_t count;
+} recbatch_t;
+
+void recbatch_init(recbatch_t *b);
+
+void recbatch_free(recbatch_t *b);
+
+void recbatch_clear(recbatch_t *b);
+
+unsigned char *recbatch_add(recbatch_t *b, uint16_t type, size_t length);
+
+int recbatch_add_record(recbatch_t *b, const unsigned char *record);
+
+int recbatch_add_tlv(recbatch_t *b, const tlv_t *tlv);
+
+bool recbatch_next(const recbatch_t *b, size_t *pos, uint16_t *type, uint16_t *length, const unsigned char **value);
+
+int recbatch_write(const recbatch_t *b, FILE *f);
+
+#endif
@@ -0,0 +1,234 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "rtcapture.h"
+#include "tty.h"
+#include "stats.h"
+#include "errandwarn.h"
+
+static uint64_t now_ns()
+{
+     struct timespec t;
+     clock_gettime(CLOCK_MONOTONIC, &t);
+     return 1000000000ull*t.tv_sec + t.tv_nsec;
+}
+
+void rtcapture_init(rtcapture_t *rt)
+{
+     memset(rt, 0, sizeof(*rt));
+     rt->policy = SCHED_OTHER;
+     rt->vmin = -1;
+     rt->vtime = -1;
+}
+
+/**
+ * Parse a list of CPUs like "0,2-3" into a bit mask.
+ */
+static int parse_cpus(const char *arg, uint64_t *cpus)
+{
+     *cpus = 0;
+     const char *s = arg;
+     while (*s != '\0') {
+	  char *end;
+	  long first = strtol(s, &end, 10);
+	  long last = first;
+	  if (end == s)
+	       return -1;
+	  if (*end == '-') {
+	       s = end+1;
+	       last = strtol(s, &end, 10);
+	       if (end == s)
+		    return -1;
+	  }
+	  if (first < 0 || last < first || last >= 64)
+	       return -1;
+	  for (long cpu = first; cpu <= last; cpu++)
+	       *cpus |= 1ull << cpu;
+	  if (*end == ',')
+	       end++;
+	  else if (*end != '\0')
+	       return -1;
+	  s = end;
+     }
+     return (*cpus != 0) ? 0 : -1;
+}
+
+/**
+ * Handle the command line option c with argument arg. Returns 1 if the
+ * option was handled, 0 if it is not an option of the capture runtime, and
+ * -1 if the argument is invalid.
+ */
+int rtcapture_option(rtcapture_t *rt, int c, const char *arg)
+{
+     const char *prio;
+     switch (c) {
+     case 'P' :
+	  if (strncmp(arg, "fifo:", 5) == 0)
+	       rt->policy = SCHED_FIFO;
+	  else if (strncmp(arg, "rr:", 3) == 0)
+	       rt->policy = SCHED_RR;
+	  else
+	       return -1;
+	  prio = strchr(arg, ':')+1;
+	  rt->priority = atoi(prio);
+	  if (rt->priority < sched_get_priority_min(rt->policy) ||
+	      rt->priority > sched_get_priority_max(rt->policy))
+	       return -1;
+	  return 1;
+     case 'A' :
+	  return (parse_cpus(arg, &rt->cpus) == 0) ? 1 : -1;
+     case 'M' :
+	  rt->lock_memory = true;
+	  return 1;
+     case 'V' :
+	  rt->vmin = atoi(arg);
+	  return (rt->vmin >= 0 && rt->vmin <= 255) ? 1 : -1;
+     case 'T' :
+	  rt->vtime = atoi(arg);
+	  return (rt->vtime >= 0 && rt->vtime <= 255) ? 1 : -1;
+     case 'L' :
+	  rt->low_latency = true;
+	  return 1;
+     }
+     return 0;
+}
+
+/**
+ * Apply the requested settings to the calling process (the reader) and the
+ * serial device fd. Returns -1 if a setting could not be applied (e.g.,
+ * missing privileges for real-time scheduling).
+ */
+int rtcapture_apply(rtcapture_t *rt, int fd)
+{
+     if (rt->vmin >= 0 || rt->vtime >= 0) {
+	  if (tty_set_read_timing(fd, rt->vmin, rt->vtime) < 0) {
+	       ERROR("Could not set VMIN/VTIME of serial device");
+	       return -1;
+	  }
+     }
+
+     // Not all drivers support this flag (e.g., USB CDC ACM devices have
+     // no latency timer), so only warn.
+     if (rt->low_latency && tty_set_low_latency(fd) < 0)
+	  WARNING("Could not set ASYNC_LOW_LATENCY on serial device");
+
+     if (rt->lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+	  ERROR("Could not lock memory");
+	  return -1;
+     }
+
+     if (rt->cpus != 0) {
+#ifdef __linux__
+	  cpu_set_t set;
+	  CPU_ZERO(&set);
+	  for (int cpu = 0; cpu < 64; cpu++) {
+	       if (rt->cpus & (1ull << cpu))
+		    CPU_SET(cpu, &set);
+	  }
+	  if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+	       ERROR("Could not set CPU affinity");
+	       return -1;
+	  }
+#else
+	  ERROR("CPU affinity is not supported on this platform");
+	  return -1;
+#endif
+     }
+
+     if (rt->policy != SCHED_OTHER) {
+	  struct sched_param param = { .sched_priority = rt->priority };
+	  if (sched_setscheduler(0, rt->policy, &param) < 0) {
+	       ERROR("Could not set real-time scheduling (missing CAP_SYS_NICE?)");
+	       return -1;
+	  }
+     }
+
+     return 0;
+}
+
+void rtcapture_register_stats(rtcapture_t *rt)
+{
+     stats_register_counter("wakeup_probes", &rt->probes);
+     stats_register_counter("wakeup_avg_us", &rt->latency_avg_us);
+     stats_register_counter("wakeup_max_us", &rt->latency_max_us);
+     stats_register_counter("wakeup_over_1ms", &rt->over_1ms);
+     stats_register_counter("wakeup_over_10ms", &rt->over_10ms);
+}
+
+static void record_latency(rtcapture_t *rt, uint64_t latency)
+{
+     rt->probes++;
+     rt->latency_sum += latency;
+     rt->latency_avg_us = rt->latency_sum/rt->probes/1000;
+     if (latency/1000 > rt->latency_max_us)
+	  rt->latency_max_us = latency/1000;
+     if (latency > 1000000)
+	  rt->over_1ms++;
+     if (latency > 10000000)
+	  rt->over_10ms++;
+}
+
+/**
+ * Wait until the serial device fd is readable, recording the wake-up
+ * latency of probes that expire while waiting. Returns -1 on errors.
+ */
+int rtcapture_wait(rtcapture_t *rt, int fd)
+{
+     const uint64_t period = RTCAPTURE_PROBE_MS*1000000ull;
+     struct pollfd pfd = { .fd = fd, .events = POLLIN };
+     while (1) {
+	  uint64_t t = now_ns();
+	  // A deadline that passed while the reader was busy (not waiting)
+	  // says nothing about wake-ups; start a new probe.
+	  if (rt->deadline <= t)
+	       rt->deadline = t + period;
+	  uint64_t dt = rt->deadline - t;
+	  struct timespec timeout = { .tv_sec = dt/1000000000ull, .tv_nsec = dt%1000000000ull };
+	  int n = ppoll(&pfd, 1, &timeout, NULL);
+	  if (n < 0) {
+	       if (errno == EINTR)
+		    continue;
+	       return -1;
+	  }
+	  if (n > 0)
+	       return 0;
+
+	  // Probe expired.
+	  t = now_ns();
+	  record_latency(rt, (t > rt->deadline) ? t - rt->deadline : 0);
+	  rt->deadline += period;
+     }
+}
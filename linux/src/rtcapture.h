@@ -0,0 +1,94 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RTCAPTURE_H
+#define RTCAPTURE_H
+
+/**
+ * Runtime settings of the serial reader of pkt-to-tlv-stream for capturing
+ * on a host that is busy with other work: real-time scheduling, CPU
+ * affinity, locked memory, and tty read settings.
+ *
+ * The reader waits for input with rtcapture_wait(), which also measures the
+ * wake-up latency of the reader: while no input arrives, the reader wakes
+ * up every RTCAPTURE_PROBE_MS ms at an absolute deadline, and the delay
+ * between the deadline and the time the reader runs again is recorded.
+ * Scheduling delays of the reader show up in this delay just like in the
+ * reaction to input, so the measurement shows whether the capture keeps up
+ * under load.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Options of the capture runtime (see rtcapture_option()).
+#define RTCAPTURE_OPTIONS "P:A:MV:T:L"
+#define RTCAPTURE_USAGE \
+     "-P POLICY:PRIORITY : real-time scheduling of the reader, POLICY fifo or rr (e.g., fifo:50)\n" \
+     "-A CPUS : pin the reader to the given CPUs (e.g., 3 or 0,2-3)\n" \
+     "-M : lock all memory to avoid page faults (mlockall)\n" \
+     "-V VMIN : minimum number of bytes of a read from the serial device (default: 1)\n" \
+     "-T VTIME : timeout of a read in 0.1 s once a byte arrived (default: 0)\n" \
+     "-L : set ASYNC_LOW_LATENCY on the serial device\n"
+
+// Period of the wake-up latency probes.
+#define RTCAPTURE_PROBE_MS 100
+
+typedef struct {
+     // SCHED_OTHER if no real-time scheduling is requested.
+     int policy;
+     int priority;
+     // CPUs 0-63 the reader is pinned to (0 if not pinned).
+     uint64_t cpus;
+     bool lock_memory;
+     // Negative values keep the tty settings of tty_init_raw().
+     int vmin;
+     int vtime;
+     bool low_latency;
+     // Absolute deadline of the next probe (CLOCK_MONOTONIC, ns).
+     uint64_t deadline;
+     uint64_t latency_sum;
+     // Wake-up latency statistics.
+     uint64_t probes;
+     uint64_t latency_avg_us;
+     uint64_t latency_max_us;
+     uint64_t over_1ms;
+     uint64_t over_10ms;
+} rtcapture_t;
+
+void rtcapture_init(rtcapture_t *rt);
+
+int rtcapture_option(rtcapture_t *rt, int c, const char *arg);
+
+int rtcapture_apply(rtcapture_t *rt, int fd);
+
+void rtcapture_register_stats(rtcapture_t *rt);
+
+int rtcapture_wait(rtcapture_t *rt, int fd);
+
+#endif
@@ -0,0 +1,168 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include "samplekernels.h"
+
+/**
+ * Frequencies of waves with the given lengths in ticks of a clock with frequency fclk.
+ */
+void kernel_frequencies(const uint32_t *restrict ticks, size_t n, double fclk, double *restrict f)
+{
+     for (size_t i = 0; i < n; i++)
+	  f[i] = fclk/ticks[i];
+}
+
+/**
+ * mask[i] = 1 if lo <= x[i] <= hi, else 0.
+ */
+void kernel_inrange(const double *restrict x, size_t n, double lo, double hi, uint8_t *restrict mask)
+{
+     for (size_t i = 0; i < n; i++)
+	  mask[i] = (x[i] >= lo) & (x[i] <= hi);
+}
+
+/**
+ * Bounds [tmin, tmax] of wave lengths in ticks with lo <= fclk/ticks <= hi,
+ * i.e., kernel_ticks_inrange() with these bounds gives exactly the same mask
+ * as kernel_frequencies() followed by kernel_inrange(), without a division
+ * per sample. Bounds only change with fclk (once per 1-pps record).
+ * tmin > tmax if no wave length is in range.
+ */
+void kernel_tick_bounds(double fclk, double lo, double hi, uint32_t *tmin, uint32_t *tmax)
+{
+     // fclk/t decreases with t, so the wave lengths in range form an interval.
+     // Start from the estimates and correct them by the exact comparisons.
+     *tmin = 1;
+     *tmax = 0;
+     if (!(hi > 0.0) || !(fclk/UINT32_MAX <= hi))
+	  return;
+     double est = fclk/hi;
+     uint64_t t = (est < 1.0) ? 1 : (est > UINT32_MAX) ? UINT32_MAX : (uint64_t) est;
+     while (t > 1 && fclk/(t-1) <= hi)
+	  t--;
+     while (!(fclk/t <= hi))
+	  t++;
+     uint64_t lower = t;
+
+     uint64_t upper = UINT32_MAX;
+     if (lo > 0.0) {
+	  est = fclk/lo;
+	  t = (est < 1.0) ? 1 : (est > UINT32_MAX) ? UINT32_MAX : (uint64_t) est;
+	  while (t < UINT32_MAX && fclk/(t+1) >= lo)
+	       t++;
+	  while (t > 0 && !(fclk/t >= lo))
+	       t--;
+	  upper = t;
+     }
+     if (lower <= upper) {
+	  *tmin = lower;
+	  *tmax = upper;
+     }
+}
+
+static bool within_deviation(uint32_t fclock, uint32_t f_clk_nominal, unsigned int max_deviation_ppm)
+{
+     double deviation = (double) fclock / f_clk_nominal;
+     if (deviation > 1.0) {
+	  deviation -= 1.0;
+     } else {
+	  deviation = 1.0 - deviation;
+     }
+     unsigned int deviation_ppm = (unsigned int) (1.0e6*deviation + 0.5);
+     return deviation_ppm <= max_deviation_ppm;
+}
+
+/**
+ * Range [fmin, fmax] of 1-pps measurements (clock ticks per second) that
+ * deviate at most max_deviation_ppm (rounded to ppm) from the nominal clock
+ * frequency, so each measurement is checked by two integer comparisons.
+ * The deviation increases with the distance from the nominal frequency, so
+ * the estimated bounds are corrected with the exact check.
+ */
+void kernel_onepps_bounds(uint32_t f_clk_nominal, unsigned int max_deviation_ppm,
+			  uint32_t *fmin, uint32_t *fmax)
+{
+     double lower = f_clk_nominal*(1.0 - 1.0e-6*max_deviation_ppm);
+     double upper = f_clk_nominal*(1.0 + 1.0e-6*max_deviation_ppm);
+
+     uint32_t f = (lower < 0.0) ? 0 : (uint32_t) lower;
+     while (f > 0 && within_deviation(f-1, f_clk_nominal, max_deviation_ppm))
+	  f--;
+     while (!within_deviation(f, f_clk_nominal, max_deviation_ppm))
+	  f++;
+     *fmin = f;
+
+     f = (upper > UINT32_MAX) ? UINT32_MAX : (uint32_t) upper;
+     while (f < UINT32_MAX && within_deviation(f+1, f_clk_nominal, max_deviation_ppm))
+	  f++;
+     while (!within_deviation(f, f_clk_nominal, max_deviation_ppm))
+	  f--;
+     *fmax = f;
+}
+
+/**
+ * mask[i] = 1 if tmin <= ticks[i] <= tmax, else 0.
+ */
+void kernel_ticks_inrange(const uint32_t *restrict ticks, size_t n, uint32_t tmin, uint32_t tmax,
+			  uint8_t *restrict mask)
+{
+     for (size_t i = 0; i < n; i++)
+	  mask[i] = (ticks[i] >= tmin) & (ticks[i] <= tmax);
+}
+
+/**
+ * Copy the samples with mask[i] == keep to out (in order). Returns their number.
+ */
+size_t kernel_compact(const uint32_t *restrict ticks, const uint8_t *restrict mask, size_t n,
+		      uint8_t keep, uint32_t *restrict out)
+{
+     // Branch-free: always write, advance only for kept samples.
+     size_t m = 0;
+     for (size_t i = 0; i < n; i++) {
+	  out[m] = ticks[i];
+	  m += (mask[i] == keep);
+     }
+     return m;
+}
+
+/**
+ * Rate of change of frequency: frequency difference to the previous wave
+ * divided by the time between the centers of both waves. f_prev and
+ * ticks_prev describe the last wave of the previous batch (ticks_prev = 0
+ * if there is none; rocof[0] is 0 then).
+ */
+void kernel_rocof(const double *restrict f, const uint32_t *restrict ticks, size_t n, double fclk,
+		  double f_prev, double ticks_prev, double *restrict rocof)
+{
+     if (n == 0)
+	  return;
+     rocof[0] = (ticks_prev > 0.0) ? (f[0]-f_prev) / (0.5*(ticks_prev + ticks[0])/fclk) : 0.0;
+     for (size_t i = 1; i < n; i++)
+	  rocof[i] = (f[i]-f[i-1]) / (0.5*((double) ticks[i-1] + ticks[i])/fclk);
+}
@@ -0,0 +1,61 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SAMPLEKERNELS_H
+#define SAMPLEKERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Batch kernels over the samples of one channel.
+ *
+ * All arguments are plain arrays (structure of arrays) that do not alias,
+ * so the compiler can vectorize the loops. Samples are copied out of the
+ * packed TLV records with tlv_get_samples() first.
+ */
+
+void kernel_frequencies(const uint32_t *restrict ticks, size_t n, double fclk, double *restrict f);
+
+void kernel_inrange(const double *restrict x, size_t n, double lo, double hi, uint8_t *restrict mask);
+
+void kernel_tick_bounds(double fclk, double lo, double hi, uint32_t *tmin, uint32_t *tmax);
+
+void kernel_onepps_bounds(uint32_t f_clk_nominal, unsigned int max_deviation_ppm,
+			  uint32_t *fmin, uint32_t *fmax);
+
+void kernel_ticks_inrange(const uint32_t *restrict ticks, size_t n, uint32_t tmin, uint32_t tmax,
+			  uint8_t *restrict mask);
+
+size_t kernel_compact(const uint32_t *restrict ticks, const uint8_t *restrict mask, size_t n,
+		      uint8_t keep, uint32_t *restrict out);
+
+void kernel_rocof(const double *restrict f, const uint32_t *restrict ticks, size_t n, double fclk,
+		  double f_prev, double ticks_prev, double *restrict rocof);
+
+#endif
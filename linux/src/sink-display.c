@@ -29,14 +29,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "tlv.h"
-
-// Samples are taken at a nominal frequency of MCLK/2 = 42 MHz.
-// (MCLK = master clock frequency of Arduino Due = 84 MHz)
-#define F_CLK_NOMINAL (84000000/2)
+#include "nominal.h"
 
 unsigned int nwin = 0;
 double sumwin = 0.0;
 uint32_t f_clk_syncd = F_CLK_NOMINAL;
+// Waves averaged for display (about one second).
+unsigned int window = F_MAINS_NOMINAL;
 double avg = 0.0;
 FILE *outfile = NULL;
 
@@ -57,8 +56,8 @@ void process_tlv_samples(const tlv_t *tlv)
 	  double freq_syncd = (double) f_clk_syncd / tlv->value.samples[i];
 	  sumwin += freq_syncd;
 	  nwin++;
-	  if (nwin == 50) {
-	       avg = sumwin/50.0;
+	  if (nwin == window) {
+	       avg = sumwin/window;
 	       print();
 	       sumwin = 0.0;
 	       nwin = 0;
@@ -72,9 +71,23 @@ void process_tlv_onepps(const tlv_t *tlv)
      print();
 }
 
+void process_tlv_header(const tlv_t *tlv)
+{
+     tlv_header_t header;
+     if (tlv_get_header(tlv, &header) == 0) {
+	  f_clk_syncd = header.f_clk;
+	  window = (header.f_mains_mhz + 500)/1000;
+	  if (window == 0)
+	       window = 1;
+     }
+}
+
 void process_tlv(const tlv_t *tlv)
 {
      switch (tlv->type) {
+     case TLV_TYPE_HEADER :
+	  process_tlv_header(tlv);
+	  break;
      case TLV_TYPE_SAMPLES :
 	  process_tlv_samples(tlv);
 	  break;
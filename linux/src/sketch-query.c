@@ -0,0 +1,249 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "sketch.h"
+#include "errandwarn.h"
+
+#define MAX_QUANTILES 100
+
+// Merged buckets sorted by start time.
+sketch_bucket_t *buckets = NULL;
+size_t nbuckets = 0;
+size_t capacity = 0;
+
+// Length of merged buckets in nanoseconds (0: a single bucket).
+uint64_t bucket_length = 0;
+bool rebucket = false;
+
+void usage(const char *app)
+{
+     fprintf(stderr, "USAGE: %s [OPTIONS] SKETCHFILE [SKETCHFILE ...]\n"
+	     "Merges sketch files (see filter-sketch) and prints quantiles or histograms as CSV.\n"
+	     "-b BUCKET_SECONDS : merge into buckets of this length (0: a single bucket; default: as in files)\n"
+	     "-q Q1,Q2,... : quantiles to print (default: 0,0.01,0.25,0.5,0.75,0.99,1)\n"
+	     "-H MIN:MAX:NBINS : print histogram with NBINS bins between MIN and MAX instead of quantiles\n"
+	     "-c : use f_clk_syncd instead of f_mains_syncd\n"
+	     "-o FILE : write merged sketch to FILE instead of printing\n",
+	     app);
+}
+
+sketch_bucket_t *get_bucket(uint64_t tstart)
+{
+     // Binary search for the position of the bucket.
+     size_t lo = 0;
+     size_t hi = nbuckets;
+     while (lo < hi) {
+	  size_t mid = (lo+hi)/2;
+	  if (buckets[mid].tstart < tstart)
+	       lo = mid+1;
+	  else
+	       hi = mid;
+     }
+     if (lo < nbuckets && buckets[lo].tstart == tstart)
+	  return &buckets[lo];
+
+     if (nbuckets == capacity) {
+	  capacity = (capacity == 0) ? 64 : 2*capacity;
+	  buckets = realloc(buckets, capacity*sizeof(sketch_bucket_t));
+	  if (buckets == NULL) {
+	       ERROR("Out of memory");
+	       exit(-1);
+	  }
+     }
+     memmove(&buckets[lo+1], &buckets[lo], (nbuckets-lo)*sizeof(sketch_bucket_t));
+     nbuckets++;
+     buckets[lo].tstart = tstart;
+     tdigest_init(&buckets[lo].f_mains_syncd);
+     tdigest_init(&buckets[lo].f_clk_syncd);
+
+     return &buckets[lo];
+}
+
+void read_sketch(const char *path)
+{
+     FILE *f = fopen(path, "r");
+     if (f == NULL) {
+	  fprintf(stderr, "Error: Could not open %s\n", path);
+	  exit(-1);
+     }
+
+     sketch_header_t header;
+     if (sketch_read_header(f, &header) < 0) {
+	  fprintf(stderr, "Error: %s is not a sketch file\n", path);
+	  exit(-1);
+     }
+     if (!rebucket) {
+	  // Keep buckets of the files; all files must use the same bucket length.
+	  if (nbuckets > 0 && header.bucket_length != bucket_length) {
+	       ERROR("Sketch files have different bucket lengths (use option -b)");
+	       exit(-1);
+	  }
+	  bucket_length = header.bucket_length;
+     }
+
+     sketch_bucket_t *b = malloc(sizeof(sketch_bucket_t));
+     if (b == NULL) {
+	  ERROR("Out of memory");
+	  exit(-1);
+     }
+     while (sketch_read_bucket(f, b) == 0) {
+	  uint64_t tstart = (bucket_length > 0) ? b->tstart/bucket_length*bucket_length : 0;
+	  sketch_bucket_t *merged = get_bucket(tstart);
+	  tdigest_merge(&merged->f_mains_syncd, &b->f_mains_syncd);
+	  tdigest_merge(&merged->f_clk_syncd, &b->f_clk_syncd);
+     }
+     if (!feof(f)) {
+	  fprintf(stderr, "Error: Could not read %s\n", path);
+	  exit(-1);
+     }
+     
+     free(b);
+     fclose(f);
+}
+
+int parse_quantiles(const char *s, double *q)
+{
+     int n = 0;
+     const char *p = s;
+     while (*p != '\0' && n < MAX_QUANTILES) {
+	  char *end;
+	  q[n] = strtod(p, &end);
+	  if (end == p || q[n] < 0.0 || q[n] > 1.0)
+	       return -1;
+	  n++;
+	  p = end;
+	  if (*p == ',')
+	       p++;
+     }
+     return n;
+}
+
+int main(int argc, char *argv[])
+{
+     double quantiles[MAX_QUANTILES] = {0.0, 0.01, 0.25, 0.5, 0.75, 0.99, 1.0};
+     int nquantiles = 7;
+     bool histogram = false;
+     double hmin, hmax;
+     int nbins = 0;
+     bool clk = false;
+     const char *outfile = NULL;
+     
+     int c;
+     while ((c = getopt (argc, argv, "b:q:H:co:")) != -1) {
+	  switch (c) {
+	  case 'b' :
+	       rebucket = true;
+	       bucket_length = 1000000000ull*atol(optarg);
+	       break;
+	  case 'q' :
+	       if ( (nquantiles = parse_quantiles(optarg, quantiles)) <= 0) {
+		    usage(argv[0]);
+		    exit(-1);
+	       }
+	       break;
+	  case 'H' :
+	       if (sscanf(optarg, "%lf:%lf:%d", &hmin, &hmax, &nbins) != 3 || nbins <= 0 || hmin >= hmax) {
+		    usage(argv[0]);
+		    exit(-1);
+	       }
+	       histogram = true;
+	       break;
+	  case 'c' :
+	       clk = true;
+	       break;
+	  case 'o' :
+	       outfile = optarg;
+	       break;
+	  case '?':
+	  default :
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     if (optind == argc) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+
+     for (int i = optind; i < argc; i++)
+	  read_sketch(argv[i]);
+
+     if (outfile != NULL) {
+	  FILE *f = fopen(outfile, "w");
+	  if (f == NULL || sketch_write_header(f, bucket_length) < 0) {
+	       ERROR("Could not write sketch file");
+	       exit(-1);
+	  }
+	  for (size_t i = 0; i < nbuckets; i++) {
+	       if (sketch_write_bucket(f, &buckets[i]) < 0) {
+		    ERROR("Could not write sketch file");
+		    exit(-1);
+	       }
+	  }
+	  fclose(f);
+	  return 0;
+     }
+     
+     if (histogram) {
+	  printf("t_bucket,bin_low,bin_high,count\n");
+     } else {
+	  printf("t_bucket,count");
+	  for (int i = 0; i < nquantiles; i++)
+	       printf(",q%g", quantiles[i]);
+	  printf("\n");
+     }
+     
+     for (size_t i = 0; i < nbuckets; i++) {
+	  tdigest_t *td = clk ? &buckets[i].f_clk_syncd : &buckets[i].f_mains_syncd;
+	  tdigest_compress(td);
+	  unsigned long long tstart = buckets[i].tstart;
+	  if (histogram) {
+	       double width = (hmax-hmin)/nbins;
+	       double cdf_low = tdigest_cdf(td, hmin);
+	       for (int j = 0; j < nbins; j++) {
+		    double low = hmin + j*width;
+		    double high = low + width;
+		    double cdf_high = tdigest_cdf(td, high);
+		    printf("%llu,%.6f,%.6f,%.0f\n", tstart, low, high, (cdf_high-cdf_low)*td->total_weight);
+		    cdf_low = cdf_high;
+	       }
+	  } else {
+	       printf("%llu,%.0f", tstart, td->total_weight);
+	       for (int j = 0; j < nquantiles; j++)
+		    printf(",%.6f", tdigest_quantile(td, quantiles[j]));
+	       printf("\n");
+	  }
+     }
+     
+     return 0;
+}
@@ -0,0 +1,80 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include "sketch.h"
+
+int sketch_write_header(FILE *f, uint64_t bucket_length)
+{
+     sketch_header_t header;
+
+     memset(&header, 0, sizeof(header));
+     memcpy(header.magic, SKETCH_MAGIC, sizeof(header.magic));
+     header.version = SKETCH_VERSION;
+     header.bucket_length = bucket_length;
+     if (fwrite(&header, sizeof(header), 1, f) != 1)
+	  return -1;
+
+     return 0;
+}
+
+int sketch_read_header(FILE *f, sketch_header_t *header)
+{
+     if (fread(header, sizeof(*header), 1, f) != 1)
+	  return -1;
+     if (memcmp(header->magic, SKETCH_MAGIC, sizeof(header->magic)) != 0)
+	  return -1;
+     if (header->version != SKETCH_VERSION)
+	  return -1;
+
+     return 0;
+}
+
+int sketch_write_bucket(FILE *f, sketch_bucket_t *bucket)
+{
+     if (fwrite(&bucket->tstart, sizeof(bucket->tstart), 1, f) != 1)
+	  return -1;
+     if (tdigest_write(&bucket->f_mains_syncd, f) < 0)
+	  return -1;
+     if (tdigest_write(&bucket->f_clk_syncd, f) < 0)
+	  return -1;
+
+     return 0;
+}
+
+int sketch_read_bucket(FILE *f, sketch_bucket_t *bucket)
+{
+     if (fread(&bucket->tstart, sizeof(bucket->tstart), 1, f) != 1)
+	  return -1;
+     if (tdigest_read(&bucket->f_mains_syncd, f) < 0)
+	  return -1;
+     if (tdigest_read(&bucket->f_clk_syncd, f) < 0)
+	  return -1;
+
+     return 0;
+}
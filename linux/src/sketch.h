@@ -0,0 +1,67 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "tdigest.h"
+
+/**
+ * Sketch files contain a header followed by one record per time bucket,
+ * each with a t-digest of f_mains_syncd (one value per sample) and a
+ * t-digest of f_clk_syncd (one value per ONEPPS record).
+ */
+
+#define SKETCH_MAGIC "TLVSKTCH"
+#define SKETCH_VERSION 1
+
+typedef struct __attribute__((__packed__)) {
+     char magic[8];
+     uint32_t version;
+     // Length of time buckets in nanoseconds (0: a single bucket).
+     uint64_t bucket_length;
+} sketch_header_t;
+
+typedef struct {
+     // Start of the bucket in nanoseconds since Unix epoch.
+     uint64_t tstart;
+     tdigest_t f_mains_syncd;
+     tdigest_t f_clk_syncd;
+} sketch_bucket_t;
+
+int sketch_write_header(FILE *f, uint64_t bucket_length);
+
+int sketch_read_header(FILE *f, sketch_header_t *header);
+
+int sketch_write_bucket(FILE *f, sketch_bucket_t *bucket);
+
+int sketch_read_bucket(FILE *f, sketch_bucket_t *bucket);
+
+#endif
@@ -36,17 +36,38 @@
 
 #define BUFFER_SIZE 1000
 
+static slip_read_hook_t read_hook = NULL;
+static void *read_hook_ctx = NULL;
+static slip_wait_hook_t wait_hook = NULL;
+static void *wait_hook_ctx = NULL;
+
+void slip_set_read_hook(slip_read_hook_t hook, void *ctx)
+{
+     read_hook = hook;
+     read_hook_ctx = ctx;
+}
+
+void slip_set_wait_hook(slip_wait_hook_t hook, void *ctx)
+{
+     wait_hook = hook;
+     wait_hook_ctx = ctx;
+}
+
 static int get_next_byte(int fd, unsigned char *buffer, size_t buffersize, size_t *len, size_t *pos)
 {
      if (*len == *pos) {
 	  // All bytes from buffer have been consumed -> refill buffer
-	  ssize_t nread = read(fd, buffer, BUFFER_SIZE);
+	  if (wait_hook != NULL && wait_hook(fd, wait_hook_ctx) < 0)
+	       return -1;
+	  ssize_t nread = read(fd, buffer, buffersize);
 	  if (nread < 0)
 	       return -1;
 	  else if (nread == 0)
 	       return -1; // EOF
 
 	  // We have read at least one byte into the buffer.
+	  if (read_hook != NULL)
+	       read_hook(buffer, nread, read_hook_ctx);
 	  
 	  *len = nread;
 	  *pos = 0;
@@ -107,9 +128,72 @@ ssize_t slip_recvpkt(int fd, void *pktbuffer, size_t pktbuffer_size)
 		    
 		    // Here we deliberately fall into the default handler and let
 		    // it store the character for us.
+		    /* fallthrough */
 	       default:
 		    if (nrcvd < pktbuffer_size)
 			 pktbytes[nrcvd++] = c;
 	  }
      }
 }
+
+ssize_t slip_decodepkt(const unsigned char *data, size_t len, size_t *pos, void *pktbuffer, size_t pktbuffer_size)
+{
+     // Same decoding as slip_recvpkt(), so raw captures decode like the live stream.
+     unsigned char *pktbytes = (unsigned char *) pktbuffer;
+     size_t i = *pos;
+     size_t nrcvd = 0;
+     while (i < len) {
+	  int c = data[i++];
+	  switch (c) {
+	  case END :
+	       if (nrcvd) {
+		    *pos = i;
+		    return nrcvd;
+	       }
+	       break;
+	  case ESC :
+	       if (i == len)
+		    return -1;
+	       c = data[i++];
+	       switch (c) {
+	       case ESC_END:
+		    c = END;
+		    break;
+	       case ESC_ESC:
+		    c = ESC;
+		    break;
+	       }
+	       /* fallthrough */
+	  default:
+	       if (nrcvd < pktbuffer_size)
+		    pktbytes[nrcvd++] = c;
+	  }
+     }
+
+     // Only empty packets up to the end of the data.
+     if (nrcvd == 0)
+	  *pos = i;
+     return -1;
+}
+
+size_t slip_split(const unsigned char *data, size_t len, size_t pos)
+{
+     // The decoder only takes END as data if it directly follows ESC, so an
+     // END not preceded by ESC always ends a frame, whatever came before it,
+     // and decoding can start right after it. (An END preceded by ESC might
+     // end a frame, too, e.g., after ESC ESC in line noise, so it is skipped.)
+     for (size_t i = pos; i < len; i++) {
+	  if (data[i] == END && (i == 0 || data[i-1] != ESC))
+	       return i+1;
+     }
+     return len;
+}
+
+size_t slip_last_split(const unsigned char *data, size_t len)
+{
+     for (size_t i = len; i > 0; i--) {
+	  if (data[i-1] == END && (i == 1 || data[i-2] != ESC))
+	       return i;
+     }
+     return 0;
+}
@@ -30,7 +30,39 @@
 #define SLIP_H
 
 #include <sys/types.h>
+#include <stddef.h>
+
+// Called with the bytes of each read from the device (e.g., to timestamp them).
+typedef void (*slip_read_hook_t)(const unsigned char *data, size_t len, void *ctx);
+
+// Called before each read from the device (e.g., to wait for input with
+// timeouts); the read fails if it returns -1.
+typedef int (*slip_wait_hook_t)(int fd, void *ctx);
 
 ssize_t slip_recvpkt(int fd, void *pktbuffer, size_t pktbuffer_size);
 
+void slip_set_read_hook(slip_read_hook_t hook, void *ctx);
+
+void slip_set_wait_hook(slip_wait_hook_t hook, void *ctx);
+
+/**
+ * Decode the next packet from received bytes data[*pos..len-1]. Returns the
+ * packet size and advances *pos behind the packet, or -1 if the data ends
+ * before the packet is complete.
+ */
+ssize_t slip_decodepkt(const unsigned char *data, size_t len, size_t *pos, void *pktbuffer, size_t pktbuffer_size);
+
+/**
+ * Position behind the first END character at or after pos that certainly
+ * terminates a packet (len if there is none), where decoding can start
+ * independently of the preceding bytes.
+ */
+size_t slip_split(const unsigned char *data, size_t len, size_t pos);
+
+/**
+ * Position behind the last END character that certainly terminates a packet
+ * (0 if there is none).
+ */
+size_t slip_last_split(const unsigned char *data, size_t len);
+
 #endif
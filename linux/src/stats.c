@@ -0,0 +1,441 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include "stats.h"
+
+#define MAX_PATH_SIZE 1000
+
+#define MAX_COUNTERS 32
+
+#define MAX_REPORT_SIZE 4096
+
+static bool enabled = false;
+static char stage[MAX_PATH_SIZE];
+static char jsonfile[MAX_PATH_SIZE];
+
+static struct timespec tstart;
+
+static uint64_t records_in = 0;
+static uint64_t bytes_in = 0;
+static uint64_t records_out = 0;
+static uint64_t bytes_out = 0;
+static uint64_t dropped = 0;
+// Time spent in reading and writing (blocked on input/output) in nanoseconds.
+static uint64_t t_input = 0;
+static uint64_t t_output = 0;
+
+// Bytes of complete records read from the input (also if not enabled).
+static uint64_t input_offset = 0;
+
+// Additional counters of a tool (e.g., link losses), reported with the others.
+static struct {
+     const char *name;
+     const uint64_t *value;
+} counters[MAX_COUNTERS];
+static int ncounters = 0;
+
+static uint64_t now()
+{
+     struct timespec t;
+     clock_gettime(CLOCK_MONOTONIC, &t);
+     return 1000000000ull*t.tv_sec + t.tv_nsec;
+}
+
+static double seconds(uint64_t ns)
+{
+     return ns/1.0e9;
+}
+
+/**
+ * Report formatting without stdio, so reports can be written from the
+ * signal handler while the filter is blocked in (or in the middle of)
+ * reading or writing.
+ */
+typedef struct {
+     char data[MAX_REPORT_SIZE];
+     size_t len;
+} report_t;
+
+static void append_str(report_t *r, const char *str)
+{
+     while (*str != '\0' && r->len < MAX_REPORT_SIZE)
+	  r->data[r->len++] = *str++;
+}
+
+static void append_uint(report_t *r, uint64_t v)
+{
+     char digits[20];
+     int n = 0;
+     do {
+	  digits[n++] = '0' + v%10;
+	  v /= 10;
+     } while (v != 0);
+     while (n > 0 && r->len < MAX_REPORT_SIZE)
+	  r->data[r->len++] = digits[--n];
+}
+
+static void append_fixed(report_t *r, double v, int decimals)
+{
+     uint64_t scale = 1;
+     for (int i = 0; i < decimals; i++)
+	  scale *= 10;
+     uint64_t scaled = (v > 0.0) ? (uint64_t) (v*scale + 0.5) : 0;
+     append_uint(r, scaled/scale);
+     if (decimals == 0)
+	  return;
+     append_str(r, ".");
+     uint64_t frac = scaled%scale;
+     for (uint64_t d = scale/10; d > 1 && frac < d; d /= 10)
+	  append_str(r, "0");
+     append_uint(r, frac);
+}
+
+static void write_all(int fd, const char *data, size_t len)
+{
+     while (len > 0) {
+	  ssize_t n = write(fd, data, len);
+	  if (n < 0) {
+	       if (errno == EINTR)
+		    continue;
+	       return;
+	  }
+	  data += n;
+	  len -= n;
+     }
+}
+
+static void handle_sigusr1(int sig)
+{
+     (void) sig;
+     int saved_errno = errno;
+     stats_report();
+     errno = saved_errno;
+}
+
+static void report_at_exit(void)
+{
+     stats_report();
+}
+
+/**
+ * Enable statistics if requested. Removes --stats[=FILE] from the command
+ * line, so it must be called before parsing the other arguments.
+ */
+void stats_init(int *argc, char *argv[])
+{
+     const char *arg = getenv("MAINSFREQ_STATS");
+     if (arg != NULL && strlen(arg) > 0 && strcmp(arg, "0") != 0)
+	  enabled = true;
+
+     int j = 1;
+     for (int i = 1; i < *argc; i++) {
+	  if (strcmp(argv[i], "--stats") == 0) {
+	       enabled = true;
+	       arg = NULL;
+	  } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+	       enabled = true;
+	       arg = &argv[i][8];
+	  } else {
+	       argv[j++] = argv[i];
+	  }
+     }
+     *argc = j;
+     argv[j] = NULL;
+
+     if (!enabled)
+	  return;
+
+     memset(jsonfile, 0, MAX_PATH_SIZE);
+     if (arg != NULL && strcmp(arg, "1") != 0)
+	  strncpy(jsonfile, arg, MAX_PATH_SIZE-1);
+     
+     char name[MAX_PATH_SIZE];
+     strncpy(name, argv[0], MAX_PATH_SIZE-1);
+     name[MAX_PATH_SIZE-1] = '\0';
+     strncpy(stage, basename(name), MAX_PATH_SIZE-1);
+     
+     clock_gettime(CLOCK_MONOTONIC, &tstart);
+
+     struct sigaction sa;
+     memset(&sa, 0, sizeof(sa));
+     sa.sa_handler = handle_sigusr1;
+     sa.sa_flags = SA_RESTART;
+     sigaction(SIGUSR1, &sa, NULL);
+     
+     atexit(report_at_exit);
+}
+
+int stats_read_tlv(tlv_t *tlv, FILE *f)
+{
+     if (!enabled) {
+	  if (read_tlv_raw(tlv, f) < 0)
+	       return -1;
+	  input_offset += sizeof(tlv->type) + sizeof(tlv->length) + tlv->length;
+	  return decode_tlv(tlv);
+     }
+
+     uint64_t t = now();
+     int ret = read_tlv_raw(tlv, f);
+     t_input += now() - t;
+     if (ret == 0) {
+	  size_t len = sizeof(tlv->type) + sizeof(tlv->length) + tlv->length;
+	  input_offset += len;
+	  records_in++;
+	  bytes_in += len;
+	  ret = decode_tlv(tlv);
+     }
+
+     return ret;
+}
+
+/**
+ * Number of bytes of complete records read so far through stats_read_tlv()
+ * (compressed records count with their size in the input).
+ */
+uint64_t stats_input_offset(void)
+{
+     return input_offset;
+}
+
+int stats_write_tlv(const tlv_t *tlv, FILE *f)
+{
+     if (!enabled)
+	  return write_tlv(tlv, f);
+
+     uint64_t t = now();
+     int ret = write_tlv(tlv, f);
+     t_output += now() - t;
+     if (ret == 0) {
+	  records_out++;
+	  bytes_out += sizeof(tlv->type) + sizeof(tlv->length) + tlv->length;
+     }
+
+     return ret;
+}
+
+/**
+ * Write n complete tlv records of len bytes in total with a single fwrite()
+ * (see recbatch.h).
+ */
+int stats_write_records(const void *data, size_t len, uint64_t n, FILE *f)
+{
+     if (!enabled)
+	  return (fwrite(data, len, 1, f) == 1) ? 0 : -1;
+
+     uint64_t t = now();
+     size_t ret = fwrite(data, len, 1, f);
+     t_output += now() - t;
+     if (ret != 1)
+	  return -1;
+     records_out += n;
+     bytes_out += len;
+
+     return 0;
+}
+
+/**
+ * printf() to stdout for filters producing text output (one record per call).
+ */
+int stats_printf(const char *format, ...)
+{
+     va_list ap;
+     va_start(ap, format);
+     
+     if (!enabled) {
+	  int ret = vprintf(format, ap);
+	  va_end(ap);
+	  return ret;
+     }
+
+     uint64_t t = now();
+     int ret = vprintf(format, ap);
+     t_output += now() - t;
+     va_end(ap);
+     if (ret >= 0) {
+	  records_out++;
+	  bytes_out += ret;
+     }
+
+     return ret;
+}
+
+/**
+ * fwrite() for filters producing binary output other than TLV records (one record per call).
+ */
+size_t stats_fwrite(const void *ptr, size_t size, size_t nmemb, FILE *f)
+{
+     if (!enabled)
+	  return fwrite(ptr, size, nmemb, f);
+
+     uint64_t t = now();
+     size_t ret = fwrite(ptr, size, nmemb, f);
+     t_output += now() - t;
+     records_out++;
+     bytes_out += ret*size;
+
+     return ret;
+}
+
+/**
+ * Count records (or samples) dropped by the filter.
+ */
+void stats_drop(uint64_t n)
+{
+     dropped += n;
+}
+
+/**
+ * Count records read and written without stats_read_tlv() and
+ * stats_write_tlv(), i.e., forwarded as raw bytes (see tlvpass.h).
+ */
+void stats_passthrough(uint64_t nin, uint64_t nbytes_in, uint64_t nout, uint64_t nbytes_out)
+{
+     input_offset += nbytes_in;
+     if (!enabled)
+	  return;
+     records_in += nin;
+     bytes_in += nbytes_in;
+     records_out += nout;
+     bytes_out += nbytes_out;
+}
+
+/**
+ * Register a counter maintained by the tool, which is reported under the
+ * given name. Name and counter must stay valid until exit.
+ */
+void stats_register_counter(const char *name, const uint64_t *counter)
+{
+     if (ncounters < MAX_COUNTERS) {
+	  counters[ncounters].name = name;
+	  counters[ncounters].value = counter;
+	  ncounters++;
+     }
+}
+
+/**
+ * Write a report to stderr (and FILE). Only uses async-signal-safe
+ * functions, since it is also called from the handler of SIGUSR1.
+ */
+void stats_report(void)
+{
+     if (!enabled)
+	  return;
+     
+     struct timespec t;
+     clock_gettime(CLOCK_MONOTONIC, &t);
+     double wall = (t.tv_sec - tstart.tv_sec) + 1.0e-9*(t.tv_nsec - tstart.tv_nsec);
+     
+     struct timespec tcpu;
+     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &tcpu);
+     double cpu = tcpu.tv_sec + 1.0e-9*tcpu.tv_nsec;
+
+     double rate = (wall > 0.0) ? records_in/wall : 0.0;
+
+     report_t r;
+     r.len = 0;
+     append_str(&r, stage);
+     append_str(&r, ": in ");
+     append_uint(&r, records_in);
+     append_str(&r, " records (");
+     append_uint(&r, bytes_in);
+     append_str(&r, " bytes), out ");
+     append_uint(&r, records_out);
+     append_str(&r, " records (");
+     append_uint(&r, bytes_out);
+     append_str(&r, " bytes), dropped ");
+     append_uint(&r, dropped);
+     append_str(&r, ", wall ");
+     append_fixed(&r, wall, 3);
+     append_str(&r, " s, cpu ");
+     append_fixed(&r, cpu, 3);
+     append_str(&r, " s, input wait ");
+     append_fixed(&r, seconds(t_input), 3);
+     append_str(&r, " s, output wait ");
+     append_fixed(&r, seconds(t_output), 3);
+     append_str(&r, " s, ");
+     append_fixed(&r, rate, 0);
+     append_str(&r, " records/s");
+     for (int i = 0; i < ncounters; i++) {
+	  append_str(&r, ", ");
+	  append_str(&r, counters[i].name);
+	  append_str(&r, " ");
+	  append_uint(&r, *counters[i].value);
+     }
+     append_str(&r, "\n");
+     write_all(STDERR_FILENO, r.data, r.len);
+
+     if (strlen(jsonfile) > 0) {
+	  int fd = open(jsonfile, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	  if (fd < 0)
+	       return;
+	  r.len = 0;
+	  append_str(&r, "{\"stage\":\"");
+	  append_str(&r, stage);
+	  append_str(&r, "\",\"pid\":");
+	  append_uint(&r, getpid());
+	  append_str(&r, ",\"records_in\":");
+	  append_uint(&r, records_in);
+	  append_str(&r, ",\"bytes_in\":");
+	  append_uint(&r, bytes_in);
+	  append_str(&r, ",\"records_out\":");
+	  append_uint(&r, records_out);
+	  append_str(&r, ",\"bytes_out\":");
+	  append_uint(&r, bytes_out);
+	  append_str(&r, ",\"dropped\":");
+	  append_uint(&r, dropped);
+	  append_str(&r, ",\"wall_s\":");
+	  append_fixed(&r, wall, 6);
+	  append_str(&r, ",\"cpu_s\":");
+	  append_fixed(&r, cpu, 6);
+	  append_str(&r, ",\"input_wait_s\":");
+	  append_fixed(&r, seconds(t_input), 6);
+	  append_str(&r, ",\"output_wait_s\":");
+	  append_fixed(&r, seconds(t_output), 6);
+	  append_str(&r, ",\"records_per_s\":");
+	  append_fixed(&r, rate, 1);
+	  for (int i = 0; i < ncounters; i++) {
+	       append_str(&r, ",\"");
+	       append_str(&r, counters[i].name);
+	       append_str(&r, "\":");
+	       append_uint(&r, *counters[i].value);
+	  }
+	  append_str(&r, "}\n");
+	  write_all(fd, r.data, r.len);
+	  close(fd);
+     }
+}
@@ -0,0 +1,68 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "tlv.h"
+
+/**
+ * Instrumentation shared by all filters.
+ *
+ * Statistics are enabled by the command line argument --stats[=FILE] or
+ * the environment variable MAINSFREQ_STATS (value 1 or FILE). They are
+ * reported to stderr in human-readable form at exit and whenever the
+ * process receives SIGUSR1. If FILE is given, a JSON object per report
+ * is appended to FILE as well.
+ */
+
+void stats_init(int *argc, char *argv[]);
+
+int stats_read_tlv(tlv_t *tlv, FILE *f);
+
+int stats_write_tlv(const tlv_t *tlv, FILE *f);
+
+int stats_write_records(const void *data, size_t len, uint64_t n, FILE *f);
+
+int stats_printf(const char *format, ...);
+
+size_t stats_fwrite(const void *ptr, size_t size, size_t nmemb, FILE *f);
+
+void stats_drop(uint64_t n);
+
+void stats_passthrough(uint64_t nin, uint64_t nbytes_in, uint64_t nout, uint64_t nbytes_out);
+
+void stats_register_counter(const char *name, const uint64_t *counter);
+
+uint64_t stats_input_offset(void);
+
+void stats_report(void);
+
+#endif
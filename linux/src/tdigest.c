@@ -0,0 +1,240 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tdigest.h"
+
+void tdigest_init(tdigest_t *td)
+{
+     td->ncentroids = 0;
+     td->nbuffered = 0;
+     td->total_weight = 0.0;
+     td->min = INFINITY;
+     td->max = -INFINITY;
+}
+
+static int compare_centroids(const void *a, const void *b)
+{
+     const tdigest_centroid_t *ca = a;
+     const tdigest_centroid_t *cb = b;
+     if (ca->mean < cb->mean)
+	  return -1;
+     else if (ca->mean > cb->mean)
+	  return 1;
+     else
+	  return 0;
+}
+
+// Scale function k1: centroids near the tails are kept small.
+static double scale(double q)
+{
+     return TDIGEST_COMPRESSION/(2.0*M_PI) * asin(2.0*q - 1.0);
+}
+
+/**
+ * Merge all buffered values into the centroids.
+ */
+void tdigest_compress(tdigest_t *td)
+{
+     if (td->nbuffered == 0)
+	  return;
+
+     tdigest_centroid_t all[TDIGEST_MAX_CENTROIDS + TDIGEST_BUFFER_SIZE];
+     size_t n = td->ncentroids;
+     memcpy(all, td->centroids, n*sizeof(tdigest_centroid_t));
+     memcpy(&all[n], td->buffer, td->nbuffered*sizeof(tdigest_centroid_t));
+     n += td->nbuffered;
+     td->nbuffered = 0;
+     qsort(all, n, sizeof(tdigest_centroid_t), compare_centroids);
+
+     double total = 0.0;
+     for (size_t i = 0; i < n; i++)
+	  total += all[i].weight;
+     td->total_weight = total;
+
+     // Greedily merge neighbours as long as a centroid spans at most one unit of k.
+     size_t m = 0;
+     tdigest_centroid_t cur = all[0];
+     double wsofar = 0.0;
+     double klimit = scale(0.0) + 1.0;
+     for (size_t i = 1; i < n; i++) {
+	  double q = (wsofar + cur.weight + all[i].weight)/total;
+	  if (scale(q) <= klimit) {
+	       double w = cur.weight + all[i].weight;
+	       cur.mean += (all[i].mean - cur.mean) * all[i].weight / w;
+	       cur.weight = w;
+	  } else {
+	       wsofar += cur.weight;
+	       td->centroids[m++] = cur;
+	       klimit = scale(wsofar/total) + 1.0;
+	       cur = all[i];
+	  }
+	  if (m == TDIGEST_MAX_CENTROIDS-1) {
+	       // Cannot happen with scale function k1; merge the rest for safety.
+	       for (i++; i < n; i++) {
+		    double w = cur.weight + all[i].weight;
+		    cur.mean += (all[i].mean - cur.mean) * all[i].weight / w;
+		    cur.weight = w;
+	       }
+	       break;
+	  }
+     }
+     td->centroids[m++] = cur;
+     td->ncentroids = m;
+}
+
+void tdigest_add(tdigest_t *td, double x, double weight)
+{
+     if (isnan(x) || weight <= 0.0)
+	  return;
+     if (td->nbuffered == TDIGEST_BUFFER_SIZE)
+	  tdigest_compress(td);
+
+     td->buffer[td->nbuffered].mean = x;
+     td->buffer[td->nbuffered].weight = weight;
+     td->nbuffered++;
+     if (x < td->min)
+	  td->min = x;
+     if (x > td->max)
+	  td->max = x;
+}
+
+void tdigest_merge(tdigest_t *td, const tdigest_t *other)
+{
+     for (uint32_t i = 0; i < other->ncentroids; i++)
+	  tdigest_add(td, other->centroids[i].mean, other->centroids[i].weight);
+     for (uint32_t i = 0; i < other->nbuffered; i++)
+	  tdigest_add(td, other->buffer[i].mean, other->buffer[i].weight);
+     if (other->min < td->min)
+	  td->min = other->min;
+     if (other->max > td->max)
+	  td->max = other->max;
+}
+
+/**
+ * Estimate the q-quantile (0 <= q <= 1). Returns NAN for an empty digest.
+ */
+double tdigest_quantile(tdigest_t *td, double q)
+{
+     tdigest_compress(td);
+     if (td->ncentroids == 0)
+	  return NAN;
+     if (q <= 0.0)
+	  return td->min;
+     if (q >= 1.0)
+	  return td->max;
+
+     // Centroid i represents the weight around its mean; interpolate linearly
+     // between the centers of neighbouring centroids (and min/max at the ends).
+     double target = q*td->total_weight;
+     double wsofar = 0.0;
+     double prev_x = td->min;
+     double prev_w = 0.0;
+     for (uint32_t i = 0; i < td->ncentroids; i++) {
+	  const tdigest_centroid_t *c = &td->centroids[i];
+	  double center = wsofar + c->weight/2.0;
+	  if (target < center) {
+	       double t = (target - prev_w)/(center - prev_w);
+	       return prev_x + t*(c->mean - prev_x);
+	  }
+	  prev_x = c->mean;
+	  prev_w = center;
+	  wsofar += c->weight;
+     }
+     double t = (target - prev_w)/(td->total_weight - prev_w);
+     return prev_x + t*(td->max - prev_x);
+}
+
+/**
+ * Estimate the fraction of values <= x.
+ */
+double tdigest_cdf(tdigest_t *td, double x)
+{
+     tdigest_compress(td);
+     if (td->ncentroids == 0)
+	  return NAN;
+     if (x < td->min)
+	  return 0.0;
+     if (x >= td->max)
+	  return 1.0;
+
+     double wsofar = 0.0;
+     double prev_x = td->min;
+     double prev_w = 0.0;
+     for (uint32_t i = 0; i < td->ncentroids; i++) {
+	  const tdigest_centroid_t *c = &td->centroids[i];
+	  double center = wsofar + c->weight/2.0;
+	  if (x < c->mean) {
+	       double t = (c->mean > prev_x) ? (x - prev_x)/(c->mean - prev_x) : 1.0;
+	       return (prev_w + t*(center - prev_w))/td->total_weight;
+	  }
+	  prev_x = c->mean;
+	  prev_w = center;
+	  wsofar += c->weight;
+     }
+     double t = (td->max > prev_x) ? (x - prev_x)/(td->max - prev_x) : 1.0;
+     return (prev_w + t*(td->total_weight - prev_w))/td->total_weight;
+}
+
+/**
+ * Serialized format: uint32 number of centroids, double min, double max,
+ * followed by (double mean, double weight) of each centroid.
+ */
+int tdigest_write(tdigest_t *td, FILE *f)
+{
+     tdigest_compress(td);
+     if (fwrite(&td->ncentroids, sizeof(td->ncentroids), 1, f) != 1 ||
+	 fwrite(&td->min, sizeof(td->min), 1, f) != 1 ||
+	 fwrite(&td->max, sizeof(td->max), 1, f) != 1)
+	  return -1;
+     if (td->ncentroids > 0 &&
+	 fwrite(td->centroids, sizeof(tdigest_centroid_t), td->ncentroids, f) != td->ncentroids)
+	  return -1;
+
+     return 0;
+}
+
+int tdigest_read(tdigest_t *td, FILE *f)
+{
+     tdigest_init(td);
+     if (fread(&td->ncentroids, sizeof(td->ncentroids), 1, f) != 1 ||
+	 fread(&td->min, sizeof(td->min), 1, f) != 1 ||
+	 fread(&td->max, sizeof(td->max), 1, f) != 1)
+	  return -1;
+     if (td->ncentroids > TDIGEST_MAX_CENTROIDS)
+	  return -1;
+     if (td->ncentroids > 0 &&
+	 fread(td->centroids, sizeof(tdigest_centroid_t), td->ncentroids, f) != td->ncentroids)
+	  return -1;
+     for (uint32_t i = 0; i < td->ncentroids; i++)
+	  td->total_weight += td->centroids[i].weight;
+
+     return 0;
+}
@@ -0,0 +1,83 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TDIGEST_H
+#define TDIGEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Merging t-digest (T. Dunning, "Computing Extremely Accurate Quantiles
+ * Using t-Digests") for estimating quantiles of a stream of values in
+ * constant memory. Digests can be merged, e.g., digests of different
+ * time intervals, files, or sites.
+ */
+
+// Compression parameter: larger values give more accurate quantiles.
+#define TDIGEST_COMPRESSION 100
+
+// Upper bound of the number of centroids after compression.
+#define TDIGEST_MAX_CENTROIDS TDIGEST_COMPRESSION
+
+// Number of values collected before they are merged into the centroids.
+#define TDIGEST_BUFFER_SIZE 100
+
+typedef struct {
+     double mean;
+     double weight;
+} tdigest_centroid_t;
+
+typedef struct {
+     // Merged centroids (sorted by mean) and not yet merged values.
+     uint32_t ncentroids;
+     tdigest_centroid_t centroids[TDIGEST_MAX_CENTROIDS];
+     uint32_t nbuffered;
+     tdigest_centroid_t buffer[TDIGEST_BUFFER_SIZE];
+     double total_weight;
+     double min;
+     double max;
+} tdigest_t;
+
+void tdigest_init(tdigest_t *td);
+
+void tdigest_add(tdigest_t *td, double x, double weight);
+
+void tdigest_merge(tdigest_t *td, const tdigest_t *other);
+
+void tdigest_compress(tdigest_t *td);
+
+double tdigest_quantile(tdigest_t *td, double q);
+
+double tdigest_cdf(tdigest_t *td, double x);
+
+int tdigest_write(tdigest_t *td, FILE *f);
+
+int tdigest_read(tdigest_t *td, FILE *f);
+
+#endif
@@ -0,0 +1,200 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Round-trip tests of the delta codec and of SAMPLES_DELTA records.
+ * Returns 0 if all tests pass.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "deltacodec.h"
+#include "tlv.h"
+
+static int failures = 0;
+
+#define CHECK(cond, m) do { if (!(cond)) { fprintf(stderr, "FAILED: %s (%s:%d)\n", m, __FILE__, __LINE__); failures++; } } while (0)
+
+/**
+ * Encode n samples, decode them again, and compare.
+ */
+static void roundtrip(const char *name, const uint32_t *samples, size_t n)
+{
+     uint8_t encoded[DELTACODEC_MAX_ENCODED_SIZE(MAX_SAMPLE_COUNT)];
+     uint32_t decoded[MAX_SAMPLE_COUNT];
+
+     size_t len = deltacodec_encode(samples, n, encoded, sizeof(encoded));
+     if (n > 0 && len == 0) {
+	  fprintf(stderr, "FAILED: %s: could not encode\n", name);
+	  failures++;
+	  return;
+     }
+     CHECK(len <= DELTACODEC_MAX_ENCODED_SIZE(n), name);
+
+     int ndecoded = deltacodec_decode(encoded, len, decoded, MAX_SAMPLE_COUNT);
+     if (ndecoded != (int) n || memcmp(samples, decoded, n*sizeof(uint32_t)) != 0) {
+	  fprintf(stderr, "FAILED: %s: decoded samples differ\n", name);
+	  failures++;
+     }
+}
+
+/**
+ * Write n samples as SAMPLES_DELTA record and read it back with read_tlv(),
+ * which must return a plain SAMPLES record.
+ */
+static void roundtrip_record(const char *name, const uint32_t *samples, size_t n)
+{
+     tlv_t tlv;
+     tlv.type = TLV_TYPE_SAMPLES_DELTA;
+     size_t len = deltacodec_encode(samples, n, tlv.value.bytes, sizeof(tlv.value));
+     CHECK(len > 0 && len <= UINT16_MAX, name);
+     tlv.length = len;
+
+     FILE *f = tmpfile();
+     if (f == NULL) {
+	  perror("tmpfile");
+	  exit(-1);
+     }
+     CHECK(write_tlv(&tlv, f) == 0, name);
+     rewind(f);
+     memset(&tlv, 0, sizeof(tlv));
+     CHECK(read_tlv(&tlv, f) == 0, name);
+     fclose(f);
+
+     CHECK(tlv.type == TLV_TYPE_SAMPLES, name);
+     CHECK(tlv.length == n*sizeof(uint32_t), name);
+     CHECK(memcmp(tlv.value.samples, samples, n*sizeof(uint32_t)) == 0, name);
+}
+
+static void test_typical(void)
+{
+     uint32_t samples[MAX_SAMPLE_COUNT];
+
+     // Periods of a 50 Hz wave at 42 MHz with some jitter.
+     srand(1);
+     for (size_t i = 0; i < MAX_SAMPLE_COUNT; i++)
+	  samples[i] = 840000 + (rand() % 2001) - 1000;
+
+     roundtrip("typical", samples, MAX_SAMPLE_COUNT);
+     roundtrip("single sample", samples, 1);
+     roundtrip("no samples", samples, 0);
+     roundtrip_record("typical record", samples, MAX_SAMPLE_COUNT);
+
+     // Small differences must be encoded compactly.
+     uint8_t encoded[DELTACODEC_MAX_ENCODED_SIZE(MAX_SAMPLE_COUNT)];
+     size_t len = deltacodec_encode(samples, MAX_SAMPLE_COUNT, encoded, sizeof(encoded));
+     CHECK(len < 3*MAX_SAMPLE_COUNT, "typical encoded size");
+}
+
+static void test_wraparound(void)
+{
+     // Interval values at both ends of the tick counter range, so that the
+     // differences are as large as possible in both directions.
+     const uint32_t samples[] = { 0, UINT32_MAX, 0, UINT32_MAX, UINT32_MAX, 1,
+				  UINT32_MAX-1, 0x80000000, 0x7fffffff, 0 };
+     size_t n = sizeof(samples)/sizeof(samples[0]);
+
+     roundtrip("wraparound", samples, n);
+     roundtrip_record("wraparound record", samples, n);
+
+     const uint32_t first_max[] = { UINT32_MAX };
+     roundtrip("maximum first sample", first_max, 1);
+}
+
+static void test_maximum_length(void)
+{
+     uint32_t samples[MAX_SAMPLE_COUNT];
+
+     // Worst case: every difference needs the maximum number of bytes.
+     for (size_t i = 0; i < MAX_SAMPLE_COUNT; i++)
+	  samples[i] = (i % 2 == 0) ? UINT32_MAX : 0;
+
+     uint8_t encoded[DELTACODEC_MAX_ENCODED_SIZE(MAX_SAMPLE_COUNT)];
+     size_t len = deltacodec_encode(samples, MAX_SAMPLE_COUNT, encoded, sizeof(encoded));
+     CHECK(len > 0, "maximum length encoding fits into the maximum encoded size");
+     roundtrip("maximum length", samples, MAX_SAMPLE_COUNT);
+     roundtrip_record("maximum length record", samples, MAX_SAMPLE_COUNT);
+
+     // One byte less than required must be rejected.
+     CHECK(deltacodec_encode(samples, MAX_SAMPLE_COUNT, encoded, len-1) == 0,
+	   "encoding into a too small buffer");
+
+     // More samples than the receiver accepts must be rejected.
+     uint32_t decoded[MAX_SAMPLE_COUNT];
+     CHECK(deltacodec_decode(encoded, len, decoded, MAX_SAMPLE_COUNT-1) == -1,
+	   "decoding more than maxsamples");
+
+     // A record with more than MAX_SAMPLE_COUNT samples must not be decoded.
+     uint32_t toomany[MAX_SAMPLE_COUNT+1];
+     for (size_t i = 0; i < MAX_SAMPLE_COUNT+1; i++)
+	  toomany[i] = 840000;
+     tlv_t tlv;
+     tlv.type = TLV_TYPE_SAMPLES_DELTA;
+     tlv.length = deltacodec_encode(toomany, MAX_SAMPLE_COUNT+1, tlv.value.bytes, sizeof(tlv.value));
+     CHECK(tlv.length > 0, "encoding more than MAX_SAMPLE_COUNT samples");
+     CHECK(decode_tlv(&tlv) == -1, "decoding a record with more than MAX_SAMPLE_COUNT samples");
+}
+
+static void test_invalid(void)
+{
+     uint32_t decoded[MAX_SAMPLE_COUNT];
+
+     // Truncated varint.
+     const uint8_t truncated[] = { 0x80, 0x80 };
+     CHECK(deltacodec_decode(truncated, sizeof(truncated), decoded, MAX_SAMPLE_COUNT) == -1,
+	   "truncated varint");
+
+     // First sample larger than 32 bit.
+     const uint8_t toolarge[] = { 0x80, 0x80, 0x80, 0x80, 0x10 };
+     CHECK(deltacodec_decode(toolarge, sizeof(toolarge), decoded, MAX_SAMPLE_COUNT) == -1,
+	   "sample larger than 32 bit");
+
+     // Difference leading to a negative sample.
+     const uint8_t negative[] = { 0x01, 0x05 };
+     CHECK(deltacodec_decode(negative, sizeof(negative), decoded, MAX_SAMPLE_COUNT) == -1,
+	   "negative sample");
+}
+
+int main(void)
+{
+     test_typical();
+     test_wraparound();
+     test_maximum_length();
+     test_invalid();
+
+     if (failures > 0) {
+	  fprintf(stderr, "%d checks failed\n", failures);
+	  return 1;
+     }
+
+     printf("All checks passed\n");
+     return 0;
+}
@@ -0,0 +1,542 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Required for pipe2() and O_CLOEXEC.
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <threads.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "errandwarn.h"
+
+#define MAX_STAGES 16
+#define MAX_ARGS 32
+#define MAX_PIPELINE_LEN 4096
+#define MAX_PATH_SIZE 1000
+#define MAX_WORKERS 256
+
+// One stage of the pipeline, e.g., "filter-sanitycheck_onepps -d 100".
+struct stage {
+     char path[MAX_PATH_SIZE];
+     char *argv[MAX_ARGS+1];
+};
+
+struct job {
+     const char *infile;
+     // OUTDIR/basename(infile)SUFFIX
+     char *outfile;
+     off_t size_in;
+     off_t size_out;
+     double seconds;
+     // 0 if all stages succeeded; otherwise exit status of the first failed stage.
+     int status;
+};
+
+// Double-ended queue of jobs of one worker. The owner takes jobs from the
+// back, idle workers steal from the front.
+struct deque {
+     mtx_t lock;
+     struct job **jobs;
+     size_t front;
+     size_t back;
+};
+
+char pipeline_spec[MAX_PIPELINE_LEN];
+struct stage stages[MAX_STAGES];
+int nstages = 0;
+
+char outdir[MAX_PATH_SIZE];
+char suffix[MAX_PATH_SIZE] = ".out";
+rlim_t memlimit = RLIM_INFINITY;
+
+struct deque deques[MAX_WORKERS];
+int nworkers;
+
+void usage(const char *app)
+{
+     fprintf(stderr, "USAGE: %s -p PIPELINE -o OUTDIR [OPTIONS] FILE [FILE ...]\n"
+	     "-p PIPELINE : filter stages separated by '|', e.g. \"filter-sanitycheck_onepps -d 100 | filter-convert_to_csv\"\n"
+	     "-o OUTDIR : directory for output files (FILE + SUFFIX) and logs of stderr (FILE + SUFFIX.log); FILEs must have distinct names\n"
+	     "-x SUFFIX : suffix of output files (default: .out)\n"
+	     "-j WORKERS : number of files processed concurrently (default: number of CPUs)\n"
+	     "-b BINDIR : directory containing the filter binaries (default: directory of this binary, then PATH)\n"
+	     "-m MEGABYTES : limit of the address space of each stage process; all pipelines together\n"
+	     "               use at most WORKERS * (number of stages) * MEGABYTES\n"
+	     "-s SUMMARYFILE : write summary to this file instead of stdout\n",
+	     app);
+}
+
+/**
+ * Split the pipeline specification into stages and arguments.
+ * Arguments can be quoted with '"' or '\'' (e.g., for times of filter-timewnd).
+ * The specification string is modified in place.
+ */
+int parse_pipeline(char *spec)
+{
+     char *p = spec;
+     int nargs = 0;
+     // Set if the last argument was terminated by '|' (which has been overwritten).
+     bool bar = false;
+
+     nstages = 0;
+     while (1) {
+	  while (*p == ' ' || *p == '\t')
+	       p++;
+	  if (bar || *p == '\0' || *p == '|') {
+	       if (nargs == 0)
+		    return -1; // empty stage
+	       stages[nstages].argv[nargs] = NULL;
+	       nstages++;
+	       nargs = 0;
+	       if (!bar && *p == '\0')
+		    return 0;
+	       if (nstages == MAX_STAGES)
+		    return -1;
+	       if (!bar)
+		    p++;
+	       bar = false;
+	       continue;
+	  }
+	  if (nargs == MAX_ARGS)
+	       return -1;
+
+	  // Parse next argument.
+	  char *arg = p;
+	  char *out = p;
+	  char quote = '\0';
+	  while (*p != '\0') {
+	       if (quote != '\0') {
+		    if (*p == quote)
+			 quote = '\0';
+		    else
+			 *out++ = *p;
+	       } else if (*p == '"' || *p == '\'') {
+		    quote = *p;
+	       } else if (*p == ' ' || *p == '\t' || *p == '|') {
+		    break;
+	       } else {
+		    *out++ = *p;
+	       }
+	       p++;
+	  }
+	  if (quote != '\0')
+	       return -1; // unterminated quote
+	  if (*p != '\0') {
+	       bar = (*p == '|');
+	       p++;
+	  }
+	  *out = '\0';
+	  stages[nstages].argv[nargs++] = arg;
+     }
+}
+
+/**
+ * Find the binary of a stage in the given directory or in PATH.
+ */
+int resolve_stage(struct stage *s, const char *bindir)
+{
+     const char *name = s->argv[0];
+     
+     if (strchr(name, '/') != NULL) {
+	  strncpy(s->path, name, MAX_PATH_SIZE-1);
+	  return 0;
+     }
+
+     if (bindir != NULL) {
+	  snprintf(s->path, MAX_PATH_SIZE, "%s/%s", bindir, name);
+	  if (access(s->path, X_OK) == 0)
+	       return 0;
+     }
+
+     const char *path = getenv("PATH");
+     if (path == NULL)
+	  return -1;
+     const char *dir = path;
+     while (*dir != '\0') {
+	  const char *end = strchr(dir, ':');
+	  size_t len = (end == NULL) ? strlen(dir) : (size_t) (end-dir);
+	  snprintf(s->path, MAX_PATH_SIZE, "%.*s/%s", (int) len, dir, name);
+	  if (access(s->path, X_OK) == 0)
+	       return 0;
+	  if (end == NULL)
+	       break;
+	  dir = end+1;
+     }
+     
+     return -1;
+}
+
+/**
+ * Run the pipeline on one input file. Each stage is a child process;
+ * stages are connected by pipes just like in the shell.
+ */
+void run_job(struct job *job)
+{
+     struct timespec tstart, tend;
+     clock_gettime(CLOCK_MONOTONIC, &tstart);
+
+     job->status = -1;
+     
+     const char *outfile = job->outfile;
+     char logfile[2*MAX_PATH_SIZE+4];
+     snprintf(logfile, sizeof(logfile), "%s.log", outfile);
+
+     // All descriptors are opened close-on-exec, so children forked concurrently
+     // by other workers do not inherit them (which would prevent EOF on pipes).
+     int fdin = open(job->infile, O_RDONLY | O_CLOEXEC);
+     if (fdin < 0) {
+	  fprintf(stderr, "Error: Could not open %s\n", job->infile);
+	  return;
+     }
+     int fdout = open(outfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+     int fdlog = open(logfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+     if (fdout < 0 || fdlog < 0) {
+	  fprintf(stderr, "Error: Could not create output files for %s\n", job->infile);
+	  close(fdin);
+	  if (fdout >= 0)
+	       close(fdout);
+	  if (fdlog >= 0)
+	       close(fdlog);
+	  return;
+     }
+
+     struct stat st;
+     if (fstat(fdin, &st) == 0)
+	  job->size_in = st.st_size;
+     
+     pid_t pids[MAX_STAGES];
+     int nstarted = 0;
+     int fdprev = fdin;
+     for (int i = 0; i < nstages; i++) {
+	  int fdpipe[2] = {-1, -1};
+	  if (i < nstages-1 && pipe2(fdpipe, O_CLOEXEC) < 0) {
+	       ERROR("Could not create pipe");
+	       break;
+	  }
+	  int fdnext = (i < nstages-1) ? fdpipe[1] : fdout;
+	  
+	  pid_t pid = fork();
+	  if (pid == 0) {
+	       // Child: dup2() clears the close-on-exec flag of the new descriptors.
+	       if (dup2(fdprev, STDIN_FILENO) < 0 ||
+		   dup2(fdnext, STDOUT_FILENO) < 0 ||
+		   dup2(fdlog, STDERR_FILENO) < 0)
+		    _exit(127);
+	       if (memlimit != RLIM_INFINITY) {
+		    struct rlimit rl = {.rlim_cur = memlimit, .rlim_max = memlimit};
+		    if (setrlimit(RLIMIT_AS, &rl) < 0) {
+			 // Only async-signal-safe calls after fork().
+			 static const char msg[] = "Error: Could not limit address space of stage\n";
+			 ssize_t ret = write(STDERR_FILENO, msg, sizeof(msg)-1);
+			 (void) ret;
+			 _exit(127);
+		    }
+	       }
+	       execv(stages[i].path, stages[i].argv);
+	       _exit(127);
+	  } else if (pid < 0) {
+	       ERROR("Could not fork");
+	       if (fdpipe[0] >= 0) {
+		    close(fdpipe[0]);
+		    close(fdpipe[1]);
+	       }
+	       break;
+	  }
+	  pids[nstarted++] = pid;
+
+	  close(fdprev);
+	  if (i < nstages-1)
+	       close(fdpipe[1]);
+	  fdprev = fdpipe[0];
+     }
+     if (fdprev >= 0 && nstarted < nstages)
+	  close(fdprev);
+     close(fdout);
+     close(fdlog);
+
+     int status = (nstarted == nstages) ? 0 : -1;
+     for (int i = 0; i < nstarted; i++) {
+	  int wstatus;
+	  while (waitpid(pids[i], &wstatus, 0) < 0) {
+	       if (errno != EINTR) {
+		    wstatus = -1;
+		    break;
+	       }
+	  }
+	  if (status == 0) {
+	       if (wstatus == -1)
+		    status = -1;
+	       else if (WIFEXITED(wstatus))
+		    status = WEXITSTATUS(wstatus);
+	       else if (WIFSIGNALED(wstatus) && WTERMSIG(wstatus) != SIGPIPE)
+		    status = 128 + WTERMSIG(wstatus);
+	       // Stages terminated by SIGPIPE are fine: a later stage (e.g.,
+	       // filter-timewnd) has stopped reading, just like in the shell.
+	  }
+     }
+     job->status = status;
+
+     if (stat(outfile, &st) == 0)
+	  job->size_out = st.st_size;
+
+     clock_gettime(CLOCK_MONOTONIC, &tend);
+     job->seconds = (tend.tv_sec - tstart.tv_sec) + 1.0e-9*(tend.tv_nsec - tstart.tv_nsec);
+}
+
+struct job *take_own(struct deque *d)
+{
+     struct job *job = NULL;
+     mtx_lock(&d->lock);
+     if (d->back > d->front)
+	  job = d->jobs[--d->back];
+     mtx_unlock(&d->lock);
+     return job;
+}
+
+struct job *steal(struct deque *d)
+{
+     struct job *job = NULL;
+     mtx_lock(&d->lock);
+     if (d->back > d->front)
+	  job = d->jobs[d->front++];
+     mtx_unlock(&d->lock);
+     return job;
+}
+
+int worker(void *arg)
+{
+     int id = *((int *) arg);
+
+     while (1) {
+	  struct job *job = take_own(&deques[id]);
+	  for (int i = 1; job == NULL && i < nworkers; i++)
+	       job = steal(&deques[(id+i) % nworkers]);
+	  if (job == NULL)
+	       // No more work anywhere; jobs are never added later.
+	       return 0;
+	  run_job(job);
+     }
+}
+
+int compare_size(const void *a, const void *b)
+{
+     const struct job *ja = *(struct job * const *) a;
+     const struct job *jb = *(struct job * const *) b;
+     // Ascending order; large files are taken first from the back of the deques.
+     if (ja->size_in < jb->size_in)
+	  return -1;
+     else if (ja->size_in > jb->size_in)
+	  return 1;
+     else
+	  return 0;
+}
+
+int compare_outfile(const void *a, const void *b)
+{
+     const struct job *ja = *(struct job * const *) a;
+     const struct job *jb = *(struct job * const *) b;
+     return strcmp(ja->outfile, jb->outfile);
+}
+
+int main(int argc, char *argv[])
+{
+     char bindir[MAX_PATH_SIZE];
+     char summaryfile[MAX_PATH_SIZE];
+     
+     memset(pipeline_spec, 0, MAX_PIPELINE_LEN);
+     memset(outdir, 0, MAX_PATH_SIZE);
+     memset(bindir, 0, MAX_PATH_SIZE);
+     memset(summaryfile, 0, MAX_PATH_SIZE);
+     nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+     
+     int c;
+     while ((c = getopt (argc, argv, "p:o:x:j:b:m:s:")) != -1) {
+	  switch (c) {
+	  case 'p' :
+	       strncpy(pipeline_spec, optarg, MAX_PIPELINE_LEN-1);
+	       break;
+	  case 'o' :
+	       strncpy(outdir, optarg, MAX_PATH_SIZE-1);
+	       break;
+	  case 'x' :
+	       strncpy(suffix, optarg, MAX_PATH_SIZE-1);
+	       break;
+	  case 'j' :
+	       nworkers = atoi(optarg);
+	       break;
+	  case 'b' :
+	       strncpy(bindir, optarg, MAX_PATH_SIZE-1);
+	       break;
+	  case 'm' :
+	       memlimit = ((rlim_t) atol(optarg))*1024*1024;
+	       break;
+	  case 's' :
+	       strncpy(summaryfile, optarg, MAX_PATH_SIZE-1);
+	       break;
+	  case '?':
+	  default :
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     int njobs = argc-optind;
+     if (strlen(pipeline_spec) == 0 || strlen(outdir) == 0 || njobs < 1 || nworkers < 1) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+     if (nworkers > MAX_WORKERS)
+	  nworkers = MAX_WORKERS;
+     if (nworkers > njobs)
+	  nworkers = njobs;
+
+     if (parse_pipeline(pipeline_spec) < 0) {
+	  ERROR("Invalid pipeline specification");
+	  exit(-1);
+     }
+
+     if (strlen(bindir) == 0) {
+	  // Default: the directory of this binary, where the filters are built.
+	  char self[MAX_PATH_SIZE];
+	  ssize_t len = readlink("/proc/self/exe", self, MAX_PATH_SIZE-1);
+	  if (len > 0) {
+	       self[len] = '\0';
+	       strncpy(bindir, dirname(self), MAX_PATH_SIZE-1);
+	  }
+     }
+     for (int i = 0; i < nstages; i++) {
+	  if (resolve_stage(&stages[i], strlen(bindir) > 0 ? bindir : NULL) < 0) {
+	       fprintf(stderr, "Error: Could not find filter %s\n", stages[i].argv[0]);
+	       exit(-1);
+	  }
+     }
+
+     struct job *jobs = calloc(njobs, sizeof(struct job));
+     struct job **slots = calloc(njobs, sizeof(struct job *));
+     if (jobs == NULL || slots == NULL) {
+	  ERROR("Out of memory");
+	  exit(-1);
+     }
+     struct job **sorted = malloc(njobs*sizeof(struct job *));
+     if (sorted == NULL) {
+	  ERROR("Out of memory");
+	  exit(-1);
+     }
+     for (int i = 0; i < njobs; i++) {
+	  struct stat st;
+	  jobs[i].infile = argv[optind+i];
+	  jobs[i].size_in = (stat(jobs[i].infile, &st) == 0) ? st.st_size : 0;
+	  jobs[i].status = -1;
+	  char name[MAX_PATH_SIZE];
+	  strncpy(name, jobs[i].infile, MAX_PATH_SIZE-1);
+	  name[MAX_PATH_SIZE-1] = '\0';
+	  char outfile[2*MAX_PATH_SIZE];
+	  snprintf(outfile, sizeof(outfile), "%s/%s%s", outdir, basename(name), suffix);
+	  if ( (jobs[i].outfile = strdup(outfile)) == NULL) {
+	       ERROR("Out of memory");
+	       exit(-1);
+	  }
+	  sorted[i] = &jobs[i];
+     }
+
+     // Files with the same name in different directories would overwrite
+     // each other's output.
+     qsort(sorted, njobs, sizeof(struct job *), compare_outfile);
+     for (int i = 1; i < njobs; i++) {
+	  if (strcmp(sorted[i-1]->outfile, sorted[i]->outfile) == 0) {
+	       fprintf(stderr, "Error: %s and %s would both be written to %s\n",
+		       sorted[i-1]->infile, sorted[i]->infile, sorted[i]->outfile);
+	       exit(-1);
+	  }
+     }
+
+     // Distribute files round-robin over the workers. Every worker deque gets a
+     // contiguous range of the slot array.
+     qsort(sorted, njobs, sizeof(struct job *), compare_size);
+     size_t pos = 0;
+     for (int w = 0; w < nworkers; w++) {
+	  deques[w].jobs = &slots[pos];
+	  deques[w].front = 0;
+	  deques[w].back = 0;
+	  mtx_init(&deques[w].lock, mtx_plain);
+	  for (int i = w; i < njobs; i += nworkers)
+	       deques[w].jobs[deques[w].back++] = sorted[i];
+	  pos += deques[w].back;
+     }
+     free(sorted);
+     
+     thrd_t threads[MAX_WORKERS];
+     int ids[MAX_WORKERS];
+     for (int w = 0; w < nworkers; w++) {
+	  ids[w] = w;
+	  if (thrd_create(&threads[w], worker, &ids[w]) != thrd_success) {
+	       ERROR("Could not create worker thread");
+	       exit(-1);
+	  }
+     }
+     for (int w = 0; w < nworkers; w++)
+	  thrd_join(threads[w], NULL);
+
+     FILE *summary = stdout;
+     if (strlen(summaryfile) > 0 && (summary = fopen(summaryfile, "w")) == NULL) {
+	  ERROR("Could not open summary file");
+	  exit(-1);
+     }
+     
+     int nfailed = 0;
+     off_t total_in = 0;
+     off_t total_out = 0;
+     double total_seconds = 0.0;
+     fprintf(summary, "file,status,bytes_in,bytes_out,seconds\n");
+     for (int i = 0; i < njobs; i++) {
+	  fprintf(summary, "%s,%d,%lld,%lld,%.3f\n", jobs[i].infile, jobs[i].status,
+		  (long long) jobs[i].size_in, (long long) jobs[i].size_out, jobs[i].seconds);
+	  if (jobs[i].status != 0)
+	       nfailed++;
+	  total_in += jobs[i].size_in;
+	  total_out += jobs[i].size_out;
+	  total_seconds += jobs[i].seconds;
+     }
+     fprintf(summary, "TOTAL,%d,%lld,%lld,%.3f\n", nfailed,
+	     (long long) total_in, (long long) total_out, total_seconds);
+     if (summary != stdout)
+	  fclose(summary);
+     
+     return (nfailed == 0) ? 0 : -1;
+}
@@ -0,0 +1,156 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "tlv.h"
+#include "zonemap.h"
+#include "errandwarn.h"
+
+#define MAX_PATH_SIZE 1000
+
+void usage(const char *app)
+{
+     fprintf(stderr, "USAGE: %s [-b BLOCKSIZE] FILE [FILE ...]\n"
+	     "Creates a zone map FILE" ZONEMAP_SUFFIX " with summary statistics of blocks of about BLOCKSIZE bytes\n"
+	     "(default: %d) for each recording.\n",
+	     app, ZONEMAP_DEFAULT_BLOCKSIZE);
+}
+
+int index_file(const char *path, uint32_t blocksize)
+{
+     char zmpath[MAX_PATH_SIZE];
+     zonemap_path(path, zmpath, MAX_PATH_SIZE);
+
+     FILE *f = fopen(path, "r");
+     if (f == NULL) {
+	  fprintf(stderr, "Error: Could not open %s\n", path);
+	  return -1;
+     }
+     FILE *fzm = fopen(zmpath, "w");
+     if (fzm == NULL) {
+	  fprintf(stderr, "Error: Could not create %s\n", zmpath);
+	  fclose(f);
+	  return -1;
+     }
+     if (zonemap_write_header(fzm, blocksize) < 0) {
+	  ERROR("Could not write zone map");
+	  exit(-1);
+     }
+
+     // State of the stream.
+     uint32_t fclk = 0;
+     uint64_t t_wallclock = 0;
+     tlv_header_t header;
+     bool has_header = false;
+     
+     zonemap_entry_t entry;
+     zonemap_entry_init(&entry, 0, fclk, t_wallclock, NULL);
+     tlv_t tlv;
+     while (1) {
+	  if (read_tlv(&tlv, f) < 0) {
+	       if (feof(f)) {
+		    break;
+	       } else {
+		    fprintf(stderr, "Error: Could not read TLV element from %s\n", path);
+		    exit(-1);
+	       }
+	  }
+
+	  zonemap_entry_add(&entry, &tlv);
+	  // Records might be stored compressed, so the size on disk is taken from the file position.
+	  entry.length = ftello(f) - entry.offset;
+	  if (tlv.type == TLV_TYPE_ONEPPS) {
+	       fclk = tlv.value.fclock;
+	  } else if (tlv.type == TLV_TYPE_WALLCLOCKTIME) {
+	       t_wallclock = tlv.value.wallclocktime;
+	  } else if (tlv.type == TLV_TYPE_HEADER) {
+	       tlv_header_t h;
+	       if (tlv_get_header(&tlv, &h) == 0) {
+		    // The clock of the header applies until the next ONEPPS record.
+		    header = h;
+		    fclk = 0;
+		    has_header = true;
+	       }
+	  }
+	  
+	  if (entry.length >= blocksize) {
+	       if (zonemap_write_entry(fzm, &entry) < 0) {
+		    ERROR("Could not write zone map");
+		    exit(-1);
+	       }
+	       zonemap_entry_init(&entry, entry.offset+entry.length, fclk, t_wallclock,
+				  has_header ? &header : NULL);
+	  }
+     }
+     if (entry.length > 0 && zonemap_write_entry(fzm, &entry) < 0) {
+	  ERROR("Could not write zone map");
+	  exit(-1);
+     }
+
+     fclose(f);
+     if (fclose(fzm) != 0) {
+	  ERROR("Could not write zone map");
+	  exit(-1);
+     }
+
+     return 0;
+}
+
+int main(int argc, char *argv[])
+{
+     long blocksize = ZONEMAP_DEFAULT_BLOCKSIZE;
+     
+     int c;
+     while ((c = getopt (argc, argv, "b:")) != -1) {
+	  switch (c) {
+	  case 'b' :
+	       blocksize = atol(optarg);
+	       break;
+	  case '?':
+	  default :
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     if (optind == argc || blocksize <= 0 || blocksize > UINT32_MAX) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+
+     int ret = 0;
+     for (int i = optind; i < argc; i++) {
+	  if (index_file(argv[i], blocksize) < 0)
+	       ret = -1;
+     }
+     
+     return ret;
+}
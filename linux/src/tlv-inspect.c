@@ -0,0 +1,842 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <threads.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tlv.h"
+#include "deltacodec.h"
+#include "errandwarn.h"
+#include "nominal.h"
+#include "samplekernels.h"
+
+#define MAX_WORKERS 256
+// Files are split into chunks of at least this size.
+#define MIN_CHUNK_SIZE (1024*1024)
+// Number of consecutive valid record headers required to start scanning
+// in the middle of a file.
+#define SYNC_RECORDS 16
+
+// Known record types (TLV_TYPE_HEADER is the highest); other types are counted as unknown.
+#define NTYPES (TLV_TYPE_HEADER+1)
+
+// Waves with a frequency deviating more than this from the nominal mains frequency are implausible.
+#define WAVE_TOLERANCE 0.1
+// A minute with valid calibration has at least this many ONEPPS records.
+#define MIN_ONEPPS_PER_MINUTE 58
+// Number of gaps and anomalous minutes listed in the human-readable report.
+#define MAX_LISTED 20
+// Characters of the coverage bitmap per day in the human-readable report (30 minutes each).
+#define COVERAGE_CHARS_PER_DAY 48
+#define MAX_TIMESTR_LEN 32
+
+const char *type_names[NTYPES] = {
+     "SAMPLES", "ONEPPS", "WALLCLOCKTIME", "SOURCE", "SAMPLES_DELTA",
+     "GAP", "WINDOWS", "TIMESTAMPS", "SAMPLES_MC", "HEADER"
+};
+
+// Counters of records assigned to one minute (by the last wall-clock timestamp).
+typedef struct {
+     // Minutes since Unix epoch.
+     uint64_t minute;
+     uint32_t waves;
+     uint32_t lost_waves;
+     uint32_t implausible;
+     uint32_t onepps;
+     uint32_t onepps_dropouts;
+     // Sample records that could not be decoded (oversized or invalid).
+     uint32_t corrupt;
+     // A wall-clock gap starts or ends in this minute.
+     bool partial;
+} minute_t;
+
+typedef struct {
+     // Wall-clock timestamps before and after the gap (ns since Unix epoch).
+     uint64_t t0;
+     uint64_t t1;
+} gap_t;
+
+typedef struct {
+     void *data;
+     size_t n;
+     size_t capacity;
+} vector_t;
+
+// Summary of the records of a chunk of a file.
+typedef struct {
+     const uint8_t *data;
+     size_t size;
+     // Nominal chunk [start, end), and actually scanned records [first, stop):
+     // the first record starts at or after start and the last one before end.
+     size_t start;
+     size_t end;
+     size_t first;
+     size_t stop;
+     bool synced;
+     
+     uint64_t records;
+     uint64_t types[NTYPES+1];
+     uint64_t truncated_bytes;
+     uint64_t waves;
+     uint64_t lost_waves;
+     uint64_t implausible;
+     uint64_t onepps;
+     uint64_t onepps_dropouts;
+     // Waves of channels other than 0 of multi-channel recordings (not
+     // assigned to minutes).
+     uint64_t mc_waves;
+     uint64_t mc_implausible;
+     bool has_wallclock;
+     uint64_t wc_first;
+     uint64_t wc_last;
+     uint64_t wc_jumps_back;
+     // Counters of records before the first wall-clock timestamp.
+     minute_t prefix;
+     // minute_t of records after wall-clock timestamps in order, and gap_t.
+     vector_t minutes;
+     vector_t gaps;
+} chunk_t;
+
+uint32_t max_deviation_ppm = 100;
+uint64_t max_gap_ns = 2000000000ull;
+// Nominal mains frequency from the command line (< 0: from the HEADER record of each file).
+double f_nominal_arg = -1.0;
+// Nominal values of the current file (HEADER record at the start of the file, or defaults).
+double f_nominal;
+uint32_t f_clk_nominal;
+double rate_tolerance = 0.02;
+uint32_t period_min;
+uint32_t period_max;
+// Range of valid 1-pps measurements (like filter-sanitycheck_onepps).
+uint32_t onepps_min;
+uint32_t onepps_max;
+
+void usage(const char *app)
+{
+     fprintf(stderr, "USAGE: %s [OPTIONS] FILE [FILE ...]\n"
+	     "Report time span, record counts, wall-clock gaps, ONEPPS dropouts, and sample-rate anomalies of recordings.\n"
+	     "-d MAX_DEVIATION_PPM : ONEPPS dropouts deviate more from the nominal clock (like filter-sanitycheck_onepps -d; default: 100)\n"
+	     "-g SECONDS : report wall-clock gaps longer than this (default: 2)\n"
+	     "-f NOMINAL_FREQUENCY : nominal mains frequency in Hz (default: from HEADER record, or 50)\n"
+	     "-t PERCENT : waves per minute deviating more from nominal are rate anomalies (default: 2)\n"
+	     "-j THREADS : number of threads scanning each file (default: number of CPUs)\n"
+	     "-J : JSON report\n"
+	     "-m : include per-minute coverage bitmap (minutes with clean data)\n",
+	     app);
+}
+
+void *vector_append(vector_t *v, size_t elemsize)
+{
+     if (v->n == v->capacity) {
+	  size_t capacity = (v->capacity == 0) ? 1024 : 2*v->capacity;
+	  void *data = realloc(v->data, capacity*elemsize);
+	  if (data == NULL) {
+	       ERROR("Out of memory");
+	       exit(-1);
+	  }
+	  v->data = data;
+	  v->capacity = capacity;
+     }
+     return (uint8_t *) v->data + elemsize*(v->n++);
+}
+
+/**
+ * Plausibility of a record header (for finding record boundaries in the
+ * middle of a file).
+ */
+bool valid_header(uint16_t type, uint16_t length)
+{
+     switch (type) {
+     case TLV_TYPE_SAMPLES :
+	  return length%sizeof(uint32_t) == 0 && length <= MAX_SAMPLE_COUNT*sizeof(uint32_t);
+     case TLV_TYPE_ONEPPS :
+	  return length == sizeof(uint32_t);
+     case TLV_TYPE_WALLCLOCKTIME :
+	  return length == sizeof(uint64_t);
+     case TLV_TYPE_SOURCE :
+	  return length == sizeof(uint16_t);
+     case TLV_TYPE_SAMPLES_DELTA :
+	  return length <= DELTACODEC_MAX_ENCODED_SIZE(MAX_SAMPLE_COUNT);
+     case TLV_TYPE_GAP :
+	  return length == sizeof(uint32_t) || length == sizeof(uint32_t)+sizeof(uint16_t);
+     case TLV_TYPE_WINDOWS :
+	  return length%sizeof(uint16_t) == 0 && length <= 2*MAX_SAMPLE_COUNT*sizeof(uint16_t);
+     case TLV_TYPE_TIMESTAMPS :
+	  return length >= sizeof(uint64_t) && length <= sizeof(uint64_t)+DELTACODEC_MAX_ENCODED_SIZE(MAX_SAMPLE_COUNT);
+     case TLV_TYPE_SAMPLES_MC :
+	  return length >= TLV_SAMPLES_MC_HEADER_SIZE &&
+	       length <= TLV_SAMPLES_MC_HEADER_SIZE+DELTACODEC_MAX_ENCODED_SIZE(MAX_SAMPLE_COUNT);
+     case TLV_TYPE_HEADER :
+	  return length >= sizeof(uint16_t) && length <= MAX_SAMPLE_COUNT*sizeof(uint32_t);
+     }
+     return false;
+}
+
+static inline void read_header(const uint8_t *p, uint16_t *type, uint16_t *length)
+{
+     memcpy(type, p, sizeof(uint16_t));
+     memcpy(length, p+sizeof(uint16_t), sizeof(uint16_t));
+}
+
+/**
+ * First offset at or after start (and before end) from which SYNC_RECORDS
+ * valid record headers follow each other (or valid records up to the end of
+ * the file). Returns end if there is none.
+ */
+size_t find_record(const uint8_t *data, size_t size, size_t start, size_t end)
+{
+     for (size_t o = start; o < end; o++) {
+	  size_t pos = o;
+	  int n = 0;
+	  while (n < SYNC_RECORDS && pos+2*sizeof(uint16_t) <= size) {
+	       uint16_t type, length;
+	       read_header(&data[pos], &type, &length);
+	       if (!valid_header(type, length))
+		    break;
+	       pos += 2*sizeof(uint16_t)+length;
+	       n++;
+	  }
+	  if (n == SYNC_RECORDS || pos == size)
+	       return o;
+     }
+     return end;
+}
+
+bool onepps_dropout(uint32_t fclock)
+{
+     return fclock < onepps_min || fclock > onepps_max;
+}
+
+uint32_t count_implausible(const uint32_t *samples, size_t n)
+{
+     uint32_t count = 0;
+     for (size_t i = 0; i < n; i++) {
+	  if (samples[i] < period_min || samples[i] > period_max)
+	       count++;
+     }
+     return count;
+}
+
+/**
+ * Scan the records of a chunk starting at offset first.
+ */
+void scan(chunk_t *chunk)
+{
+     const uint8_t *data = chunk->data;
+     // Counters of the current minute.
+     minute_t *m = &chunk->prefix;
+     uint32_t samples[MAX_SAMPLE_COUNT];
+     tlv_t tlv;
+     size_t pos = chunk->first;
+     while (pos < chunk->end) {
+	  if (pos+2*sizeof(uint16_t) > chunk->size) {
+	       chunk->truncated_bytes = chunk->size-pos;
+	       pos = chunk->size;
+	       break;
+	  }
+	  uint16_t type, length;
+	  read_header(&data[pos], &type, &length);
+	  const uint8_t *value = &data[pos+2*sizeof(uint16_t)];
+	  if (pos+2*sizeof(uint16_t)+length > chunk->size) {
+	       chunk->truncated_bytes = chunk->size-pos;
+	       pos = chunk->size;
+	       break;
+	  }
+	  pos += 2*sizeof(uint16_t)+length;
+	  chunk->records++;
+	  chunk->types[(type < NTYPES) ? type : NTYPES]++;
+
+	  int n;
+	  uint32_t u32;
+	  uint64_t t;
+	  switch (type) {
+	  case TLV_TYPE_SAMPLES :
+	       if (length > MAX_SAMPLE_COUNT*sizeof(uint32_t) || length%sizeof(uint32_t) != 0) {
+		    m->corrupt++;
+		    break;
+	       }
+	       n = length/sizeof(uint32_t);
+	       memcpy(samples, value, n*sizeof(uint32_t));
+	       m->waves += n;
+	       m->implausible += count_implausible(samples, n);
+	       break;
+	  case TLV_TYPE_SAMPLES_DELTA :
+	       n = deltacodec_decode(value, length, samples, MAX_SAMPLE_COUNT);
+	       if (n < 0) {
+		    m->corrupt++;
+		    break;
+	       }
+	       m->waves += n;
+	       m->implausible += count_implausible(samples, n);
+	       break;
+	  case TLV_TYPE_SAMPLES_MC :
+	       if (length > sizeof(tlv.value)) {
+		    m->corrupt++;
+		    break;
+	       }
+	       tlv.type = type;
+	       tlv.length = length;
+	       memcpy(&tlv.value, value, length);
+	       if (decode_tlv(&tlv) < 0 || tlv_channel(&tlv) < 0 ||
+		   (n = tlv_get_samples(&tlv, samples, MAX_SAMPLE_COUNT)) < 0) {
+		    m->corrupt++;
+		    break;
+	       }
+	       if (tlv_channel(&tlv) == 0) {
+		    m->waves += n;
+		    m->implausible += count_implausible(samples, n);
+	       } else {
+		    chunk->mc_waves += n;
+		    chunk->mc_implausible += count_implausible(samples, n);
+	       }
+	       break;
+	  case TLV_TYPE_GAP :
+	       // Channel 0 only (GAP records of other channels carry the channel).
+	       if (length == sizeof(uint32_t)) {
+		    memcpy(&u32, value, sizeof(u32));
+		    m->lost_waves += u32;
+	       }
+	       break;
+	  case TLV_TYPE_ONEPPS :
+	       if (length < sizeof(uint32_t))
+		    break;
+	       memcpy(&u32, value, sizeof(u32));
+	       m->onepps++;
+	       if (onepps_dropout(u32))
+		    m->onepps_dropouts++;
+	       break;
+	  case TLV_TYPE_WALLCLOCKTIME :
+	       if (length < sizeof(uint64_t))
+		    break;
+	       memcpy(&t, value, sizeof(t));
+	       bool gap = false;
+	       if (!chunk->has_wallclock) {
+		    chunk->has_wallclock = true;
+		    chunk->wc_first = t;
+	       } else if (t < chunk->wc_last) {
+		    chunk->wc_jumps_back++;
+	       } else if (t - chunk->wc_last > max_gap_ns) {
+		    gap_t *g = vector_append(&chunk->gaps, sizeof(gap_t));
+		    g->t0 = chunk->wc_last;
+		    g->t1 = t;
+		    m->partial = true;
+		    gap = true;
+	       }
+	       chunk->wc_last = t;
+	       uint64_t minute = t/60000000000ull;
+	       if (m == &chunk->prefix || m->minute != minute) {
+		    m = vector_append(&chunk->minutes, sizeof(minute_t));
+		    memset(m, 0, sizeof(*m));
+		    m->minute = minute;
+	       }
+	       if (gap)
+		    m->partial = true;
+	       break;
+	  }
+     }
+     chunk->stop = pos;
+}
+
+/**
+ * Worker: find the first record of a chunk in the middle of a file, and scan it.
+ */
+int scan_chunk(void *arg)
+{
+     chunk_t *chunk = (chunk_t *) arg;
+     if (chunk->start == 0) {
+	  chunk->first = 0;
+	  chunk->synced = true;
+     } else {
+	  chunk->first = find_record(chunk->data, chunk->size, chunk->start, chunk->end);
+	  chunk->synced = (chunk->first < chunk->end);
+     }
+     if (chunk->synced)
+	  scan(chunk);
+     return 0;
+}
+
+void reset_chunk(chunk_t *chunk)
+{
+     vector_t minutes = chunk->minutes;
+     vector_t gaps = chunk->gaps;
+     minutes.n = 0;
+     gaps.n = 0;
+     const uint8_t *data = chunk->data;
+     size_t size = chunk->size;
+     size_t start = chunk->start;
+     size_t end = chunk->end;
+     memset(chunk, 0, sizeof(*chunk));
+     chunk->data = data;
+     chunk->size = size;
+     chunk->start = start;
+     chunk->end = end;
+     chunk->minutes = minutes;
+     chunk->gaps = gaps;
+}
+
+int compare_minutes(const void *a, const void *b)
+{
+     const minute_t *ma = (const minute_t *) a;
+     const minute_t *mb = (const minute_t *) b;
+     if (ma->minute < mb->minute)
+	  return -1;
+     else if (ma->minute > mb->minute)
+	  return 1;
+     else
+	  return 0;
+}
+
+void format_time(uint64_t t, char *timestr)
+{
+     time_t tsec = t/1000000000ull;
+     struct tm tmtime;
+     if (gmtime_r(&tsec, &tmtime) == NULL)
+	  snprintf(timestr, MAX_TIMESTR_LEN, "%" PRIu64, t);
+     else
+	  strftime(timestr, MAX_TIMESTR_LEN, "%Y-%m-%d %H:%M:%S", &tmtime);
+}
+
+bool minute_clean(const minute_t *m, bool anomaly)
+{
+     return !m->partial && !anomaly && m->lost_waves == 0 && m->implausible == 0 &&
+	  m->corrupt == 0 && m->onepps_dropouts == 0 && m->onepps >= MIN_ONEPPS_PER_MINUTE;
+}
+
+/**
+ * Scan a file in parallel chunks, stitch the chunk summaries, and print the report.
+ */
+void inspect(const char *path, int nworkers, bool json, bool bitmap, bool first_file)
+{
+     int fd = open(path, O_RDONLY);
+     struct stat st;
+     if (fd < 0 || fstat(fd, &st) != 0) {
+	  ERROR("Could not open input file");
+	  exit(-1);
+     }
+     size_t size = st.st_size;
+     const uint8_t *data = NULL;
+     if (size > 0) {
+	  data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	  if (data == MAP_FAILED) {
+	       ERROR("Could not map input file");
+	       exit(-1);
+	  }
+	  madvise((void *) data, size, MADV_SEQUENTIAL);
+     }
+
+     // Nominal values of this file.
+     tlv_header_t header;
+     tlv_header_init(&header);
+     bool has_header = false;
+     if (size >= 2*sizeof(uint16_t)) {
+	  tlv_t tlv;
+	  uint16_t type, length;
+	  read_header(data, &type, &length);
+	  tlv.type = type;
+	  tlv.length = length;
+	  if (tlv.type == TLV_TYPE_HEADER && tlv.length <= size-2*sizeof(uint16_t) &&
+	      tlv.length <= sizeof(tlv.value)) {
+	       memcpy(&tlv.value, &data[2*sizeof(uint16_t)], tlv.length);
+	       has_header = (tlv_get_header(&tlv, &header) == 0);
+	       if (!has_header)
+		    tlv_header_init(&header);
+	  }
+     }
+     f_clk_nominal = header.f_clk;
+     f_nominal = (f_nominal_arg > 0.0) ? f_nominal_arg : header.f_mains_mhz/1000.0;
+     // Periods (clock ticks) of plausible waves.
+     period_min = (uint32_t) (f_clk_nominal/(f_nominal*(1.0+WAVE_TOLERANCE)));
+     period_max = (uint32_t) (f_clk_nominal/(f_nominal*(1.0-WAVE_TOLERANCE)));
+     kernel_onepps_bounds(f_clk_nominal, max_deviation_ppm, &onepps_min, &onepps_max);
+
+     size_t nchunks = size/MIN_CHUNK_SIZE + 1;
+     if (nchunks > (size_t) nworkers)
+	  nchunks = nworkers;
+     chunk_t *chunks = calloc(nchunks, sizeof(chunk_t));
+     thrd_t *threads = malloc(nchunks*sizeof(thrd_t));
+     if (chunks == NULL || threads == NULL) {
+	  ERROR("Out of memory");
+	  exit(-1);
+     }
+     for (size_t c = 0; c < nchunks; c++) {
+	  chunks[c].data = data;
+	  chunks[c].size = size;
+	  chunks[c].start = c*(size/nchunks);
+	  chunks[c].end = (c == nchunks-1) ? size : (c+1)*(size/nchunks);
+	  if (thrd_create(&threads[c], scan_chunk, &chunks[c]) != thrd_success) {
+	       ERROR("Could not create thread");
+	       exit(-1);
+	  }
+     }
+     for (size_t c = 0; c < nchunks; c++)
+	  thrd_join(threads[c], NULL);
+
+     // Stitch the chunks: a chunk must start exactly where the previous one
+     // stopped; otherwise (no or wrong record boundary found, or a record
+     // spanning the whole chunk), it is scanned again from there.
+     for (size_t c = 1; c < nchunks; c++) {
+	  size_t stop = chunks[c-1].stop;
+	  if (chunks[c].synced && chunks[c].first == stop)
+	       continue;
+	  reset_chunk(&chunks[c]);
+	  chunks[c].first = stop;
+	  if (stop < chunks[c].end) {
+	       scan(&chunks[c]);
+	  } else {
+	       chunks[c].stop = stop;
+	  }
+     }
+
+     // Combine the chunk summaries in file order.
+     chunk_t total;
+     memset(&total, 0, sizeof(total));
+     // Index of the minute the records of the next chunk before its first
+     // wall-clock timestamp belong to (none before the first timestamp).
+     bool has_minute = false;
+     for (size_t c = 0; c < nchunks; c++) {
+	  chunk_t *chunk = &chunks[c];
+	  total.records += chunk->records;
+	  for (int t = 0; t <= NTYPES; t++)
+	       total.types[t] += chunk->types[t];
+	  total.truncated_bytes += chunk->truncated_bytes;
+	  total.wc_jumps_back += chunk->wc_jumps_back;
+	  total.mc_waves += chunk->mc_waves;
+	  total.mc_implausible += chunk->mc_implausible;
+
+	  minute_t *prefix = &chunk->prefix;
+	  minute_t *m = has_minute ? &((minute_t *) total.minutes.data)[total.minutes.n-1] : &total.prefix;
+	  m->waves += prefix->waves;
+	  m->lost_waves += prefix->lost_waves;
+	  m->implausible += prefix->implausible;
+	  m->onepps += prefix->onepps;
+	  m->onepps_dropouts += prefix->onepps_dropouts;
+	  m->corrupt += prefix->corrupt;
+
+	  if (!chunk->has_wallclock)
+	       continue;
+	  minute_t *minutes = (minute_t *) chunk->minutes.data;
+	  if (!total.has_wallclock) {
+	       total.has_wallclock = true;
+	       total.wc_first = chunk->wc_first;
+	  } else if (chunk->wc_first < total.wc_last) {
+	       total.wc_jumps_back++;
+	  } else if (chunk->wc_first - total.wc_last > max_gap_ns) {
+	       gap_t *g = vector_append(&total.gaps, sizeof(gap_t));
+	       g->t0 = total.wc_last;
+	       g->t1 = chunk->wc_first;
+	       m->partial = true;
+	       minutes[0].partial = true;
+	  }
+	  total.wc_last = chunk->wc_last;
+	  for (size_t i = 0; i < chunk->gaps.n; i++)
+	       *((gap_t *) vector_append(&total.gaps, sizeof(gap_t))) = ((gap_t *) chunk->gaps.data)[i];
+	  for (size_t i = 0; i < chunk->minutes.n; i++)
+	       *((minute_t *) vector_append(&total.minutes, sizeof(minute_t))) = minutes[i];
+	  has_minute = true;
+     }
+
+     // Merge the counters of each minute (a minute may appear several times,
+     // e.g., at chunk boundaries or if the wall-clock jumped back).
+     minute_t *minutes = (minute_t *) total.minutes.data;
+     size_t nminutes = 0;
+     if (total.minutes.n > 0) {
+	  qsort(minutes, total.minutes.n, sizeof(minute_t), compare_minutes);
+	  for (size_t i = 1; i < total.minutes.n; i++) {
+	       if (minutes[i].minute == minutes[nminutes].minute) {
+		    minute_t *m = &minutes[nminutes];
+		    m->waves += minutes[i].waves;
+		    m->lost_waves += minutes[i].lost_waves;
+		    m->implausible += minutes[i].implausible;
+		    m->onepps += minutes[i].onepps;
+		    m->onepps_dropouts += minutes[i].onepps_dropouts;
+		    m->corrupt += minutes[i].corrupt;
+		    m->partial |= minutes[i].partial;
+	       } else {
+		    minutes[++nminutes] = minutes[i];
+	       }
+	  }
+	  nminutes++;
+	  // The first and last minute of the recording are incomplete.
+	  minutes[0].partial = true;
+	  minutes[nminutes-1].partial = true;
+     }
+     
+     uint64_t waves = total.prefix.waves, lost_waves = total.prefix.lost_waves;
+     uint64_t implausible = total.prefix.implausible;
+     uint64_t onepps = total.prefix.onepps, onepps_dropouts = total.prefix.onepps_dropouts;
+     uint64_t corrupt = total.prefix.corrupt;
+     double expected = 60.0*f_nominal;
+     bool *anomaly = calloc(nminutes+1, sizeof(bool));
+     size_t nanomalies = 0, nclean = 0;
+     for (size_t i = 0; i < nminutes; i++) {
+	  minute_t *m = &minutes[i];
+	  waves += m->waves;
+	  lost_waves += m->lost_waves;
+	  implausible += m->implausible;
+	  onepps += m->onepps;
+	  onepps_dropouts += m->onepps_dropouts;
+	  corrupt += m->corrupt;
+	  // Waves of complete minutes should match the nominal frequency
+	  // (lost waves are reported separately).
+	  double n = m->waves + m->lost_waves;
+	  if (!m->partial && (n < (1.0-rate_tolerance)*expected || n > (1.0+rate_tolerance)*expected)) {
+	       anomaly[i] = true;
+	       nanomalies++;
+	  }
+	  if (minute_clean(m, anomaly[i]))
+	       nclean++;
+     }
+     gap_t *gaps = (gap_t *) total.gaps.data;
+     uint64_t longest_gap = 0;
+     for (size_t i = 0; i < total.gaps.n; i++) {
+	  if (gaps[i].t1 - gaps[i].t0 > longest_gap)
+	       longest_gap = gaps[i].t1 - gaps[i].t0;
+     }
+
+     // Coverage bitmap: bit i is set if minute first+i is clean.
+     uint64_t first_minute = (nminutes > 0) ? minutes[0].minute : 0;
+     uint64_t span_minutes = (nminutes > 0) ? minutes[nminutes-1].minute - first_minute + 1 : 0;
+     
+     char t0str[MAX_TIMESTR_LEN], t1str[MAX_TIMESTR_LEN];
+     if (json) {
+	  printf("%s{\n", first_file ? "" : ",\n");
+	  printf("  \"file\": \"");
+	  for (const char *p = path; *p; p++) {
+	       if (*p == '"' || *p == '\\')
+		    putchar('\\');
+	       putchar(*p);
+	  }
+	  printf("\",\n  \"bytes\": %zu,\n  \"records\": %" PRIu64 ",\n  \"truncated_bytes\": %" PRIu64 ",\n  \"types\": {",
+		 size, total.records, total.truncated_bytes);
+	  for (int t = 0; t < NTYPES; t++)
+	       printf("%s\"%s\": %" PRIu64, t == 0 ? "" : ", ", type_names[t], total.types[t]);
+	  printf(", \"unknown\": %" PRIu64 "},\n", total.types[NTYPES]);
+	  if (has_header)
+	       printf("  \"header\": {\"version\": %u, \"appliance_id\": %" PRIu32 ", \"f_clk\": %" PRIu32
+		      ", \"f_mains\": %.3f, \"batch_size\": %u},\n", header.version, header.appliance_id,
+		      header.f_clk, header.f_mains_mhz/1000.0, header.batch_size);
+	  else
+	       printf("  \"header\": null,\n");
+	  if (total.has_wallclock)
+	       printf("  \"tstart\": %" PRIu64 ",\n  \"tend\": %" PRIu64 ",\n", total.wc_first, total.wc_last);
+	  else
+	       printf("  \"tstart\": null,\n  \"tend\": null,\n");
+	  printf("  \"waves\": %" PRIu64 ",\n  \"lost_waves\": %" PRIu64 ",\n  \"implausible_waves\": %" PRIu64 ",\n",
+		 waves, lost_waves, implausible);
+	  printf("  \"corrupt_records\": %" PRIu64 ",\n", corrupt);
+	  printf("  \"other_channel_waves\": %" PRIu64 ",\n  \"other_channel_implausible_waves\": %" PRIu64 ",\n",
+		 total.mc_waves, total.mc_implausible);
+	  printf("  \"onepps\": %" PRIu64 ",\n  \"onepps_dropouts\": %" PRIu64 ",\n", onepps, onepps_dropouts);
+	  printf("  \"wallclock_jumps_back\": %" PRIu64 ",\n  \"wallclock_gaps\": [", total.wc_jumps_back);
+	  for (size_t i = 0; i < total.gaps.n; i++)
+	       printf("%s[%" PRIu64 ", %" PRIu64 "]", i == 0 ? "" : ", ", gaps[i].t0, gaps[i].t1);
+	  printf("],\n  \"minutes\": %zu,\n  \"clean_minutes\": %zu,\n  \"rate_anomalies\": [", nminutes, nclean);
+	  size_t k = 0;
+	  for (size_t i = 0; i < nminutes; i++) {
+	       if (anomaly[i])
+		    printf("%s%" PRIu64, k++ == 0 ? "" : ", ", 60*minutes[i].minute);
+	  }
+	  printf("]");
+	  if (bitmap) {
+	       // Hex digits, 4 minutes each, most significant bit first.
+	       printf(",\n  \"coverage\": {\"start\": %" PRIu64 ", \"minutes\": %" PRIu64 ", \"bitmap\": \"",
+		      60*first_minute, span_minutes);
+	       size_t i = 0;
+	       for (uint64_t d = 0; d < (span_minutes+3)/4; d++) {
+		    unsigned int digit = 0;
+		    for (int b = 0; b < 4; b++) {
+			 uint64_t minute = first_minute + 4*d + b;
+			 if (i < nminutes && minutes[i].minute == minute) {
+			      if (minute_clean(&minutes[i], anomaly[i]))
+				   digit |= 8 >> b;
+			      i++;
+			 }
+		    }
+		    putchar("0123456789abcdef"[digit]);
+	       }
+	       printf("\"}");
+	  }
+	  printf("\n}");
+     } else {
+	  printf("%s%s: %zu bytes, %" PRIu64 " records", first_file ? "" : "\n", path, size, total.records);
+	  if (total.truncated_bytes > 0)
+	       printf(" (%" PRIu64 " bytes of a truncated record at the end)", total.truncated_bytes);
+	  printf("\n");
+	  if (has_header)
+	       printf("  header: appliance %" PRIu32 ", clock %" PRIu32 " Hz, mains %.3f Hz, batch size %u (version %u)\n",
+		      header.appliance_id, header.f_clk, header.f_mains_mhz/1000.0, header.batch_size, header.version);
+	  if (total.has_wallclock) {
+	       format_time(total.wc_first, t0str);
+	       format_time(total.wc_last, t1str);
+	       printf("  time span: %s - %s UTC (%.0f s)\n", t0str, t1str,
+		      (total.wc_last - total.wc_first)/1e9);
+	  } else {
+	       printf("  time span: no wall-clock timestamps\n");
+	  }
+	  printf("  records:");
+	  for (int t = 0; t < NTYPES; t++) {
+	       if (total.types[t] > 0)
+		    printf(" %s %" PRIu64, type_names[t], total.types[t]);
+	  }
+	  if (total.types[NTYPES] > 0)
+	       printf(" unknown %" PRIu64, total.types[NTYPES]);
+	  printf("\n  waves: %" PRIu64 " (lost on link: %" PRIu64 ", implausible: %" PRIu64 ")\n",
+		 waves, lost_waves, implausible);
+	  if (total.mc_waves > 0)
+	       printf("  waves of other channels: %" PRIu64 " (implausible: %" PRIu64 ")\n",
+		      total.mc_waves, total.mc_implausible);
+	  if (corrupt > 0)
+	       printf("  corrupt sample records: %" PRIu64 "\n", corrupt);
+	  printf("  ONEPPS: %" PRIu64 " records, %" PRIu64 " dropouts (deviation > %" PRIu32 " ppm)\n",
+		 onepps, onepps_dropouts, max_deviation_ppm);
+	  printf("  wall-clock gaps (> %.0f s): %zu", max_gap_ns/1e9, total.gaps.n);
+	  if (total.gaps.n > 0)
+	       printf(", longest %.0f s", longest_gap/1e9);
+	  if (total.wc_jumps_back > 0)
+	       printf(", %" PRIu64 " jumps back", total.wc_jumps_back);
+	  printf("\n");
+	  for (size_t i = 0; i < total.gaps.n && i < MAX_LISTED; i++) {
+	       format_time(gaps[i].t0, t0str);
+	       format_time(gaps[i].t1, t1str);
+	       printf("    %s - %s (%.0f s)\n", t0str, t1str, (gaps[i].t1 - gaps[i].t0)/1e9);
+	  }
+	  if (total.gaps.n > MAX_LISTED)
+	       printf("    ...\n");
+	  printf("  minutes: %zu with data, %zu clean, %zu rate anomalies (waves deviating > %.1f %% from nominal)\n",
+		 nminutes, nclean, nanomalies, 100.0*rate_tolerance);
+	  size_t k = 0;
+	  for (size_t i = 0; i < nminutes && k < MAX_LISTED; i++) {
+	       if (anomaly[i]) {
+		    format_time(60000000000ull*minutes[i].minute, t0str);
+		    printf("    %s: %" PRIu32 " waves\n", t0str, minutes[i].waves + minutes[i].lost_waves);
+		    k++;
+	       }
+	  }
+	  if (nanomalies > MAX_LISTED)
+	       printf("    ...\n");
+	  if (bitmap && nminutes > 0) {
+	       printf("  coverage (30 minutes per character; '#': all clean, '+': partly clean, '.': not clean, ' ': no data):\n");
+	       size_t i = 0;
+	       uint64_t day = first_minute/1440;
+	       uint64_t last_day = minutes[nminutes-1].minute/1440;
+	       for (; day <= last_day; day++) {
+		    format_time(86400000000000ull*day, t0str);
+		    t0str[10] = '\0';
+		    printf("    %s |", t0str);
+		    for (int slot = 0; slot < COVERAGE_CHARS_PER_DAY; slot++) {
+			 uint64_t slot_end = 1440*day + (slot+1)*(1440/COVERAGE_CHARS_PER_DAY);
+			 int with_data = 0, clean = 0;
+			 for (; i < nminutes && minutes[i].minute < slot_end; i++) {
+			      with_data++;
+			      if (minute_clean(&minutes[i], anomaly[i]))
+				   clean++;
+			 }
+			 char ch = ' ';
+			 if (with_data > 0)
+			      ch = (clean == 1440/COVERAGE_CHARS_PER_DAY) ? '#' : ((clean > 0) ? '+' : '.');
+			 putchar(ch);
+		    }
+		    printf("|\n");
+	       }
+	  }
+     }
+
+     free(anomaly);
+     for (size_t c = 0; c < nchunks; c++) {
+	  free(chunks[c].minutes.data);
+	  free(chunks[c].gaps.data);
+     }
+     free(total.minutes.data);
+     free(total.gaps.data);
+     free(chunks);
+     free(threads);
+     if (size > 0)
+	  munmap((void *) data, size);
+     close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+     int nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+     bool json = false;
+     bool bitmap = false;
+     int c;
+     while ((c = getopt (argc, argv, "d:g:f:t:j:Jm")) != -1) {
+	  switch (c) {
+	  case 'd' :
+	       max_deviation_ppm = atoi(optarg);
+	       break;
+	  case 'g' :
+	       max_gap_ns = (uint64_t) (atof(optarg)*1e9);
+	       break;
+	  case 'f' :
+	       f_nominal_arg = atof(optarg);
+	       break;
+	  case 't' :
+	       rate_tolerance = atof(optarg)/100.0;
+	       break;
+	  case 'j' :
+	       nworkers = atoi(optarg);
+	       break;
+	  case 'J' :
+	       json = true;
+	       break;
+	  case 'm' :
+	       bitmap = true;
+	       break;
+	  case '?':
+	  default :
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     if (optind == argc || nworkers < 1 || f_nominal_arg == 0.0) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+     if (nworkers > MAX_WORKERS)
+	  nworkers = MAX_WORKERS;
+
+     if (json)
+	  printf("[\n");
+     for (int i = optind; i < argc; i++)
+	  inspect(argv[i], nworkers, json, bitmap, i == optind);
+     if (json)
+	  printf("\n]\n");
+     
+     return 0;
+}
@@ -0,0 +1,273 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include "tlv.h"
+#include "errandwarn.h"
+
+// Maximum number of recordings that can be merged.
+#define MAX_SOURCES 256
+
+// Size of the stdio buffer of each input file.
+#define READ_BUFFER_SIZE (1024*1024)
+
+// Number of bytes the kernel is asked to read ahead asynchronously
+// while we are still consuming the buffered data of a file.
+#define READ_AHEAD_SIZE (8*READ_BUFFER_SIZE)
+
+struct source {
+     FILE *f;
+     char *buffer;
+     uint16_t id;
+     // Number of bytes consumed from the file so far.
+     off_t offset;
+     // Offset up to which read-ahead has been requested.
+     off_t prefetched;
+     // Wallclock time of the segment starting with the pending record.
+     // Records before the first WALLCLOCKTIME record have key 0.
+     uint64_t key;
+     // Next record to be written (first record of the next segment).
+     tlv_t pending;
+     // Last 1-pps measurement of this source.
+     bool has_onepps;
+     uint32_t fclock;
+     // Last HEADER record of this source (sources may use different nominal values).
+     tlv_header_t header;
+};
+
+struct source sources[MAX_SOURCES];
+
+// Binary min-heap of sources ordered by (key, id).
+struct source *heap[MAX_SOURCES];
+size_t nheap = 0;
+
+void usage(const char *app)
+{
+     fprintf(stderr, "USAGE: %s FILE [FILE ...]\n"
+	     "Merges TLV recordings into one stream ordered by wallclock time.\n"
+	     "Records of the i-th file (counting from 0) are tagged with source id i.\n",
+	     app);
+}
+
+static bool less(const struct source *a, const struct source *b)
+{
+     if (a->key != b->key)
+	  return (a->key < b->key);
+     else
+	  return (a->id < b->id);
+}
+
+static void heap_push(struct source *s)
+{
+     size_t i = nheap++;
+     heap[i] = s;
+     while (i > 0) {
+	  size_t parent = (i-1)/2;
+	  if (!less(heap[i], heap[parent]))
+	       break;
+	  struct source *tmp = heap[i];
+	  heap[i] = heap[parent];
+	  heap[parent] = tmp;
+	  i = parent;
+     }
+}
+
+static struct source *heap_pop()
+{
+     struct source *top = heap[0];
+     heap[0] = heap[--nheap];
+     size_t i = 0;
+     while (1) {
+	  size_t l = 2*i+1;
+	  size_t r = l+1;
+	  size_t min = i;
+	  if (l < nheap && less(heap[l], heap[min]))
+	       min = l;
+	  if (r < nheap && less(heap[r], heap[min]))
+	       min = r;
+	  if (min == i)
+	       break;
+	  struct source *tmp = heap[i];
+	  heap[i] = heap[min];
+	  heap[min] = tmp;
+	  i = min;
+     }
+     return top;
+}
+
+/**
+ * Read the next record of a source.
+ * Returns 0 on success and -1 at the end of the file.
+ */
+static int read_next(struct source *s, tlv_t *tlv)
+{
+     if (read_tlv(tlv, s->f) < 0) {
+	  if (feof(s->f)) {
+	       return -1;
+	  } else {
+	       fprintf(stderr, "Error: Could not read TLV element from source %u\n", s->id);
+	       exit(-1);
+	  }
+     }
+     s->offset += sizeof(tlv->type) + sizeof(tlv->length) + tlv->length;
+
+     // Keep the kernel reading ahead of us, so we do not block on
+     // the disk when the stdio buffer runs empty.
+     if (s->offset + READ_AHEAD_SIZE/2 > s->prefetched) {
+	  posix_fadvise(fileno(s->f), s->prefetched, READ_AHEAD_SIZE, POSIX_FADV_WILLNEED);
+	  s->prefetched += READ_AHEAD_SIZE;
+     }
+     
+     return 0;
+}
+
+static void write_record(const tlv_t *tlv)
+{
+     if (write_tlv(tlv, stdout) < 0) {
+	  ERROR("Could not write TLV element to stdout");
+	  exit(-1);
+     }
+}
+
+static void set_pending(struct source *s)
+{
+     if (s->pending.type == TLV_TYPE_WALLCLOCKTIME)
+	  s->key = s->pending.value.wallclocktime;
+}
+
+int main(int argc, char *argv[])
+{
+     int nsources = argc-1;
+     if (nsources < 1) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+     if (nsources > MAX_SOURCES) {
+	  ERROR("Too many input files");
+	  exit(-1);
+     }
+
+     for (int i = 0; i < nsources; i++) {
+	  struct source *s = &sources[i];
+	  s->id = i;
+	  s->offset = 0;
+	  s->key = 0;
+	  s->has_onepps = false;
+	  tlv_header_init(&s->header);
+	  if ( (s->f = fopen(argv[i+1], "r")) == NULL) {
+	       fprintf(stderr, "Error: Could not open file %s\n", argv[i+1]);
+	       exit(-1);
+	  }
+	  if ( (s->buffer = malloc(READ_BUFFER_SIZE)) == NULL) {
+	       ERROR("Out of memory");
+	       exit(-1);
+	  }
+	  setvbuf(s->f, s->buffer, _IOFBF, READ_BUFFER_SIZE);
+	  posix_fadvise(fileno(s->f), 0, 0, POSIX_FADV_SEQUENTIAL);
+	  posix_fadvise(fileno(s->f), 0, READ_AHEAD_SIZE, POSIX_FADV_WILLNEED);
+	  s->prefetched = READ_AHEAD_SIZE;
+	  
+	  if (read_next(s, &s->pending) == 0) {
+	       set_pending(s);
+	       heap_push(s);
+	  }
+     }
+
+     // Once any source carried a HEADER record, every source switch
+     // re-emits the header of the new source (nominal values for
+     // sources without header), so downstream filters never apply the
+     // header of one source to the data of another.
+     bool headers = false;
+     // Once a 1-pps measurement has been written, a source without one
+     // gets its nominal clock, so downstream filters do not keep the
+     // calibrated clock of the previous source.
+     bool clock_written = false;
+     struct source *current = NULL;
+     tlv_t tlv;
+     while (nheap > 0) {
+	  struct source *s = heap_pop();
+
+	  if (s != current) {
+	       // Switching sources: tag the following records and restore
+	       // the nominal values and the calibrated clock of this source
+	       // for downstream filters.
+	       tlv.type = TLV_TYPE_SOURCE;
+	       tlv.length = sizeof(uint16_t);
+	       tlv.value.source = s->id;
+	       write_record(&tlv);
+	       if (headers) {
+		    tlv_set_header(&tlv, &s->header);
+		    write_record(&tlv);
+	       }
+	       if (s->has_onepps || clock_written) {
+		    tlv.type = TLV_TYPE_ONEPPS;
+		    tlv.length = sizeof(uint32_t);
+		    tlv.value.fclock = s->has_onepps ? s->fclock : s->header.f_clk;
+		    write_record(&tlv);
+		    clock_written = true;
+	       }
+	       current = s;
+	  }
+
+	  // Write one segment of this source, i.e., all records up to the
+	  // next wallclock timestamp.
+	  tlv_t *next = &s->pending;
+	  do {
+	       if (next->type == TLV_TYPE_ONEPPS) {
+		    clock_written = true;
+		    s->has_onepps = true;
+		    s->fclock = next->value.fclock;
+	       } else if (next->type == TLV_TYPE_HEADER) {
+		    tlv_get_header(next, &s->header);
+		    headers = true;
+	       }
+	       write_record(next);
+	       if (read_next(s, &tlv) < 0) {
+		    // Source exhausted.
+		    fclose(s->f);
+		    free(s->buffer);
+		    next = NULL;
+		    break;
+	       }
+	       next = &tlv;
+	  } while (tlv.type != TLV_TYPE_WALLCLOCKTIME);
+
+	  if (next != NULL) {
+	       memcpy(&s->pending, &tlv, sizeof(tlv.type) + sizeof(tlv.length) + tlv.length);
+	       set_pending(s);
+	       heap_push(s);
+	  }
+     }
+     
+     return 0;
+}
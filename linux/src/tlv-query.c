@@ -0,0 +1,356 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "tlv.h"
+#include "zonemap.h"
+#include "errandwarn.h"
+#include "nominal.h"
+
+#define MAX_TIMESTR_LEN 1000
+#define MAX_PATH_SIZE 1000
+
+// Predicate.
+uint64_t tstartns = 0;
+uint64_t tendns = UINT64_MAX;
+double f_min = 0.0;
+double f_max = 1.0e9;
+bool outside = false;
+
+// Statistics.
+uint64_t bytes_total = 0;
+uint64_t bytes_read = 0;
+unsigned long blocks_total = 0;
+unsigned long blocks_read = 0;
+
+void usage(const char *app)
+{
+     fprintf(stderr, "USAGE: %s [OPTIONS] FILE [FILE ...]\n"
+	     "Writes a TLV stream with all samples of the given recordings matching the predicate.\n"
+	     "-l : time specified as local time\n"
+	     "-u : time specified as UTC (default)\n"
+	     "-s STARTTIME : only samples with wallclock timestamp after and including this time\n"
+	     "-e ENDTIME : only samples with wallclock timestamp before and including this time\n"
+	     "-f FMIN : lower bound of f_mains_syncd\n"
+	     "-F FMAX : upper bound of f_mains_syncd\n"
+	     "-x : select samples outside of [FMIN, FMAX] instead of inside\n"
+	     "-v : report number of bytes read to stderr\n"
+	     "\n"
+	     "Time format (quoted string): year-month-day hour:minute:second\n"
+	     "year: yyyy \t month: 1-12 \t day: 1-31 \t hour: 0-23 \t minute: 0-59 \t second: 0-59 \n",
+	     app);
+}
+
+time_t parse_time(const char *s, bool uselocaltime)
+{
+     struct tm t;
+
+     memset(&t, 0, sizeof(t));
+     if (strptime(s, "%Y-%m-%d %H:%M:%S", &t) == NULL) {
+	  fprintf(stderr, "Could not parse time %s\n", s);
+	  exit(-1);
+     }
+     // The result of both, mktime() and timegm(), is time since epoch in UTC.
+     if (uselocaltime)
+	  return mktime(&t);
+     else
+	  return timegm(&t);
+}
+
+void write_record(const tlv_t *tlv)
+{
+     if (write_tlv(tlv, stdout) < 0) {
+	  ERROR("Could not write TLV element to stdout");
+	  exit(-1);
+     }
+}
+
+bool match(uint32_t ticks, uint32_t fclk)
+{
+     double f = (double) fclk / ticks;
+     if (outside)
+	  return (f < f_min || f > f_max);
+     else
+	  return (f >= f_min && f <= f_max);
+}
+
+/**
+ * Decode a block and write matching samples together with the HEADER, ONEPPS,
+ * and WALLCLOCKTIME records required to interpret them.
+ */
+void query_block(FILE *f, const zonemap_entry_t *e)
+{
+     if (fseeko(f, e->offset, SEEK_SET) != 0) {
+	  ERROR("Could not seek in recording");
+	  exit(-1);
+     }
+
+     uint32_t fclk = F_CLK_NOMINAL;
+     if (e->fclk_in != 0)
+	  fclk = e->fclk_in;
+     else if (e->header_in.version != 0)
+	  fclk = e->header_in.f_clk;
+     uint64_t t_wallclock = e->t_wallclock_in;
+     
+     // Restore the state of the stream at the beginning of the block.
+     tlv_t tlv;
+     if (e->header_in.version != 0) {
+	  tlv_set_header(&tlv, &e->header_in);
+	  write_record(&tlv);
+     }
+     if (e->fclk_in != 0) {
+	  tlv.type = TLV_TYPE_ONEPPS;
+	  tlv.length = sizeof(uint32_t);
+	  tlv.value.fclock = e->fclk_in;
+	  write_record(&tlv);
+     }
+     if (e->t_wallclock_in != 0) {
+	  tlv.type = TLV_TYPE_WALLCLOCKTIME;
+	  tlv.length = sizeof(uint64_t);
+	  tlv.value.wallclocktime = e->t_wallclock_in;
+	  write_record(&tlv);
+     }
+     
+     while (ftello(f) < (off_t) (e->offset + e->length)) {
+	  if (read_tlv(&tlv, f) < 0) {
+	       ERROR("Could not read TLV element (zone map does not match recording)");
+	       exit(-1);
+	  }
+
+	  switch (tlv.type) {
+	  case TLV_TYPE_SAMPLES :
+	  case TLV_TYPE_SAMPLES_MC : {
+	       if (t_wallclock < tstartns || t_wallclock > tendns)
+		    break;
+	       uint32_t samples[MAX_SAMPLE_COUNT];
+	       int nsamples = tlv_get_samples(&tlv, samples, MAX_SAMPLE_COUNT);
+	       size_t nmatching = 0;
+	       for (int i = 0; i < nsamples; i++) {
+		    if (match(samples[i], fclk))
+			 samples[nmatching++] = samples[i];
+	       }
+	       if (nmatching > 0) {
+		    tlv_set_samples(&tlv, tlv_channel(&tlv), samples, nmatching);
+		    write_record(&tlv);
+	       }
+	       break;
+	  }
+	  case TLV_TYPE_ONEPPS :
+	       fclk = tlv.value.fclock;
+	       write_record(&tlv);
+	       break;
+	  case TLV_TYPE_WALLCLOCKTIME :
+	       t_wallclock = tlv.value.wallclocktime;
+	       write_record(&tlv);
+	       break;
+	  case TLV_TYPE_HEADER : {
+	       tlv_header_t header;
+	       if (tlv_get_header(&tlv, &header) == 0)
+		    fclk = header.f_clk;
+	       write_record(&tlv);
+	       break;
+	  }
+	  default :
+	       write_record(&tlv);
+	  }
+     }
+     bytes_read += e->length;
+     blocks_read++;
+}
+
+/**
+ * State of the stream at the end of block e (which is not in the zone map
+ * if e is the last block), obtained by reading the block. The version of
+ * the header is 0 if there was no HEADER record.
+ */
+void block_end_state(FILE *f, const zonemap_entry_t *e, uint32_t *fclk, uint64_t *t_wallclock,
+		     tlv_header_t *header)
+{
+     *fclk = e->fclk_in;
+     *t_wallclock = e->t_wallclock_in;
+     *header = e->header_in;
+     if (fseeko(f, e->offset, SEEK_SET) != 0) {
+	  ERROR("Could not seek in recording");
+	  exit(-1);
+     }
+     tlv_t tlv;
+     while (ftello(f) < (off_t) (e->offset + e->length)) {
+	  if (read_tlv(&tlv, f) < 0) {
+	       ERROR("Could not read TLV element (zone map does not match recording)");
+	       exit(-1);
+	  }
+	  if (tlv.type == TLV_TYPE_ONEPPS) {
+	       *fclk = tlv.value.fclock;
+	  } else if (tlv.type == TLV_TYPE_WALLCLOCKTIME) {
+	       *t_wallclock = tlv.value.wallclocktime;
+	  } else if (tlv.type == TLV_TYPE_HEADER) {
+	       tlv_header_t h;
+	       if (tlv_get_header(&tlv, &h) == 0) {
+		    // The clock of the header applies until the next ONEPPS record.
+		    *header = h;
+		    *fclk = 0;
+	       }
+	  }
+     }
+}
+
+void query_file(const char *path)
+{
+     FILE *f = fopen(path, "r");
+     if (f == NULL) {
+	  fprintf(stderr, "Error: Could not open %s\n", path);
+	  exit(-1);
+     }
+
+     char zmpath[MAX_PATH_SIZE];
+     zonemap_path(path, zmpath, MAX_PATH_SIZE);
+     FILE *fzm = fopen(zmpath, "r");
+     zonemap_header_t header;
+     if (fzm == NULL || zonemap_read_header(fzm, &header) < 0) {
+	  // Without zone map, the whole file is one candidate block.
+	  fprintf(stderr, "Warning: No valid zone map for %s (scanning whole file)\n", path);
+	  zonemap_entry_t e;
+	  zonemap_entry_init(&e, 0, 0, 0, NULL);
+	  fseeko(f, 0, SEEK_END);
+	  e.length = ftello(f);
+	  bytes_total += e.length;
+	  blocks_total++;
+	  query_block(f, &e);
+     } else {
+	  zonemap_entry_t e;
+	  zonemap_entry_t last;
+	  bool has_last = false;
+	  while (zonemap_read_entry(fzm, &e) == 0) {
+	       bytes_total += e.length;
+	       blocks_total++;
+	       if (zonemap_may_contain_time(&e, tstartns, tendns) &&
+		   zonemap_may_contain_freq(&e, f_min, f_max, outside, F_CLK_NOMINAL))
+		    query_block(f, &e);
+	       last = e;
+	       has_last = true;
+	  }
+
+	  // Data appended to the recording after the zone map was created is
+	  // not covered by the zone map; scan it as one more block.
+	  fseeko(f, 0, SEEK_END);
+	  uint64_t size = ftello(f);
+	  uint64_t end = has_last ? last.offset + last.length : 0;
+	  if (end > size) {
+	       ERROR("Zone map does not match recording (recording truncated?)");
+	       exit(-1);
+	  }
+	  if (end < size) {
+	       uint32_t fclk = 0;
+	       uint64_t t_wallclock = 0;
+	       tlv_header_t header;
+	       memset(&header, 0, sizeof(header));
+	       if (has_last)
+		    block_end_state(f, &last, &fclk, &t_wallclock, &header);
+	       zonemap_entry_init(&e, end, fclk, t_wallclock,
+				  (header.version != 0) ? &header : NULL);
+	       e.length = size - end;
+	       bytes_total += e.length;
+	       blocks_total++;
+	       query_block(f, &e);
+	  }
+     }
+     
+     if (fzm != NULL)
+	  fclose(fzm);
+     fclose(f);
+}
+
+int main(int argc, char *argv[])
+{
+     // If set to false, use UTC (default). 
+     bool uselocaltime = false;
+     bool verbose = false;
+     char starttime_arg[MAX_TIMESTR_LEN];
+     char endtime_arg[MAX_TIMESTR_LEN];
+     
+     memset(starttime_arg, 0, MAX_TIMESTR_LEN);
+     memset(endtime_arg, 0, MAX_TIMESTR_LEN);	       
+     int c;
+     while ((c = getopt (argc, argv, "lus:e:f:F:xv")) != -1) {
+	  switch (c) {
+	  case 'l' :
+	       uselocaltime = true;
+	       break;
+	  case 'u' :
+	       uselocaltime = false;
+	       break;
+	  case 's' :
+	       strncpy(starttime_arg, optarg, MAX_TIMESTR_LEN-1);
+	       break;
+	  case 'e' :
+	       strncpy(endtime_arg, optarg, MAX_TIMESTR_LEN-1);
+	       break;
+	  case 'f' :
+	       f_min = strtod(optarg, NULL);
+	       break;
+	  case 'F' :
+	       f_max = strtod(optarg, NULL);
+	       break;
+	  case 'x' :
+	       outside = true;
+	       break;
+	  case 'v' :
+	       verbose = true;
+	       break;
+	  case '?':
+	  default :
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     if (optind == argc || f_min > f_max) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+
+     if (strlen(starttime_arg) > 0)
+	  tstartns = 1000000000ull*parse_time(starttime_arg, uselocaltime);
+     if (strlen(endtime_arg) > 0)
+	  tendns = 1000000000ull*parse_time(endtime_arg, uselocaltime);
+
+     for (int i = optind; i < argc; i++)
+	  query_file(argv[i]);
+
+     if (verbose) {
+	  fprintf(stderr, "Read %lu of %lu blocks (%llu of %llu bytes)\n",
+		  blocks_read, blocks_total,
+		  (unsigned long long) bytes_read, (unsigned long long) bytes_total);
+     }
+     
+     return 0;
+}
@@ -0,0 +1,781 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "tlv.h"
+#include "samplekernels.h"
+#include "errandwarn.h"
+#include "nominal.h"
+
+#define MAX_TIMESTR_LEN 1000
+#define MAX_LINE_LEN 1000
+
+// Waves copied out of the cache per lock of a samples query.
+#define QUERY_CHUNK 4096
+
+// Buckets copied out of the cache per lock of an aggregate query.
+#define AGGREGATE_CHUNK 1024
+
+// Interval of polling a followed file for new records (ms).
+#define FOLLOW_POLL_MS 100
+
+// Clients served concurrently, and time after which an idle or stalled
+// client is disconnected (s).
+#define MAX_CLIENTS 64
+#define CLIENT_TIMEOUT_S 60
+
+/**
+ * Run of consecutive waves with the same wallclock timestamp, calibrated
+ * and nominal clock frequency (typically one second of waves), with
+ * aggregates of f_mains_syncd precomputed when the waves are added.
+ * If the oldest waves of a run are evicted, f_min and f_max may still
+ * include them (minmax_stale) until they are recomputed by a query.
+ */
+typedef struct {
+     uint64_t t_wallclock;
+     // Index of the first wave (counting all waves ever added).
+     uint64_t first;
+     uint32_t n;
+     uint32_t f_clk_syncd;
+     uint32_t f_clk_nominal;
+     double f_min;
+     double f_max;
+     double f_sum;
+     double f_sumsq;
+     bool minmax_stale;
+} run_t;
+
+/**
+ * Columnar cache of the most recent waves: the tick counts of the waves in
+ * a ring buffer, and the runs describing them in a second ring buffer.
+ * Both are allocated once, so the memory is bounded. Wave i is stored at
+ * ticks[i % wave_capacity], run i at runs[i % run_capacity].
+ */
+typedef struct {
+     mtx_t lock;
+     uint32_t *ticks;
+     uint64_t wave_capacity;
+     uint64_t waves_end;
+     run_t *runs;
+     uint64_t run_capacity;
+     uint64_t runs_begin;
+     uint64_t runs_end;
+     // Runs older than this (relative to the newest run) are evicted.
+     uint64_t max_age_ns;
+} cache_t;
+
+cache_t cache;
+
+// Channel to cache.
+int selected_channel = 0;
+
+// State of the input stream.
+tlv_header_t header;
+uint32_t f_clk_syncd = F_CLK_NOMINAL;
+uint64_t t_wallclock = 0;
+
+// Input files (stdin if none) and whether to follow the last one.
+char **infiles = NULL;
+int ninfiles = 0;
+bool follow = false;
+
+atomic_int nclients = 0;
+
+void usage(const char *app)
+{
+     fprintf(stderr, "USAGE: %s -s SOCKET [OPTIONS] [FILE ...]\n"
+	     "Keeps the most recent samples of a TLV stream (stdin or FILEs in this order) in memory\n"
+	     "and answers queries on the Unix domain socket SOCKET.\n"
+	     "-H HOURS : cache the samples of the last HOURS hours (default: 24)\n"
+	     "-r RATE : maximum number of waves per second to reserve memory for (default: 60)\n"
+	     "-c CHANNEL : cache samples of this channel of a multi-channel recording (default: 0)\n"
+	     "-f : follow the last FILE as it grows (like tail -f)\n"
+	     "-q QUERY : send QUERY to the daemon listening on SOCKET and print the response\n"
+	     "\n"
+	     "Queries (one per line; each response ends with an empty line):\n"
+	     "samples TSTART TEND : samples in CSV format like filter-convert_to_csv\n"
+	     "aggregate TSTART TEND STEP : number of waves, min, max, mean, and standard deviation of f_mains_syncd\n"
+	     "                             per STEP seconds\n"
+	     "info : cached waves, time range, and memory\n"
+	     "Times are seconds since Unix epoch (UTC), or relative to the newest cached sample if <= 0\n"
+	     "(e.g., \"aggregate -3600 0 60\": last hour per minute).\n",
+	     app);
+}
+
+void cache_init(cache_t *c, double hours, double rate)
+{
+     c->wave_capacity = (uint64_t) (hours*3600.0*rate) + MAX_SAMPLE_COUNT;
+     // Runs start with each wallclock timestamp and 1-pps calibration,
+     // i.e., about twice per second.
+     c->run_capacity = (uint64_t) (hours*3600.0*4.0) + 16;
+     c->ticks = malloc(c->wave_capacity*sizeof(uint32_t));
+     c->runs = malloc(c->run_capacity*sizeof(run_t));
+     if (c->ticks == NULL || c->runs == NULL) {
+	  ERROR("Out of memory");
+	  exit(-1);
+     }
+     c->waves_end = 0;
+     c->runs_begin = 0;
+     c->runs_end = 0;
+     c->max_age_ns = (uint64_t) (hours*3600.0e9);
+     mtx_init(&c->lock, mtx_plain);
+}
+
+run_t *cache_run(cache_t *c, uint64_t i)
+{
+     return &c->runs[i % c->run_capacity];
+}
+
+uint32_t cache_ticks(cache_t *c, uint64_t i)
+{
+     return c->ticks[i % c->wave_capacity];
+}
+
+void cache_evict_oldest(cache_t *c)
+{
+     c->runs_begin++;
+}
+
+run_t *cache_new_run(cache_t *c)
+{
+     if (c->runs_end - c->runs_begin == c->run_capacity)
+	  cache_evict_oldest(c);
+     run_t *run = cache_run(c, c->runs_end++);
+     run->t_wallclock = t_wallclock;
+     run->first = c->waves_end;
+     run->n = 0;
+     run->f_clk_syncd = f_clk_syncd;
+     run->f_clk_nominal = header.f_clk;
+     run->f_min = INFINITY;
+     run->f_max = -INFINITY;
+     run->f_sum = 0.0;
+     run->f_sumsq = 0.0;
+     run->minmax_stale = false;
+     return run;
+}
+
+/**
+ * Evict the oldest wave of the oldest run (if the wave buffer is full and
+ * the run is the only one, e.g., without wallclock timestamps).
+ */
+void cache_evict_oldest_wave(cache_t *c)
+{
+     run_t *run = cache_run(c, c->runs_begin);
+     double f = (double) run->f_clk_syncd/cache_ticks(c, run->first);
+     run->f_sum -= f;
+     run->f_sumsq -= f*f;
+     if (f <= run->f_min || f >= run->f_max)
+	  run->minmax_stale = true;
+     run->first++;
+     run->n--;
+}
+
+/**
+ * Recompute f_min and f_max of a run from its cached waves.
+ */
+void cache_update_minmax(cache_t *c, run_t *run)
+{
+     run->f_min = INFINITY;
+     run->f_max = -INFINITY;
+     for (uint64_t w = run->first; w < run->first + run->n; w++) {
+	  double f = (double) run->f_clk_syncd/cache_ticks(c, w);
+	  if (f < run->f_min)
+	       run->f_min = f;
+	  if (f > run->f_max)
+	       run->f_max = f;
+     }
+     run->minmax_stale = false;
+}
+
+void cache_add_samples(cache_t *c, const uint32_t *ticks, int n)
+{
+     double f[MAX_SAMPLE_COUNT];
+     kernel_frequencies(ticks, n, f_clk_syncd, f);
+     
+     run_t *run = NULL;
+     if (c->runs_end > c->runs_begin) {
+	  run = cache_run(c, c->runs_end-1);
+	  if (run->t_wallclock != t_wallclock || run->f_clk_syncd != f_clk_syncd ||
+	      run->f_clk_nominal != header.f_clk)
+	       run = NULL;
+     }
+     for (int i = 0; i < n; i++) {
+	  if (c->runs_end > c->runs_begin &&
+	      c->waves_end - cache_run(c, c->runs_begin)->first >= c->wave_capacity) {
+	       // Wave buffer is full. If the oldest run is the only one, only
+	       // its oldest wave is evicted.
+	       if (c->runs_end - c->runs_begin == 1)
+		    cache_evict_oldest_wave(c);
+	       else
+		    cache_evict_oldest(c);
+	  }
+	  if (run == NULL)
+	       run = cache_new_run(c);
+	  c->ticks[c->waves_end % c->wave_capacity] = ticks[i];
+	  c->waves_end++;
+	  run->n++;
+	  if (f[i] < run->f_min)
+	       run->f_min = f[i];
+	  if (f[i] > run->f_max)
+	       run->f_max = f[i];
+	  run->f_sum += f[i];
+	  run->f_sumsq += f[i]*f[i];
+     }
+
+     // Evict runs older than the cached time span.
+     while (c->runs_end - c->runs_begin > 1 &&
+	    cache_run(c, c->runs_begin)->t_wallclock + c->max_age_ns < t_wallclock)
+	  cache_evict_oldest(c);
+}
+
+/**
+ * Index of the first run with a wallclock timestamp >= t (or after t if
+ * after is set). Wallclock timestamps are non-decreasing in recordings
+ * of pkt-to-tlv-stream, so the runs can be searched by bisection.
+ */
+uint64_t cache_find(cache_t *c, uint64_t t, bool after)
+{
+     uint64_t lo = c->runs_begin;
+     uint64_t hi = c->runs_end;
+     while (lo < hi) {
+	  uint64_t mid = lo + (hi-lo)/2;
+	  uint64_t tmid = cache_run(c, mid)->t_wallclock;
+	  if (tmid < t || (after && tmid == t))
+	       lo = mid+1;
+	  else
+	       hi = mid;
+     }
+     return lo;
+}
+
+void process_tlv(const tlv_t *tlv)
+{
+     uint32_t ticks[MAX_SAMPLE_COUNT];
+     int n;
+     switch (tlv->type) {
+     case TLV_TYPE_SAMPLES :
+     case TLV_TYPE_SAMPLES_MC :
+	  if (tlv_channel(tlv) != selected_channel)
+	       break;
+	  if ( (n = tlv_get_samples(tlv, ticks, MAX_SAMPLE_COUNT)) < 0) {
+	       WARNING("Invalid samples record");
+	       break;
+	  }
+	  mtx_lock(&cache.lock);
+	  cache_add_samples(&cache, ticks, n);
+	  mtx_unlock(&cache.lock);
+	  break;
+     case TLV_TYPE_ONEPPS :
+	  f_clk_syncd = tlv->value.fclock;
+	  break;
+     case TLV_TYPE_WALLCLOCKTIME :
+	  t_wallclock = tlv->value.wallclocktime;
+	  break;
+     case TLV_TYPE_HEADER :
+	  // Samples before the first 1-pps record are calibrated with the nominal clock.
+	  if (tlv_get_header(tlv, &header) == 0)
+	       f_clk_syncd = header.f_clk;
+	  break;
+     }
+}
+
+/**
+ * Read the TLV stream from f. If follow_file is set, wait for the file to
+ * grow at its end instead of returning (a partially written record is
+ * read again once it is complete). Records with invalid compressed samples
+ * are skipped; a record with an invalid length ends a followed file with
+ * an error, since the records following it cannot be found.
+ */
+void read_stream(FILE *f, bool follow_file)
+{
+     tlv_t tlv;
+     while (1) {
+	  long offset = follow_file ? ftell(f) : 0;
+	  if (read_tlv_raw(&tlv, f) < 0) {
+	       if (ferror(f)) {
+		    ERROR("Could not read TLV element");
+		    exit(-1);
+	       }
+	       if (!follow_file)
+		    return;
+	       if (ftell(f) >= offset + (long) (sizeof(tlv.type) + sizeof(tlv.length)) &&
+		   tlv.length > sizeof(tlv.value)) {
+		    ERROR("Invalid TLV element in followed file");
+		    exit(-1);
+	       }
+	       clearerr(f);
+	       if (fseek(f, offset, SEEK_SET) < 0) {
+		    ERROR("Could not follow file");
+		    exit(-1);
+	       }
+	       struct timespec tpoll = { 0, FOLLOW_POLL_MS*1000000l };
+	       nanosleep(&tpoll, NULL);
+	       continue;
+	  }
+	  if (decode_tlv(&tlv) < 0) {
+	       WARNING("Invalid compressed samples (ignoring record)");
+	       continue;
+	  }
+	  process_tlv(&tlv);
+     }
+}
+
+int reader(void *arg)
+{
+     (void) arg;
+     if (ninfiles == 0) {
+	  read_stream(stdin, false);
+     } else {
+	  for (int i = 0; i < ninfiles; i++) {
+	       FILE *f = fopen(infiles[i], "r");
+	       if (f == NULL) {
+		    fprintf(stderr, "Error: Could not open %s\n", infiles[i]);
+		    exit(-1);
+	       }
+	       read_stream(f, follow && i == ninfiles-1);
+	       fclose(f);
+	  }
+     }
+     return 0;
+}
+
+/**
+ * Parse a time argument of a query: seconds since Unix epoch, or relative
+ * to the newest cached sample if <= 0.
+ */
+int parse_query_time(const char *s, uint64_t tnewest, uint64_t *t)
+{
+     char *end;
+     long long v = strtoll(s, &end, 10);
+     if (end == s || *end != '\0')
+	  return -1;
+     if (v <= 0) {
+	  if ((uint64_t) (-v)*1000000000ull > tnewest)
+	       *t = 0;
+	  else
+	       *t = tnewest - (uint64_t) (-v)*1000000000ull;
+     } else {
+	  *t = 1000000000ull*v;
+     }
+     return 0;
+}
+
+/**
+ * Samples with tstart <= t_wallclock <= tend, formatted like filter-convert_to_csv.
+ * The waves are copied out of the cache in chunks, so the lock is not held
+ * while writing to the client.
+ */
+void query_samples(FILE *out, uint64_t tstart, uint64_t tend)
+{
+     fprintf(out, "f_mains,f_mains_syncd,f_clk_syncd,clk_accuracy_ppm,t_wallclock,t_wallclock_str\n");
+
+     mtx_lock(&cache.lock);
+     uint64_t r = cache_find(&cache, tstart, false);
+     uint64_t w = (r < cache.runs_end) ? cache_run(&cache, r)->first : cache.waves_end;
+     mtx_unlock(&cache.lock);
+
+     while (1) {
+	  uint32_t ticks[QUERY_CHUNK];
+	  uint32_t fclk[QUERY_CHUNK];
+	  uint32_t fnominal[QUERY_CHUNK];
+	  uint64_t twall[QUERY_CHUNK];
+	  size_t n = 0;
+
+	  mtx_lock(&cache.lock);
+	  if (r < cache.runs_begin) {
+	       // Evicted while writing the last chunk.
+	       r = cache.runs_begin;
+	       w = cache_run(&cache, r)->first;
+	  } else if (w < cache_run(&cache, r)->first) {
+	       // Oldest waves of the run evicted while writing the last chunk.
+	       w = cache_run(&cache, r)->first;
+	  }
+	  while (r < cache.runs_end && n < QUERY_CHUNK) {
+	       const run_t *run = cache_run(&cache, r);
+	       if (run->t_wallclock > tend)
+		    break;
+	       if (w >= run->first + run->n) {
+		    if (r+1 == cache.runs_end)
+			 break;
+		    r++;
+		    w = cache_run(&cache, r)->first;
+		    continue;
+	       }
+	       ticks[n] = cache_ticks(&cache, w);
+	       fclk[n] = run->f_clk_syncd;
+	       fnominal[n] = run->f_clk_nominal;
+	       twall[n] = run->t_wallclock;
+	       n++;
+	       w++;
+	  }
+	  mtx_unlock(&cache.lock);
+	  if (n == 0)
+	       break;
+
+	  for (size_t i = 0; i < n; i++) {
+	       char timestr[MAX_TIMESTR_LEN];
+	       time_t tsec = twall[i]/1000000000;
+	       struct tm tmtime;
+	       if (gmtime_r(&tsec, &tmtime) == NULL)
+		    timestr[0] = '\0';
+	       else
+		    strftime(timestr, MAX_TIMESTR_LEN, "%Y-%m-%d %H:%M:%S", &tmtime);
+	       double deviation = (double) (fclk[i]) / fnominal[i];
+	       if (deviation > 1.0) {
+		    deviation -= 1.0;
+	       } else {
+		    deviation = 1.0 - deviation;
+	       }
+	       unsigned int deviation_ppm = (unsigned int) (1.0e6*deviation + 0.5);
+	       double f = (double) fnominal[i]/ticks[i];
+	       double f_syncd = (double) fclk[i]/ticks[i];
+	       fprintf(out, "%.4f,%.4f,%u,%u,%llu,%s\n", f, f_syncd, fclk[i], deviation_ppm,
+		       (unsigned long long) twall[i], timestr);
+	  }
+     }
+}
+
+void print_aggregate(FILE *out, uint64_t tbucket, const run_t *agg)
+{
+     double mean = agg->f_sum/agg->n;
+     double var = agg->f_sumsq/agg->n - mean*mean;
+     fprintf(out, "%llu,%u,%.4f,%.4f,%.4f,%.4f\n", (unsigned long long) tbucket, agg->n,
+	     agg->f_min, agg->f_max, mean, (var > 0.0) ? sqrt(var) : 0.0);
+}
+
+/**
+ * Aggregates of f_mains_syncd per step ns, combined from the aggregates
+ * of the runs. Buckets without waves are omitted. Completed buckets are
+ * copied out of the cache in chunks, so the lock is not held while
+ * writing to the client.
+ */
+void query_aggregate(FILE *out, uint64_t tstart, uint64_t tend, uint64_t step)
+{
+     fprintf(out, "t_start,waves,f_min,f_max,f_mean,f_stddev\n");
+
+     mtx_lock(&cache.lock);
+     uint64_t r = cache_find(&cache, tstart, false);
+     mtx_unlock(&cache.lock);
+
+     // Bucket being aggregated (UINT64_MAX if none).
+     uint64_t bucket = UINT64_MAX;
+     run_t agg;
+     bool done = false;
+     while (!done) {
+	  uint64_t tbuckets[AGGREGATE_CHUNK];
+	  run_t aggs[AGGREGATE_CHUNK];
+	  size_t n = 0;
+
+	  mtx_lock(&cache.lock);
+	  // Runs evicted while writing the last chunk are skipped.
+	  if (r < cache.runs_begin)
+	       r = cache.runs_begin;
+	  uint64_t end = cache_find(&cache, tend, true);
+	  for (; r < end && n < AGGREGATE_CHUNK; r++) {
+	       run_t *run = cache_run(&cache, r);
+	       if (run->n == 0)
+		    continue;
+	       if (run->minmax_stale)
+		    cache_update_minmax(&cache, run);
+	       uint64_t b = (run->t_wallclock - tstart)/step;
+	       if (b != bucket) {
+		    if (bucket != UINT64_MAX) {
+			 tbuckets[n] = tstart + bucket*step;
+			 aggs[n] = agg;
+			 n++;
+		    }
+		    bucket = b;
+		    agg = *run;
+		    continue;
+	       }
+	       agg.n += run->n;
+	       agg.f_min = (run->f_min < agg.f_min) ? run->f_min : agg.f_min;
+	       agg.f_max = (run->f_max > agg.f_max) ? run->f_max : agg.f_max;
+	       agg.f_sum += run->f_sum;
+	       agg.f_sumsq += run->f_sumsq;
+	  }
+	  done = (r >= end);
+	  mtx_unlock(&cache.lock);
+
+	  for (size_t i = 0; i < n; i++)
+	       print_aggregate(out, tbuckets[i], &aggs[i]);
+     }
+     if (bucket != UINT64_MAX)
+	  print_aggregate(out, tstart + bucket*step, &agg);
+}
+
+void query_info(FILE *out)
+{
+     mtx_lock(&cache.lock);
+     uint64_t waves = 0;
+     uint64_t tfirst = 0;
+     uint64_t tlast = 0;
+     if (cache.runs_end > cache.runs_begin) {
+	  waves = cache.waves_end - cache_run(&cache, cache.runs_begin)->first;
+	  tfirst = cache_run(&cache, cache.runs_begin)->t_wallclock;
+	  tlast = cache_run(&cache, cache.runs_end-1)->t_wallclock;
+     }
+     uint64_t runs = cache.runs_end - cache.runs_begin;
+     mtx_unlock(&cache.lock);
+     fprintf(out, "waves,runs,t_first,t_last,memory_bytes\n");
+     fprintf(out, "%llu,%llu,%llu,%llu,%llu\n", (unsigned long long) waves, (unsigned long long) runs,
+	     (unsigned long long) tfirst, (unsigned long long) tlast,
+	     (unsigned long long) (cache.wave_capacity*sizeof(uint32_t) + cache.run_capacity*sizeof(run_t)));
+}
+
+void handle_query(FILE *out, char *line)
+{
+     char *args[4];
+     int nargs = 0;
+     char *saveptr;
+     for (char *tok = strtok_r(line, " \t\r\n", &saveptr); tok != NULL; tok = strtok_r(NULL, " \t\r\n", &saveptr)) {
+	  if (nargs == 4) {
+	       fprintf(out, "error: too many arguments\n");
+	       return;
+	  }
+	  args[nargs++] = tok;
+     }
+     if (nargs == 0)
+	  return;
+
+     mtx_lock(&cache.lock);
+     uint64_t tnewest = (cache.runs_end > cache.runs_begin) ? cache_run(&cache, cache.runs_end-1)->t_wallclock : 0;
+     mtx_unlock(&cache.lock);
+
+     uint64_t tstart, tend;
+     if (strcmp(args[0], "samples") == 0 && nargs == 3) {
+	  if (parse_query_time(args[1], tnewest, &tstart) < 0 || parse_query_time(args[2], tnewest, &tend) < 0) {
+	       fprintf(out, "error: invalid time\n");
+	       return;
+	  }
+	  query_samples(out, tstart, tend);
+     } else if (strcmp(args[0], "aggregate") == 0 && nargs == 4) {
+	  long long step = atoll(args[3]);
+	  if (parse_query_time(args[1], tnewest, &tstart) < 0 || parse_query_time(args[2], tnewest, &tend) < 0) {
+	       fprintf(out, "error: invalid time\n");
+	       return;
+	  }
+	  if (step <= 0) {
+	       fprintf(out, "error: invalid step\n");
+	       return;
+	  }
+	  query_aggregate(out, tstart, tend, 1000000000ull*step);
+     } else if (strcmp(args[0], "info") == 0 && nargs == 1) {
+	  query_info(out);
+     } else {
+	  fprintf(out, "error: unknown query\n");
+     }
+}
+
+void serve_client(int fd)
+{
+     FILE *in = fdopen(fd, "r");
+     FILE *out = fdopen(dup(fd), "w");
+     if (in == NULL || out == NULL) {
+	  WARNING("Could not open connection");
+	  if (in != NULL)
+	       fclose(in);
+	  else
+	       close(fd);
+	  if (out != NULL)
+	       fclose(out);
+	  return;
+     }
+     char line[MAX_LINE_LEN];
+     while (fgets(line, MAX_LINE_LEN, in) != NULL) {
+	  handle_query(out, line);
+	  fprintf(out, "\n");
+	  if (fflush(out) != 0)
+	       break;
+     }
+     fclose(in);
+     fclose(out);
+}
+
+int client_thread(void *arg)
+{
+     int fd = (int) (intptr_t) arg;
+     serve_client(fd);
+     atomic_fetch_sub(&nclients, 1);
+     return 0;
+}
+
+/**
+ * Serve a client in its own thread, so a slow or idle client does not
+ * block others. Reads and writes time out after CLIENT_TIMEOUT_S seconds.
+ */
+void start_client(int fd)
+{
+     struct timeval timeout = { CLIENT_TIMEOUT_S, 0 };
+     setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+     setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+     if (atomic_fetch_add(&nclients, 1) >= MAX_CLIENTS) {
+	  atomic_fetch_sub(&nclients, 1);
+	  WARNING("Too many clients (closing connection)");
+	  const char msg[] = "error: too many clients\n\n";
+	  if (write(fd, msg, sizeof(msg)-1) < 0)
+	       WARNING("Could not reject client");
+	  close(fd);
+	  return;
+     }
+     thrd_t thread;
+     if (thrd_create(&thread, client_thread, (void *) (intptr_t) fd) != thrd_success) {
+	  atomic_fetch_sub(&nclients, 1);
+	  WARNING("Could not create client thread");
+	  close(fd);
+	  return;
+     }
+     thrd_detach(thread);
+}
+
+/**
+ * Client mode: send a query to a running daemon and copy the response to stdout.
+ */
+int run_query(int fdsock, const struct sockaddr_un *addr, const char *query)
+{
+     if (connect(fdsock, (const struct sockaddr *) addr, sizeof(*addr)) < 0) {
+	  ERROR("Could not connect to daemon");
+	  return -1;
+     }
+     FILE *f = fdopen(fdsock, "r+");
+     if (f == NULL) {
+	  ERROR("Could not connect to daemon");
+	  return -1;
+     }
+     fprintf(f, "%s\n", query);
+     fflush(f);
+     shutdown(fdsock, SHUT_WR);
+     char line[MAX_LINE_LEN];
+     while (fgets(line, MAX_LINE_LEN, f) != NULL) {
+	  // The empty line terminates the response.
+	  if (strcmp(line, "\n") == 0)
+	       break;
+	  fputs(line, stdout);
+     }
+     fclose(f);
+     return 0;
+}
+
+int main(int argc, char *argv[])
+{
+     const char *sockpath = NULL;
+     double hours = 24.0;
+     double rate = 60.0;
+     const char *query = NULL;
+     
+     int c;
+     while ((c = getopt (argc, argv, "s:H:r:c:fq:")) != -1) {
+	  switch (c) {
+	  case 's' :
+	       sockpath = optarg;
+	       break;
+	  case 'H' :
+	       hours = atof(optarg);
+	       break;
+	  case 'r' :
+	       rate = atof(optarg);
+	       break;
+	  case 'c' :
+	       selected_channel = atoi(optarg);
+	       break;
+	  case 'f' :
+	       follow = true;
+	       break;
+	  case 'q' :
+	       query = optarg;
+	       break;
+	  case '?':
+	  default :
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     struct sockaddr_un addr;
+     memset(&addr, 0, sizeof(addr));
+     if (sockpath == NULL || strlen(sockpath) >= sizeof(addr.sun_path) || hours <= 0.0 || rate <= 0.0 ||
+	 selected_channel < 0 || selected_channel >= TLV_MAX_CHANNELS || (follow && optind == argc)) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+     infiles = &argv[optind];
+     ninfiles = argc-optind;
+
+     int fdsock = socket(AF_UNIX, SOCK_STREAM, 0);
+     if (fdsock < 0) {
+	  ERROR("Could not create socket");
+	  exit(-1);
+     }
+     addr.sun_family = AF_UNIX;
+     strcpy(addr.sun_path, sockpath);
+
+     if (query != NULL)
+	  return (run_query(fdsock, &addr, query) < 0) ? -1 : 0;
+
+     // Clients closing their connection early must not terminate the daemon.
+     signal(SIGPIPE, SIG_IGN);
+     // Remove the socket of a previous run.
+     unlink(sockpath);
+     if (bind(fdsock, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fdsock, 16) < 0) {
+	  ERROR("Could not bind socket");
+	  exit(-1);
+     }
+     
+     tlv_header_init(&header);
+     cache_init(&cache, hours, rate);
+
+     thrd_t thread;
+     if (thrd_create(&thread, reader, NULL) != thrd_success) {
+	  ERROR("Could not create reader thread");
+	  exit(-1);
+     }
+     
+     while (1) {
+	  int fd = accept(fdsock, NULL, NULL);
+	  if (fd < 0) {
+	       WARNING("Could not accept connection");
+	       continue;
+	  }
+	  start_client(fd);
+     }
+     
+     return 0;
+}
@@ -0,0 +1,431 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <threads.h>
+#include <sys/stat.h>
+#include "slip.h"
+#include "tlv.h"
+#include "linkdecode.h"
+#include "recbatch.h"
+#include "stats.h"
+#include "errandwarn.h"
+
+#define MAX_PATH_SIZE 1000
+#define MAX_WORKERS 256
+
+// Raw bytes decoded by each worker per round.
+#define CHUNK_SIZE (4*1024*1024)
+
+// Wall-clock time of a read of the capture (from the .ts file of a segment).
+typedef struct {
+     // Offset of the first byte of the read from the start of the capture.
+     uint64_t offset;
+     uint64_t t;
+} readtime_t;
+
+// Packet decoded by a worker, followed by its tlv element in the arena.
+typedef struct {
+     // Offset of the END character terminating the packet.
+     uint64_t end;
+     // Result of linkdecode_check().
+     int check;
+     linkdecode_packet_t p;
+     // Size of the following tlv element (type, length, value).
+     size_t size;
+} record_t;
+
+// Work of one worker in a round: decode raw bytes [start, end) into records.
+typedef struct {
+     const unsigned char *data;
+     size_t start;
+     size_t end;
+     uint64_t base;
+     unsigned char *arena;
+     size_t arena_size;
+     size_t arena_len;
+} chunk_t;
+
+bool keep_compressed = false;
+
+readtime_t *readtimes = NULL;
+size_t nreadtimes = 0;
+
+void usage(const char *app)
+{
+     fprintf(stderr, "USAGE: %s [-z] [-j THREADS] [-F NOMINAL_FREQUENCY] [-C CLOCK_FREQUENCY] [-b BATCHSIZE] [-i APPLIANCE_ID] [--stats[=FILE]] FILE.raw [FILE.raw ...]\n"
+	     "Decode raw captures of pkt-to-tlv-stream -r into a tlv stream (same output as live decoding).\n"
+	     "Segment files must be given in capture order; wall-clock timestamps are read from FILE.ts.\n"
+	     "-z : write delta-encoded sample packets as compressed TLV records (default: decode)\n"
+	     "-j THREADS : number of decoding threads (default: number of CPUs)\n"
+	     LINKDECODE_HEADER_USAGE,
+	     app);
+}
+
+/**
+ * Append the read times of a segment starting at offset base of the capture.
+ */
+void load_readtimes(const char *rawpath, uint64_t base)
+{
+     char path[MAX_PATH_SIZE+8];
+     size_t len = strlen(rawpath);
+     if (len > 4 && strcmp(&rawpath[len-4], ".raw") == 0)
+	  len -= 4;
+     snprintf(path, sizeof(path), "%.*s.ts", (int) len, rawpath);
+     FILE *f = fopen(path, "r");
+     if (f == NULL) {
+	  WARNING("No timestamp file for segment (no wall-clock timestamps)");
+	  return;
+     }
+
+     static size_t capacity = 0;
+     uint64_t offset, t;
+     while (fscanf(f, "%" SCNu64 " %" SCNu64, &offset, &t) == 2) {
+	  if (nreadtimes == capacity) {
+	       capacity = (capacity == 0) ? 4096 : 2*capacity;
+	       readtimes = realloc(readtimes, capacity*sizeof(readtime_t));
+	       if (readtimes == NULL) {
+		    ERROR("Out of memory");
+		    exit(-1);
+	       }
+	  }
+	  readtimes[nreadtimes].offset = base+offset;
+	  readtimes[nreadtimes].t = t;
+	  nreadtimes++;
+     }
+     fclose(f);
+}
+
+/**
+ * Reserve size bytes at the end of the arena of a chunk.
+ */
+unsigned char *arena_alloc(chunk_t *chunk, size_t size)
+{
+     // Keep records aligned.
+     size = (size + 7) & ~((size_t) 7);
+     if (chunk->arena_len + size > chunk->arena_size) {
+	  size_t newsize = (chunk->arena_size == 0) ? CHUNK_SIZE : 2*chunk->arena_size;
+	  while (newsize < chunk->arena_len + size)
+	       newsize *= 2;
+	  unsigned char *arena = realloc(chunk->arena, newsize);
+	  if (arena == NULL)
+	       return NULL;
+	  chunk->arena = arena;
+	  chunk->arena_size = newsize;
+     }
+     unsigned char *p = &chunk->arena[chunk->arena_len];
+     chunk->arena_len += size;
+     return p;
+}
+
+/**
+ * Worker: SLIP decode, CRC check, and decode the packets of a chunk.
+ */
+int decode_chunk(void *arg)
+{
+     chunk_t *chunk = (chunk_t *) arg;
+     unsigned char *pkt = malloc(LINKDECODE_MAX_PKT_SIZE);
+     unsigned char *buffer = malloc(LINKDECODE_MAX_RECORD_SIZE);
+     if (pkt == NULL || buffer == NULL) {
+	  free(pkt);
+	  free(buffer);
+	  return -1;
+     }
+     
+     size_t pos = chunk->start;
+     ssize_t pktsize;
+     while ( (pktsize = slip_decodepkt(chunk->data, chunk->end, &pos, pkt, LINKDECODE_MAX_PKT_SIZE)) >= 0) {
+	  record_t rec;
+	  rec.end = chunk->base + pos-1;
+	  rec.check = linkdecode_check(pkt, pktsize);
+	  rec.p.status = rec.check;
+	  rec.size = 0;
+	  if (rec.check == LINKDECODE_OK) {
+	       linkdecode_prepare(pkt, pktsize, keep_compressed, buffer, &rec.p);
+	       if (rec.p.status == LINKDECODE_OK) {
+		    uint16_t length;
+		    memcpy(&length, &rec.p.record[sizeof(uint16_t)], sizeof(length));
+		    rec.size = RECBATCH_HEADER_SIZE + length;
+	       }
+	  }
+	  unsigned char *p = arena_alloc(chunk, sizeof(rec) + rec.size);
+	  if (p == NULL) {
+	       free(pkt);
+	       free(buffer);
+	       return -1;
+	  }
+	  memcpy(p, &rec, sizeof(rec));
+	  if (rec.size > 0)
+	       memcpy(p+sizeof(rec), rec.p.record, rec.size);
+     }
+
+     free(pkt);
+     free(buffer);
+     return 0;
+}
+
+/**
+ * Emit the records of a chunk in order into batch b, with wall-clock
+ * timestamps of the reads as pkt-to-tlv-stream writes them.
+ */
+void emit_chunk(linkdecode_t *decoder, chunk_t *chunk, size_t *nextreadtime, recbatch_t *b)
+{
+     size_t pos = 0;
+     while (pos < chunk->arena_len) {
+	  record_t rec;
+	  memcpy(&rec, &chunk->arena[pos], sizeof(rec));
+	  rec.p.record = &chunk->arena[pos+sizeof(rec)];
+	  pos += (sizeof(rec) + rec.size + 7) & ~((size_t) 7);
+
+	  // The packet has been processed after all reads up to its END character.
+	  while (*nextreadtime < nreadtimes && readtimes[*nextreadtime].offset <= rec.end) {
+	       linkdecode_read_time(decoder, readtimes[*nextreadtime].t);
+	       (*nextreadtime)++;
+	  }
+
+	  linkdecode_emit(decoder, &rec.p, b);
+	  if (rec.check == LINKDECODE_OK)
+	       linkdecode_timestamp(decoder, b);
+     }
+     chunk->arena_len = 0;
+}
+
+/**
+ * Account for a frame longer than the whole buffer (e.g., line noise) with
+ * its END character at offset end. pkt-to-tlv-stream truncates such a frame
+ * to the size of its packet buffer and rejects it as CRC error.
+ */
+void emit_discarded(linkdecode_t *decoder, uint64_t end, size_t *nextreadtime, recbatch_t *b)
+{
+     while (*nextreadtime < nreadtimes && readtimes[*nextreadtime].offset <= end) {
+	  linkdecode_read_time(decoder, readtimes[*nextreadtime].t);
+	  (*nextreadtime)++;
+     }
+
+     linkdecode_packet_t p;
+     memset(&p, 0, sizeof(p));
+     p.status = LINKDECODE_CRC_ERROR;
+     linkdecode_emit(decoder, &p, b);
+}
+
+int main(int argc, char *argv[])
+{
+     stats_init(&argc, argv);
+
+     static linkdecode_t decoder;
+     linkdecode_init(&decoder);
+     
+     int nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+     int c;
+     while ((c = getopt (argc, argv, "zj:" LINKDECODE_HEADER_OPTIONS)) != -1) {
+	  switch (c) {
+	  case 'z' :
+	       keep_compressed = true;
+	       break;
+	  case 'j' :
+	       nworkers = atoi(optarg);
+	       break;
+	  case 'F' :
+	  case 'C' :
+	  case 'b' :
+	  case 'i' :
+	       if (linkdecode_header_option(&decoder, c, optarg) < 0) {
+		    usage(argv[0]);
+		    exit(-1);
+	       }
+	       break;
+	  case '?':
+	  default :
+	       usage(argv[0]);
+	       exit(-1);
+	  }
+     }
+     int nfiles = argc-optind;
+     if (nfiles < 1 || nworkers < 1) {
+	  usage(argv[0]);
+	  exit(-1);
+     }
+     if (nworkers > MAX_WORKERS)
+	  nworkers = MAX_WORKERS;
+
+     // Segments form one continuous byte stream (packets can span segments).
+     uint64_t base = 0;
+     for (int i = optind; i < argc; i++) {
+	  struct stat st;
+	  if (stat(argv[i], &st) != 0) {
+	       ERROR("Could not open raw capture file");
+	       exit(-1);
+	  }
+	  load_readtimes(argv[i], base);
+	  base += st.st_size;
+     }
+
+     linkdecode_register_stats(&decoder);
+     // Records of one chunk, written at once.
+     recbatch_t batch;
+     recbatch_init(&batch);
+     linkdecode_write_header(&decoder, &batch);
+     static uint64_t bytes = 0;
+     stats_register_counter("bytes", &bytes);
+
+     size_t capacity = (size_t) nworkers*CHUNK_SIZE;
+     unsigned char *buffer = malloc(capacity);
+     chunk_t *chunks = calloc(nworkers, sizeof(chunk_t));
+     thrd_t *threads = malloc(nworkers*sizeof(thrd_t));
+     if (buffer == NULL || chunks == NULL || threads == NULL) {
+	  ERROR("Out of memory");
+	  exit(-1);
+     }
+     
+     int file = optind;
+     FILE *f = NULL;
+     // Bytes in the buffer carried over from the last round (incomplete packet),
+     // and offset of the buffer in the capture.
+     size_t len = 0;
+     base = 0;
+     size_t nextreadtime = 0;
+     bool eof = false;
+     // Set while skipping the rest of a frame longer than the buffer; the
+     // last skipped byte is kept at the start of the buffer, so an escaped
+     // END character is recognized.
+     bool discarding = false;
+     while (!eof || len > 0) {
+	  // Fill the buffer from the segment files.
+	  while (len < capacity && !eof) {
+	       if (f == NULL) {
+		    if (file == argc) {
+			 eof = true;
+			 break;
+		    }
+		    if ( (f = fopen(argv[file++], "r")) == NULL) {
+			 ERROR("Could not open raw capture file");
+			 exit(-1);
+		    }
+	       }
+	       size_t n = fread(&buffer[len], 1, capacity-len, f);
+	       len += n;
+	       bytes += n;
+	       if (n == 0) {
+		    if (ferror(f)) {
+			 ERROR("Could not read raw capture file");
+			 exit(-1);
+		    }
+		    fclose(f);
+		    f = NULL;
+	       }
+	  }
+
+	  if (discarding) {
+	       size_t skip = slip_split(buffer, len, 1);
+	       bool ended = (skip < len || (len > 1 && slip_last_split(buffer, len) == len));
+	       if (!ended) {
+		    if (eof)
+			 break;
+		    base += len-1;
+		    buffer[0] = buffer[len-1];
+		    len = 1;
+		    continue;
+	       }
+	       emit_discarded(&decoder, base + skip-1, &nextreadtime, &batch);
+	       memmove(buffer, &buffer[skip], len-skip);
+	       len -= skip;
+	       base += skip;
+	       discarding = false;
+	       // The buffer is not full anymore.
+	       continue;
+	  }
+
+	  // Decode up to the last END character certainly terminating a packet;
+	  // the rest is decoded with the next data.
+	  size_t cut = len;
+	  if (!eof) {
+	       cut = slip_last_split(buffer, len);
+	       if (cut == 0) {
+		    // No packet boundary in the whole buffer (e.g., line noise):
+		    // skip the frame up to the next END character.
+		    discarding = true;
+		    base += len-1;
+		    buffer[0] = buffer[len-1];
+		    len = 1;
+		    continue;
+	       }
+	  }
+
+	  // Split at packet boundaries into chunks of about the same size.
+	  size_t start = 0;
+	  for (int w = 0; w < nworkers; w++) {
+	       size_t end = (w == nworkers-1) ? cut : slip_split(buffer, cut, (w+1)*(cut/nworkers));
+	       if (end < start)
+		    end = start;
+	       chunks[w].data = buffer;
+	       chunks[w].start = start;
+	       chunks[w].end = end;
+	       chunks[w].base = base;
+	       start = end;
+	  }
+	  for (int w = 0; w < nworkers; w++) {
+	       if (thrd_create(&threads[w], decode_chunk, &chunks[w]) != thrd_success) {
+		    ERROR("Could not create thread");
+		    exit(-1);
+	       }
+	  }
+	  for (int w = 0; w < nworkers; w++) {
+	       int result;
+	       thrd_join(threads[w], &result);
+	       if (result != 0) {
+		    ERROR("Out of memory");
+		    exit(-1);
+	       }
+	  }
+	  for (int w = 0; w < nworkers; w++) {
+	       emit_chunk(&decoder, &chunks[w], &nextreadtime, &batch);
+	       if (recbatch_write(&batch, stdout) != 0) {
+		    ERROR("Error while writing tlv to stdout");
+		    exit(-1);
+	       }
+	       recbatch_clear(&batch);
+	  }
+
+	  // A packet not completed at the end of the capture is dropped
+	  // (pkt-to-tlv-stream would still be waiting for its END character).
+	  if (eof)
+	       break;
+	  memmove(buffer, &buffer[cut], len-cut);
+	  len -= cut;
+	  base += cut;
+     }
+     
+     fflush(stdout);
+     return 0;
+}
@@ -26,9 +26,22 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <string.h>
 #include "tlv.h"
+#include "nominal.h"
 
 int read_tlv(tlv_t *tlv, FILE *f)
+{
+     if (read_tlv_raw(tlv, f) < 0)
+	  return -1;
+     
+     return decode_tlv(tlv);
+}
+
+/**
+ * Read a record without decoding compressed records.
+ */
+int read_tlv_raw(tlv_t *tlv, FILE *f)
 {
      size_t nread;
 
@@ -39,7 +52,7 @@ int read_tlv(tlv_t *tlv, FILE *f)
      nread = fread(&tlv->length, sizeof(tlv->length), 1, f);
      if (nread != 1)
 	  return -1;
-     else if (tlv->length > sizeof(tlv->value.samples))
+     else if (tlv->length > sizeof(tlv->value))
 	  return -1;
 
      nread = fread(&tlv->value, 1, tlv->length, f);
@@ -59,3 +72,207 @@ int write_tlv(const tlv_t *tlv, FILE *f)
 
      return 0;
 }
+
+/**
+ * Convert compressed records into their plain representation, so
+ * filters only have to deal with TLV_TYPE_SAMPLES.
+ */
+int decode_tlv(tlv_t *tlv)
+{
+     if (tlv->type == TLV_TYPE_SAMPLES_DELTA) {
+	  uint32_t samples[MAX_SAMPLE_COUNT];
+	  int nsamples = deltacodec_decode(tlv->value.bytes, tlv->length, samples, MAX_SAMPLE_COUNT);
+	  if (nsamples < 0)
+	       return -1;
+	  memcpy(tlv->value.samples, samples, nsamples*sizeof(uint32_t));
+	  tlv->type = TLV_TYPE_SAMPLES;
+	  tlv->length = nsamples*sizeof(uint32_t);
+     } else if (tlv->type == TLV_TYPE_SAMPLES_MC && tlv->length >= TLV_SAMPLES_MC_HEADER_SIZE &&
+		(tlv->value.samples_mc.flags & TLV_SAMPLES_MC_DELTA)) {
+	  uint32_t samples[MAX_SAMPLE_COUNT];
+	  int nsamples = deltacodec_decode(tlv->value.samples_mc.bytes, tlv->length-TLV_SAMPLES_MC_HEADER_SIZE,
+					   samples, MAX_SAMPLE_COUNT);
+	  if (nsamples < 0)
+	       return -1;
+	  memcpy(tlv->value.samples_mc.samples, samples, nsamples*sizeof(uint32_t));
+	  tlv->value.samples_mc.flags &= ~TLV_SAMPLES_MC_DELTA;
+	  tlv->length = TLV_SAMPLES_MC_HEADER_SIZE + nsamples*sizeof(uint32_t);
+     }
+
+     return 0;
+}
+
+/**
+ * Create a TIMESTAMPS record for n waves starting at tstart (ns since
+ * Unix epoch) with the given lengths in ns.
+ */
+int encode_timestamps(tlv_t *tlv, uint64_t tstart, const uint32_t *periods, size_t n)
+{
+     if (n > MAX_SAMPLE_COUNT)
+	  return -1;
+     
+     tlv->type = TLV_TYPE_TIMESTAMPS;
+     tlv->value.timestamps.tstart = tstart;
+     size_t len = deltacodec_encode(periods, n, tlv->value.timestamps.periods,
+				    sizeof(tlv->value.timestamps.periods));
+     tlv->length = sizeof(uint64_t) + len;
+
+     return 0;
+}
+
+/**
+ * Calculate the points in time (ns since Unix epoch) when the waves of a
+ * TIMESTAMPS record ended. Returns the number of waves or -1 on error.
+ */
+int decode_timestamps(const tlv_t *tlv, uint64_t *t, size_t maxn)
+{
+     if (tlv->type != TLV_TYPE_TIMESTAMPS || tlv->length < sizeof(uint64_t))
+	  return -1;
+
+     uint32_t periods[MAX_SAMPLE_COUNT];
+     int n = deltacodec_decode(tlv->value.timestamps.periods, tlv->length-sizeof(uint64_t),
+			       periods, MAX_SAMPLE_COUNT);
+     if (n < 0 || (size_t) n > maxn)
+	  return -1;
+
+     uint64_t tend = tlv->value.timestamps.tstart;
+     for (int i = 0; i < n; i++) {
+	  tend += periods[i];
+	  t[i] = tend;
+     }
+
+     return n;
+}
+
+/**
+ * Channel of a (decoded) SAMPLES or SAMPLES_MC record, or -1 for other
+ * records. SAMPLES records belong to channel 0.
+ */
+int tlv_channel(const tlv_t *tlv)
+{
+     if (tlv->type == TLV_TYPE_SAMPLES)
+	  return 0;
+     if (tlv->type == TLV_TYPE_SAMPLES_MC && tlv->length >= TLV_SAMPLES_MC_HEADER_SIZE &&
+	 !(tlv->value.samples_mc.flags & TLV_SAMPLES_MC_DELTA))
+	  return tlv->value.samples_mc.channel;
+     return -1;
+}
+
+/**
+ * Copy the samples of a (decoded) SAMPLES or SAMPLES_MC record into an
+ * aligned array for batch processing. Returns the number of samples or
+ * -1 for other records.
+ */
+int tlv_get_samples(const tlv_t *tlv, uint32_t *samples, size_t maxn)
+{
+     const uint8_t *data;
+     size_t len;
+     if (tlv->type == TLV_TYPE_SAMPLES) {
+	  data = tlv->value.bytes;
+	  len = tlv->length;
+     } else if (tlv_channel(tlv) >= 0) {
+	  data = tlv->value.samples_mc.bytes;
+	  len = tlv->length - TLV_SAMPLES_MC_HEADER_SIZE;
+     } else {
+	  return -1;
+     }
+
+     size_t n = len/sizeof(uint32_t);
+     if (n > maxn)
+	  return -1;
+     memcpy(samples, data, n*sizeof(uint32_t));
+     
+     return n;
+}
+
+/**
+ * Create a samples record of the given channel (a SAMPLES record for
+ * channel 0, so single-channel tools can read it).
+ */
+int tlv_set_samples(tlv_t *tlv, uint16_t channel, const uint32_t *samples, size_t n)
+{
+     if (n > MAX_SAMPLE_COUNT)
+	  return -1;
+
+     if (channel == 0) {
+	  tlv->type = TLV_TYPE_SAMPLES;
+	  tlv->length = n*sizeof(uint32_t);
+	  memcpy(tlv->value.bytes, samples, n*sizeof(uint32_t));
+     } else {
+	  tlv->type = TLV_TYPE_SAMPLES_MC;
+	  tlv->length = TLV_SAMPLES_MC_HEADER_SIZE + n*sizeof(uint32_t);
+	  tlv->value.samples_mc.channel = channel;
+	  tlv->value.samples_mc.flags = 0;
+	  memcpy(tlv->value.samples_mc.bytes, samples, n*sizeof(uint32_t));
+     }
+
+     return 0;
+}
+
+/**
+ * Channel of a GAP record.
+ */
+uint16_t tlv_gap_channel(const tlv_t *tlv)
+{
+     if (tlv->length >= sizeof(tlv->value.gap_mc))
+	  return tlv->value.gap_mc.channel;
+     return 0;
+}
+
+/**
+ * Create a GAP record (without channel for channel 0, as written by
+ * single-channel firmware).
+ */
+void tlv_set_gap(tlv_t *tlv, uint16_t channel, uint32_t waves)
+{
+     tlv->type = TLV_TYPE_GAP;
+     tlv->value.gap_mc.waves = waves;
+     if (channel == 0) {
+	  tlv->length = sizeof(uint32_t);
+     } else {
+	  tlv->value.gap_mc.channel = channel;
+	  tlv->length = sizeof(tlv->value.gap_mc);
+     }
+}
+
+/**
+ * Header with the nominal values (for streams without HEADER record).
+ */
+void tlv_header_init(tlv_header_t *header)
+{
+     header->version = TLV_HEADER_VERSION;
+     header->batch_size = BATCH_SIZE_NOMINAL;
+     header->f_clk = F_CLK_NOMINAL;
+     header->f_mains_mhz = 1000*F_MAINS_NOMINAL;
+     header->appliance_id = 0;
+}
+
+/**
+ * Create a HEADER record.
+ */
+void tlv_set_header(tlv_t *tlv, const tlv_header_t *header)
+{
+     tlv->type = TLV_TYPE_HEADER;
+     tlv->length = sizeof(tlv_header_t);
+     tlv->value.header = *header;
+}
+
+/**
+ * Read a HEADER record. Fields missing in headers of older versions keep
+ * their nominal values; fields of newer versions are ignored.
+ * Returns -1 if the record is not a valid HEADER record.
+ */
+int tlv_get_header(const tlv_t *tlv, tlv_header_t *header)
+{
+     if (tlv->type != TLV_TYPE_HEADER || tlv->length < sizeof(uint16_t))
+	  return -1;
+
+     tlv_header_init(header);
+     size_t len = (tlv->length < sizeof(tlv_header_t)) ? tlv->length : sizeof(tlv_header_t);
+     memcpy(header, &tlv->value.header, len);
+     if (header->f_clk == 0 || header->f_mains_mhz == 0) {
+	  tlv_header_init(header);
+	  return -1;
+     }
+     return 0;
+}
@@ -31,6 +31,8 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stddef.h>
+#include "deltacodec.h"
 
 #define MAX_SAMPLE_COUNT 1000
 
@@ -38,6 +40,37 @@
 #define TLV_TYPE_SAMPLES 0    /* samples packet */
 #define TLV_TYPE_ONEPPS 1     /* 1-pps calibration packet */
 #define TLV_TYPE_WALLCLOCKTIME 2  /* packet carrying wallclock timestamp as uint64_t representing nanoseconds since Epoch */
+#define TLV_TYPE_SOURCE 3     /* uint16_t id of the recording the following records originate from (merged streams) */
+#define TLV_TYPE_SAMPLES_DELTA 4  /* samples packet, delta-encoded (see deltacodec.h); read_tlv() returns it as TLV_TYPE_SAMPLES */
+#define TLV_TYPE_GAP 5        /* uint32_t number of waves lost on the serial link before the next samples */
+#define TLV_TYPE_WINDOWS 6    /* uint16_t ids of the windows the following records belong to (filter-timewnd -w) */
+#define TLV_TYPE_TIMESTAMPS 7 /* uint64_t start time of the next SAMPLES record followed by delta-encoded wave lengths in ns (filter-timestamp) */
+#define TLV_TYPE_SAMPLES_MC 8 /* uint16_t channel, uint16_t flags, samples of one channel of a multi-channel recording */
+#define TLV_TYPE_HEADER 9     /* tlv_header_t describing the following records (first record of a stream) */
+
+// Channels of multi-channel recordings. Samples of channel 0 are sent as
+// TLV_TYPE_SAMPLES records, so single-channel tools see channel 0 only.
+#define TLV_MAX_CHANNELS 16
+
+// Flags of TLV_TYPE_SAMPLES_MC records.
+#define TLV_SAMPLES_MC_DELTA 0x0001 /* samples are delta-encoded (see deltacodec.h); read_tlv() returns them decoded */
+
+#define TLV_SAMPLES_MC_HEADER_SIZE (2*sizeof(uint16_t))
+
+// Version of the HEADER record (fields are only appended in later versions).
+#define TLV_HEADER_VERSION 1
+
+typedef struct __attribute__((__packed__)) {
+     uint16_t version;
+     // Samples per sample packet.
+     uint16_t batch_size;
+     // Nominal frequency of the clock counting the ticks of a wave in Hz.
+     uint32_t f_clk;
+     // Nominal mains frequency in mHz (e.g., 50000 or 60000).
+     uint32_t f_mains_mhz;
+     // Id of the measurement appliance (e.g., in merged recordings of several sites).
+     uint32_t appliance_id;
+} tlv_header_t;
 
 typedef struct __attribute__((__packed__)) {
      uint16_t type;
@@ -45,12 +78,58 @@ typedef struct __attribute__((__packed__)) {
      union {
 	  uint32_t fclock;
 	  uint64_t wallclocktime;
+	  uint16_t source;
+	  uint32_t gap;
+	  // GAP records of channels other than 0 carry the channel.
+	  struct __attribute__((__packed__)) {
+	       uint32_t waves;
+	       uint16_t channel;
+	  } gap_mc;
+	  uint16_t windows[MAX_SAMPLE_COUNT*2];
 	  uint32_t samples[MAX_SAMPLE_COUNT];	  
+	  uint8_t bytes[MAX_SAMPLE_COUNT*sizeof(uint32_t)];
+	  struct __attribute__((__packed__)) {
+	       uint64_t tstart;
+	       uint8_t periods[DELTACODEC_MAX_ENCODED_SIZE(MAX_SAMPLE_COUNT)];
+	  } timestamps;
+	  struct __attribute__((__packed__)) {
+	       uint16_t channel;
+	       uint16_t flags;
+	       union {
+		    uint32_t samples[MAX_SAMPLE_COUNT];
+		    uint8_t bytes[DELTACODEC_MAX_ENCODED_SIZE(MAX_SAMPLE_COUNT)];
+	       };
+	  } samples_mc;
+	  tlv_header_t header;
      } value;
 } tlv_t;
 
 int read_tlv(tlv_t *tlv, FILE *f);
 
+int read_tlv_raw(tlv_t *tlv, FILE *f);
+
 int write_tlv(const tlv_t *tlv, FILE *f);
+
+int decode_tlv(tlv_t *tlv);
+
+int encode_timestamps(tlv_t *tlv, uint64_t tstart, const uint32_t *periods, size_t n);
+
+int decode_timestamps(const tlv_t *tlv, uint64_t *t, size_t maxn);
+
+int tlv_channel(const tlv_t *tlv);
+
+int tlv_get_samples(const tlv_t *tlv, uint32_t *samples, size_t maxn);
+
+int tlv_set_samples(tlv_t *tlv, uint16_t channel, const uint32_t *samples, size_t n);
+
+uint16_t tlv_gap_channel(const tlv_t *tlv);
+
+void tlv_set_gap(tlv_t *tlv, uint16_t channel, uint32_t waves);
+
+void tlv_header_init(tlv_header_t *header);
+
+void tlv_set_header(tlv_t *tlv, const tlv_header_t *header);
+
+int tlv_get_header(const tlv_t *tlv, tlv_header_t *header);
      
 #endif
@@ -0,0 +1,414 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include "tlvpass.h"
+#include "tlv.h"
+#include "stats.h"
+
+// Size of the input buffer if stdin is not a regular file.
+#define BUFFER_SIZE (1024*1024)
+
+#define HEADER_SIZE (2*sizeof(uint16_t))
+
+/**
+ * Write len bytes from memory.
+ */
+static int write_all(int fd, const uint8_t *data, size_t len)
+{
+     while (len > 0) {
+	  ssize_t n = write(fd, data, len);
+	  if (n < 0) {
+	       if (errno == EINTR)
+		    continue;
+	       return -1;
+	  }
+	  data += n;
+	  len -= n;
+     }
+     return 0;
+}
+
+/**
+ * Copy len bytes at offset of the mapped input file fdin to fdout within
+ * the kernel. Falls back to writing from the mapping if the kernel cannot
+ * copy between these files.
+ */
+static int copy_range(int fdin, const uint8_t *map, off_t offset, size_t len, int fdout, mode_t outmode)
+{
+     while (len > 0) {
+	  ssize_t n;
+	  if (S_ISREG(outmode))
+	       n = copy_file_range(fdin, &offset, fdout, NULL, len, 0);
+	  else if (S_ISFIFO(outmode))
+	       n = splice(fdin, &offset, fdout, NULL, len, SPLICE_F_MORE);
+	  else
+	       n = sendfile(fdout, fdin, &offset, len);
+	  if (n < 0 && errno == EINTR)
+	       continue;
+	  if (n <= 0) {
+	       if (n < 0 && errno != EINVAL && errno != ENOSYS && errno != EXDEV &&
+		   errno != EOPNOTSUPP && errno != EBADF)
+		    return -1;
+	       // Not supported for these files (e.g., output opened with O_APPEND).
+	       return write_all(fdout, &map[offset], len);
+	  }
+	  len -= n;
+     }
+     return 0;
+}
+
+/**
+ * Input of pass_records(): a mapped file, a buffer filled by read(), or a
+ * pipe whose content has been peeked at with tee().
+ */
+typedef struct {
+     enum { INPUT_MAPPED, INPUT_BUFFERED, INPUT_PIPE } mode;
+     int fdin;
+     int fdout;
+     mode_t outmode;
+     // Mapped input: mapping of fdin, and offset of the data in fdin.
+     const uint8_t *map;
+     off_t base;
+     // Pipe input: the first held bytes of the data have already been read
+     // from fdin, the rest is still in the pipe. Dropped bytes are spliced
+     // to fdnull.
+     size_t held;
+     int fdnull;
+} input_t;
+
+/**
+ * Move len bytes from the pipe fdin to fdout within the kernel.
+ */
+static int splice_all(int fdin, int fdout, size_t len)
+{
+     while (len > 0) {
+	  ssize_t n = splice(fdin, NULL, fdout, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+	  if (n < 0 && errno == EINTR)
+	       continue;
+	  if (n <= 0)
+	       return -1;
+	  len -= n;
+     }
+     return 0;
+}
+
+/**
+ * Remove len bytes from the pipe fdin.
+ */
+static int consume(const input_t *in, size_t len)
+{
+     if (in->fdnull >= 0 && splice_all(in->fdin, in->fdnull, len) == 0)
+	  return 0;
+
+     uint8_t scratch[4096];
+     while (len > 0) {
+	  ssize_t n = read(in->fdin, scratch, (len < sizeof(scratch)) ? len : sizeof(scratch));
+	  if (n < 0 && errno == EINTR)
+	       continue;
+	  if (n <= 0)
+	       return -1;
+	  len -= n;
+     }
+     return 0;
+}
+
+/**
+ * Forward the records in data[start, start+len).
+ */
+static int forward(const input_t *in, const uint8_t *data, size_t start, size_t len)
+{
+     switch (in->mode) {
+     case INPUT_MAPPED :
+	  return copy_range(in->fdin, in->map, in->base + start, len, in->fdout, in->outmode);
+     case INPUT_BUFFERED :
+	  return write_all(in->fdout, &data[start], len);
+     case INPUT_PIPE :
+	  if (start < in->held) {
+	       size_t k = (len < in->held - start) ? len : in->held - start;
+	       if (write_all(in->fdout, &data[start], k) < 0)
+		    return -1;
+	       start += k;
+	       len -= k;
+	  }
+	  return (len > 0) ? splice_all(in->fdin, in->fdout, len) : 0;
+     }
+     return -1;
+}
+
+/**
+ * Drop the records in data[start, start+len).
+ */
+static int drop(const input_t *in, size_t start, size_t len)
+{
+     if (in->mode != INPUT_PIPE)
+	  return 0;
+     size_t end = start + len;
+     if (start < in->held)
+	  start = in->held;
+     return (end > start) ? consume(in, end - start) : 0;
+}
+
+/**
+ * Classify the records in data[0, len) and forward runs of records.
+ * Returns the number of bytes of complete records consumed (all of them
+ * unless stopped), or -1 on errors. Sets stop if the filter stopped.
+ */
+static ssize_t pass_records(const uint8_t *data, size_t len, const input_t *in,
+			    tlvpass_classify_t classify, void *ctx, bool *stop)
+{
+     size_t pos = 0;
+     // Run of records to be forwarded.
+     size_t run_start = 0;
+     size_t run_len = 0;
+     uint64_t run_records = 0;
+     uint64_t records = 0;
+     *stop = false;
+     
+     while (pos + HEADER_SIZE <= len) {
+	  uint16_t type, length;
+	  memcpy(&type, &data[pos], sizeof(type));
+	  memcpy(&length, &data[pos+sizeof(type)], sizeof(length));
+	  if (length > sizeof(((tlv_t *) NULL)->value)) {
+	       // Corrupt input (like read_tlv_raw()).
+	       errno = EINVAL;
+	       return -1;
+	  }
+	  if (pos + HEADER_SIZE + length > len)
+	       break;
+
+	  int result = classify(type, length, &data[pos+HEADER_SIZE], ctx);
+	  if (result == TLVPASS_STOP) {
+	       *stop = true;
+	       break;
+	  }
+	  size_t reclen = HEADER_SIZE + length;
+	  records++;
+	  if (result == TLVPASS_FORWARD) {
+	       if (run_len == 0)
+		    run_start = pos;
+	       run_len += reclen;
+	       run_records++;
+	  } else {
+	       // A dropped record ends the run.
+	       if (run_len > 0) {
+		    if (forward(in, data, run_start, run_len) < 0)
+			 return -1;
+		    stats_passthrough(0, 0, run_records, run_len);
+		    run_len = 0;
+		    run_records = 0;
+	       }
+	       if (drop(in, pos, reclen) < 0)
+		    return -1;
+	  }
+	  pos += reclen;
+     }
+     if (run_len > 0) {
+	  if (forward(in, data, run_start, run_len) < 0)
+	       return -1;
+	  stats_passthrough(0, 0, run_records, run_len);
+     }
+     stats_passthrough(records, pos, 0, 0);
+     
+     return pos;
+}
+
+/**
+ * Read exactly len bytes.
+ */
+static int read_all(int fd, uint8_t *data, size_t len)
+{
+     while (len > 0) {
+	  ssize_t n = read(fd, data, len);
+	  if (n < 0 && errno == EINTR)
+	       continue;
+	  if (n <= 0)
+	       return -1;
+	  data += n;
+	  len -= n;
+     }
+     return 0;
+}
+
+/**
+ * Pass records from pipe to pipe: the content of the input pipe is
+ * duplicated with tee() into a private pipe and read from there to
+ * classify the records, and runs of forwarded records are moved to the
+ * output pipe with splice(), so forwarded data is copied to user space
+ * once instead of being read and written. A partial record at the end of
+ * the input is read from the input pipe, so the next tee() waits for new
+ * data. Returns 1 if tee() is not supported (nothing has been read).
+ */
+static int pass_pipe(input_t *in, tlvpass_classify_t classify, void *ctx)
+{
+     int peek[2];
+     if (pipe(peek) < 0)
+	  return 1;
+     // Larger pipes need fewer rounds (fails above the system limit).
+     fcntl(in->fdin, F_SETPIPE_SZ, BUFFER_SIZE);
+     fcntl(in->fdout, F_SETPIPE_SZ, BUFFER_SIZE);
+     fcntl(peek[1], F_SETPIPE_SZ, BUFFER_SIZE);
+     in->fdnull = open("/dev/null", O_WRONLY);
+     in->held = 0;
+
+     uint8_t *buffer = malloc(BUFFER_SIZE);
+     int ret = (buffer == NULL) ? -1 : 0;
+     size_t len = 0;
+     bool first = true;
+     while (ret == 0) {
+	  ssize_t n = tee(in->fdin, peek[1], BUFFER_SIZE - len, 0);
+	  if (n < 0 && errno == EINTR)
+	       continue;
+	  if (n < 0) {
+	       ret = (first && errno == EINVAL) ? 1 : -1;
+	       break;
+	  }
+	  if (n == 0)
+	       break;
+	  first = false;
+	  if (read_all(peek[0], &buffer[len], n) < 0) {
+	       ret = -1;
+	       break;
+	  }
+	  len += n;
+	  bool stop;
+	  ssize_t consumed = pass_records(buffer, len, in, classify, ctx, &stop);
+	  if (consumed < 0) {
+	       ret = -1;
+	       break;
+	  }
+	  if (stop)
+	       break;
+	  // Take the partial record at the end out of the input pipe, and
+	  // keep it at the start of the buffer.
+	  size_t pending = (size_t) consumed > in->held ? len - consumed : len - in->held;
+	  if (consume(in, pending) < 0) {
+	       ret = -1;
+	       break;
+	  }
+	  memmove(buffer, &buffer[consumed], len - consumed);
+	  len -= consumed;
+	  in->held = len;
+     }
+     free(buffer);
+     if (in->fdnull >= 0)
+	  close(in->fdnull);
+     close(peek[0]);
+     close(peek[1]);
+     
+     return ret;
+}
+
+/**
+ * Pass the records of stdin to stdout as classified by the filter.
+ * Output buffered in stdout is flushed first. Returns 0 at the end of
+ * the input or if the filter stopped, or -1 on errors. Like with
+ * stats_read_tlv(), a partial record at the end of the input (e.g., of a
+ * growing recording) is not consumed.
+ */
+int tlvpass_run(tlvpass_classify_t classify, void *ctx)
+{
+     if (fflush(stdout) != 0)
+	  return -1;
+     
+     int fdin = fileno(stdin);
+     int fdout = fileno(stdout);
+     struct stat stin, stout;
+     if (fstat(fdin, &stin) < 0 || fstat(fdout, &stout) < 0)
+	  return -1;
+     bool stop;
+
+     // Current offset (e.g., after resuming from a checkpoint).
+     off_t offset = S_ISREG(stin.st_mode) ? lseek(fdin, 0, SEEK_CUR) : -1;
+     if (offset >= 0) {
+	  if (offset >= stin.st_size)
+	       return 0;
+	  uint8_t *map = mmap(NULL, stin.st_size, PROT_READ, MAP_PRIVATE, fdin, 0);
+	  if (map == MAP_FAILED)
+	       return -1;
+	  madvise(map, stin.st_size, MADV_SEQUENTIAL);
+	  input_t in = { .mode = INPUT_MAPPED, .fdin = fdin, .fdout = fdout, .outmode = stout.st_mode,
+			 .map = map, .base = offset, .fdnull = -1 };
+	  ssize_t n = pass_records(&map[offset], stin.st_size - offset, &in, classify, ctx, &stop);
+	  munmap(map, stin.st_size);
+	  if (n < 0)
+	       return -1;
+	  lseek(fdin, offset + n, SEEK_SET);
+	  return 0;
+     }
+
+     if (S_ISFIFO(stin.st_mode) && S_ISFIFO(stout.st_mode)) {
+	  input_t in = { .mode = INPUT_PIPE, .fdin = fdin, .fdout = fdout, .outmode = stout.st_mode };
+	  int ret = pass_pipe(&in, classify, ctx);
+	  if (ret <= 0)
+	       return ret;
+     }
+
+     input_t in = { .mode = INPUT_BUFFERED, .fdin = fdin, .fdout = fdout, .outmode = stout.st_mode,
+		    .fdnull = -1 };
+     uint8_t *buffer = malloc(BUFFER_SIZE);
+     if (buffer == NULL)
+	  return -1;
+     size_t len = 0;
+     int ret = 0;
+     while (1) {
+	  ssize_t n = read(fdin, &buffer[len], BUFFER_SIZE - len);
+	  if (n < 0 && errno == EINTR)
+	       continue;
+	  if (n < 0) {
+	       ret = -1;
+	       break;
+	  }
+	  if (n == 0)
+	       break;
+	  len += n;
+	  ssize_t consumed = pass_records(buffer, len, &in, classify, ctx, &stop);
+	  if (consumed < 0) {
+	       ret = -1;
+	       break;
+	  }
+	  if (stop)
+	       break;
+	  // Keep the partial record at the end of the buffer.
+	  memmove(buffer, &buffer[consumed], len - consumed);
+	  len -= consumed;
+     }
+     free(buffer);
+     
+     return ret;
+}
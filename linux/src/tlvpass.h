@@ -0,0 +1,64 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TLVPASS_H
+#define TLVPASS_H
+
+#include <stdint.h>
+
+/**
+ * Passthrough of TLV records from stdin to stdout for filters that forward
+ * most records unchanged and drop the others.
+ *
+ * Only the headers (and values the filter looks at) of the records are
+ * inspected; records are not copied into tlv_t structures. If stdin is a
+ * regular file, it is mapped into memory, and runs of forwarded records are
+ * copied by the kernel (copy_file_range() to regular files, splice() to
+ * pipes, sendfile() otherwise). From pipe to pipe, the input is peeked at
+ * with tee(), and runs are moved with splice(). Otherwise, stdin is read in
+ * large blocks, and each run of forwarded records is written with a single
+ * write().
+ *
+ * Compressed records are forwarded as they are (readers decode them).
+ * Records are accounted in the statistics (see stats.h) and the input
+ * offset of checkpoints (see checkpoint.h).
+ */
+
+// Results of the classification of a record.
+#define TLVPASS_FORWARD 0 /* write record unchanged */
+#define TLVPASS_DROP 1    /* drop record */
+#define TLVPASS_STOP 2    /* stop before this record (the rest of the input is not read) */
+
+/**
+ * Classify a record. value points to the (unaligned) value of length bytes.
+ */
+typedef int (*tlvpass_classify_t)(uint16_t type, uint16_t length, const uint8_t *value, void *ctx);
+
+int tlvpass_run(tlvpass_classify_t classify, void *ctx);
+
+#endif
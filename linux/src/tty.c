@@ -32,6 +32,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
 
 int tty_init_raw(const char *dev, speed_t speed)
 {
@@ -80,3 +84,34 @@ int tty_init_raw(const char *dev, speed_t speed)
 
      return fd;
 }
+
+int tty_set_read_timing(int fd, int vmin, int vtime)
+{
+     struct termios tios;
+     
+     if (tcgetattr(fd, &tios) < 0)
+	  return -1;
+
+     // Negative values keep the current setting.
+     if (vmin >= 0)
+	  tios.c_cc[VMIN] = vmin;
+     if (vtime >= 0)
+	  tios.c_cc[VTIME] = vtime;
+
+     return tcsetattr(fd, TCSANOW, &tios);
+}
+
+int tty_set_low_latency(int fd)
+{
+#ifdef __linux__
+     // Ask the driver to pass received bytes on immediately instead of
+     // collecting them (e.g., in the latency timer of FTDI adapters).
+     struct serial_struct serial;
+     if (ioctl(fd, TIOCGSERIAL, &serial) < 0)
+	  return -1;
+     serial.flags |= ASYNC_LOW_LATENCY;
+     return ioctl(fd, TIOCSSERIAL, &serial);
+#else
+     return -1;
+#endif
+}
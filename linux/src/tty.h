@@ -33,4 +33,8 @@
 
 int tty_init_raw(const char *dev, speed_t speed);
 
+int tty_set_read_timing(int fd, int vmin, int vtime);
+
+int tty_set_low_latency(int fd);
+
 #endif
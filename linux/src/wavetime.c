@@ -0,0 +1,122 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "wavetime.h"
+
+void wavetime_init(wavetime_t *wt, uint32_t f_clk)
+{
+     wt->anchored = false;
+     wt->t = 0;
+     wt->remainder = 0;
+     wt->f_clk = f_clk;
+     wt->discontinuity = false;
+     wt->slew = 0;
+}
+
+void wavetime_set_clock(wavetime_t *wt, uint32_t f_clk)
+{
+     if (f_clk == 0)
+	  return;
+     
+     // The remainder is given in units of the old clock period.
+     // Dropping it costs less than one nanosecond.
+     wt->f_clk = f_clk;
+     wt->remainder = 0;
+}
+
+void wavetime_wallclock(wavetime_t *wt, uint64_t t_wallclock)
+{
+     uint64_t offset;
+     if (t_wallclock > wt->t)
+	  offset = t_wallclock - wt->t;
+     else
+	  offset = wt->t - t_wallclock;
+     
+     if (!wt->anchored || offset > WAVETIME_MAX_OFFSET_NS) {
+	  wt->t = t_wallclock;
+	  wt->remainder = 0;
+	  wt->discontinuity = wt->anchored;
+	  wt->anchored = true;
+	  wt->slew = 0;
+     }
+}
+
+/**
+ * Like wavetime_wallclock(), but small offsets to the wallclock timestamp
+ * are corrected gradually by the following calls of wavetime_advance()
+ * instead of being ignored. The time axis stays monotonic, and the length
+ * of a wave is changed by at most WAVETIME_MAX_SLEW_PPM.
+ */
+void wavetime_slew(wavetime_t *wt, uint64_t t_wallclock)
+{
+     int64_t offset = (int64_t) (t_wallclock - wt->t);
+     if (!wt->anchored || offset > (int64_t) WAVETIME_MAX_SLEW_OFFSET_NS ||
+	 offset < -(int64_t) WAVETIME_MAX_SLEW_OFFSET_NS) {
+	  wt->t = t_wallclock;
+	  wt->remainder = 0;
+	  wt->discontinuity = wt->anchored;
+	  wt->anchored = true;
+	  offset = 0;
+     }
+     wt->slew = offset;
+}
+
+uint64_t wavetime_advance(wavetime_t *wt, uint32_t ticks)
+{
+     // Exact integer conversion; the remainder is carried over to the next wave,
+     // so no rounding error accumulates.
+     uint64_t x = 1000000000ull*ticks + wt->remainder;
+     uint64_t dt = x/wt->f_clk;
+     wt->remainder = x%wt->f_clk;
+
+     if (wt->slew != 0) {
+	  int64_t max = dt*WAVETIME_MAX_SLEW_PPM/1000000;
+	  int64_t correction = wt->slew;
+	  if (correction > max)
+	       correction = max;
+	  else if (correction < -max)
+	       correction = -max;
+	  dt += correction;
+	  wt->slew -= correction;
+     }
+     wt->t += dt;
+
+     return wt->t;
+}
+
+/**
+ * Skip waves lost on the serial link (GAP records), whose duration is
+ * estimated by the caller. The time axis is marked as discontinuous.
+ */
+void wavetime_gap(wavetime_t *wt, uint64_t ticks)
+{
+     uint64_t x = 1000000000ull*ticks + wt->remainder;
+     wt->t += x/wt->f_clk;
+     wt->remainder = x%wt->f_clk;
+     wt->discontinuity = wt->anchored;
+}
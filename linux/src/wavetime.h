@@ -0,0 +1,77 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WAVETIME_H
+#define WAVETIME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Wallclock timestamps deviating more than this from the reconstructed
+// time re-anchor the time axis (e.g., after gaps in the recording).
+#define WAVETIME_MAX_OFFSET_NS 1000000000ull
+
+// Maximum rate of slewing the time axis towards wallclock timestamps
+// (see wavetime_slew()), in nanoseconds per second. Larger offsets are
+// corrected by re-anchoring (like NTP's step threshold).
+#define WAVETIME_MAX_SLEW_PPM 500
+#define WAVETIME_MAX_SLEW_OFFSET_NS 128000000ull
+
+/**
+ * Reconstruction of the points in time when waves ended by integrating
+ * their tick counts against the calibrated clock frequency.
+ * The time axis is anchored to the WALLCLOCKTIME records of the stream.
+ */
+typedef struct {
+     // Set once the first wallclock timestamp has been seen.
+     bool anchored;
+     // Time in nanoseconds since Unix epoch when the last wave ended.
+     uint64_t t;
+     // Remainder of the tick to nanosecond conversion (1/f_clk ns).
+     uint64_t remainder;
+     // Calibrated clock frequency.
+     uint32_t f_clk;
+     // Set if the time axis has been re-anchored by the last wallclock timestamp.
+     bool discontinuity;
+     // Offset to the last wallclock timestamp still to be corrected by slewing (ns).
+     int64_t slew;
+} wavetime_t;
+
+void wavetime_init(wavetime_t *wt, uint32_t f_clk);
+
+void wavetime_set_clock(wavetime_t *wt, uint32_t f_clk);
+
+void wavetime_wallclock(wavetime_t *wt, uint64_t t_wallclock);
+
+void wavetime_slew(wavetime_t *wt, uint64_t t_wallclock);
+
+uint64_t wavetime_advance(wavetime_t *wt, uint32_t ticks);
+
+void wavetime_gap(wavetime_t *wt, uint64_t ticks);
+
+#endif
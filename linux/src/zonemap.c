@@ -0,0 +1,194 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include "zonemap.h"
+
+void zonemap_path(const char *recording, char *path, size_t pathsize)
+{
+     snprintf(path, pathsize, "%s%s", recording, ZONEMAP_SUFFIX);
+}
+
+int zonemap_write_header(FILE *f, uint32_t blocksize)
+{
+     zonemap_header_t header;
+
+     memset(&header, 0, sizeof(header));
+     strncpy(header.magic, ZONEMAP_MAGIC, sizeof(header.magic));
+     header.version = ZONEMAP_VERSION;
+     header.blocksize = blocksize;
+     if (fwrite(&header, sizeof(header), 1, f) != 1)
+	  return -1;
+
+     return 0;
+}
+
+int zonemap_read_header(FILE *f, zonemap_header_t *header)
+{
+     if (fread(header, sizeof(*header), 1, f) != 1)
+	  return -1;
+     if (strncmp(header->magic, ZONEMAP_MAGIC, sizeof(header->magic)) != 0)
+	  return -1;
+     if (header->version != ZONEMAP_VERSION)
+	  return -1;
+
+     return 0;
+}
+
+void zonemap_entry_init(zonemap_entry_t *e, uint64_t offset, uint32_t fclk_in, uint64_t t_wallclock_in,
+			const tlv_header_t *header_in)
+{
+     memset(e, 0, sizeof(*e));
+     e->offset = offset;
+     e->fclk_in = fclk_in;
+     e->t_wallclock_in = t_wallclock_in;
+     e->ticks_min = UINT32_MAX;
+     e->ticks_max = 0;
+     e->fclk_min = (fclk_in != 0) ? fclk_in : UINT32_MAX;
+     e->fclk_max = fclk_in;
+     e->t_min = (t_wallclock_in != 0) ? t_wallclock_in : UINT64_MAX;
+     e->t_max = t_wallclock_in;
+     if (header_in != NULL) {
+	  e->header_in = *header_in;
+	  // Samples before the first ONEPPS record use the clock of the header.
+	  if (fclk_in == 0) {
+	       e->fclk_min = header_in->f_clk;
+	       e->fclk_max = header_in->f_clk;
+	  }
+     }
+}
+
+void zonemap_entry_add(zonemap_entry_t *e, const tlv_t *tlv)
+{
+     switch (tlv->type) {
+     case TLV_TYPE_SAMPLES :
+     case TLV_TYPE_SAMPLES_MC : {
+	  // Samples of all channels.
+	  uint32_t samples[MAX_SAMPLE_COUNT];
+	  int nsamples = tlv_get_samples(tlv, samples, MAX_SAMPLE_COUNT);
+	  if (nsamples < 0)
+	       break;
+	  e->nsamples_records++;
+	  e->nsamples += nsamples;
+	  for (int i = 0; i < nsamples; i++) {
+	       uint32_t ticks = samples[i];
+	       if (ticks < e->ticks_min)
+		    e->ticks_min = ticks;
+	       if (ticks > e->ticks_max)
+		    e->ticks_max = ticks;
+	  }
+	  break;
+     }
+     case TLV_TYPE_ONEPPS :
+	  e->nonepps_records++;
+	  if (tlv->value.fclock < e->fclk_min)
+	       e->fclk_min = tlv->value.fclock;
+	  if (tlv->value.fclock > e->fclk_max)
+	       e->fclk_max = tlv->value.fclock;
+	  break;
+     case TLV_TYPE_WALLCLOCKTIME :
+	  e->nwallclock_records++;
+	  if (tlv->value.wallclocktime < e->t_min)
+	       e->t_min = tlv->value.wallclocktime;
+	  if (tlv->value.wallclocktime > e->t_max)
+	       e->t_max = tlv->value.wallclocktime;
+	  break;
+     case TLV_TYPE_HEADER : {
+	  // Samples after the header use its clock until the next ONEPPS record.
+	  tlv_header_t header;
+	  if (tlv_get_header(tlv, &header) < 0)
+	       break;
+	  if (header.f_clk < e->fclk_min)
+	       e->fclk_min = header.f_clk;
+	  if (header.f_clk > e->fclk_max)
+	       e->fclk_max = header.f_clk;
+	  break;
+     }
+     }
+}
+
+int zonemap_write_entry(FILE *f, const zonemap_entry_t *e)
+{
+     if (fwrite(e, sizeof(*e), 1, f) != 1)
+	  return -1;
+
+     return 0;
+}
+
+int zonemap_read_entry(FILE *f, zonemap_entry_t *e)
+{
+     if (fread(e, sizeof(*e), 1, f) != 1)
+	  return -1;
+
+     return 0;
+}
+
+/**
+ * Check whether samples of the block might have wallclock timestamps within [tstart, tend].
+ */
+bool zonemap_may_contain_time(const zonemap_entry_t *e, uint64_t tstart, uint64_t tend)
+{
+     if (e->t_min > e->t_max) {
+	  // No wallclock reference at all: samples are assigned timestamp 0.
+	  return (tstart == 0);
+     }
+     
+     // Samples before the first wallclock timestamp of the stream have timestamp 0.
+     uint64_t tmin = (e->t_wallclock_in == 0) ? 0 : e->t_min;
+     
+     return (tmin <= tend && e->t_max >= tstart);
+}
+
+/**
+ * Check whether samples of the block might have a calibrated frequency within
+ * [fmin, fmax] (outside = false) or outside of this interval (outside = true).
+ */
+bool zonemap_may_contain_freq(const zonemap_entry_t *e, double fmin, double fmax, bool outside, uint32_t fclk_default)
+{
+     if (e->nsamples == 0)
+	  return false;
+
+     // Samples before the first ONEPPS and HEADER records of the stream use
+     // the default clock.
+     uint32_t fclk_min = e->fclk_min;
+     uint32_t fclk_max = e->fclk_max;
+     if (e->fclk_in == 0 && e->header_in.version == 0) {
+	  if (fclk_default < fclk_min)
+	       fclk_min = fclk_default;
+	  if (fclk_default > fclk_max)
+	       fclk_max = fclk_default;
+     }
+     
+     double fblock_min = (double) fclk_min / e->ticks_max;
+     double fblock_max = (double) fclk_max / e->ticks_min;
+
+     if (outside)
+	  return (fblock_min < fmin || fblock_max > fmax);
+     else
+	  return (fblock_min <= fmax && fblock_max >= fmin);
+}
@@ -0,0 +1,103 @@
+/**
+ * Copyright 2022 Frank Duerr
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ZONEMAP_H
+#define ZONEMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "tlv.h"
+
+// Zone maps are stored in a sidecar file next to the recording.
+#define ZONEMAP_SUFFIX ".zmap"
+
+#define ZONEMAP_MAGIC "TLVZMAP"
+#define ZONEMAP_VERSION 2
+
+// Default size of blocks in bytes (blocks always end at record boundaries).
+#define ZONEMAP_DEFAULT_BLOCKSIZE (64*1024)
+
+typedef struct __attribute__((__packed__)) {
+     char magic[8];
+     uint32_t version;
+     uint32_t blocksize;
+} zonemap_header_t;
+
+/**
+ * Summary of one block of a recording.
+ */
+typedef struct __attribute__((__packed__)) {
+     // Position of the block in the recording (in bytes as stored, i.e.,
+     // before decoding compressed records).
+     uint64_t offset;
+     uint64_t length;
+     // Record counts.
+     uint32_t nsamples_records;
+     uint32_t nonepps_records;
+     uint32_t nwallclock_records;
+     uint32_t nsamples;
+     // State of the stream at the start of the block (0 if not yet known):
+     // last ONEPPS value and last wallclock timestamp before the block.
+     uint32_t fclk_in;
+     uint64_t t_wallclock_in;
+     // Range of tick counts of all samples.
+     uint32_t ticks_min;
+     uint32_t ticks_max;
+     // Range of clock frequencies used to calibrate samples of this block
+     // (including fclk_in).
+     uint32_t fclk_min;
+     uint32_t fclk_max;
+     // Range of wallclock timestamps assigned to samples of this block
+     // (including t_wallclock_in).
+     uint64_t t_min;
+     uint64_t t_max;
+     // Last HEADER record before the block (version 0 if none).
+     tlv_header_t header_in;
+} zonemap_entry_t;
+
+void zonemap_path(const char *recording, char *path, size_t pathsize);
+
+int zonemap_write_header(FILE *f, uint32_t blocksize);
+
+int zonemap_read_header(FILE *f, zonemap_header_t *header);
+
+void zonemap_entry_init(zonemap_entry_t *e, uint64_t offset, uint32_t fclk_in, uint64_t t_wallclock_in,
+			const tlv_header_t *header_in);
+
+void zonemap_entry_add(zonemap_entry_t *e, const tlv_t *tlv);
+
+int zonemap_write_entry(FILE *f, const zonemap_entry_t *e);
+
+int zonemap_read_entry(FILE *f, zonemap_entry_t *e);
+
+bool zonemap_may_contain_time(const zonemap_entry_t *e, uint64_t tstart, uint64_t tend);
+
+bool zonemap_may_contain_freq(const zonemap_entry_t *e, double fmin, double fmax, bool outside, uint32_t fclk_default);
+
+#endif